@@ -714,7 +714,7 @@ int main (int argc, char* argv[])
         exit (1);
     }
 
-    if (card_no > 4) {
+    if ((card_no < 0) || (card_no > 0xffff)) {  /* PCI domain */
         usage (argv[0]);
         exit (1);
     }
@@ -722,7 +722,7 @@ int main (int argc, char* argv[])
     if (card_no == 0) {
         snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
     } else {
-        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", card_no);
+        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
     }
 
     VERBOSE2 ("Open Card: %d device: %s\n", card_no, device);
@@ -162,6 +162,17 @@ static uint32_t action_read(struct snap_card* h, uint32_t addr)
 }
 
 
+/* Soft reset through REG_SOFT_RESET, see get_action(), 0x20 if still busy */
+static int action_stop (struct snap_card* h)
+{
+    if (SNAP_OK != snap_action_stop ((void*)h)) {
+        VERBOSE0 ("ERROR: AFU still busy after the soft reset.\n");
+        return 0x20;
+    }
+
+    return 0;
+}
+
 static void mem_init (void* mem_addr, uint32_t init_data, uint64_t total_bytes)
 {
 
@@ -198,6 +209,298 @@ static uint64_t mem_check(uint8_t *src, uint8_t *dest, uint64_t len)
     return 0;
 }
 
+/*
+ * Time trace RAMs. Each RAM entry holds the AXI ID and the cycle of one
+ * command or response. Reading the cycle register returns the entry and
+ * advances the RAM address, reading the ID register returns the ID of
+ * the current entry without advancing. The RAMs keep the last 4096
+ * transactions, the address is reset to 0 when the engine is done.
+ */
+#define TT_ENTRIES      4096
+#define TT_IDS          32          /* 5 bit AXI ID */
+#define TT_LAT_BUCKETS  33          /* Power of two cycle buckets */
+
+struct tt_trace {
+    uint32_t n;                     /* Entries read */
+    uint32_t cmd_id[TT_ENTRIES];
+    uint32_t cmd_cyc[TT_ENTRIES];
+    uint32_t rsp_id[TT_ENTRIES];
+    uint32_t rsp_cyc[TT_ENTRIES];
+};
+
+static struct tt_trace tt_rd;
+static struct tt_trace tt_wr;
+
+/*
+ * Drain one RAM. Without IDs (pattern id_range 0, all IDs are 0) only
+ * the cycle register is read, half the MMIO reads.
+ */
+static int tt_drain (struct snap_card* h, uint32_t id_reg, uint32_t cyc_reg,
+                     uint32_t n, bool ids, uint32_t* id, uint32_t* cyc)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        id[i] = 0;
+
+        if (ids && (0 != snap_action_read32 (h, id_reg, &id[i]))) {
+            return -1;
+        }
+
+        if (0 != snap_action_read32 (h, cyc_reg, &cyc[i])) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int tt_read (struct snap_card* h, struct tt_trace* tt, uint32_t num,
+                    uint32_t pattern, uint32_t id_cmd, uint32_t cyc_cmd,
+                    uint32_t id_rsp, uint32_t cyc_rsp)
+{
+    bool ids = (0 != (pattern & 0x1F0000));
+
+    tt->n = (num > TT_ENTRIES) ? TT_ENTRIES : num;
+
+    if ((0 != tt_drain (h, id_cmd, cyc_cmd, tt->n, ids, tt->cmd_id, tt->cmd_cyc)) ||
+        (0 != tt_drain (h, id_rsp, cyc_rsp, tt->n, ids, tt->rsp_id, tt->rsp_cyc))) {
+        VERBOSE0 ("Read MMIO 32 Err\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void tt_write_file (const char* fname, const struct tt_trace* tt)
+{
+    FILE* f = fopen (fname, "w");
+    uint32_t i;
+
+    if (NULL == f) {
+        VERBOSE0 ("ERROR: Can not write %s\n", fname);
+        return;
+    }
+
+    for (i = 0; i < tt->n; i++) {
+        fprintf (f, "%8d, %16d, %8d, %16d\n", tt->cmd_id[i], tt->cmd_cyc[i],
+                 tt->rsp_id[i], tt->rsp_cyc[i]);
+    }
+
+    fclose (f);
+}
+
+static int tt_cmp_u32 (const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Latency, outstanding depth and completion order of the transactions
+ * in a trace, printed in cycles. num is the number of transactions of
+ * the run. With more than 4096 the RAM wrapped and entry num % 4096 is
+ * the oldest.
+ *
+ * Responses of one ID come in command order, so the k-th last response
+ * of an ID belongs to the k-th last command of that ID. Pairing from
+ * the end stays exact when the window starts with responses to
+ * commands which are no longer in the RAM. A response is out of order
+ * when an older command is still outstanding. The depth over time is
+ * written to depth_fname as "cycle, depth" lines.
+ */
+static void tt_analyze (const char* name, const struct tt_trace* tt,
+                        uint32_t num, const char* depth_fname)
+{
+    uint32_t n = tt->n;
+    uint32_t rot = (num > n) ? num % n : 0;
+    uint32_t* c_id = malloc (n * sizeof (uint32_t));
+    uint32_t* c_t = malloc (n * sizeof (uint32_t));
+    uint32_t* r_id = malloc (n * sizeof (uint32_t));
+    uint32_t* r_t = malloc (n * sizeof (uint32_t));
+    int32_t* match = malloc (n * sizeof (int32_t));
+    uint8_t* state = calloc (n, 1);     /* 1: matched, 2: completed */
+    uint32_t* lat = malloc (n * sizeof (uint32_t));
+    uint64_t* depth_cyc = calloc (n + 1, sizeof (uint64_t));
+    uint32_t cpos[TT_IDS];
+    uint32_t hist[TT_LAT_BUCKETS] = { 0 };
+    uint32_t i, j, k, b, matched = 0, ooo = 0, oldest;
+    uint32_t depth = 0, max_depth = 0, t_prev, t0;
+    uint64_t lat_sum = 0, span;
+    FILE* f;
+
+    if (!c_id || !c_t || !r_id || !r_t || !match || !state || !lat || !depth_cyc) {
+        VERBOSE0 ("ERROR: No memory for the %s trace analysis\n", name);
+        goto __analyze_exit;
+    }
+
+    if (0 == n) {
+        goto __analyze_exit;
+    }
+
+    /* Oldest entry first, cycles relative to the first command */
+    for (i = 0; i < n; i++) {
+        k = (rot + i) % n;
+        c_id[i] = tt->cmd_id[k] % TT_IDS;
+        c_t[i] = tt->cmd_cyc[k] - tt->cmd_cyc[rot];
+        r_id[i] = tt->rsp_id[k] % TT_IDS;
+        r_t[i] = tt->rsp_cyc[k] - tt->cmd_cyc[rot];
+    }
+
+    /* Pair from the end, per ID */
+    for (i = 0; i < TT_IDS; i++) {
+        cpos[i] = n;
+    }
+
+    for (j = n; j-- > 0;) {
+        uint32_t id = r_id[j];
+
+        match[j] = -1;
+
+        while (cpos[id] > 0) {
+            if (c_id[--cpos[id]] == id) {
+                break;
+            }
+        }
+
+        if ((cpos[id] < n) && (c_id[cpos[id]] == id) && !state[cpos[id]] &&
+            (r_t[j] >= c_t[cpos[id]]) && (r_t[j] < 0x80000000u)) {
+            match[j] = cpos[id];
+            state[cpos[id]] = 1;
+            lat[matched++] = r_t[j] - c_t[cpos[id]];
+            lat_sum += r_t[j] - c_t[cpos[id]];
+        } else {
+            cpos[id] = 0;           /* Older commands left the RAM */
+        }
+    }
+
+    if (0 == matched) {
+        VERBOSE0 ("%s trace: no command/response pairs\n", name);
+        goto __analyze_exit;
+    }
+
+    /* Completion order */
+    for (oldest = 0; (oldest < n) && (1 != state[oldest]); oldest++)
+        ;
+
+    for (j = 0; j < n; j++) {
+        if (match[j] < 0) {
+            continue;
+        }
+
+        if ((uint32_t)match[j] != oldest) {
+            ooo++;
+        }
+
+        state[match[j]] = 2;
+
+        while ((oldest < n) && (1 != state[oldest])) {
+            oldest++;
+        }
+    }
+
+    /* Outstanding depth, responses first on equal cycles */
+    f = depth_fname ? fopen (depth_fname, "w") : NULL;
+    i = 0;
+    j = 0;
+    t0 = t_prev = c_t[0];
+
+    while ((i < n) || (j < n)) {
+        uint32_t t;
+        bool rsp;
+
+        if ((i < n) && (0 == state[i])) {
+            i++;                    /* Command without response */
+            continue;
+        }
+
+        if ((j < n) && (match[j] < 0)) {
+            j++;
+            continue;
+        }
+
+        rsp = (j < n) && ((i >= n) || (r_t[j] <= c_t[i]));
+        t = rsp ? r_t[j] : c_t[i];
+        depth_cyc[depth] += t - t_prev;
+        t_prev = t;
+
+        if (rsp) {
+            depth--;
+            j++;
+        } else {
+            depth++;
+            i++;
+        }
+
+        max_depth = (depth > max_depth) ? depth : max_depth;
+
+        if (f) {
+            fprintf (f, "%u, %u\n", t, depth);
+        }
+    }
+
+    if (f) {
+        fclose (f);
+    }
+
+    span = t_prev - t0;
+
+    qsort (lat, matched, sizeof (uint32_t), tt_cmp_u32);
+
+    for (k = 0; k < matched; k++) {
+        for (b = 0; (b < TT_LAT_BUCKETS - 1) && (lat[k] >= (2u << b)); b++)
+            ;
+
+        hist[b]++;
+    }
+
+    VERBOSE0 (" ----- %s trace: %u of %u transactions, %u paired ----- \n",
+              name, n, num, matched);
+    VERBOSE0 ("Latency (cycles): min %u, mean %.1f, p50 %u, p90 %u, p99 %u, max %u\n",
+              lat[0], (double)lat_sum / matched, lat[(matched - 1) / 2],
+              lat[(uint32_t) ((matched - 1) * 0.9)],
+              lat[(uint32_t) ((matched - 1) * 0.99)], lat[matched - 1]);
+
+    for (b = 0; b < TT_LAT_BUCKETS; b++) {
+        if (hist[b]) {
+            VERBOSE0 ("  %10u - %10u: %6u (%5.1f%%)\n", b ? (1u << b) : 0,
+                      (2u << b) - 1, hist[b], 100.0 * hist[b] / matched);
+        }
+    }
+
+    VERBOSE0 ("Outstanding: max %u, mean %.2f over %lu cycles\n", max_depth,
+              span ? (double)lat_sum / span : 0.0, (unsigned long)span);
+
+    /* Depth 0, 1, 2-3, 4-7, ... */
+    for (b = 0, k = 0; (k <= max_depth) && span; b++) {
+        uint32_t hi = b ? (1u << b) - 1 : 0;
+        uint64_t cyc = 0;
+
+        for (; (k <= hi) && (k <= max_depth); k++) {
+            cyc += depth_cyc[k];
+        }
+
+        if (cyc) {
+            VERBOSE0 ("  depth %5u - %5u: %5.1f%% of cycles\n", b ? (1u << (b - 1)) : 0,
+                      hi, 100.0 * cyc / span);
+        }
+    }
+
+    VERBOSE0 ("Out of order completions: %u of %u (%.1f%%)\n", ooo, matched,
+              100.0 * ooo / matched);
+
+__analyze_exit:
+    free (c_id);
+    free (c_t);
+    free (r_id);
+    free (r_t);
+    free (match);
+    free (state);
+    free (lat);
+    free (depth_cyc);
+}
+
 static int run_single_engine (struct snap_card* h,
         uint32_t timeout,
         void* src_base,
@@ -206,6 +509,7 @@ static int run_single_engine (struct snap_card* h,
         uint32_t init_rdata, uint32_t init_wdata,
         uint32_t wrap_pattern,
         uint32_t rpattern, uint32_t wpattern,
+        bool analyze,
         uint64_t *td
         )
 {
@@ -216,16 +520,6 @@ static int run_single_engine (struct snap_card* h,
     uint64_t t_start;
     uint32_t cnt;
     uint32_t reg_data;
-    uint32_t tt_rd_cmd[4096];
-    uint32_t tt_rd_rsp[4096];
-    uint32_t tt_wr_cmd[4096];
-    uint32_t tt_wr_rsp[4096];
-    uint32_t tt_arid[4096];
-    uint32_t tt_awid[4096];
-    uint32_t tt_rid[4096];
-    uint32_t tt_bid[4096];
-    FILE * file_rtt;
-    FILE * file_wtt;
 
     VERBOSE0 (" ----- START SNAP_CONTROL ----- \n");
     snap_action_start ((void*)h);
@@ -262,10 +556,7 @@ static int run_single_engine (struct snap_card* h,
 
     if(ready == 0) {
         VERBOSE0("ERROR: AFU not ready! \n");
-        action_write(h, REG_SOFT_RESET, 0x00000001);
-        action_write(h, REG_SOFT_RESET, 0x00000000);
-
-        rc += 0x2;
+        rc += 0x2 + action_stop(h);
         return rc;
     }
 
@@ -320,42 +611,30 @@ static int run_single_engine (struct snap_card* h,
     if(read_error) {
         exp_data=action_read(h,REG_ERROR_INFO_L);	
         act_data=action_read(h,REG_ERROR_INFO_H);	
-        action_write(h, REG_SOFT_RESET, 0x00000001);
-        action_write(h, REG_SOFT_RESET, 0x00000000);
         VERBOSE0 ("Expected data is:%8x\n",exp_data);
         VERBOSE0 ("Actual data is:%8x\n",act_data);
-        rc += 0x4;
+        rc += 0x4 + action_stop(h);
         return rc;
     }
     if( !both_done) {
         VERBOSE0 ("Timeout! Transactions haven't been finished.\n");
-
-        action_write(h, REG_SOFT_RESET, 0x00000001);
-        action_write(h, REG_SOFT_RESET, 0x00000000);
-        rc += 0x8;
+        rc += 0x8 + action_stop(h);
         return rc;
     }
 
     VERBOSE0 (" ----- Dump TT Arrays ----- \n");
-    file_rtt = fopen("file_rd_cycle", "w");
-    file_wtt = fopen("file_wr_cycle", "w");
-
-    for (cnt = 0; cnt < ((rnum > 4096)? 4096: rnum); cnt++) {
-        tt_arid[cnt]   = action_read(h, REG_TT_ARID);
-        tt_rd_cmd[cnt] = action_read(h, REG_TT_RD_CMD);
-        tt_rid[cnt]    = action_read(h, REG_TT_RID);
-        tt_rd_rsp[cnt] = action_read(h, REG_TT_RD_RSP);
-        fprintf(file_rtt, "%8d, %16d, %8d, %16d\n", tt_arid[cnt], tt_rd_cmd[cnt], tt_rid[cnt], tt_rd_rsp[cnt]);
-    }
+    t_start = get_usec();
 
-    for (cnt = 0; cnt < ((wnum > 4096)? 4096: wnum); cnt++) {
-        tt_awid[cnt]   = action_read(h, REG_TT_AWID);
-        tt_wr_cmd[cnt] = action_read(h, REG_TT_WR_CMD);
-        tt_bid[cnt]    = action_read(h, REG_TT_BID);
-        tt_wr_rsp[cnt] = action_read(h, REG_TT_WR_RSP);
-        fprintf(file_wtt, "%8d, %16d, %8d, %16d\n", tt_awid[cnt], tt_wr_cmd[cnt], tt_bid[cnt], tt_wr_rsp[cnt]);
+    if ((0 != tt_read (h, &tt_rd, rnum, rpattern, REG_TT_ARID, REG_TT_RD_CMD,
+                       REG_TT_RID, REG_TT_RD_RSP)) ||
+        (0 != tt_read (h, &tt_wr, wnum, wpattern, REG_TT_AWID, REG_TT_WR_CMD,
+                       REG_TT_BID, REG_TT_WR_RSP))) {
+        rc += 0x10 + action_stop(h);
+        return rc;
     }
 
+    VERBOSE1 ("TT readout: %d + %d entries in %ld usec\n", tt_rd.n, tt_wr.n,
+              get_usec() - t_start);
 
     VERBOSE0 (" ----- Finish dump, release AFU ----- \n");
     action_write(h, REG_USER_CONTROL, 0x00000002);
@@ -366,11 +645,16 @@ static int run_single_engine (struct snap_card* h,
     //rc += snap_action_completed ((void*)h, NULL, timeout);
     //VERBOSE0 ("Card in idle\n");
 
-    action_write(h, REG_SOFT_RESET, 0x00000001);
-    action_write(h, REG_SOFT_RESET, 0x00000000);
+    rc += action_stop(h);
+
+    tt_write_file("file_rd_cycle", &tt_rd);
+    tt_write_file("file_wr_cycle", &tt_wr);
+
+    if (analyze) {
+        tt_analyze("Read", &tt_rd, rnum, "file_rd_depth");
+        tt_analyze("Write", &tt_wr, wnum, "file_wr_depth");
+    }
 
-    fclose(file_rtt);
-    fclose(file_wtt);
     printf("single run exit, rc=%d\n", rc);
     return rc; //0 means successful
 }
@@ -386,8 +670,12 @@ static struct snap_action* get_action (struct snap_card* handle,
     if (NULL == act) {
         VERBOSE0 ("Error: Can not attach Action: %x\n", ACTION_TYPE_HDL_SINGLE_ENGINE);
         VERBOSE0 ("       Try to run snap_main tool\n");
+        return NULL;
     }
 
+    /* snap_action_stop() aborts a run with it */
+    snap_action_set_reset_reg (act, REG_SOFT_RESET, 1);
+
     return act;
 }
 
@@ -499,6 +787,9 @@ static void usage (const char* prog)
             "                            Pattern: [20:16] id_range. for example, 3 means [0,1,2,3]\n"
             "                                     [15:8]  Burst length - 1,        =AXI A*LEN\n"
             "                                     [2:0]   Data width in each beat, =AXI A*SIZE\n"
+            "    -a, --analyze           | Analyze the time trace of the last run: latency histogram,\n"
+            "                            | outstanding transactions (file_rd/wr_depth) and out of\n"
+            "                            | order completions, all in cycles\n"
             , prog);
 }
 
@@ -537,6 +828,7 @@ int main (int argc, char* argv[])
     double max_bandwidth;
     double variance;
     double bandwidth_array[65536];
+    bool analyze = false;
 
     //Default value
     init_rdata = 0x90000000;
@@ -566,9 +858,10 @@ int main (int argc, char* argv[])
             { "wnum"       , required_argument , NULL , 'N' } ,
             { "rpattern"   , required_argument , NULL , 'p' } ,
             { "wpattern"   , required_argument , NULL , 'P' } ,
+            { "analyze"    , no_argument       , NULL , 'a' } ,
             { 0            , no_argument       , NULL , 0   } 
         };
-        cmd = getopt_long (argc, argv, "hC:vVt:Iw:c:d:D:n:N:p:P:",
+        cmd = getopt_long (argc, argv, "hC:vVt:Iw:c:d:D:n:N:p:P:a",
                 long_options, &option_index);
 
         if (cmd == -1) { /* all params processed ? */
@@ -632,6 +925,10 @@ int main (int argc, char* argv[])
                 wpattern = strtol (optarg, (char**)NULL, 0);
                 break;
 
+            case 'a':
+                analyze = true;
+                break;
+
             default:
                 usage (argv[0]);
                 exit (EXIT_FAILURE);
@@ -653,7 +950,7 @@ int main (int argc, char* argv[])
     if(card_no == 0)
         snprintf(device, sizeof(device)-1, "IBM,oc-snap");
     else
-        snprintf(device, sizeof(device)-1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", card_no);
+        snprintf(device, sizeof(device)-1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
 
     dn = snap_card_alloc_dev (device, SNAP_VENDOR_ID_IBM, SNAP_DEVICE_ID_SNAP);
     if (NULL == dn) {
@@ -738,6 +1035,7 @@ int main (int argc, char* argv[])
                 init_rdata, init_wdata,
                 wrap_pattern,
                 rpattern, wpattern,
+                analyze && (i == test_count - 1),
                 &time_used
                 );
 	printf ("rc: %d\n", rc);
@@ -0,0 +1,128 @@
+#!/bin/bash
+
+##
+## Copyright 2019 International Business Machines
+##
+## Licensed under the Apache License, Version 2.0 (the "License");
+## you may not use this file except in compliance with the License.
+## You may obtain a copy of the License at
+##
+##     http://www.apache.org/licenses/LICENSE-2.0
+##
+## Unless required by applicable law or agreed to in writing, software
+## distributed under the License is distributed on an "AS IS" BASIS,
+## WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+## See the License for the specific language governing permissions and
+## limitations under the License.
+##
+
+# hdl_single_engine on the card emulator, no card needed. The emulator
+# checks the read data, the tool checks the written data and the time
+# trace analysis (-a) runs on the emulated TT RAMs.
+
+# Get path of this script
+THIS_DIR=$(dirname $(readlink -f "$BASH_SOURCE"))
+ACTION_ROOT=$(dirname ${THIS_DIR})
+SNAP_ROOT=$(dirname $(dirname ${ACTION_ROOT}))
+
+echo "Starting :    $0"
+echo "SNAP_ROOT :   ${SNAP_ROOT}"
+echo "ACTION_ROOT : ${ACTION_ROOT}"
+
+function usage() {
+    echo "Usage:"
+    echo "  ./sim_test.sh"
+    echo "  test hdl_single_engine on the card emulator"
+    echo "    [-t <trace_level>]"
+    echo
+}
+
+while getopts ":t:h" opt; do
+    case $opt in
+    t)
+    export SNAP_TRACE=$OPTARG;
+    ;;
+    h)
+    usage;
+    exit 0;
+    ;;
+    \?)
+    echo "Invalid option: -$OPTARG" >&2
+    ;;
+    esac
+done
+
+export PATH=$PATH:${SNAP_ROOT}/software/tools:${ACTION_ROOT}/sw
+export SNAP_CONFIG=CPU
+
+LOG=hdl_single_engine_sim_test.log
+rm -f ${LOG} file_rd_* file_wr_*
+touch ${LOG}
+
+# run <log message> <command>: stop on failure
+function run {
+    local msg=$1
+    shift
+
+    echo -n "${msg} ... "
+    cmd="$@"
+    echo ${cmd} >> ${LOG}
+    eval ${cmd} >> ${LOG} 2>&1
+    if [ $? -ne 0 ]; then
+        echo "cmd: ${cmd}"
+        echo "failed, please check ${LOG}"
+        exit 1
+    fi
+    echo "ok"
+}
+
+# duplex <num> <size> <length> <id num>: incr mode, check the written data
+function duplex {
+    local num=$1
+    local pattern=$(( ($4 << 16) + ($3 << 8) + $2 ))
+
+    run "Duplex num $1 size $2 length $3 id num $4" \
+        "hdl_single_engine -c 1 -w 0 -n ${num} -N ${num} -p ${pattern} -P ${pattern} | grep -q 'WRITE Check PASSED'"
+}
+
+#### DATA #############################################################
+
+for id in 0 3; do
+    duplex 5 2 255 ${id}
+    duplex 5 3 255 ${id}
+    duplex 5 4 255 ${id}
+    duplex 5 5 127 ${id}
+    duplex 5 6 63  ${id}
+    duplex 5 7 31  ${id}
+done
+
+run "Wrap mode" "hdl_single_engine -c 1"
+run "Read only" "hdl_single_engine -c 1 -w 0 -n 64 -N 0 -p 0x31F07"
+run "Write only" "hdl_single_engine -c 1 -w 0 -n 0 -N 64 -P 0x31F07 | grep -q 'WRITE Check PASSED'"
+run "Duplex with interrupt" "hdl_single_engine -I -c 1 -w 0 -n 64 -N 64 -p 0x31F07 -P 0x31F07 | grep -q 'WRITE Check PASSED'"
+
+# A run longer than the timeout ends with snap_action_stop(), the soft
+# reset aborts the emulated job before its 5 s execution time
+SECONDS=0
+run "Abort on timeout" "! SNAP_SIM_DELAY_US=5000000 hdl_single_engine -c 1 -w 0 -n 64 -N 64 -p 0x31F07 -P 0x31F07 > sim_abort.out"
+run "Check timeout" "grep -q 'End of Test rc = 0x8\\.' sim_abort.out"
+run "Check aborted" "[ ${SECONDS} -lt 5 ]"
+run "Run after abort" "hdl_single_engine -c 1 -w 0 -n 64 -N 64 -p 0x31F07 -P 0x31F07 | grep -q 'WRITE Check PASSED'"
+
+#### TIME TRACE #######################################################
+
+# One ID completes in order, several IDs overtake each other
+run "Analyze, one id" "hdl_single_engine -c 1 -w 0 -n 64 -N 64 -p 0x01F07 -P 0x01F07 -a > sim_one_id.out"
+run "Check in order" "grep -q 'Out of order completions: 0 of 64' sim_one_id.out"
+run "Analyze, four ids" "hdl_single_engine -c 1 -w 0 -n 64 -N 64 -p 0x31F07 -P 0x31F07 -a > sim_four_ids.out"
+run "Check out of order" "grep -q 'Out of order completions: [1-9][0-9]* of 64' sim_four_ids.out"
+
+# More transactions than the 4096 entries of the TT RAMs
+run "Analyze, TT RAMs full" "hdl_single_engine -c 1 -w 0 -n 5000 -N 6000 -p 0x00307 -P 0x10002 -a > sim_tt_full.out"
+run "Check read trace" "grep -q 'Read trace: 4096 of 5000 transactions' sim_tt_full.out"
+run "Check write trace" "grep -q 'Write trace: 4096 of 6000 transactions' sim_tt_full.out"
+run "Check trace files" "[ \$(wc -l < file_rd_cycle) -eq 4096 ] && [ \$(wc -l < file_wr_cycle) -eq 4096 ]"
+
+rm -f *.out file_rd_* file_wr_*
+echo "Test OK"
+exit 0
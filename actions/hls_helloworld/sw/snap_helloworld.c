@@ -308,7 +308,7 @@ int main(int argc, char *argv[])
         if(card_no == 0)
                 snprintf(device, sizeof(device)-1, "IBM,oc-snap");
         else
-                snprintf(device, sizeof(device)-1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", card_no);
+                snprintf(device, sizeof(device)-1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
 
 	card = snap_card_alloc_dev(device, SNAP_VENDOR_ID_IBM,
 				   SNAP_DEVICE_ID_SNAP);
@@ -243,6 +243,39 @@ static void process_action(snap_membus_1024_t *din_gmem,
 	return;
 }
 
+// Jobs from a submission ring, each workitem is laid out like act_reg
+static void process_ring(snap_membus_1024_t *din_gmem,
+                         snap_membus_1024_t *dout_gmem,
+                         snap_membus_512_t *lcl_mem0,
+                         action_reg *act_reg)
+{
+	snap_ring_t ring;
+	snap_membus_1024_t wi;
+	snap_sgl_entry_t in, out;
+	action_reg job;
+
+	snap_ring_open(din_gmem, &ring, act_reg->Control.Reserved);
+
+	while (snap_ring_next(din_gmem, &ring, &wi)) {
+		in = snap_sgl_entry(wi, 1);
+		out = snap_sgl_entry(wi, 2);
+		job.Data.in.addr = in.addr;
+		job.Data.in.size = in.size;
+		job.Data.in.type = in.type;
+		job.Data.in.flags = in.flags;
+		job.Data.out.addr = out.addr;
+		job.Data.out.size = out.size;
+		job.Data.out.type = out.type;
+		job.Data.out.flags = out.flags;
+
+		process_action(din_gmem, dout_gmem, lcl_mem0, &job);
+		snap_ring_complete(dout_gmem, &ring, wi, job.Control.Retc, 0);
+	}
+
+	snap_ring_close(dout_gmem, &ring);
+	act_reg->Control.Retc = SNAP_RETC_SUCCESS;
+}
+
 //--- TOP LEVEL MODULE -------------------------------------------------
 void hls_action(snap_membus_1024_t *din_gmem,
 		snap_membus_1024_t *dout_gmem,
@@ -268,7 +301,13 @@ void hls_action(snap_membus_1024_t *din_gmem,
 #pragma HLS INTERFACE s_axilite port=act_reg bundle=ctrl_reg offset=0x100
 #pragma HLS INTERFACE s_axilite port=return bundle=ctrl_reg
 
+        if (act_reg->Control.flags & SNAP_JOBFLAG_RING) {
+                process_ring(din_gmem, dout_gmem, lcl_mem0, act_reg);
+                return;
+        }
+
         process_action(din_gmem, dout_gmem, lcl_mem0, act_reg);
+        snap_cmpl_write(dout_gmem, &act_reg->Control, act_reg->Control.Retc, 0);
 }
 
 //-----------------------------------------------------------------------------
@@ -318,6 +357,51 @@ int main(void)
     else
     	printf(" ==> DATA COMPARE OK <==\n");
 
+    /* Same copy as the only entry of a two entry submission ring */
+#define RING_CTL 480
+#define RING_SQ  482
+#define RING_CQ  484
+    snap_membus_1024_t line = 0;
+
+    memset(dout_gmem, 0xB, sizeof(dout_gmem));
+    line(63, 0)    = RING_SQ * BPERDW_1024;
+    line(127, 64)  = RING_CQ * BPERDW_1024;
+    line(159, 128) = 2;                         /* entries */
+    line(191, 160) = 1;                         /* sq_tail */
+    din_gmem[RING_CTL] = line;
+    din_gmem[RING_CTL + 1] = 0;
+
+    line = 0;
+    line(15, 8)    = SNAP_JOBFLAG_EXEC | SNAP_JOBFLAG_CMPL;
+    line(31, 16)   = 0x42;                      /* seq */
+    line(127, 64)  = RING_CQ * BPERDW_1024;
+    line(191, 128) = 0;                         /* in */
+    line(223, 192) = 4096;
+    line(239, 224) = SNAP_ADDRTYPE_HOST_DRAM;
+    line(319, 256) = 8192;                      /* out */
+    line(351, 320) = 4096;
+    line(367, 352) = SNAP_ADDRTYPE_HOST_DRAM;
+    din_gmem[RING_SQ] = line;
+
+    act_reg.Control.flags = SNAP_JOBFLAG_EXEC | SNAP_JOBFLAG_RING;
+    act_reg.Control.Reserved = RING_CTL * BPERDW_1024;
+
+    hls_action(din_gmem, dout_gmem, lcl_mem0, &act_reg);
+    line = dout_gmem[RING_CQ];
+    if ((line(15, 0) != 0x42) || (line(31, 16) != SNAP_CMPL_VALID) ||
+        (line(63, 32) != SNAP_RETC_SUCCESS) ||
+        (dout_gmem[RING_CTL + 1](63, 0) != ((1ull << 32) | 1))) {
+	    fprintf(stderr, " ==> RING COMPLETION FAILURE <==\n");
+	    return 1;
+    }
+    if (memcmp((void *)((unsigned long)din_gmem + 0),
+	       (void *)((unsigned long)dout_gmem + 8192), 4096) != 0) {
+	    fprintf(stderr, " ==> RING DATA COMPARE FAILURE <==\n");
+	    return 1;
+    }
+    else
+    	printf(" ==> RING DATA COMPARE OK <==\n");
+
     return 0;
 }
 
@@ -0,0 +1,764 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Job API checks with the memcopy action: every test copies buffers
+ * with a pattern of their own and compares the result. Written for the
+ * card emulator (SNAP_CONFIG=CPU), see tests/sim_test.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <osnap_tools.h>
+#include <action_memcopy.h>
+#include <libosnap.h>
+#include <osnap_hls_if.h>
+
+int verbose_flag = 0;
+
+static const char *version = GIT_VERSION;
+
+#define CHECK(cond) do {						\
+		if (!(cond)) {						\
+			fprintf(stderr, "err: %s:%d: %s failed, "	\
+				"errno: %d\n", __func__, __LINE__,	\
+				#cond, errno);				\
+			return EX_ERR_DATA;				\
+		}							\
+	} while (0)
+
+#define RING_ENTRIES	32
+#define THREADS_MAX	8u		/* running at the same time */
+
+struct api_test {
+	struct snap_card *card;
+	struct snap_action *action;
+	snap_action_flag_t flags;
+	unsigned int count;		/* jobs, entries or threads */
+	size_t size;			/* bytes per job */
+	unsigned long timeout;
+};
+
+struct copy_job {
+	struct memcopy_job mjob;
+	struct snap_job cjob;
+	uint8_t *src;
+	uint8_t *dst;
+};
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-h] [-v, --verbose] [-V, --version]\n"
+	       "  -C, --card <cardno>        card to be used\n"
+	       "  -I, --irq                  wait for the action done IRQ\n"
+	       "  -n, --count <n>            jobs, SGL entries or threads\n"
+	       "  -s, --size <size>          bytes per job\n"
+	       "  -t, --timeout <sec>        timeout per job (10 sec default)\n"
+	       "  <test>                     one of:\n"
+	       "    async    submit all jobs, wait for them in reverse order\n"
+	       "    cancel   cancel queued and running jobs, stop the action,\n"
+	       "             needs jobs which run long, e.g. SNAP_SIM_DELAY_US\n"
+	       "    ring     run the jobs through a submission ring\n"
+	       "    fault    jobs on fresh mappings with SNAP_ACTION_FAULT_RESTART,\n"
+	       "             faults need SNAP_SIM_FAULTS with the emulator\n"
+	       "    hang     job to an unmapped buffer on an action which hangs\n"
+	       "             after the fault, SNAP_SIM_FAULTS=2 with the emulator\n"
+	       "    pool     jobs on buffers from a snap_buffer_pool\n"
+	       "    sgl      build a scatter-gather list, walk it like the\n"
+	       "             action and copy every entry\n"
+	       "    lcl      copy through card memory from the LCL allocator\n"
+	       "    threads  one job per thread, for the trace ring reuse\n"
+	       "\n"
+	       "Example:\n"
+	       "  SNAP_CONFIG=CPU %s -n 64 async\n",
+	       prog, prog);
+}
+
+/* Pattern of job i, so a job which copies the wrong buffer is seen */
+static void fill(uint8_t *buf, size_t size, unsigned int i)
+{
+	size_t k;
+
+	for (k = 0; k < size; k++)
+		buf[k] = (uint8_t)(k * 7 + i * 13 + 1);
+}
+
+static void copy_job_set(struct copy_job *j, void *src, uint16_t type_in,
+			 void *dst, uint16_t type_out, size_t size)
+{
+	memset(&j->mjob, 0, sizeof(j->mjob));
+	snap_addr_set(&j->mjob.in, src, size, type_in,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+	snap_addr_set(&j->mjob.out, dst, size, type_out,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST |
+		      SNAP_ADDRFLAG_END);
+	snap_job_set(&j->cjob, &j->mjob, sizeof(j->mjob), NULL, 0);
+}
+
+/* Host buffers of count jobs, src filled, dst cleared */
+static struct copy_job *copy_jobs_alloc(struct api_test *t)
+{
+	struct copy_job *j = calloc(t->count, sizeof(*j));
+	unsigned int i;
+
+	for (i = 0; j && (i < t->count); i++) {
+		j[i].src = snap_malloc(t->size);
+		j[i].dst = snap_malloc(t->size);
+
+		if (!j[i].src || !j[i].dst)
+			return NULL;
+
+		fill(j[i].src, t->size, i);
+		memset(j[i].dst, 0, t->size);
+		copy_job_set(&j[i], j[i].src, SNAP_ADDRTYPE_HOST_DRAM,
+			     j[i].dst, SNAP_ADDRTYPE_HOST_DRAM, t->size);
+	}
+
+	return j;
+}
+
+static void copy_jobs_free(struct api_test *t, struct copy_job *j)
+{
+	unsigned int i;
+
+	for (i = 0; j && (i < t->count); i++) {
+		__free(j[i].src);
+		__free(j[i].dst);
+	}
+
+	free(j);
+}
+
+static int copy_ok(const struct copy_job *j, size_t size)
+{
+	return (j->cjob.retc == SNAP_RETC_SUCCESS) &&
+		(0 == memcmp(j->src, j->dst, size));
+}
+
+static int test_async(struct api_test *t)
+{
+	struct copy_job *j = copy_jobs_alloc(t);
+	struct snap_job_handle **h = calloc(t->count, sizeof(*h));
+	unsigned int i, first, end;
+
+	CHECK(j && h);
+
+	/* Batches up to a full job table, waited for newest first */
+	for (first = 0; first < t->count; first = end) {
+		for (end = first; end < t->count; end++) {
+			h[end] = snap_action_submit_job(t->action, &j[end].cjob);
+
+			if (NULL == h[end])
+				break;
+		}
+
+		CHECK((end == t->count) || ((EBUSY == errno) && (end > first)));
+
+		for (i = end; i-- > first;) {
+			CHECK(SNAP_OK == snap_job_wait(h[i], t->timeout));
+			CHECK(copy_ok(&j[i], t->size));
+		}
+	}
+
+	/* Sync jobs go through the same job table */
+	memset(j[0].dst, 0, t->size);
+	CHECK(SNAP_OK == snap_action_sync_execute_job(t->action, &j[0].cjob,
+						      t->timeout));
+	CHECK(copy_ok(&j[0], t->size));
+
+	free(h);
+	copy_jobs_free(t, j);
+	return 0;
+}
+
+static int test_cancel(struct api_test *t)
+{
+	struct copy_job *j;
+	struct snap_job_handle *h[4];
+	unsigned int i;
+	int rc;
+
+	t->count = 4;
+	j = copy_jobs_alloc(t);
+	CHECK(j);
+
+	/* Queued: never runs. Running: drained, then cancelled */
+	for (i = 0; i < 4; i++)
+		CHECK(NULL != (h[i] = snap_action_submit_job(t->action,
+							      &j[i].cjob)));
+
+	CHECK(SNAP_OK == snap_job_cancel(h[2]));
+	rc = snap_job_cancel(h[0]);
+	CHECK((SNAP_EBUSY == rc) || (SNAP_OK == rc));
+	CHECK(SNAP_ECANCELED == snap_job_wait(h[0], t->timeout));
+	CHECK(SNAP_ECANCELED == snap_job_wait(h[2], t->timeout));
+	CHECK(j[2].dst[0] == 0 && !memcmp(j[2].dst, j[2].dst + 1,
+					  t->size - 1));
+
+	for (i = 1; i < 4; i += 2) {
+		CHECK(SNAP_OK == snap_job_wait(h[i], t->timeout));
+		CHECK(copy_ok(&j[i], t->size));
+	}
+
+	/* Stop: the running job is cancelled, the queued one runs */
+	for (i = 0; i < 2; i++) {
+		memset(j[i].dst, 0, t->size);
+		CHECK(NULL != (h[i] = snap_action_submit_job(t->action,
+							      &j[i].cjob)));
+	}
+
+	CHECK(SNAP_OK == snap_action_stop(t->action));
+	CHECK(SNAP_ECANCELED == snap_job_wait(h[0], t->timeout));
+	CHECK(SNAP_OK == snap_job_wait(h[1], t->timeout));
+	CHECK(copy_ok(&j[1], t->size));
+	CHECK(SNAP_OK == snap_action_stop(t->action));	/* idle */
+
+	copy_jobs_free(t, j);
+	return 0;
+}
+
+static int test_ring(struct api_test *t)
+{
+	struct copy_job *j;
+	struct snap_job *done[RING_ENTRIES];
+	struct snap_ring *ring;
+	unsigned int submitted = 0, completed = 0, i, n = t->count;
+	int k;
+
+	/* Slots of RING_ENTRIES jobs, reused with a new pattern */
+	t->count = RING_ENTRIES;
+	j = copy_jobs_alloc(t);
+	CHECK(j);
+
+	ring = snap_action_ring_create(t->action, RING_ENTRIES);
+	CHECK(ring);
+	CHECK(NULL == snap_action_submit_job(t->action, &j[0].cjob));
+	CHECK(EBUSY == errno);
+
+	while (completed < n) {
+		while ((submitted < n) &&
+		       (submitted - completed < RING_ENTRIES)) {
+			i = submitted % RING_ENTRIES;
+			fill(j[i].src, t->size, submitted);
+			memset(j[i].dst, 0, t->size);
+			copy_job_set(&j[i], j[i].src, SNAP_ADDRTYPE_HOST_DRAM,
+				     j[i].dst, SNAP_ADDRTYPE_HOST_DRAM,
+				     t->size);
+			CHECK(SNAP_OK == snap_ring_submit(ring, &j[i].cjob));
+			submitted++;
+		}
+
+		CHECK(SNAP_OK == snap_ring_doorbell(ring));
+		k = snap_ring_wait(ring, done, RING_ENTRIES,
+				   t->timeout * 1000);
+		CHECK(k > 0);
+
+		/* In submission order */
+		for (i = 0; i < (unsigned int)k; i++, completed++) {
+			CHECK(done[i] == &j[completed % RING_ENTRIES].cjob);
+			CHECK(copy_ok(&j[completed % RING_ENTRIES], t->size));
+		}
+	}
+
+	CHECK(0 == snap_ring_pending(ring));
+	snap_ring_free(ring);
+
+	/* The job table owns the action again */
+	memset(j[0].dst, 0, t->size);
+	CHECK(SNAP_OK == snap_action_sync_execute_job(t->action, &j[0].cjob,
+						      t->timeout));
+	CHECK(copy_ok(&j[0], t->size));
+
+	copy_jobs_free(t, j);
+	return 0;
+}
+
+/* Not yet touched, so not resident */
+static uint8_t *fresh_map(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return (MAP_FAILED == p) ? NULL : p;
+}
+
+static int test_fault(struct api_test *t)
+{
+	struct copy_job j;
+	struct snap_stats st;
+	uint8_t *bad;
+	unsigned int i;
+
+	CHECK(t->flags & SNAP_ACTION_FAULT_RESTART);
+	j.src = fresh_map(t->size);
+	CHECK(j.src);
+	fill(j.src, t->size / 2, 0);	/* second half not resident */
+
+	/* Restart after faulting in all ranges of the job */
+	for (i = 0; i < t->count; i++) {
+		snap_card_reset_stats(t->card);
+		j.dst = fresh_map(t->size);
+		CHECK(j.dst);
+		copy_job_set(&j, j.src, SNAP_ADDRTYPE_HOST_DRAM, j.dst,
+			     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+		CHECK(SNAP_OK == snap_action_sync_execute_job(t->action,
+							      &j.cjob,
+							      t->timeout));
+		CHECK(copy_ok(&j, t->size));
+		CHECK(SNAP_OK == snap_card_get_stats(t->card, &st));
+		CHECK(st.faults <= 1);
+		printf("fault job %u: %llu restarts\n", i,
+		       (unsigned long long)st.faults);
+		munmap(j.dst, t->size);
+	}
+
+	/* Unmapped: fails for good */
+	bad = fresh_map(t->size);
+	CHECK(bad);
+	munmap(bad, t->size);
+	copy_job_set(&j, j.src, SNAP_ADDRTYPE_HOST_DRAM, bad,
+		     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+	CHECK(SNAP_EFAULT == snap_action_sync_execute_job(t->action, &j.cjob,
+							  t->timeout));
+
+	/* Without the flag a fault ends the job */
+	snap_detach_action(t->action);
+	t->action = snap_attach_action(t->card, ACTION_TYPE,
+				       t->flags & ~SNAP_ACTION_FAULT_RESTART,
+				       t->timeout);
+	CHECK(t->action);
+
+	if (t->flags & SNAP_ACTION_DONE_IRQ)
+		snap_action_assign_irq(t->action, ACTION_IRQ_SRC_LO);
+
+	j.dst = fresh_map(t->size);
+	CHECK(j.dst);
+	copy_job_set(&j, j.src, SNAP_ADDRTYPE_HOST_DRAM, j.dst,
+		     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+	CHECK(SNAP_EFAULT == snap_action_sync_execute_job(t->action, &j.cjob,
+							  t->timeout));
+
+	munmap(j.dst, t->size);
+	munmap(j.src, t->size);
+	return 0;
+}
+
+/* Without a completion to wait for, the fault still ends the job */
+static int test_hang(struct api_test *t)
+{
+	struct copy_job j;
+	uint8_t *bad;
+
+	CHECK(t->flags & SNAP_ACTION_FAULT_RESTART);
+	j.src = fresh_map(t->size);
+	CHECK(j.src);
+	fill(j.src, t->size, 0);
+
+	bad = fresh_map(t->size);
+	CHECK(bad);
+	munmap(bad, t->size);
+	copy_job_set(&j, j.src, SNAP_ADDRTYPE_HOST_DRAM, bad,
+		     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+	CHECK(SNAP_EFAULT == snap_action_sync_execute_job(t->action, &j.cjob,
+							  t->timeout));
+
+	munmap(j.src, t->size);
+	return 0;
+}
+
+static int test_pool(struct api_test *t)
+{
+	struct snap_buffer_pool *pool;
+	struct copy_job j;
+	void *held[4];
+	unsigned int i;
+
+	pool = snap_buffer_pool_create(t->size, 4, 0);
+	CHECK(pool);
+	CHECK(snap_buffer_pool_slab_size(pool) >= t->size);
+
+	for (i = 0; i < t->count; i++) {
+		j.src = snap_buffer_pool_get(pool);
+		j.dst = snap_buffer_pool_get(pool);
+		CHECK(j.src && j.dst && (j.src != j.dst));
+		CHECK(0 == ((unsigned long)j.src % SNAP_MEMBUS_WIDTH));
+		CHECK(0 == ((unsigned long)j.dst % SNAP_MEMBUS_WIDTH));
+		fill(j.src, t->size, i);
+		memset(j.dst, 0, t->size);
+		copy_job_set(&j, j.src, SNAP_ADDRTYPE_HOST_DRAM, j.dst,
+			     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+		CHECK(SNAP_OK == snap_action_sync_execute_job(t->action,
+							      &j.cjob,
+							      t->timeout));
+		CHECK(copy_ok(&j, t->size));
+		snap_buffer_pool_put(pool, j.src);
+		snap_buffer_pool_put(pool, j.dst);
+	}
+
+	snap_buffer_pool_destroy(pool);
+
+	/* A fixed pool runs empty */
+	pool = snap_buffer_pool_create(t->size, 4, SNAP_BUFFER_FIXED);
+	CHECK(pool);
+
+	for (i = 0; i < 4; i++)
+		CHECK(NULL != (held[i] = snap_buffer_pool_get(pool)));
+
+	CHECK(NULL == snap_buffer_pool_get(pool));
+	CHECK(ENOMEM == errno);
+	snap_buffer_pool_put(pool, held[3]);
+	CHECK(held[3] == snap_buffer_pool_get(pool));
+	snap_buffer_pool_destroy(pool);
+	return 0;
+}
+
+/*
+ * Walk the tables the way snap_sgl_walk_next() in hls_snap_1024.H does:
+ * an EXT entry links to the next table, the list ends after END or a
+ * full table without link. Returns the number of data entries.
+ */
+static unsigned int sgl_walk(const struct snap_addr *head,
+			     const struct snap_addr **e, unsigned int max)
+{
+	const struct snap_addr *table;
+	unsigned int n = 0, idx;
+
+	if (!(head->flags & SNAP_ADDRFLAG_EXT))
+		return 0;
+
+	table = (const struct snap_addr *)(unsigned long)head->addr;
+
+	for (idx = 0; idx < SNAP_SGL_TABLE_ENTRIES; idx++) {
+		if (table[idx].flags & SNAP_ADDRFLAG_EXT) {
+			table = (const struct snap_addr *)
+				(unsigned long)table[idx].addr;
+			idx = -1;
+			continue;
+		}
+
+		if (n == max)
+			return max + 1;
+
+		e[n++] = &table[idx];
+
+		if (table[idx].flags & SNAP_ADDRFLAG_END)
+			break;
+	}
+
+	return n;
+}
+
+static int test_sgl(struct api_test *t)
+{
+	const struct snap_addr **e;
+	struct snap_addr head;
+	struct snap_sgl *sgl;
+	struct copy_job *j;
+	unsigned int i;
+
+	j = copy_jobs_alloc(t);
+	e = calloc(t->count + 1, sizeof(*e));
+	sgl = snap_sgl_create(t->count);
+	CHECK(j && e && sgl);
+
+	CHECK(0 == snap_sgl_entries(NULL));
+	snap_sgl_reset(NULL);
+	CHECK(SNAP_EINVAL == snap_sgl_addr_set(&head, sgl, 0));
+
+	for (i = 0; i < t->count; i++)
+		CHECK(SNAP_OK == snap_sgl_add(sgl, j[i].src, t->size,
+					      SNAP_ADDRTYPE_HOST_DRAM,
+					      SNAP_ADDRFLAG_ADDR |
+					      SNAP_ADDRFLAG_SRC));
+
+	CHECK(SNAP_ENOMEM == snap_sgl_add(sgl, j[0].src, t->size,
+					  SNAP_ADDRTYPE_HOST_DRAM,
+					  SNAP_ADDRFLAG_SRC));
+	CHECK(ENOMEM == errno);
+	CHECK(t->count == snap_sgl_entries(sgl));
+	CHECK(SNAP_OK == snap_sgl_addr_set(&head, sgl, SNAP_ADDRFLAG_SRC));
+	CHECK(t->count == sgl_walk(&head, e, t->count));
+
+	/* One job per entry, with the buffer the list points to */
+	for (i = 0; i < t->count; i++) {
+		CHECK(e[i]->addr == (unsigned long)j[i].src);
+		CHECK(e[i]->size == t->size);
+		CHECK(!(e[i]->flags & SNAP_ADDRFLAG_END) ==
+		      (i != t->count - 1));
+		copy_job_set(&j[i], (void *)(unsigned long)e[i]->addr,
+			     e[i]->type, j[i].dst, SNAP_ADDRTYPE_HOST_DRAM,
+			     e[i]->size);
+		CHECK(SNAP_OK == snap_action_sync_execute_job(t->action,
+							      &j[i].cjob,
+							      t->timeout));
+		CHECK(copy_ok(&j[i], t->size));
+	}
+
+	snap_sgl_reset(sgl);
+	CHECK(0 == snap_sgl_entries(sgl));
+	CHECK(SNAP_OK == snap_sgl_add(sgl, j[0].dst, t->size,
+				      SNAP_ADDRTYPE_HOST_DRAM,
+				      SNAP_ADDRFLAG_DST));
+	CHECK(SNAP_OK == snap_sgl_addr_set(&head, sgl, SNAP_ADDRFLAG_DST));
+	CHECK(1 == sgl_walk(&head, e, t->count));
+	CHECK(e[0]->flags & SNAP_ADDRFLAG_END);
+
+	snap_sgl_free(sgl);
+	free(e);
+	copy_jobs_free(t, j);
+	return 0;
+}
+
+static int test_lcl(struct api_test *t)
+{
+	struct copy_job j;
+	uint64_t a0, a1, size, used;
+	uint8_t *src = snap_malloc(t->size);
+	uint8_t *dst = snap_malloc(t->size);
+
+	CHECK(src && dst);
+	fill(src, t->size, 1);
+	memset(dst, 0, t->size);
+
+	CHECK(SNAP_OK == snap_lcl_usage(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					&size, &used));
+	CHECK(0 == used);
+	CHECK(SNAP_EINVAL == snap_lcl_alloc(t->card, SNAP_ADDRTYPE_HOST_DRAM,
+					    t->size, &a0));
+	CHECK(SNAP_OK == snap_lcl_alloc(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					t->size, &a0));
+	CHECK(SNAP_OK == snap_lcl_alloc(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					t->size, &a1));
+	CHECK((a0 + t->size <= a1) || (a1 + t->size <= a0));
+	CHECK(SNAP_ENOMEM == snap_lcl_alloc(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					    size, &size));
+
+	/* Host -> a0 -> a1 -> host */
+	j.src = src;
+	j.dst = dst;
+	copy_job_set(&j, src, SNAP_ADDRTYPE_HOST_DRAM, (void *)a0,
+		     SNAP_ADDRTYPE_LCL_MEM0, t->size);
+	CHECK(SNAP_OK == snap_action_sync_execute_job(t->action, &j.cjob,
+						      t->timeout));
+	copy_job_set(&j, (void *)a0, SNAP_ADDRTYPE_LCL_MEM0, (void *)a1,
+		     SNAP_ADDRTYPE_LCL_MEM0, t->size);
+	CHECK(SNAP_OK == snap_action_sync_execute_job(t->action, &j.cjob,
+						      t->timeout));
+	copy_job_set(&j, (void *)a1, SNAP_ADDRTYPE_LCL_MEM0, dst,
+		     SNAP_ADDRTYPE_HOST_DRAM, t->size);
+	CHECK(SNAP_OK == snap_action_sync_execute_job(t->action, &j.cjob,
+						      t->timeout));
+	CHECK(copy_ok(&j, t->size));
+
+	CHECK(SNAP_OK == snap_lcl_free(t->card, SNAP_ADDRTYPE_LCL_MEM0, a0));
+	CHECK(SNAP_EINVAL == snap_lcl_free(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					   a0));
+	CHECK(SNAP_OK == snap_lcl_free(t->card, SNAP_ADDRTYPE_LCL_MEM0, a1));
+	CHECK(SNAP_OK == snap_lcl_usage(t->card, SNAP_ADDRTYPE_LCL_MEM0,
+					&size, &used));
+	CHECK(0 == used);
+
+	__free(src);
+	__free(dst);
+	return 0;
+}
+
+struct thread_arg {
+	struct api_test *t;
+	struct copy_job *j;
+	int rc;
+};
+
+static void *thread_job(void *arg)
+{
+	struct thread_arg *a = arg;
+
+	a->rc = snap_action_sync_execute_job(a->t->action, &a->j->cjob,
+					     a->t->timeout);
+
+	if ((SNAP_OK == a->rc) && !copy_ok(a->j, a->t->size))
+		a->rc = EX_ERR_DATA;
+
+	return NULL;
+}
+
+/* count threads, THREADS_MAX at a time, each runs one job and exits */
+static int test_threads(struct api_test *t)
+{
+	struct copy_job *j = copy_jobs_alloc(t);
+	struct thread_arg a[THREADS_MAX];
+	pthread_t tid[THREADS_MAX];
+	unsigned int i, k, n;
+
+	CHECK(j);
+
+	for (i = 0; i < t->count; i += n) {
+		n = MIN(THREADS_MAX, t->count - i);
+
+		for (k = 0; k < n; k++) {
+			a[k].t = t;
+			a[k].j = &j[i + k];
+			CHECK(0 == pthread_create(&tid[k], NULL, thread_job,
+						  &a[k]));
+		}
+
+		for (k = 0; k < n; k++) {
+			pthread_join(tid[k], NULL);
+			CHECK(SNAP_OK == a[k].rc);
+		}
+	}
+
+	copy_jobs_free(t, j);
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(struct api_test *t);
+	snap_action_flag_t flags;
+} tests[] = {
+	{ "async",   test_async,   0 },
+	{ "cancel",  test_cancel,  0 },
+	{ "ring",    test_ring,    0 },
+	{ "fault",   test_fault,   SNAP_ACTION_FAULT_RESTART },
+	{ "hang",    test_hang,    SNAP_ACTION_FAULT_RESTART },
+	{ "pool",    test_pool,    0 },
+	{ "sgl",     test_sgl,     0 },
+	{ "lcl",     test_lcl,     0 },
+	{ "threads", test_threads, 0 },
+};
+
+int main(int argc, char *argv[])
+{
+	int ch, rc;
+	int card_no = 0;
+	char device[128];
+	struct api_test t;
+	unsigned int i;
+
+	memset(&t, 0, sizeof(t));
+	t.count = 16;
+	t.size = 64 * 1024;
+	t.timeout = 10;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{ "card",	 required_argument, NULL, 'C' },
+			{ "irq",	 no_argument,	    NULL, 'I' },
+			{ "count",	 required_argument, NULL, 'n' },
+			{ "size",	 required_argument, NULL, 's' },
+			{ "timeout",	 required_argument, NULL, 't' },
+			{ "version",	 no_argument,	    NULL, 'V' },
+			{ "verbose",	 no_argument,	    NULL, 'v' },
+			{ "help",	 no_argument,	    NULL, 'h' },
+			{ 0,		 no_argument,	    NULL, 0   },
+		};
+
+		ch = getopt_long(argc, argv, "C:In:s:t:Vvh",
+				 long_options, &option_index);
+
+		if (ch == -1)
+			break;
+
+		switch (ch) {
+		case 'C':
+			card_no = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'I':
+			t.flags |= SNAP_ACTION_DONE_IRQ;
+			break;
+		case 'n':
+			t.count = strtoul(optarg, (char **)NULL, 0);
+			break;
+		case 's':
+			t.size = __str_to_num(optarg);
+			break;
+		case 't':
+			t.timeout = strtoul(optarg, (char **)NULL, 0);
+			break;
+		case 'V':
+			printf("%s\n", version);
+			exit(EXIT_SUCCESS);
+		case 'v':
+			verbose_flag = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		if (0 == strcmp(argv[optind], tests[i].name))
+			break;
+
+	if ((i == ARRAY_SIZE(tests)) || (0 == t.count) || (0 == t.size) ||
+	    (t.size > UINT32_MAX)) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	t.flags |= tests[i].flags;
+
+	if (card_no == 0)
+		snprintf(device, sizeof(device)-1, "IBM,oc-snap");
+	else
+		snprintf(device, sizeof(device)-1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
+
+	t.card = snap_card_alloc_dev(device, SNAP_VENDOR_ID_IBM,
+				     SNAP_DEVICE_ID_SNAP);
+	if (t.card == NULL) {
+		fprintf(stderr, "err: failed to open card %u: %s\n",
+			card_no, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	t.action = snap_attach_action(t.card, ACTION_TYPE, t.flags,
+				      t.timeout);
+	if (t.action == NULL) {
+		fprintf(stderr, "err: failed to attach action %u: %s\n",
+			card_no, strerror(errno));
+		snap_card_free(t.card);
+		exit(EXIT_FAILURE);
+	}
+
+	if (t.flags & SNAP_ACTION_DONE_IRQ)
+		snap_action_assign_irq(t.action, ACTION_IRQ_SRC_LO);
+
+	rc = tests[i].run(&t);
+	printf("%s %s\n", tests[i].name, rc ? "FAILED" : "OK");
+
+	if (t.action)
+		snap_detach_action(t.action);
+	snap_card_free(t.card);
+	exit(rc ? rc : EXIT_SUCCESS);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * osnap.hpp checks with the memcopy action: a sync job, more coroutine
+ * jobs than the job table holds, and the errno of a failed job. Written
+ * for the card emulator (SNAP_CONFIG=CPU) with SNAP_SIM_FAULTS=1, so the
+ * job to an unmapped buffer faults, see tests/sim_test.sh.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+
+#include <osnap.hpp>
+#include <action_memcopy.h>
+
+#define TASKS	40
+#define JOBS	10		/* per task */
+#define SIZE	8192
+
+static_assert (snap::JobParams<memcopy_job_t>);
+
+static int copied = 0;
+
+/* One job, true if the data arrived */
+static snap::Task<bool> copy (snap::Action& action, snap::Buffer& src,
+                              snap::Buffer& dst, int val)
+{
+    memset (src.data (), val, src.size ());
+    memset (dst.data (), 0, dst.size ());
+
+    memcopy_job_t job = { src.addr (SNAP_ADDRFLAG_SRC),
+                          dst.addr (SNAP_ADDRFLAG_DST | SNAP_ADDRFLAG_END) };
+    auto res = co_await action.run (job);
+
+    co_return res.ok () && !memcmp (src.data (), dst.data (), src.size ());
+}
+
+static snap::Task<> worker (snap::Action& action, int first)
+{
+    snap::Buffer src (SIZE), dst (SIZE);
+
+    for (int i = 0; i < JOBS; i++) {
+        copied += co_await copy (action, src, dst, first + i);
+    }
+}
+
+/* A job to an unmapped buffer, returns the errno it was thrown with */
+static snap::Task<int> copy_unmapped (snap::Action& action,
+                                      snap::Buffer& src)
+{
+    void* bad = mmap (nullptr, SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memcopy_job_t job;
+
+    munmap (bad, SIZE);
+    job.in = src.addr (SNAP_ADDRFLAG_SRC);
+    snap_addr_set (&job.out, bad, SIZE, SNAP_ADDRTYPE_HOST_DRAM,
+                   SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST |
+                   SNAP_ADDRFLAG_END);
+
+    try {
+        co_await action.run (job);
+    } catch (const std::system_error& e) {
+        co_return e.code ().value ();
+    }
+
+    co_return 0;
+}
+
+/* Without IRQ the event fd stays quiet, poll_ms paces the polling */
+template <class T>
+static void run (snap::Card& card, std::vector<snap::Task<T>>& tasks,
+                 int poll_ms)
+{
+    for (auto& t : tasks) {
+        t.start ();
+    }
+
+    for (bool done = false; !done;) {
+        card.run_once (poll_ms);
+        done = true;
+
+        for (auto& t : tasks) {
+            done &= t.done ();
+        }
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    bool irq = (argc > 1) && !strcmp (argv[1], "-I");
+    snap_action_flag_t flags = irq ? SNAP_ACTION_DONE_IRQ :
+                                     (snap_action_flag_t)0;
+    int poll_ms = irq ? 1000 : 1;
+
+    try {
+        snap::Card card ("IBM,oc-snap");
+        snap::Action action (card, ACTION_TYPE, flags);
+
+        /* Sync */
+        snap::Buffer src (SIZE), dst (SIZE);
+        memset (src.data (), 0x5a, SIZE);
+        memset (dst.data (), 0, SIZE);
+        auto res = action.execute (memcopy_job_t {
+                src.addr (SNAP_ADDRFLAG_SRC),
+                dst.addr (SNAP_ADDRFLAG_DST | SNAP_ADDRFLAG_END) });
+
+        if (!res.ok () || memcmp (src.data (), dst.data (), SIZE)) {
+            fprintf (stderr, "err: sync job failed\n");
+            return EXIT_FAILURE;
+        }
+
+        /* More jobs in flight than the job table holds */
+        std::vector<snap::Task<>> workers;
+
+        for (int i = 0; i < TASKS; i++) {
+            workers.push_back (worker (action, i * JOBS));
+        }
+
+        run (card, workers, poll_ms);
+
+        for (auto& t : workers) {
+            t.get ();
+        }
+
+        printf ("%d of %d jobs copied\n", copied, TASKS * JOBS);
+
+        if (TASKS * JOBS != copied) {
+            return EXIT_FAILURE;
+        }
+
+        /* Job errors keep their meaning */
+        std::vector<snap::Task<int>> bad;
+        bad.push_back (copy_unmapped (action, src));
+        run (card, bad, poll_ms);
+
+        int err = bad[0].get ();
+
+        if (EFAULT != err) {
+            fprintf (stderr, "err: unmapped job: %s\n", strerror (err));
+            return EXIT_FAILURE;
+        }
+
+        if ((ECANCELED != snap::snap_errno (SNAP_ECANCELED)) ||
+            (EIO != snap::snap_errno (SNAP_EIO))) {
+            fprintf (stderr, "err: snap_errno\n");
+            return EXIT_FAILURE;
+        }
+    } catch (const std::system_error& e) {
+        fprintf (stderr, "err: %s: %s\n", e.what (), strerror (e.code ().value ()));
+        return EXIT_FAILURE;
+    }
+
+    printf ("osnap.hpp OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#!/bin/bash
+
+##
+## Copyright 2019 International Business Machines
+##
+## Licensed under the Apache License, Version 2.0 (the "License");
+## you may not use this file except in compliance with the License.
+## You may obtain a copy of the License at
+##
+##     http://www.apache.org/licenses/LICENSE-2.0
+##
+## Unless required by applicable law or agreed to in writing, software
+## distributed under the License is distributed on an "AS IS" BASIS,
+## WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+## See the License for the specific language governing permissions and
+## limitations under the License.
+##
+
+# Tests on the card emulator, no card needed. Every test checks
+# the copied data, see snap_memcopy_api -h.
+
+# Get path of this script
+THIS_DIR=$(dirname $(readlink -f "$BASH_SOURCE"))
+ACTION_ROOT=$(dirname ${THIS_DIR})
+SNAP_ROOT=$(dirname $(dirname ${ACTION_ROOT}))
+
+echo "Starting :    $0"
+echo "SNAP_ROOT :   ${SNAP_ROOT}"
+echo "ACTION_ROOT : ${ACTION_ROOT}"
+
+function usage() {
+    echo "Usage:"
+    echo "  ./sim_test.sh"
+    echo "  libosnap tests with the memcopy action on the card emulator."
+    echo "    [-t <trace_level>]"
+    echo "    [-N ] not use interrupt"
+    echo
+}
+
+while getopts ":t:Nh" opt; do
+    case $opt in
+    t)
+    export SNAP_TRACE=$OPTARG;
+    ;;
+    N)
+    noirq=1;
+    ;;
+    h)
+    usage;
+    exit 0;
+    ;;
+    \?)
+    echo "Invalid option: -$OPTARG" >&2
+    ;;
+    esac
+done
+
+export PATH=$PATH:${SNAP_ROOT}/software/tools:${ACTION_ROOT}/sw
+export SNAP_CONFIG=CPU
+
+# Both modes unless -N: polling, then the action done IRQ
+irq_modes="poll irq"
+if [ -n "$noirq" ]; then
+    irq_modes="poll"
+fi
+
+rm -f sim_test.log
+touch sim_test.log
+
+# run <log message> <command>: stop on failure
+function run {
+    local msg=$1
+    shift
+
+    echo -n "${msg} ... "
+    cmd="$@"
+    echo ${cmd} >> sim_test.log
+    eval ${cmd} >> sim_test.log 2>&1
+    if [ $? -ne 0 ]; then
+        echo "cmd: ${cmd}"
+        echo "failed, please check sim_test.log"
+        exit 1
+    fi
+    echo "ok"
+}
+
+#### MEMCOPY ##########################################################
+
+dd if=/dev/urandom of=sim_A.bin count=1 bs=65536 2> dd.log
+run "snap_memcopy host to host" "snap_memcopy -N -X -i sim_A.bin -o sim_A.out"
+run "Check results" "cmp sim_A.bin sim_A.out"
+
+#### JOB API ##########################################################
+
+for mode in ${irq_modes}; do
+    irq=""
+    if [ "$mode" = "irq" ]; then
+        irq="-I"
+    fi
+
+    echo "---- ${mode} ----"
+    run "async submit and wait" "snap_memcopy_api ${irq} -n 100 async"
+    # Jobs run long enough to be cancelled while queued or running
+    run "cancel and stop" "SNAP_SIM_DELAY_US=200000 snap_memcopy_api ${irq} -s 4KiB cancel"
+    run "submission ring" "snap_memcopy_api ${irq} -n 2000 -s 4KiB ring"
+    run "fault restart" "SNAP_SIM_FAULTS=1 snap_memcopy_api ${irq} -n 3 -s 8MiB fault"
+    run "Check one restart per job" "! grep '^fault job' sim_test.log | grep -v ': 1 restarts'"
+    run "fault on a hung action" "SNAP_SIM_FAULTS=2 snap_memcopy_api ${irq} -t 2 hang"
+    run "buffer pool" "snap_memcopy_api ${irq} -n 100 pool"
+    run "SGL chaining" "snap_memcopy_api ${irq} -n 100 -s 4KiB sgl"
+    run "LCL allocator" "snap_memcopy_api ${irq} -s 1MiB lcl"
+    run "C++ coroutine jobs" "SNAP_SIM_FAULTS=1 snap_memcopy_cpp ${irq}"
+done
+
+#### TRACE RING #######################################################
+
+# 100 threads, fewer rings: the rings of exited threads are reused
+rm -f sim_trace.bin
+run "trace ring, 100 threads" "SNAP_SIM_DELAY_US=1000 SNAP_TRACE_RING=4096 SNAP_TRACE_FILE=sim_trace.bin snap_memcopy_api -I -n 100 -s 4KiB threads"
+snap_trace_decode sim_trace.bin > sim_trace.out 2>> sim_test.log
+snap_trace_decode -s sim_trace.bin > sim_trace_summary.out 2>> sim_test.log
+run "Check 100 jobs done" "awk '\$1 == \"JOB_DONE\" { n = \$2 } END { exit n != 100 }' sim_trace_summary.out"
+run "Check 100 thread records" "awk '\$1 == \"THREAD\" { n = \$2 } END { exit n < 100 }' sim_trace_summary.out"
+run "Check rings reused" "awk '/^# ring/ { n++ } END { exit (n == 0) || (n > 9) }' sim_trace.out"
+run "Check no records lost" "! grep -q '[1-9][0-9]* lost to wrap' sim_trace.out"
+tid=$(awk '$3 == "JOB_DONE" { print $2; exit }' sim_trace.out)
+run "Check decode of thread ${tid}" "snap_trace_decode -t ${tid} sim_trace.bin | awk -v t=${tid} '!/^#/ { n++; if (\$2 != t) bad++ } END { exit (n == 0) || bad }'"
+
+echo "ok"
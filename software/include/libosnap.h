@@ -34,6 +34,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <osnap_types.h>
 
 /**
@@ -82,6 +83,36 @@
  * to the available number of compute kernels.
  */
 
+/**
+ * Threading model
+ *
+ * One card/action handle can be shared by the threads of a process:
+ *  - snap_action_sync_execute_job(), snap_action_submit_job(),
+ *    snap_job_poll(), snap_job_wait(), snap_job_cancel(),
+ *    snap_action_stop() and snap_prepared_job_execute() may be called
+ *    concurrently.
+ *    There is no per-thread submission context object: an action has
+ *    one set of job registers and one done IRQ, so its jobs run one at
+ *    a time whatever the number of threads. The per-thread state is the
+ *    job: each one gets a slot in the per-card job table with its own
+ *    sequence number, completion code, results and IRQ wait. The table
+ *    lock is not held while a job runs. The action executes the jobs in
+ *    submission order, the thread which waits drives the action for the
+ *    others.
+ *  - snap_action_wait_irq() and snap_card_process_events() may be called
+ *    concurrently, IRQ events are routed to the waiter of the matching
+ *    handle.
+ *  - Register access (snap_action_read32/write32, snap_mmio_*) is
+ *    thread-safe, the job sequence number is atomic.
+ *  - Card open/free, attach/detach, snap_action_assign_irq() and the
+ *    configuration calls (e.g. snap_action_set_wait_policy()) must not
+ *    run concurrently with other calls on the same handle.
+ *  - The split job calls (set_regs, snap_action_start, check_completion)
+ *    bypass the job table and must not be mixed with concurrent jobs.
+ *  - A submission ring (snap_ring_*) is driven by one thread at a time,
+ *    the job table is closed while it exists.
+ */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -107,6 +138,8 @@ extern "C" {
 #define SNAP_EINVAL    -7 /* Invalid parameters */
 #define SNAP_EATTACH   -8 /* Attach error */
 #define SNAP_EDETACH   -9 /* Detach error */
+#define SNAP_ECANCELED -10 /* Job cancelled */
+#define SNAP_ENOMEM    -11 /* Out of memory */
 
 /**********************************************************************
  * SNAP Common Definitions
@@ -216,11 +249,23 @@ int snap_global_read64 (struct snap_card* card, uint64_t offset,
  *
  * @SNAP_ACTION_DONE_IRQ  Enables Action Done Interrupt.
  *
+ * @SNAP_ACTION_CMPL_RECORD The action writes a completion record to host
+ *                        memory (see struct snap_completion_record), the
+ *                        job wait checks it instead of ACTION_CONTROL.
+ *                        Only for actions built to write the record.
+ *
+ * @SNAP_ACTION_FAULT_RESTART Restart a job after a translation fault on
+ *                        host memory, see snap_action_submit_job(). Only
+ *                        for actions which give the same result when
+ *                        they run a job twice.
+ *
  * @SNAP_ATTACH_IRQ       Use interrupt to determine if action got attached
  *                        from Job Manager.
  */
 typedef enum snap_action_flag  {
     SNAP_ACTION_DONE_IRQ = 0x01,   /* Enable Action Done Interrupt */
+    SNAP_ACTION_CMPL_RECORD = 0x02, /* Action writes completion records */
+    SNAP_ACTION_FAULT_RESTART = 0x04, /* Restart jobs after a fault */
     SNAP_ATTACH_IRQ = 0x10000      /* Enable Attach IRQ from Job Manager */
 } snap_action_flag_t;
 
@@ -276,19 +321,128 @@ int snap_action_write32 (struct snap_card* card, uint64_t offset,
 int snap_action_read32 (struct snap_card* card, uint64_t offset,
                         uint32_t* data);
 
+/*
+ * Block MMIO access to consecutive action registers, e.g. to upload
+ * a whole job. Register pairs on 8 byte aligned offsets are accessed
+ * with one 64 bit MMIO, the rest with 32 bit MMIOs. Set bit 0x2 in
+ * SNAP_CONFIG to force 32 bit accesses for actions which cannot
+ * handle 64 bit MMIO.
+ *
+ * @card        snap_card device handle.
+ * @offset      offset of the first register, 4 byte aligned.
+ * @data        register values, lowest offset first.
+ * @size        number of bytes, multiple of 4.
+ * @return      SNAP_OK in case of success, else error.
+ */
+int snap_action_write_block (struct snap_card* card, uint64_t offset,
+                             const void* data, uint32_t size);
+int snap_action_read_block (struct snap_card* card, uint64_t offset,
+                            void* data, uint32_t size);
+
 /*
  * Manual access to job passing and action control functions. Normal
  * usage should be using the execute_job functions. If those are not
  * sufficient, consider using the following low-level functions.
  */
 int snap_action_start (struct snap_action* action);
+
+/**
+ * Stop the action: the running job is aborted through the soft reset
+ * register of the action if one was set with snap_action_set_reset_reg(),
+ * else it is drained, for at most SNAP_STOP_TIMEOUT_MS either way. The
+ * results of a job from the job table which is running at that time are
+ * discarded, it completes with SNAP_ECANCELED. Queued jobs are kept and
+ * start afterwards. The action done IRQ is disabled and cleared.
+ *
+ * @action      handle to the attached action.
+ * @return      SNAP_OK once the running job is off the action,
+ *              SNAP_ETIMEDOUT if it is still busy with it, SNAP_EBUSY
+ *              while a submission ring exists.
+ */
+#define SNAP_STOP_TIMEOUT_MS 1000
+
 int snap_action_stop (struct snap_action* action);
+
+/**
+ * Soft reset register of the action, used to abort a running job:
+ * value is written to it, then 0, as hdl_single_engine does with
+ * REG_SOFT_RESET. The action has to report ACTION_CONTROL_IDLE after
+ * the reset. HLS actions have no such register, without it (offset 0,
+ * the default) jobs can only be drained. Kept over detach and re-attach.
+ *
+ * @action      handle to the attached action.
+ * @offset      register offset in the action space, 0 for none.
+ * @value       value which asserts the reset.
+ * @return      SNAP_OK in case of success, else error.
+ */
+int snap_action_set_reset_reg (struct snap_action* action, uint32_t offset,
+                               uint32_t value);
+
 int snap_action_is_idle (struct snap_action* action, int* rc);
 int snap_action_completed (struct snap_action* action, int* rc,
                            int timeout_sec);
 int snap_action_wait_interrupt (struct snap_action* action, int* rc, int timeout);
 int snap_action_assign_irq (struct snap_action* action, uint32_t action_irq_ea_reg_addr);
 
+/**
+ * Allocate an additional IRQ from the per card IRQ pool, e.g. for an
+ * action with several engines which signal their own interrupts. The
+ * action done IRQ of snap_action_assign_irq() is part of the same pool.
+ * Events are routed by handle, so threads waiting for different IRQs of
+ * one action do not steal each other's interrupts.
+ *
+ * @action      handle to the attached action.
+ * @irq_ea      returns the IRQ EA to program into the action.
+ * @return      SNAP_OK, SNAP_EBUSY if the pool is exhausted, else error.
+ */
+int snap_action_alloc_irq (struct snap_action* action, uint64_t* irq_ea);
+
+/**
+ * Wait for an IRQ from the pool. Each IRQ raised by the action wakes
+ * exactly one wait for that handle; IRQs which fire before the wait
+ * starts are kept.
+ *
+ * @action      handle to the attached action.
+ * @irq_ea      IRQ EA from snap_action_alloc_irq().
+ * @timeout_ms  timeout in msec, < 0 waits forever, 0 only checks.
+ * @return      SNAP_OK, SNAP_ETIMEDOUT, SNAP_EFAULT on a translation
+ *              fault, else error.
+ */
+int snap_action_wait_irq (struct snap_action* action, uint64_t irq_ea,
+                          int timeout_ms);
+
+/**
+ * Wait policy for action completion. The wait busy polls for spin_usec,
+ * then polls with exponential backoff (sched_yield, then sleeps up to
+ * sleep_max_usec) for backoff_usec, and finally sleeps on the action
+ * done interrupt if irq is set and an IRQ was assigned. Short jobs thus
+ * never pay the interrupt latency and long jobs do not burn a core.
+ * SNAP_WAIT_FOREVER in spin_usec or backoff_usec never leaves that phase.
+ *
+ * Without a policy SNAP_ACTION_DONE_IRQ selects {0, 0, 0, 1}, else
+ * {SNAP_WAIT_FOREVER, 0, 0, 0}. SNAP_WAIT_POLICY overrides the default
+ * for all actions, e.g. SNAP_WAIT_POLICY="spin=20,backoff=1000,sleep=100,irq".
+ */
+#define SNAP_WAIT_FOREVER 0xffffffff
+
+struct snap_wait_policy {
+    uint32_t spin_usec;             /* Busy poll time */
+    uint32_t backoff_usec;          /* Backoff poll time */
+    uint32_t sleep_max_usec;        /* Maximum sleep between backoff polls */
+    uint32_t irq;                   /* Fall back to action done IRQ */
+};
+
+/**
+ * Set the completion wait policy, used by all completion functions
+ * including the asynchronous job API. Kept over detach and re-attach.
+ *
+ * @action      handle to the attached action.
+ * @policy      wait policy, copied.
+ * @return      SNAP_OK in case of success, else error.
+ */
+int snap_action_set_wait_policy (struct snap_action* action,
+                                 const struct snap_wait_policy* policy);
+
 /**
  * Synchronous way to send a job away.  First step : set registers
  * This function writes through MMIO interface the registers
@@ -345,6 +499,220 @@ int snap_action_sync_execute_job (struct snap_action* action,
                                   struct snap_job* cjob,
                                   unsigned int timeout_sec);
 
+/**
+ * Asynchronous way to send a job away. The job is queued in the per-card
+ * job table and started as soon as the action is free, the call does
+ * not wait for the action. Completion is collected with snap_job_poll()
+ * or snap_job_wait(). The action still executes one job at a time in
+ * submission order, but the caller can prepare the next job's buffers
+ * while the current one runs.
+ *
+ * @cjob and the buffers it references must stay valid until the job
+ * completed. snap_action_sync_execute_job() queues its job in the same
+ * table, so both can be mixed on one action, from any thread. Only the
+ * low level snap_action_sync_execute_job_set_regs() and
+ * _check_completion() bypass the table and must not be used while jobs
+ * are in flight.
+ *
+ * A job which hits a translation fault on a host page fails with
+ * SNAP_EFAULT. With SNAP_ACTION_FAULT_RESTART set at attach, the library
+ * faults in the host snap_addr ranges of the job's parameters and the
+ * reported addresses, and starts the job once more, see the faults
+ * counter of struct snap_stats. The action must give the same result
+ * when it runs a job twice. A fault on an unmapped address, or again
+ * after the restart, fails the job with SNAP_EFAULT. This applies to
+ * snap_action_sync_execute_job() as well.
+ *
+ * @action      handle to streaming framework queue
+ * @cjob        streaming framework job, see snap_action_sync_execute_job()
+ * @return      job handle or NULL with errno set (EBUSY: job table full).
+ */
+struct snap_job_handle;
+
+struct snap_job_handle* snap_action_submit_job (struct snap_action* action,
+        struct snap_job* cjob);
+
+/**
+ * Check an asynchronous job without blocking. Also starts queued jobs
+ * once the action became free. The handle stays valid.
+ *
+ * @job         handle from snap_action_submit_job()
+ * @return      SNAP_EBUSY while the job is queued or running, else the
+ *              job completion code (SNAP_OK, SNAP_EIO).
+ */
+int snap_job_poll (struct snap_job_handle* job);
+
+/**
+ * Wait for an asynchronous job to complete and release its handle.
+ * On SNAP_ETIMEDOUT the job is still in flight and the handle stays
+ * valid, wait again or keep polling.
+ *
+ * @job         handle from snap_action_submit_job()
+ * @timeout_sec timeout to wait for completion
+ * @return      SNAP_OK, SNAP_EIO, SNAP_EFAULT, SNAP_ECANCELED or
+ *              SNAP_ETIMEDOUT.
+ */
+int snap_job_wait (struct snap_job_handle* job, unsigned int timeout_sec);
+
+/**
+ * Cancel an asynchronous job, e.g. one which overran its deadline. A
+ * queued job is dropped right away. A running job is aborted through
+ * the soft reset register of the action, see snap_action_set_reset_reg(),
+ * without one it runs to its end. Its results are not read back and it
+ * completes with SNAP_ECANCELED, the action stays usable for the jobs
+ * queued after it. Does not block, collect the job with snap_job_wait()
+ * as usual. Until then the action may still access the job's buffers.
+ *
+ * @job         handle from snap_action_submit_job()
+ * @return      SNAP_OK if the job is done now, SNAP_EBUSY if the action
+ *              is still busy with it, SNAP_ENOENT if it completed before.
+ */
+int snap_job_cancel (struct snap_job_handle* job);
+
+/**
+ * Event loop integration. The event fd of a card becomes readable when
+ * the card has events pending, e.g. the action done IRQ. Add it to
+ * epoll/poll/io_uring and call snap_card_process_events() when it fires:
+ * it reads the events without blocking, completes the running
+ * asynchronous job, starts the next queued one and returns the handles
+ * of the jobs which completed since the last call. Collect each with
+ * snap_job_wait(job, 0).
+ *
+ * For the fd to fire, attach the action with SNAP_ACTION_DONE_IRQ and
+ * assign an IRQ with snap_action_assign_irq(), and keep the default
+ * (IRQ only) wait policy. Without the IRQ process_events() polls
+ * ACTION_CONTROL once per call, so it can be driven from a timer.
+ *
+ * @card        card handle
+ * @return      event fd, do not read or close it.
+ */
+int snap_card_get_event_fd (struct snap_card* card);
+
+/**
+ * Process pending events and job completions without blocking.
+ *
+ * @card        card handle
+ * @done        array for the completed job handles
+ * @max         size of done
+ * @return      number of handles stored in done, else error.
+ */
+int snap_card_process_events (struct snap_card* card,
+                              struct snap_job_handle** done,
+                              unsigned int max);
+
+/**
+ * Prepared jobs, for an application which runs the same kind of job over
+ * and over. The workitem is encoded once, and the library keeps a shadow
+ * of what is already in the action's ACTION_PARAMS_IN registers, so
+ * executing it again only writes the words which changed, typically the
+ * sequence number and the buffer addresses. Inline parameters (win_size
+ * up to 96 bytes) are read from cjob->win_addr again on every execute,
+ * larger ones are passed by reference anyway. win_size and wout_size
+ * are fixed when the job is prepared.
+ *
+ * The shadow is dropped on attach/detach and when the application
+ * writes into ACTION_PARAMS_IN itself. Set bit 0x4 in SNAP_CONFIG to
+ * always upload the whole workitem.
+ */
+struct snap_prepared_job;
+
+/**
+ * Encode a job for snap_prepared_job_execute().
+ *
+ * @action      handle to streaming framework action
+ * @cjob        streaming framework job, must stay valid until the
+ *              prepared job is freed
+ * @return      prepared job, NULL on error with errno set.
+ */
+struct snap_prepared_job* snap_action_prepare_job (struct snap_action* action,
+        struct snap_job* cjob);
+
+/**
+ * Execute a prepared job and wait for completion, the same way as
+ * snap_action_sync_execute_job(). Several threads may execute jobs
+ * concurrently, but a prepared job must not be executed twice at once.
+ *
+ * @pjob        prepared job
+ * @timeout_sec timeout to wait for completion
+ * @return      SNAP_OK in case of success, else error.
+ */
+int snap_prepared_job_execute (struct snap_prepared_job* pjob,
+                               unsigned int timeout_sec);
+
+/**
+ * Free a prepared job.
+ *
+ * @pjob        prepared job, NULL is ignored
+ */
+void snap_prepared_job_free (struct snap_prepared_job* pjob);
+
+/**
+ * Job statistics. The library records every job run through the job
+ * table (snap_action_sync_execute_job() and the asynchronous jobs) into
+ * log-linear histograms, one per phase, in nsec:
+ *
+ * @SNAP_PHASE_UPLOAD    write the job to ACTION_PARAMS_IN
+ * @SNAP_PHASE_START     write ACTION_CONTROL_START
+ * @SNAP_PHASE_WAIT      from start until the action was seen idle
+ * @SNAP_PHASE_READBACK  read RETC and the results from ACTION_PARAMS_OUT
+ * @SNAP_PHASE_TOTAL     from queueing the job until its results are read
+ *
+ * Buckets are 2^SNAP_HIST_SUB_BITS linear steps per power of 2, i.e.
+ * values are resolved to 12.5%.
+ */
+enum snap_stats_phase {
+    SNAP_PHASE_UPLOAD = 0,
+    SNAP_PHASE_START,
+    SNAP_PHASE_WAIT,
+    SNAP_PHASE_READBACK,
+    SNAP_PHASE_TOTAL,
+    SNAP_PHASE_MAX
+};
+
+#define SNAP_HIST_SUB_BITS  3
+#define SNAP_HIST_BUCKETS   ((64 - SNAP_HIST_SUB_BITS + 1) << SNAP_HIST_SUB_BITS)
+
+struct snap_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bucket[SNAP_HIST_BUCKETS];
+};
+
+struct snap_stats {
+    uint64_t jobs;                  /* Completed jobs */
+    uint64_t errors;                /* Jobs completed with rc != 0 */
+    uint64_t timeouts;              /* Sync and snap_job_wait() timeouts */
+    uint64_t cancels;               /* Jobs cancelled or stopped */
+    uint64_t faults;                /* Restarts after a translation fault */
+    uint64_t irq_completions;       /* Completions seen through the IRQ */
+    struct snap_histogram polls;    /* ACTION_CONTROL reads per job */
+    struct snap_histogram phase[SNAP_PHASE_MAX];
+};
+
+/**
+ * Copy the job statistics of the card.
+ *
+ * @card        snap_card device handle.
+ * @stats       returns a snapshot of the statistics.
+ * @return      SNAP_OK or SNAP_EINVAL.
+ */
+int snap_card_get_stats (struct snap_card* card, struct snap_stats* stats);
+
+/* Clear the job statistics of the card */
+int snap_card_reset_stats (struct snap_card* card);
+
+/**
+ * Value below which percentile % of the recorded values are, resolved
+ * to the bucket width, e.g. snap_histogram_percentile(h, 99.0).
+ */
+uint64_t snap_histogram_percentile (const struct snap_histogram* h,
+                                    double percentile);
+
+/* Lowest value counted in bucket i */
+uint64_t snap_histogram_bucket_value (unsigned int i);
+
 #if 0 /* FIXME Discuss how this must be done correctly */
 /**
  * Allow the action to use interrupts to signal results back to the
@@ -389,6 +757,300 @@ int snap_card_ioctl (struct snap_card* card, unsigned int cmd, unsigned long par
  */
 uint32_t snap_action_get_pasid(struct snap_card *card);
 
+/**
+ * NUMA node the card is attached to, the numa_node of its PCI device in
+ * sysfs. DMA buffers on another node cost link bandwidth, place them
+ * with snap_buffer_pool_create_on_node(). Submission rings are placed
+ * on this node by the library.
+ *
+ * @card        snap_card device handle.
+ * @return      node, or -1 if unknown, e.g. on a single node host.
+ */
+int snap_card_get_numa_node (struct snap_card* card);
+
+/**
+ * Restrict the calling thread to the CPUs of the card's NUMA node, as
+ * far as its current affinity allows. With SNAP_NUMA_BIND=1 this is
+ * done for the thread calling snap_attach_action().
+ *
+ * @card        snap_card device handle.
+ * @return      SNAP_OK, SNAP_ENODEV if the node is unknown, else error.
+ */
+int snap_card_bind_thread (struct snap_card* card);
+
+/**
+ * DMA buffer pool. Instead of a fresh snap_malloc() per job, buffers
+ * come from arenas which are mapped once, pre-faulted and optionally
+ * locked, so the action does not hit cold pages in the address
+ * translation. The arenas are cut into slabs of one size, aligned to
+ * SNAP_MEMBUS_WIDTH, which are recycled with snap_buffer_pool_put().
+ * The pool functions are thread-safe.
+ *
+ * @SNAP_BUFFER_HUGEPAGE     Map arenas on 2 MiB pages, fall back to
+ *                           transparent hugepages, then to base pages.
+ * @SNAP_BUFFER_HUGEPAGE_1G  Try 1 GiB pages first.
+ * @SNAP_BUFFER_MLOCK        mlock() the arenas.
+ * @SNAP_BUFFER_FIXED        Do not add arenas when the pool is empty.
+ */
+#define SNAP_BUFFER_HUGEPAGE    0x01
+#define SNAP_BUFFER_HUGEPAGE_1G 0x02
+#define SNAP_BUFFER_MLOCK       0x04
+#define SNAP_BUFFER_FIXED       0x08
+
+struct snap_buffer_pool;
+
+/**
+ * Create a pool and map its first arena.
+ *
+ * @slab_size        buffer size, rounded up to SNAP_MEMBUS_WIDTH.
+ * @slabs_per_arena  buffers per arena, one arena is mapped per growth.
+ * @flags            SNAP_BUFFER_* flags.
+ * @return           pool or NULL with errno set.
+ */
+struct snap_buffer_pool* snap_buffer_pool_create (size_t slab_size,
+        unsigned int slabs_per_arena, unsigned int flags);
+
+/**
+ * Create a pool whose arenas are placed on a NUMA node, usually the
+ * node of the card from snap_card_get_numa_node(). A node < 0 is the
+ * same as snap_buffer_pool_create(). The placement is preferred, pages
+ * come from other nodes if the node runs out of memory.
+ */
+struct snap_buffer_pool* snap_buffer_pool_create_on_node (size_t slab_size,
+        unsigned int slabs_per_arena, unsigned int flags, int node);
+
+/**
+ * Get a buffer, the content is undefined. Adds an arena if the pool is
+ * empty, unless SNAP_BUFFER_FIXED is set.
+ *
+ * @return      buffer or NULL with errno ENOMEM.
+ */
+void* snap_buffer_pool_get (struct snap_buffer_pool* pool);
+
+/* Return a buffer obtained from snap_buffer_pool_get() of this pool */
+void snap_buffer_pool_put (struct snap_buffer_pool* pool, void* buf);
+
+/* Size of the buffers of this pool */
+size_t snap_buffer_pool_slab_size (struct snap_buffer_pool* pool);
+
+/* Unmap all arenas, buffers must no longer be used by an action */
+void snap_buffer_pool_destroy (struct snap_buffer_pool* pool);
+
+/**
+ * Scatter-gather lists, to pass more buffers to one job than fit into
+ * the 96 bytes of inline parameters. The entries are written into
+ * chained snap_addr tables in pre-faulted host memory, see
+ * SNAP_SGL_TABLE_ENTRIES in osnap_types.h for the layout and
+ * snap_sgl_walk_next() in hls_snap_1024.H for the action side. Put the
+ * head descriptor from snap_sgl_addr_set() into the job. A list must
+ * not be changed while a job uses it.
+ */
+struct snap_sgl;
+
+/**
+ * Create an empty list.
+ *
+ * @max_entries data entries the list can hold.
+ * @return      list or NULL with errno set.
+ */
+struct snap_sgl* snap_sgl_create (unsigned int max_entries);
+
+/**
+ * Append an entry, it becomes the one with SNAP_ADDRFLAG_END.
+ *
+ * @flags       SNAP_ADDRFLAG_ADDR/SRC/DST/DATA, EXT and END are managed
+ *              by the list.
+ * @return      SNAP_OK, SNAP_ENOMEM if the list is full, else error.
+ */
+int snap_sgl_add (struct snap_sgl* sgl, const void* addr, uint32_t size,
+                  snap_addrtype_t type, snap_addrflag_t flags);
+
+/* Drop all entries, the memory is kept for the next list */
+void snap_sgl_reset (struct snap_sgl* sgl);
+
+/* Number of data entries in the list */
+unsigned int snap_sgl_entries (const struct snap_sgl* sgl);
+
+/**
+ * Set the head descriptor of a list: the address of the first table
+ * with SNAP_ADDRFLAG_EXT.
+ *
+ * @da          descriptor in the job parameters.
+ * @flags       extra flags for the head, e.g. SNAP_ADDRFLAG_SRC.
+ * @return      SNAP_OK, SNAP_EINVAL if the list is empty.
+ */
+int snap_sgl_addr_set (struct snap_addr* da, const struct snap_sgl* sgl,
+                       snap_addrflag_t flags);
+
+/* Free a list, no job may use it anymore */
+void snap_sgl_free (struct snap_sgl* sgl);
+
+/**
+ * Card memory allocator, one buddy allocator per SNAP_ADDRTYPE_LCL_MEM0/1
+ * port, so jobs and libraries sharing a card handle can keep data in
+ * card memory without agreeing on fixed offsets. By default each port
+ * manages its share of GET_SDRAM_SIZE from offset 0. Blocks are at least
+ * 4 KiB and aligned to GET_DMA_ALIGN, sizes are rounded up to a power of
+ * two of blocks. The allocator is per card handle: processes sharing a
+ * card give each other disjoint ranges with snap_lcl_set_range().
+ *
+ * @card        snap_card device handle.
+ * @type        SNAP_ADDRTYPE_LCL_MEM0 or SNAP_ADDRTYPE_LCL_MEM1.
+ * @size        bytes to allocate.
+ * @addr        returns the offset in the port, for snap_addr_set().
+ * @return      SNAP_OK, SNAP_ENOMEM if no block is free, else error.
+ */
+int snap_lcl_alloc (struct snap_card* card, snap_addrtype_t type,
+                    uint64_t size, uint64_t* addr);
+
+/* Release an allocation, no job may use it anymore */
+int snap_lcl_free (struct snap_card* card, snap_addrtype_t type,
+                   uint64_t addr);
+
+/**
+ * Range of a port managed by the allocator, instead of the default.
+ * SNAP_EBUSY while the port has allocations.
+ */
+int snap_lcl_set_range (struct snap_card* card, snap_addrtype_t type,
+                        uint64_t base, uint64_t size);
+
+/* Managed and allocated bytes of a port */
+int snap_lcl_usage (struct snap_card* card, snap_addrtype_t type,
+                    uint64_t* size, uint64_t* used);
+
+/**
+ * Card pool, to spread jobs over all cards of a host. A pool opens every
+ * AFU of a name listed in /dev/ocxl. Jobs for an action type go to the
+ * attached card with the lowest expected wait, from its jobs in flight
+ * and its recent job execution time. The job functions are thread-safe,
+ * open, attach and free are not. With SNAP_CONFIG=CPU the pool holds
+ * SNAP_SIM_CARDS emulated cards (default 1).
+ */
+struct snap_card_pool;
+
+/**
+ * Open all cards with an AFU name, cards which fail to open are skipped.
+ *
+ * @afu_name    AFU name, NULL for "IBM,oc-snap".
+ * @return      pool, NULL with errno ENODEV if no card could be opened.
+ */
+struct snap_card_pool* snap_card_pool_open (const char* afu_name);
+
+/* Number of cards in the pool */
+unsigned int snap_card_pool_count (struct snap_card_pool* pool);
+
+/* Card i of the pool, in device name order, NULL if out of range */
+struct snap_card* snap_card_pool_card (struct snap_card_pool* pool,
+                                       unsigned int i);
+
+/**
+ * Attach an action on every card of the pool which provides it. Cards
+ * which are attached to another action already are left alone.
+ *
+ * @return      number of cards with the action attached, SNAP_ENODEV
+ *              if none.
+ */
+int snap_card_pool_attach (struct snap_card_pool* pool,
+                           snap_action_type_t action_type,
+                           snap_action_flag_t action_flags,
+                           int attach_timeout_sec);
+
+/**
+ * Execute a job on the least loaded card with the action attached, see
+ * snap_action_sync_execute_job().
+ *
+ * @return      SNAP_OK, SNAP_ENODEV if no card has the action, else error.
+ */
+int snap_card_pool_execute_job (struct snap_card_pool* pool,
+                                snap_action_type_t action_type,
+                                struct snap_job* cjob,
+                                unsigned int timeout_sec);
+
+/**
+ * Submit a job to the least loaded card with the action attached, see
+ * snap_action_submit_job(). Wait for it with snap_job_wait().
+ *
+ * @return      job handle or NULL with errno set.
+ */
+struct snap_job_handle* snap_card_pool_submit_job (struct snap_card_pool* pool,
+        snap_action_type_t action_type,
+        struct snap_job* cjob);
+
+/* Detach the actions and free all cards of the pool */
+void snap_card_pool_free (struct snap_card_pool* pool);
+
+/**
+ * Submission ring. Jobs are written as workitems into a ring in host
+ * memory which the action fetches by DMA, instead of about 30 MMIO
+ * writes per job through ACTION_PARAMS_IN. Submitting is a memory
+ * copy, a whole batch is started with one MMIO write, the doorbell, and
+ * completions are read from completion records in host memory. The
+ * action must support SNAP_JOBFLAG_RING, see struct snap_ring_ctl in
+ * osnap_types.h and snap_ring_next() in hls_snap_1024.H.
+ *
+ * While a ring exists it owns the action, snap_action_submit_job() and
+ * the sync job functions fail with EBUSY. Jobs complete in submission
+ * order. A ring must be used by one thread at a time.
+ */
+struct snap_ring;
+
+/**
+ * Create a ring and hand it to the action.
+ *
+ * @entries     ring size, a power of 2 up to 65536.
+ * @return      ring, NULL with errno set, EBUSY if jobs are in flight
+ *              or the action has a ring already.
+ */
+struct snap_ring* snap_action_ring_create (struct snap_action* action,
+        unsigned int entries);
+
+/**
+ * Put a job into the ring. It is not seen by the action before the
+ * next snap_ring_doorbell(). cjob must stay valid until it is reaped,
+ * the parameters are copied.
+ *
+ * @return      SNAP_OK, SNAP_EBUSY if the ring is full, else error.
+ */
+int snap_ring_submit (struct snap_ring* ring, struct snap_job* cjob);
+
+/**
+ * Publish the jobs submitted since the last call and start the action
+ * if it is idle.
+ *
+ * @return      SNAP_OK, SNAP_EIO if the doorbell write failed.
+ */
+int snap_ring_doorbell (struct snap_ring* ring);
+
+/**
+ * Collect completed jobs without blocking. RETC and results are copied
+ * back into each job like snap_action_sync_execute_job() does. Rings
+ * the doorbell again if entries were published while the action was
+ * finishing its run.
+ *
+ * @done        returns up to max completed jobs, in submission order.
+ * @return      number of jobs in done, negative on error.
+ */
+int snap_ring_reap (struct snap_ring* ring, struct snap_job** done,
+                    unsigned int max);
+
+/**
+ * Like snap_ring_reap(), but wait up to timeout_ms (-1 forever) for at
+ * least one job if published jobs are pending.
+ *
+ * @return      number of jobs in done, SNAP_ETIMEDOUT, else error.
+ */
+int snap_ring_wait (struct snap_ring* ring, struct snap_job** done,
+                    unsigned int max, int timeout_ms);
+
+/* Jobs submitted and not reaped yet */
+unsigned int snap_ring_pending (const struct snap_ring* ring);
+
+/**
+ * Free a ring and give the action back to the job table. Waits up to a
+ * second for a run of the action to end.
+ */
+void snap_ring_free (struct snap_ring* ring);
+
 #ifdef __cplusplus
 }
 #endif
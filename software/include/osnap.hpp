@@ -0,0 +1,674 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __OSNAP_HPP__
+#define __OSNAP_HPP__
+
+/*
+ * Header-only C++20 layer over libosnap
+ *
+ * Card, Action and Buffer own their libosnap objects and release them in
+ * the destructor, they can be moved but not copied. Jobs are typed: the
+ * parameter struct is checked against SNAP_JOBSIZE at compile time and
+ * comes back with the results filled in.
+ *
+ *     snap::Task<> copy (snap::Action& action, snap::Buffer& src,
+ *                        snap::Buffer& dst)
+ *     {
+ *         memcopy_job_t job = { src.addr (SNAP_ADDRFLAG_SRC),
+ *                               dst.addr (SNAP_ADDRFLAG_DST |
+ *                                         SNAP_ADDRFLAG_END) };
+ *         auto res = co_await action.run (job);
+ *         ...
+ *     }
+ *
+ *     snap::Card card ("/dev/ocxl/IBM,oc-snap.0004:00:00.1.0");
+ *     snap::Action action (card, ACTION_TYPE);
+ *     auto t = copy (action, src, dst);
+ *     t.start ();
+ *     while (!t.done ())
+ *         card.run_once (10);
+ *
+ * A coroutine which awaits a job is suspended until the job completed
+ * and is resumed from Card::dispatch(), called by run_once() or by the
+ * application's own event loop when Card::event_fd() is readable. Any
+ * number of jobs can be awaited, those which do not fit into the job
+ * table wait in a backlog. A Card and its coroutines are driven by one
+ * thread, and the Card must not be moved while jobs are in flight.
+ *
+ * libosnap errors are thrown as std::system_error, job errors with the
+ * errno of their SNAP_* code, e.g. EFAULT or ECANCELED.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <new>
+#include <optional>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <libosnap.h>
+#include <osnap_hls_if.h>
+
+namespace snap {
+
+[[noreturn]] inline void throw_error (const char* what, int err = errno)
+{
+    throw std::system_error (err ? err : EIO, std::generic_category (), what);
+}
+
+/* errno for a SNAP_* return code, for the std::system_error */
+inline int snap_errno (int rc)
+{
+    switch (rc) {
+    case SNAP_EBUSY:
+        return EBUSY;
+    case SNAP_ENODEV:
+    case SNAP_EATTACH:
+        return ENODEV;
+    case SNAP_ENOENT:
+        return ENOENT;
+    case SNAP_EFAULT:
+        return EFAULT;
+    case SNAP_ETIMEDOUT:
+        return ETIME;
+    case SNAP_EINVAL:
+        return EINVAL;
+    case SNAP_ECANCELED:
+        return ECANCELED;
+    case SNAP_ENOMEM:
+        return ENOMEM;
+    default:
+        return EIO;
+    }
+}
+
+/* Parameters of a job, copied into the workitem registers */
+template <class T>
+concept JobParams = std::is_trivially_copyable_v<T> &&
+                    (sizeof (T) <= SNAP_JOBSIZE) &&
+                    (sizeof (T) % sizeof (uint32_t) == 0);
+
+/* Parameters with the results written back by the action, and RETC */
+template <JobParams T>
+struct Result {
+    T params;
+    uint32_t retc;
+
+    bool ok () const
+    {
+        return SNAP_RETC_SUCCESS == retc;
+    }
+};
+
+/* Buffer for the action, aligned for DMA */
+class Buffer {
+public:
+    Buffer () = default;
+
+    explicit Buffer (size_t size) : ptr_ (snap_malloc (size)), size_ (size)
+    {
+        if (nullptr == ptr_) {
+            throw std::bad_alloc ();
+        }
+    }
+
+    ~Buffer ()
+    {
+        std::free (ptr_);
+    }
+
+    Buffer (Buffer&& o) noexcept
+        : ptr_ (std::exchange (o.ptr_, nullptr)),
+          size_ (std::exchange (o.size_, 0)) {}
+
+    Buffer& operator= (Buffer&& o) noexcept
+    {
+        if (this != &o) {
+            std::free (ptr_);
+            ptr_ = std::exchange (o.ptr_, nullptr);
+            size_ = std::exchange (o.size_, 0);
+        }
+
+        return *this;
+    }
+
+    Buffer (const Buffer&) = delete;
+    Buffer& operator= (const Buffer&) = delete;
+
+    void* data () const
+    {
+        return ptr_;
+    }
+
+    size_t size () const
+    {
+        return size_;
+    }
+
+    template <class U>
+    U* as () const
+    {
+        return static_cast<U*> (ptr_);
+    }
+
+    /* Descriptor of the whole buffer for the job parameters. The size of
+       a snap_addr is 32 bit, larger buffers go through snap_sgl_add(). */
+    struct snap_addr addr (snap_addrflag_t flags,
+                           snap_addrtype_t type = SNAP_ADDRTYPE_HOST_DRAM) const
+    {
+        struct snap_addr a;
+
+        if (size_ > UINT32_MAX) {
+            throw_error ("Buffer::addr", EOVERFLOW);
+        }
+
+        snap_addr_set (&a, ptr_, (uint32_t)size_, type,
+                       flags | SNAP_ADDRFLAG_ADDR);
+        return a;
+    }
+
+private:
+    void* ptr_ = nullptr;
+    size_t size_ = 0;
+};
+
+class Action;
+template <JobParams T> class JobAwaiter;
+
+class Card {
+public:
+    explicit Card (const char* path,
+                   uint16_t vendor_id = SNAP_VENDOR_ID_IBM,
+                   uint16_t device_id = SNAP_DEVICE_ID_SNAP)
+        : card_ (snap_card_alloc_dev (path, vendor_id, device_id))
+    {
+        if (nullptr == card_) {
+            throw_error ("snap_card_alloc_dev");
+        }
+    }
+
+    /* Card by its PCI domain number, as the -C option of the tools */
+    static Card number (unsigned int card_no)
+    {
+        char path[64];
+
+        snprintf (path, sizeof (path), "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0",
+                  card_no);
+        return Card (path);
+    }
+
+    ~Card ()
+    {
+        if (card_) {
+            snap_card_free (card_);
+        }
+    }
+
+    Card (Card&& o) noexcept
+        : card_ (std::exchange (o.card_, nullptr)),
+          running_ (std::move (o.running_)),
+          backlog_ (std::move (o.backlog_)) {}
+
+    Card& operator= (Card&& o) noexcept
+    {
+        if (this != &o) {
+            if (card_) {
+                snap_card_free (card_);
+            }
+
+            card_ = std::exchange (o.card_, nullptr);
+            running_ = std::move (o.running_);
+            backlog_ = std::move (o.backlog_);
+        }
+
+        return *this;
+    }
+
+    Card (const Card&) = delete;
+    Card& operator= (const Card&) = delete;
+
+    struct snap_card* get () const
+    {
+        return card_;
+    }
+
+    int event_fd () const
+    {
+        return snap_card_get_event_fd (card_);
+    }
+
+    /* Jobs awaited and not resumed yet */
+    size_t pending () const
+    {
+        return running_.size () + backlog_.size ();
+    }
+
+    /*
+     * Resume the coroutines of completed jobs and submit backlogged ones.
+     * Never blocks. Returns the number of coroutines resumed.
+     */
+    unsigned int dispatch ()
+    {
+        struct snap_job_handle* done[16];
+        std::vector<Waiter*> ready;
+        unsigned int resumed = 0;
+        int n;
+
+        do {
+            ready.clear ();
+            n = snap_card_process_events (card_, done, 16);
+
+            if (n < 0) {
+                throw_error ("snap_card_process_events");
+            }
+
+            for (int i = 0; i < n; i++) {
+                for (size_t k = 0; k < running_.size (); k++) {
+                    if (running_[k]->handle == done[i]) {
+                        running_[k]->rc = snap_job_wait (done[i], 0);
+                        ready.push_back (running_[k]);
+                        running_.erase (running_.begin () + k);
+                        break;
+                    }
+                }
+            }
+
+            while (!backlog_.empty () && submit (backlog_.front (), ready)) {
+                backlog_.pop_front ();
+            }
+
+            /* Resumed coroutines may submit jobs which complete right
+               away, so go on until a pass found nothing */
+            for (Waiter* w : ready) {
+                w->co.resume ();
+                resumed++;
+            }
+        } while (!ready.empty ());
+
+        return resumed;
+    }
+
+    /* Wait up to timeout_ms for card events, then dispatch() */
+    unsigned int run_once (int timeout_ms)
+    {
+        struct pollfd pfd = { event_fd (), POLLIN, 0 };
+
+        if (pending () && (pfd.fd >= 0) && (timeout_ms != 0)) {
+            poll (&pfd, 1, timeout_ms);
+        }
+
+        return dispatch ();
+    }
+
+private:
+    template <JobParams T> friend class JobAwaiter;
+
+    struct Waiter {
+        struct snap_action* action;
+        struct snap_job* cjob;
+        struct snap_job_handle* handle;
+        std::coroutine_handle<> co;
+        int rc;
+    };
+
+    /* Submit a job, false if the job table is full */
+    bool submit (Waiter* w, std::vector<Waiter*>& ready)
+    {
+        w->handle = snap_action_submit_job (w->action, w->cjob);
+
+        if (w->handle) {
+            running_.push_back (w);
+            return true;
+        }
+
+        if (EBUSY == errno) {
+            return false;
+        }
+
+        w->rc = SNAP_EINVAL;
+        ready.push_back (w);
+        return true;
+    }
+
+    /* From JobAwaiter::await_suspend(), false to resume at once */
+    bool park (Waiter* w)
+    {
+        std::vector<Waiter*> ready;
+
+        if (!backlog_.empty () || !submit (w, ready)) {
+            backlog_.push_back (w);
+        }
+
+        return ready.empty ();
+    }
+
+    struct snap_card* card_;
+    std::vector<Waiter*> running_;
+    std::deque<Waiter*> backlog_;
+};
+
+/* co_await Action::run(): submits the job and suspends until it is done */
+template <JobParams T>
+class [[nodiscard]] JobAwaiter {
+public:
+    JobAwaiter (Card& card, struct snap_action* action, const T& params)
+        : card_ (card), params_ (params)
+    {
+        snap_job_set (&cjob_, &params_, sizeof (T), nullptr, 0);
+        w_.action = action;
+        w_.cjob = &cjob_;
+        w_.handle = nullptr;
+        w_.rc = SNAP_OK;
+    }
+
+    /* The job points into the awaiter, it must stay in place */
+    JobAwaiter (const JobAwaiter&) = delete;
+    JobAwaiter& operator= (const JobAwaiter&) = delete;
+
+    bool await_ready () const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend (std::coroutine_handle<> co)
+    {
+        w_.co = co;
+        return card_.park (&w_);
+    }
+
+    Result<T> await_resume ()
+    {
+        if (SNAP_OK != w_.rc) {
+            throw_error ("snap job", snap_errno (w_.rc));
+        }
+
+        return Result<T> { params_, cjob_.retc };
+    }
+
+private:
+    Card& card_;
+    T params_;
+    struct snap_job cjob_;
+    Card::Waiter w_;
+};
+
+class Action {
+public:
+    /*
+     * Attach an action. With SNAP_ACTION_DONE_IRQ, the default, an IRQ
+     * is assigned so job completions show up on Card::event_fd().
+     */
+    Action (Card& card, snap_action_type_t type,
+            snap_action_flag_t flags = SNAP_ACTION_DONE_IRQ,
+            int attach_timeout_sec = 10)
+        : card_ (&card),
+          action_ (snap_attach_action (card.get (), type, flags,
+                                       attach_timeout_sec))
+    {
+        if (nullptr == action_) {
+            throw_error ("snap_attach_action");
+        }
+
+        if ((SNAP_ACTION_DONE_IRQ & flags) &&
+            (SNAP_OK != snap_action_assign_irq (action_, ACTION_IRQ_SRC_LO))) {
+            int err = errno;
+
+            snap_detach_action (action_);
+            throw_error ("snap_action_assign_irq", err);
+        }
+    }
+
+    ~Action ()
+    {
+        if (action_) {
+            snap_detach_action (action_);
+        }
+    }
+
+    Action (Action&& o) noexcept
+        : card_ (o.card_), action_ (std::exchange (o.action_, nullptr)) {}
+
+    Action& operator= (Action&& o) noexcept
+    {
+        if (this != &o) {
+            if (action_) {
+                snap_detach_action (action_);
+            }
+
+            card_ = o.card_;
+            action_ = std::exchange (o.action_, nullptr);
+        }
+
+        return *this;
+    }
+
+    Action (const Action&) = delete;
+    Action& operator= (const Action&) = delete;
+
+    struct snap_action* get () const
+    {
+        return action_;
+    }
+
+    /* Job for co_await, the parameters are copied */
+    template <JobParams T>
+    JobAwaiter<T> run (const T& params)
+    {
+        return JobAwaiter<T> (*card_, action_, params);
+    }
+
+    /* Blocking job execution, see snap_action_sync_execute_job() */
+    template <JobParams T>
+    Result<T> execute (const T& params, unsigned int timeout_sec = 10)
+    {
+        Result<T> res { params, 0 };
+        struct snap_job cjob;
+
+        snap_job_set (&cjob, &res.params, sizeof (T), nullptr, 0);
+
+        int rc = snap_action_sync_execute_job (action_, &cjob, timeout_sec);
+
+        if (SNAP_OK != rc) {
+            throw_error ("snap_action_sync_execute_job", snap_errno (rc));
+        }
+
+        res.retc = cjob.retc;
+        return res;
+    }
+
+private:
+    Card* card_;
+    struct snap_action* action_;
+};
+
+/*
+ * Coroutine type for code which awaits jobs. A Task starts suspended,
+ * start() runs it up to its first co_await, and it can be awaited from
+ * another Task. get() returns the result or rethrows.
+ */
+template <class T = void>
+class [[nodiscard]] Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine ();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend () noexcept
+    {
+        return {};
+    }
+
+    struct FinalAwaiter {
+        bool await_ready () noexcept
+        {
+            return false;
+        }
+
+        template <class P>
+        std::coroutine_handle<> await_suspend (std::coroutine_handle<P> h) noexcept
+        {
+            return h.promise ().continuation;
+        }
+
+        void await_resume () noexcept {}
+    };
+
+    FinalAwaiter final_suspend () noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception ()
+    {
+        error = std::current_exception ();
+    }
+};
+
+template <class T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object ();
+
+    void return_value (T v)
+    {
+        value.emplace (std::move (v));
+    }
+
+    T result ()
+    {
+        if (error) {
+            std::rethrow_exception (error);
+        }
+
+        return std::move (*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object ();
+
+    void return_void () {}
+
+    void result ()
+    {
+        if (error) {
+            std::rethrow_exception (error);
+        }
+    }
+};
+
+} /* namespace detail */
+
+template <class T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task (std::coroutine_handle<promise_type> h) : h_ (h) {}
+
+    ~Task ()
+    {
+        if (h_) {
+            h_.destroy ();
+        }
+    }
+
+    Task (Task&& o) noexcept : h_ (std::exchange (o.h_, nullptr)) {}
+
+    Task& operator= (Task&& o) noexcept
+    {
+        if (this != &o) {
+            if (h_) {
+                h_.destroy ();
+            }
+
+            h_ = std::exchange (o.h_, nullptr);
+        }
+
+        return *this;
+    }
+
+    Task (const Task&) = delete;
+    Task& operator= (const Task&) = delete;
+
+    /* Run until the first suspension, for a top level Task */
+    void start ()
+    {
+        h_.resume ();
+    }
+
+    bool done () const
+    {
+        return h_.done ();
+    }
+
+    T get ()
+    {
+        return h_.promise ().result ();
+    }
+
+    bool await_ready () const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<> co) noexcept
+    {
+        h_.promise ().continuation = co;
+        return h_;
+    }
+
+    T await_resume ()
+    {
+        return h_.promise ().result ();
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <class T>
+inline Task<T> Promise<T>::get_return_object ()
+{
+    return Task<T> (std::coroutine_handle<Promise<T>>::from_promise (*this));
+}
+
+inline Task<void> Promise<void>::get_return_object ()
+{
+    return Task<void> (std::coroutine_handle<Promise<void>>::from_promise (*this));
+}
+
+} /* namespace detail */
+
+} /* namespace snap */
+
+#endif /* __OSNAP_HPP__ */
@@ -78,6 +78,7 @@ extern "C" {
 #define SNAP_MEMBUS_WIDTH          128                /* bytes */
 #define SNAP_ROUND_UP(x, width) (((x) + (width) - 1) & ~((width) - 1))
 
+/* One-off buffers, for buffers reused by many jobs see snap_buffer_pool_create() */
 static inline void* snap_malloc (size_t size)
 {
     unsigned int page_size = sysconf (_SC_PAGESIZE);
@@ -39,8 +39,10 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <sys/syscall.h>   /* For SYS_xxx definitions */
+#include <libocxl.h>
 
 #include "osnap_queue.h"
+#include "osnap_trace.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -86,12 +88,47 @@ struct snap_funcs {
 
     int (* mmio_per_pasid_write32) (struct snap_card* card, uint64_t offset, uint32_t data);
     int (* mmio_per_pasid_read32) (struct snap_card* card, uint64_t offset, uint32_t* data);
+    int (* mmio_per_pasid_write_block) (struct snap_card* card, uint64_t offset,
+                                        const uint32_t* data, unsigned int words);
+    int (* mmio_per_pasid_read_block) (struct snap_card* card, uint64_t offset,
+                                       uint32_t* data, unsigned int words);
     int (* mmio_global_write64) (struct snap_card* card, uint64_t offset, uint64_t data);
     int (* mmio_global_read64) (struct snap_card* card, uint64_t offset, uint64_t* data);
     void (* card_free) (struct snap_card* card);
     int (* card_ioctl) (struct snap_card* card, unsigned int cmd, unsigned long arg);
+    int (* irq_alloc) (struct snap_card* card, ocxl_irq_h* irq, uint64_t* handle);
+    int (* event_check) (struct snap_card* card, int timeout_ms,
+                         ocxl_event* events, uint16_t event_count);
 };
 
+/*
+ * Software card emulator (osnap_sim.c), selected with SNAP_CONFIG=CPU.
+ * The emulator state is kept in snap_card->priv.
+ */
+struct snap_sim_card;
+
+struct snap_sim_card* snap_sim_card_open (void);
+void snap_sim_card_close (struct snap_sim_card* sim);
+int snap_sim_attach_action (struct snap_sim_card* sim,
+                            snap_action_type_t action_type);
+int snap_sim_per_pasid_write32 (struct snap_sim_card* sim,
+                                uint64_t offset, uint32_t data);
+int snap_sim_per_pasid_read32 (struct snap_sim_card* sim,
+                               uint64_t offset, uint32_t* data);
+int snap_sim_per_pasid_write_block (struct snap_sim_card* sim, uint64_t offset,
+                                    const uint32_t* data, unsigned int words);
+int snap_sim_per_pasid_read_block (struct snap_sim_card* sim, uint64_t offset,
+                                   uint32_t* data, unsigned int words);
+int snap_sim_global_write64 (struct snap_sim_card* sim,
+                             uint64_t offset, uint64_t data);
+int snap_sim_global_read64 (struct snap_sim_card* sim,
+                            uint64_t offset, uint64_t* data);
+int snap_sim_irq_alloc (struct snap_sim_card* sim, uint16_t* irq,
+                        uint64_t* handle);
+int snap_sim_event_check (struct snap_sim_card* sim, int timeout_ms,
+                          ocxl_event* events, uint16_t event_count);
+int snap_sim_event_fd (struct snap_sim_card* sim);
+
 static inline pid_t __gettid (void)
 {
     return (pid_t)syscall (SYS_gettid);
@@ -104,11 +141,78 @@ static inline long long __get_usec (void)
     return t.tv_sec * 1000000LL + t.tv_usec;
 }
 
+int sim_trace_enabled (void);
 int action_trace_enabled (void);
 int block_trace_enabled (void);
 int cache_trace_enabled (void);
 int stat_trace_enabled (void);
 int pp_trace_enabled (void);
+int mem_trace_enabled (void);
+int pool_trace_enabled (void);
+
+#define sim_trace(fmt, ...) do {                                        \
+        if (sim_trace_enabled())                                \
+            fprintf(stderr, "S " fmt, ## __VA_ARGS__);        \
+    } while (0)
+
+/* Jobs queued or running on the card and its recent job latency */
+unsigned int snap_card_load (struct snap_card* card, uint64_t* latency_ns);
+
+/* Cards are emulated in software (SNAP_CONFIG=CPU) */
+int snap_card_emulated (void);
+
+/* Job in the workitem layout, see osnap.c */
+int snap_job_encode (struct snap_card* card, struct snap_job* cjob,
+                     struct snap_queue_workitem* job, unsigned int* mmio_in);
+
+/* Reserve the action for a submission ring of length entries, 0 releases
+   it. SNAP_EBUSY while jobs are in flight or another ring owns it */
+int snap_card_queue_set (struct snap_card* card, unsigned int length);
+
+/* Card memory allocator of the card, see osnap_lcl.c */
+struct snap_lcl;
+struct snap_lcl** snap_card_lcl (struct snap_card* card);
+void snap_lcl_fini (struct snap_lcl* lcl);
+
+/* NUMA placement, see osnap_numa.c. Node -1 is unknown, nothing is done */
+int snap_numa_sysfs_node (const char* sysfs_path);
+int snap_numa_bind_mem (void* addr, size_t size, int node);
+int snap_numa_bind_thread (int node);
+int snap_sim_numa_node (struct snap_sim_card* sim);
+
+/* Latency histograms, see osnap_stats.c */
+void snap_histogram_add (struct snap_histogram* h, uint64_t v);
+
+/* Binary trace ring, see osnap_trace.c */
+extern int snap_tr_enabled;
+void snap_tr_init (void);
+void snap_tr_put (uint16_t id, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+uint64_t snap_tr_clock (void);
+
+#define snap_tr(id, arg0, arg1, arg2) do {                              \
+        if (__builtin_expect (snap_tr_enabled, 0))                      \
+            snap_tr_put ((id), (arg0), (arg1), (arg2));                 \
+    } while (0)
+
+/* Start time of a traced operation, 0 if tracing is off */
+#define snap_tr_start()                                                 \
+    (__builtin_expect (snap_tr_enabled, 0) ? snap_tr_clock () : 0)
+
+/* Record the operation started at t0 with its duration in arg2 */
+#define snap_tr_end(id, t0, arg0, arg1) do {                            \
+        if (t0)                                                         \
+            snap_tr_put ((id), (arg0), (arg1), snap_tr_clock () - (t0)); \
+    } while (0)
+
+#define mem_trace(fmt, ...) do {                                        \
+        if (mem_trace_enabled())                                \
+            fprintf(stderr, "M " fmt, ## __VA_ARGS__);        \
+    } while (0)
+
+#define pool_trace(fmt, ...) do {                                       \
+        if (pool_trace_enabled())                                \
+            fprintf(stderr, "L " fmt, ## __VA_ARGS__);        \
+    } while (0)
 
 #define act_trace(fmt, ...) do {                                        \
         if (action_trace_enabled())                                \
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __OSNAP_TRACE_H__
+#define __OSNAP_TRACE_H__
+
+/*
+ * Binary trace ring file layout, written by libosnap when SNAP_TRACE_RING
+ * is set and read by snap_trace_decode.
+ *
+ * The file holds a header and a fixed number of rings, one per thread.
+ * Each ring has a single writer, records are stored in place and the
+ * ring head is published with a release store, so writers take no lock.
+ * Old records are overwritten when a ring wraps. The ring of a thread
+ * which exited goes to the next new thread, which continues after the
+ * old records with a THREAD record.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SNAP_TRACE_MAGIC        0x3152544e50414e53ull   /* "SNAPNTR1" */
+#define SNAP_TRACE_VERSION      2
+#define SNAP_TRACE_RINGS        64      /* Threads which get a ring */
+
+/* Event IDs, the comment lists arg0, arg1, arg2 */
+enum snap_trace_event {
+    SNAP_TR_NONE = 0,
+    SNAP_TR_MMIO_W32,           /* offset, data, access ns */
+    SNAP_TR_MMIO_R32,           /* offset, data (0 on error), access ns */
+    SNAP_TR_MMIO_WBLK,          /* offset, bytes, access ns */
+    SNAP_TR_MMIO_RBLK,          /* offset, bytes, access ns */
+    SNAP_TR_GLOBAL_W64,         /* offset, data, access ns */
+    SNAP_TR_GLOBAL_R64,         /* offset, data (0 on error), access ns */
+    SNAP_TR_ACTION_START,       /* seq, -, - */
+    SNAP_TR_ACTION_DONE,        /* completed, rc, wait ns */
+    SNAP_TR_JOB_QUEUE,          /* -, ticket, - */
+    SNAP_TR_JOB_START,          /* -, ticket, - */
+    SNAP_TR_JOB_DONE,           /* rc, ticket, - */
+    SNAP_TR_IRQ_ARM,            /* -, handle, - */
+    SNAP_TR_IRQ_WAIT,           /* rc, handle, wait ns */
+    SNAP_TR_IRQ_EVENT,          /* irq, handle, count */
+    SNAP_TR_IRQ_FAULT,          /* -, addr, dsisr */
+    SNAP_TR_RING_DOORBELL,      /* -, sq_tail, entries pending */
+    SNAP_TR_ACTION_STOP,        /* idle, reset, stop ns */
+    SNAP_TR_JOB_CANCEL,         /* state, ticket, - */
+    SNAP_TR_JOB_FAULT,          /* faulted in, ticket, addr */
+    SNAP_TR_THREAD,             /* tid, previous owner tid, - */
+    SNAP_TR_MAX
+};
+
+struct snap_trace_rec {
+    uint64_t ts;                /* CLOCK_MONOTONIC_RAW in ns */
+    uint16_t id;                /* enum snap_trace_event */
+    uint16_t rsvd;
+    uint32_t arg0;
+    uint64_t arg1;
+    uint64_t arg2;
+};
+
+struct snap_trace_ring {
+    uint32_t tid;               /* Owner thread, 0: ring free */
+    uint32_t last_tid;          /* Last owner, kept when it exited */
+    uint64_t head;              /* Records written so far */
+    uint64_t pad[6];
+    struct snap_trace_rec rec[];
+};
+
+struct snap_trace_file {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t rings;             /* Rings in the file */
+    uint32_t ring_entries;      /* Records per ring, power of 2 */
+    uint32_t rings_used;
+    int32_t pid;
+    uint32_t rsvd;
+    uint64_t t0;                /* Timestamp of library init */
+    uint64_t pad[3];
+};
+
+static inline uint64_t snap_trace_ring_size (uint32_t ring_entries)
+{
+    return sizeof (struct snap_trace_ring) +
+           (uint64_t)ring_entries * sizeof (struct snap_trace_rec);
+}
+
+static inline struct snap_trace_ring* snap_trace_get_ring (
+        struct snap_trace_file* f, uint32_t i)
+{
+    return (struct snap_trace_ring*) ((uint8_t*) (f + 1) +
+                                      i * snap_trace_ring_size (f->ring_entries));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __OSNAP_TRACE_H__ */
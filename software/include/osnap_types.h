@@ -86,6 +86,65 @@ static inline void snap_addr_set (struct snap_addr* da,
     da->flags = flags;
 }
 
+/*
+ * Scatter-gather lists (snap_sgl_* in libosnap) are chained tables of
+ * SNAP_SGL_TABLE_ENTRIES snap_addr entries, one table per 128 byte host
+ * memory line, aligned to it. An entry with SNAP_ADDRFLAG_EXT links to
+ * the next table, it is always the last one of a full table. The last
+ * data entry of the list has SNAP_ADDRFLAG_END.
+ */
+#define SNAP_SGL_TABLE_ENTRIES 8
+
+/*
+ * Completion record. With SNAP_JOBFLAG_CMPL set in the job flags the
+ * action writes this record, one 128 byte host memory line, to the
+ * address in the job's priv_data before it goes idle. The host clears
+ * flags before the start and waits for SNAP_CMPL_VALID with the job's
+ * seq, in local memory instead of polling ACTION_CONTROL.
+ */
+#define SNAP_JOBFLAG_EXEC                0x01 /* set in every job */
+#define SNAP_JOBFLAG_CMPL                0x02 /* write a completion record */
+
+#define SNAP_CMPL_VALID                  0x0001
+
+struct snap_completion_record {
+    uint16_t seq;                        /* seq of the completed job */
+    uint16_t flags;                      /* SNAP_CMPL_VALID */
+    uint32_t retc;                       /* SNAP_RETC_* */
+    uint64_t timestamp;                  /* action defined, e.g. cycles */
+    uint64_t rsvd[14];
+};                                       /* 128 bytes */
+
+/*
+ * Submission ring (snap_ring_* in libosnap). The job in ACTION_PARAMS_IN
+ * has SNAP_JOBFLAG_RING set and priv_data pointing to the snap_ring_ctl
+ * in host memory, it stays there while the ring exists. Jobs are
+ * snap_queue_workitem entries in the submission queue, each with
+ * SNAP_JOBFLAG_CMPL and priv_data pointing to its completion record.
+ *
+ * ACTION_CONTROL_START is the doorbell. The action reads sq_tail and
+ * executes the entries from sq_head up to it, in order. Per entry it
+ * writes the workitem with RETC and results back to its slot, then the
+ * completion record, and advances sq_head. With no entries left it
+ * reads sq_tail again, and once that brings nothing new it increments
+ * runs as its last host memory write and goes idle. Indices are free
+ * running, the slot is index & (entries - 1).
+ */
+#define SNAP_JOBFLAG_RING                0x04 /* priv_data: snap_ring_ctl */
+
+struct snap_ring_ctl {
+    /* Written by the host */
+    uint64_t sq_addr;                    /* snap_queue_workitem[entries] */
+    uint64_t cq_addr;                    /* snap_completion_record[entries] */
+    uint32_t entries;                    /* power of 2 */
+    uint32_t sq_tail;                    /* entries published */
+    uint64_t rsvd0[13];
+    /* Written by the action */
+    uint32_t sq_head;                    /* entries consumed */
+    uint32_t runs;                       /* doorbells served */
+    uint64_t rsvd1[15];
+};                                       /* 2 * 128 bytes */
+
 /*
  * Maximum size of an SNAP HLS job without addr extension, this size is required
  * such that the output MMIO registers will end up at the correct address offset.
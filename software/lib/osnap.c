@@ -23,6 +23,10 @@
 #include <errno.h>
 #include <endian.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include <libosnap.h>
 #include <libocxl.h>
@@ -35,12 +39,27 @@
 
 /* Trace hardware implementation */
 static unsigned int snap_trace = 0x0;
+static unsigned int snap_config = 0x0;
+
+/* SNAP_NUMA_BIND: bind the thread attaching an action to the card's node */
+static bool snap_numa_bind_env = false;
+
+/* Wait policy from SNAP_WAIT_POLICY, applies to all cards if set */
+static struct snap_wait_policy snap_env_wait_policy;
+static bool snap_env_wait_policy_set = false;
 
 #define snap_trace_enabled()  (snap_trace & 0x0001)
 #define reg_trace_enabled()   (snap_trace & 0x0002)
-#define sim_trace_enabled()   (snap_trace & 0x0004)
 #define poll_trace_enabled()  (snap_trace & 0x0010)
 
+#define mmio64_enabled()      (!(snap_config & 0x02))
+#define delta_upload_enabled() (!(snap_config & 0x04))
+
+int sim_trace_enabled (void)
+{
+    return snap_trace & 0x0004;
+}
+
 int action_trace_enabled (void)
 {
     return snap_trace & 0x0008;
@@ -66,6 +85,16 @@ int pp_trace_enabled (void)
     return snap_trace & 0x0100;
 }
 
+int mem_trace_enabled (void)
+{
+    return snap_trace & 0x0200;
+}
+
+int pool_trace_enabled (void)
+{
+    return snap_trace & 0x0400;
+}
+
 #define software_action_enabled()  (snap_config & 0x01)
 
 #define snap_trace(fmt, ...) do { \
@@ -78,11 +107,6 @@ int pp_trace_enabled (void)
             fprintf(stderr, "R " fmt, ## __VA_ARGS__); \
     } while (0)
 
-#define sim_trace(fmt, ...) do { \
-        if (sim_trace_enabled()) \
-            fprintf(stderr, "S " fmt, ## __VA_ARGS__); \
-    } while (0)
-
 #define poll_trace(fmt, ...) do { \
         if (poll_trace_enabled()) \
             fprintf(stderr, "P " fmt, ## __VA_ARGS__); \
@@ -90,8 +114,76 @@ int pp_trace_enabled (void)
 
 #define        INVALID_SAT 0x0ffffffff
 
+/* We access the hardware via this function pointer struct */
+static struct snap_funcs* df;
+
+/* Words of the workitem in ACTION_PARAMS_IN */
+#define SNAP_PARAMS_WORDS   (sizeof (struct snap_queue_workitem) / sizeof (uint32_t))
+
+/* Job encoded for upload, see snap_action_prepare_job() */
+struct snap_prepared_job {
+    struct snap_card* card;
+    struct snap_job* cjob;
+    struct snap_queue_workitem job;
+    unsigned int mmio_in;           /* Words to upload */
+};
+
+/* Asynchronous jobs, see snap_action_submit_job() */
+#define SNAP_JOB_TABLE_SIZE 16
+
+enum snap_job_state {
+    SNAP_JOB_FREE = 0,
+    SNAP_JOB_QUEUED,                /* waiting for the action */
+    SNAP_JOB_RUNNING,               /* registers written, action started */
+    SNAP_JOB_DONE                   /* results read back, rc valid */
+};
+
+struct snap_job_handle {
+    struct snap_card* card;
+    struct snap_job* cjob;
+    struct snap_prepared_job* pjob; /* Upload this encoding if set */
+    bool reported;                  /* Returned by snap_card_process_events() */
+    bool cancelled;                 /* Results discarded, rc SNAP_ECANCELED */
+    enum snap_job_state state;
+    uint64_t ticket;                /* submission order */
+    int rc;
+    uint64_t t_queue;               /* tget_ns() when queued */
+    uint64_t t_start;               /* tget_ns() after the action start */
+    uint64_t polls;                 /* card->polls at start */
+    uint64_t irq_done;              /* card->irq_done at start */
+    uint64_t irq_faults;            /* card->irq_faults at (re)start */
+    unsigned int faults;            /* Restarts after translation faults */
+};
+
+/*
+ * Threading: the job table is protected by job_lock. One thread at a
+ * time owns the action (job_driving) and runs snap_job_progress(), it
+ * drops job_lock only while waiting for the action. Threads waiting for
+ * their job while another one drives sleep on job_cond. A job whose
+ * owner gave up (sync timeout) has cjob == NULL and is freed by the
+ * driver once the action is done with it. A cancelled job is aborted
+ * through the action reset register under job_lock, so the reset never
+ * hits the job started after it.
+ */
+
+/*
+ * IRQ pool, see snap_action_alloc_irq(). Events are read by whichever
+ * waiter currently holds the dispatcher role and routed by handle to
+ * the pool entry, so no waiter consumes an event of another one.
+ */
+#define SNAP_IRQ_POOL_SIZE  8
+#define SNAP_IRQ_BATCH      16              /* Events per event_check */
+#define SNAP_FAULT_LOG      8               /* Translation faults kept */
+
+struct snap_irq {
+    ocxl_irq_h irq;
+    uint64_t handle;                /* EA the action writes to */
+    uint64_t fired;                 /* IRQs routed to this entry */
+    uint64_t taken;                 /* IRQs consumed by waiters */
+};
+
 struct snap_card {
-    void* priv;
+    void* priv;                     /* software emulator state */
     ocxl_afu_h afu_h;
     bool master;                    /* True if this is Master Device */
     int cir;                        /* Context id */
@@ -107,19 +199,61 @@ struct snap_card {
     uint32_t sat;                   /* Short Action Type */
     bool start_attach;
     snap_action_flag_t flags;       /* Flags from Application */
-    uint16_t seq;                   /* Seq Number */
+    uint16_t seq;                   /* Seq Number, atomic */
     int afu_fd;
 
     struct snap_sim_action* action; /* software simulation mode */
     size_t errinfo_size;            /* Size of errinfo */
     void* errinfo;                  /* Err info Buffer */
-    ocxl_event event;               /* Buffer to keep event from IRQ */
-    ocxl_irq_h afu_irq;             /* The IRQ handler. TODO: add support to multi process */ 
-    uint64_t irq_ea;                /* The IRQ EA/obj_handler. TODO: add support to multi process */ 
+    ocxl_event event;               /* Last fault or error event */
+    uint64_t irq_ea;                /* Action done IRQ EA/obj_handler */
+
+    pthread_mutex_t irq_lock;       /* Protects the IRQ pool */
+    pthread_cond_t irq_cond;        /* Signalled after each dispatch */
+    bool irq_dispatching;           /* A waiter is in event_check */
+    unsigned int irq_count;         /* Used pool entries */
+    struct snap_irq irq_pool[SNAP_IRQ_POOL_SIZE];
+    uint64_t irq_faults;            /* Translation fault events */
+    ocxl_event_translation_fault fault_log[SNAP_FAULT_LOG]; /* Last faults,
+                                       at irq_faults % SNAP_FAULT_LOG */
+    uint64_t irq_errors;            /* Other non IRQ events */
     unsigned int attach_timeout_sec;
-    unsigned int queue_length;      /* unused */
+    unsigned int queue_length;      /* Submission ring entries, 0: none */
     uint64_t cap_reg;               /* Capability Register */
     const char* name;               /* Card name */
+    int numa_node;                  /* Of the PCI device, -1: unknown */
+
+    struct snap_wait_policy wait_policy; /* How to wait for action done */
+    bool wait_policy_set;           /* Set by application, keep on attach */
+    bool irq_armed;                 /* Action done IRQ enabled for this job */
+    uint32_t reset_reg;             /* Action soft reset register, 0: none */
+    uint32_t reset_value;
+    bool aborting;                  /* Reset pulsed, the job ends without
+                                       completion record or IRQ */
+
+    pthread_mutex_t job_lock;       /* Protects the job table */
+    pthread_cond_t job_cond;        /* Signalled after each progress step */
+    bool job_driving;               /* A thread owns the action */
+    struct snap_job_handle jobs[SNAP_JOB_TABLE_SIZE];
+    struct snap_job_handle* job_running; /* Job owning the action */
+    uint64_t job_ticket;            /* Next submission ticket */
+    uint64_t job_ewma_ns;           /* Recent job execution time */
+
+    struct snap_lcl* lcl;           /* Card memory allocator, on first use */
+
+    /* Completion record, with SNAP_ACTION_CMPL_RECORD */
+    struct snap_completion_record* cmpl;
+    uint16_t cmpl_seq;              /* seq of the job started last */
+
+    struct snap_stats stats;        /* Job statistics, under job_lock */
+    uint64_t polls;                 /* ACTION_CONTROL idle polls */
+    uint64_t irq_done;              /* Waits ended by the done IRQ */
+
+    /* Copy of ACTION_PARAMS_IN as last written, first params_valid words.
+       params_valid is cleared by direct register writes without job_lock,
+       it is only accessed atomically. */
+    uint32_t params_shadow[SNAP_PARAMS_WORDS];
+    unsigned int params_valid;
 };
 
 /* Translate Card ID to Name */
@@ -154,16 +288,36 @@ static const char* snap_card_id_2_name (int card_id)
 }
 
 
-/*        Get Time in msec */
-static unsigned long tget_ms (void)
+/*        Get monotonic Time in nsec */
+static uint64_t tget_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/* Locks of the IRQ pool and the job table, conditions use CLOCK_MONOTONIC */
+static void snap_card_sync_init (struct snap_card* card)
 {
-    struct timeval now;
-    unsigned long tms;
+    pthread_condattr_t attr;
+
+    pthread_mutex_init (&card->irq_lock, NULL);
+    pthread_mutex_init (&card->job_lock, NULL);
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&card->irq_cond, &attr);
+    pthread_cond_init (&card->job_cond, &attr);
+    pthread_condattr_destroy (&attr);
+}
 
-    gettimeofday (&now, NULL);
-    tms = (unsigned long) (now.tv_sec * 1000) +
-          (unsigned long) (now.tv_usec / 1000);
-    return tms;
+static void snap_card_sync_fini (struct snap_card* card)
+{
+    /* The ocxl IRQs are freed when the AFU is closed */
+    pthread_cond_destroy (&card->job_cond);
+    pthread_cond_destroy (&card->irq_cond);
+    pthread_mutex_destroy (&card->job_lock);
+    pthread_mutex_destroy (&card->irq_lock);
 }
 
 static void* hw_snap_card_alloc_dev (const char* path,
@@ -200,6 +354,8 @@ static void* hw_snap_card_alloc_dev (const char* path,
     }
 
     dn->sat = INVALID_SAT;        // Invalid Short Action Type stands for not attached
+    dn->wait_policy = snap_env_wait_policy;
+    dn->wait_policy_set = snap_env_wait_policy_set;
     dn->action_type = 0xffffffff;
     dn->vendor_id = vendor_id;
     dn->device_id = device_id;
@@ -239,6 +395,9 @@ static void* hw_snap_card_alloc_dev (const char* path,
     dn->cap_reg = reg;
     // Get SNAP Card Name
     dn->name = snap_card_id_2_name ((int) (reg & 0xff));
+    dn->numa_node = snap_numa_sysfs_node (ocxl_afu_get_sysfs_path (dn->afu_h));
+
+    snap_card_sync_init (dn);
 
     snap_trace ("%s Exit %p OK Context: %d Master: %d Card: %s\n", __func__,
                 dn, dn->cir, dn->master, dn->name);
@@ -300,6 +459,91 @@ static int hw_mmio_per_pasid_read32 (struct snap_card* card,
     return rc;
 }
 
+/*
+ * Block access to consecutive action registers. The card is checked
+ * and traced once per block, 8 byte aligned register pairs go out as
+ * one 64 bit MMIO unless SNAP_CONFIG bit 0x2 forces 32 bit accesses.
+ * The register at the lower offset is the low word of the 64 bit value.
+ */
+static int hw_mmio_per_pasid_write_block (struct snap_card* card,
+        uint64_t offset, const uint32_t* data, unsigned int words)
+{
+    unsigned int i = 0;
+    int rc = 0;
+
+    if ((NULL == card) || (NULL == card->afu_h)) {
+        reg_trace ("  %s Error\n", __func__);
+        errno = EINVAL;
+        return -1;
+    }
+
+    reg_trace ("  %s(%p, %llx, %d words)\n", __func__, card,
+               (long long)offset, words);
+
+    if ((offset & 0x4) && (words > 0)) {
+        rc = ocxl_mmio_write32 (card->mmio_per_pasid, offset, card->mmio_endian,
+                                data[0]);
+        i = 1;
+    }
+
+    if (mmio64_enabled()) {
+        for (; (0 == rc) && (i + 1 < words); i += 2) {
+            rc = ocxl_mmio_write64 (card->mmio_per_pasid,
+                                    offset + i * sizeof (uint32_t),
+                                    card->mmio_endian,
+                                    ((uint64_t)data[i + 1] << 32) | data[i]);
+        }
+    }
+
+    for (; (0 == rc) && (i < words); i++) {
+        rc = ocxl_mmio_write32 (card->mmio_per_pasid,
+                                offset + i * sizeof (uint32_t),
+                                card->mmio_endian, data[i]);
+    }
+
+    return rc;
+}
+
+static int hw_mmio_per_pasid_read_block (struct snap_card* card,
+        uint64_t offset, uint32_t* data, unsigned int words)
+{
+    unsigned int i = 0;
+    uint64_t data64;
+    int rc = 0;
+
+    if ((NULL == card) || (NULL == card->afu_h)) {
+        reg_trace ("  %s Error\n", __func__);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((offset & 0x4) && (words > 0)) {
+        rc = ocxl_mmio_read32 (card->mmio_per_pasid, offset, card->mmio_endian,
+                               &data[0]);
+        i = 1;
+    }
+
+    if (mmio64_enabled()) {
+        for (; (0 == rc) && (i + 1 < words); i += 2) {
+            rc = ocxl_mmio_read64 (card->mmio_per_pasid,
+                                   offset + i * sizeof (uint32_t),
+                                   card->mmio_endian, &data64);
+            data[i] = (uint32_t)data64;
+            data[i + 1] = (uint32_t) (data64 >> 32);
+        }
+    }
+
+    for (; (0 == rc) && (i < words); i++) {
+        rc = ocxl_mmio_read32 (card->mmio_per_pasid,
+                               offset + i * sizeof (uint32_t),
+                               card->mmio_endian, &data[i]);
+    }
+
+    reg_trace ("  %s(%p, %llx, %d words) %d\n", __func__, card,
+               (long long)offset, words, rc);
+    return rc;
+}
+
 // Snap_core registers are 64bits and in GLOBAL space
 static int hw_mmio_global_write64 (struct snap_card* card,
                                    uint64_t offset, uint64_t data)
@@ -353,72 +597,296 @@ static void hw_snap_card_free (struct snap_card* card)
         card->afu_h = NULL;
     }
 
+    snap_card_sync_fini (card);
     __free (card);
 }
 
-//FIXME: irq procedure needs to be revised
-static int hw_wait_irq (struct snap_card* card, int timeout_sec/*, int expect_irq*/)
+/* Called with irq_lock held */
+static struct snap_irq* snap_irq_lookup (struct snap_card* card,
+        uint64_t handle)
 {
-    int rc = 0;
+    unsigned int i;
+
+    for (i = 0; i < card->irq_count; i++) {
+        if (card->irq_pool[i].handle == handle) {
+            return &card->irq_pool[i];
+        }
+    }
 
-    snap_trace ("  %s: Enter fd: %d Flags: 0x%x  Timeout: %d sec\n",
-                __func__, card->afu_fd,
-                card->flags, timeout_sec);
+    return NULL;
+}
+
+/* Allocate a new IRQ into the pool */
+static int snap_irq_get (struct snap_card* card, uint64_t* handle)
+{
+    struct snap_irq* e;
+    int rc = 0;
 
-__hw_wait_irq_retry:
+    pthread_mutex_lock (&card->irq_lock);
 
-    if (!ocxl_afu_event_check (card->afu_h, -1, &card->event, 1)) {
-	rc = EINTR;
-        snap_trace ("    Timeout......\n");
-    } else {
-        snap_trace ("    Event is Pending ......\n");
+    if (card->irq_count >= SNAP_IRQ_POOL_SIZE) {
+        errno = ENOSPC;
+        rc = -1;
+        goto __snap_irq_get_exit;
     }
 
+    e = &card->irq_pool[card->irq_count];
+    rc = df->irq_alloc (card, &e->irq, &e->handle);
+
     if (0 == rc) {
-        switch (card->event.type) {
+        e->fired = 0;
+        e->taken = 0;
+        *handle = e->handle;
+        card->irq_count++;
+    }
+
+__snap_irq_get_exit:
+    pthread_mutex_unlock (&card->irq_lock);
+    return rc;
+}
+
+/* Forget IRQs which fired before the caller (re)armed the source */
+static void snap_irq_discard (struct snap_card* card, uint64_t handle)
+{
+    struct snap_irq* e;
+
+    pthread_mutex_lock (&card->irq_lock);
+    e = snap_irq_lookup (card, handle);
+
+    if (e) {
+        e->taken = e->fired;
+    }
+
+    pthread_mutex_unlock (&card->irq_lock);
+}
+
+/* Route a batch of events to the pool entries, called with irq_lock held */
+static void snap_irq_route (struct snap_card* card, ocxl_event* events,
+                            int n)
+{
+    struct snap_irq* e;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        switch (events[i].type) {
 
         case OCXL_EVENT_IRQ:
             snap_trace ("  %s: OCXL_EVENT_IRQ\n"
-                        "      irq=%d,  count=%lld\n", __func__,
-                        (int)card->event.irq.irq,
-                        (long long)card->event.irq.count);
-
-            // TODO: expect_irq is useless
-            //if (expect_irq != card->event.irq.irq) {
-            if (card->irq_ea != card->event.irq.handle) {
-                snap_trace ("  %s:     Wrong IRQ.. Retry ! Get: %lx, expect: %lx\n", __func__,
-                        card->event.irq.handle, card->irq_ea);
-                goto __hw_wait_irq_retry;
+                        "      irq=%d,  count=%lld handle: %lx\n", __func__,
+                        (int)events[i].irq.irq,
+                        (long long)events[i].irq.count,
+                        (long)events[i].irq.handle);
+            snap_tr (SNAP_TR_IRQ_EVENT, events[i].irq.irq,
+                     events[i].irq.handle, events[i].irq.count);
+            e = snap_irq_lookup (card, events[i].irq.handle);
+
+            if (NULL == e) {
+                snap_trace ("  %s:     Unknown IRQ handle %lx dropped\n",
+                            __func__, (long)events[i].irq.handle);
+                break;
             }
 
-            rc = 0;
+            e->fired++;
             break;
 
         case OCXL_EVENT_TRANSLATION_FAULT: {
             ocxl_event_translation_fault* ds =
-                &card->event.translation_fault;
+                &events[i].translation_fault;
 
             snap_trace ("  %s: OCXL_EVENT_TRANSLATION_FAULT\n", __func__);
             snap_trace ("      addr=%08llx, dsisr=%08llx\n",
                         (long long)ds->addr,
                         (long long)ds->dsisr);
-            rc = EFAULT;
+            snap_tr (SNAP_TR_IRQ_FAULT, 0, (uint64_t)ds->addr, ds->dsisr);
+            card->event = events[i];
+            card->fault_log[card->irq_faults % SNAP_FAULT_LOG] = *ds;
+            card->irq_faults++;
             break;
         }
 
         default:
             snap_trace ("  %s: AFU_ERROR type=%d\n",
-                        __func__, card->event.type);
+                        __func__, events[i].type);
+            card->event = events[i];
+            card->irq_errors++;
+            break;
+        }
+    }
+}
+
+/*
+ * Wait for the IRQ with the given handle. timeout_ms < 0 blocks, 0 only
+ * checks. One waiter at a time reads the events for all of them (the
+ * dispatcher), the others sleep on irq_cond until their IRQ was routed.
+ * Faults and errors wake up all current waiters.
+ * Returns 0, ETIME on timeout, EFAULT or EINTR.
+ */
+static int snap_irq_wait (struct snap_card* card, uint64_t handle,
+                          int timeout_ms)
+{
+    ocxl_event events[SNAP_IRQ_BATCH];
+    struct snap_irq* e;
+    uint64_t faults, errors;
+    uint64_t now, end = 0;
+    struct timespec ts;
+    int n, wait_ms, rc = ETIME;
+    uint64_t t0 = snap_tr_start ();
+
+    snap_trace ("  %s: Enter fd: %d Flags: 0x%x Handle: %lx Timeout: %d msec\n",
+                __func__, card->afu_fd, card->flags, (long)handle,
+                timeout_ms);
+
+    if (timeout_ms > 0) {
+        end = tget_ns() + (uint64_t)timeout_ms * 1000000ull;
+    }
+
+    pthread_mutex_lock (&card->irq_lock);
+    e = snap_irq_lookup (card, handle);
+
+    if (NULL == e) {
+        pthread_mutex_unlock (&card->irq_lock);
+        snap_trace ("  %s: Handle %lx not in IRQ pool\n", __func__,
+                    (long)handle);
+        return EINVAL;
+    }
+
+    faults = card->irq_faults;
+    errors = card->irq_errors;
+
+    for (;;) {
+        if (e->taken < e->fired) {
+            e->taken++;
+            rc = 0;
+            break;
+        }
+
+        if (faults != card->irq_faults) {
+            rc = EFAULT;
+            break;
+        }
+
+        if (errors != card->irq_errors) {
             rc = EINTR;
             break;
         }
+
+        if (timeout_ms < 0) {
+            wait_ms = -1;
+        } else if (timeout_ms == 0) {
+            wait_ms = 0;
+        } else {
+            now = tget_ns();
+
+            if (now >= end) {
+                break;
+            }
+
+            wait_ms = (int) ((end - now + 999999) / 1000000);
+        }
+
+        if (!card->irq_dispatching) {
+            card->irq_dispatching = true;
+            pthread_mutex_unlock (&card->irq_lock);
+            n = df->event_check (card, wait_ms, events, SNAP_IRQ_BATCH);
+            pthread_mutex_lock (&card->irq_lock);
+            card->irq_dispatching = false;
+
+            if (n > 0) {
+                snap_irq_route (card, events, n);
+            }
+
+            /* Wake waiters, one of them takes over dispatching */
+            pthread_cond_broadcast (&card->irq_cond);
+
+            if ((n <= 0) && (e->taken == e->fired)) {
+                if (wait_ms < 0) {
+                    rc = EINTR;             /* Blocking wait interrupted */
+                    break;
+                }
+
+                if (wait_ms == 0) {
+                    break;
+                }
+            }
+        } else if (wait_ms < 0) {
+            pthread_cond_wait (&card->irq_cond, &card->irq_lock);
+        } else if (wait_ms == 0) {
+            break;
+        } else {
+            ts.tv_sec = end / 1000000000ull;
+            ts.tv_nsec = end % 1000000000ull;
+            pthread_cond_timedwait (&card->irq_cond, &card->irq_lock, &ts);
+        }
     }
 
+    pthread_mutex_unlock (&card->irq_lock);
+    snap_tr_end (SNAP_TR_IRQ_WAIT, t0, rc, handle);
+
     snap_trace ("  %s: Exit fd: %d rc: %d\n", __func__,
                 card->afu_fd, rc);
     return rc;
 }
 
+/*
+ * Read the pending events without blocking, IRQs are routed to the IRQ
+ * pool. If a waiter is dispatching already it does the same for us.
+ */
+static void snap_irq_drain (struct snap_card* card)
+{
+    ocxl_event events[SNAP_IRQ_BATCH];
+    int n;
+
+    pthread_mutex_lock (&card->irq_lock);
+
+    if (!card->irq_dispatching) {
+        card->irq_dispatching = true;
+
+        do {
+            pthread_mutex_unlock (&card->irq_lock);
+            n = df->event_check (card, 0, events, SNAP_IRQ_BATCH);
+            pthread_mutex_lock (&card->irq_lock);
+
+            if (n > 0) {
+                snap_irq_route (card, events, n);
+            }
+        } while (SNAP_IRQ_BATCH == n);
+
+        card->irq_dispatching = false;
+        pthread_cond_broadcast (&card->irq_cond);
+    }
+
+    pthread_mutex_unlock (&card->irq_lock);
+}
+
+/*
+ * Wait for the action done IRQ. timeout_ms < 0 blocks, 0 only checks.
+ * Returns ETIME if no event arrived within timeout_ms.
+ */
+static int hw_wait_irq (struct snap_card* card, int timeout_ms)
+{
+    return snap_irq_wait (card, card->irq_ea, timeout_ms);
+}
+
+/*
+ * Without a policy from the application or SNAP_WAIT_POLICY keep the
+ * classic behavior: wait for the IRQ if SNAP_ACTION_DONE_IRQ is set,
+ * else busy poll ACTION_CONTROL until the timeout.
+ */
+static void snap_default_wait_policy (struct snap_card* card)
+{
+    if (card->wait_policy_set) {
+        return;
+    }
+
+    memset (&card->wait_policy, 0, sizeof (card->wait_policy));
+
+    if (SNAP_ACTION_DONE_IRQ & card->flags) {
+        card->wait_policy.irq = 1;
+    } else {
+        card->wait_policy.spin_usec = SNAP_WAIT_FOREVER;
+    }
+}
+
 static struct snap_action* hw_attach_action (struct snap_card* card,
         snap_action_type_t action_type,
         snap_action_flag_t action_flags,
@@ -443,12 +911,15 @@ static struct snap_action* hw_attach_action (struct snap_card* card,
     }
 
     card->flags = action_flags;
+    __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
+    snap_default_wait_policy (card);
 
     snap_trace ("Set start_attach\n");
 
-    // TODO: Attach IRQ is currently not supported in oc-accel
-    if (SNAP_ATTACH_IRQ & card->flags) {
-        rc = hw_wait_irq (card, timeout_sec );
+    // TODO: Attach IRQ is currently not supported in oc-accel,
+    // no IRQ can be assigned before the action is attached
+    if ((SNAP_ATTACH_IRQ & card->flags) && card->irq_ea) {
+        rc = hw_wait_irq (card, -1);
     }
 
     /* Return Pointer if all went well */
@@ -480,6 +951,7 @@ static int hw_detach_action (struct snap_action* action)
                 card->attach_timeout_sec, card->seq);
 
     card->start_attach = true;              /* Set Flag to Attach next Time again */
+    __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
     return rc;
 }
 
@@ -557,6 +1029,23 @@ static int hw_card_ioctl (struct snap_card* card, unsigned int cmd, unsigned lon
     return rc;
 }
 
+static int hw_irq_alloc (struct snap_card* card, ocxl_irq_h* irq,
+                         uint64_t* handle)
+{
+    if (OCXL_OK != ocxl_irq_alloc (card->afu_h, NULL, irq)) {
+        return -1;
+    }
+
+    *handle = ocxl_irq_get_handle (card->afu_h, *irq);
+    return 0;
+}
+
+static int hw_event_check (struct snap_card* card, int timeout_ms,
+                           ocxl_event* events, uint16_t event_count)
+{
+    return ocxl_afu_event_check (card->afu_h, timeout_ms, events, event_count);
+}
+
 /* Hardware version of the lowlevel functions */
 static struct snap_funcs hardware_funcs = {
     .card_alloc_dev = hw_snap_card_alloc_dev,
@@ -564,37 +1053,255 @@ static struct snap_funcs hardware_funcs = {
     .detach_action = hw_detach_action,       /* detach Action */
     .mmio_per_pasid_write32 = hw_mmio_per_pasid_write32,
     .mmio_per_pasid_read32 = hw_mmio_per_pasid_read32,
+    .mmio_per_pasid_write_block = hw_mmio_per_pasid_write_block,
+    .mmio_per_pasid_read_block = hw_mmio_per_pasid_read_block,
     .mmio_global_write64 = hw_mmio_global_write64,
     .mmio_global_read64 = hw_mmio_global_read64,
     .card_free = hw_snap_card_free,
     .card_ioctl = hw_card_ioctl,
+    .irq_alloc = hw_irq_alloc,
+    .event_check = hw_event_check,
 };
 
-/* We access the hardware via this function pointer struct */
-static struct snap_funcs* df = &hardware_funcs;
+/*
+ * Software version of the lowlevel functions. The card is emulated
+ * in-process by osnap_sim.c, the common code above (start, completion,
+ * job upload) is the same as for the hardware.
+ */
+static void* sw_snap_card_alloc_dev (const char* path,
+                                     uint16_t vendor_id,
+                                     uint16_t device_id)
+{
+    struct snap_card* dn;
+    uint64_t reg;
 
-struct snap_card* snap_card_alloc_dev (const char* path,
-                                       uint16_t vendor_id,
-                                       uint16_t device_id)
+    snap_trace ("%s Enter %s (software)\n", __func__, path);
+
+    dn = calloc (1, sizeof (*dn));
+
+    if (NULL == dn) {
+        return NULL;
+    }
+
+    dn->priv = snap_sim_card_open ();
+
+    if (NULL == dn->priv) {
+        free (dn);
+        return NULL;
+    }
+
+    dn->sat = INVALID_SAT;
+    dn->action_type = 0xffffffff;
+    dn->wait_policy = snap_env_wait_policy;
+    dn->wait_policy_set = snap_env_wait_policy_set;
+    dn->vendor_id = vendor_id;
+    dn->device_id = device_id;
+    dn->afu_fd = snap_sim_event_fd (dn->priv);
+
+    snap_sim_global_read64 (dn->priv, SNAP_CAP, &reg);
+    dn->cap_reg = reg;
+    dn->name = snap_card_id_2_name ((int) (reg & 0xff));
+    dn->numa_node = snap_sim_numa_node (dn->priv);
+    snap_card_sync_init (dn);
+
+    snap_trace ("%s Exit %p OK Card: %s (software)\n", __func__, dn, dn->name);
+    return dn;
+}
+
+static struct snap_action* sw_attach_action (struct snap_card* card,
+        snap_action_type_t action_type,
+        snap_action_flag_t action_flags,
+        int timeout_sec)
 {
-    return df->card_alloc_dev (path, vendor_id, device_id);
+    if ((card == NULL) || (card->priv == NULL)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (0 != snap_sim_attach_action (card->priv, action_type)) {
+        return NULL;
+    }
+
+    card->action_type = action_type;
+    card->attach_timeout_sec = timeout_sec;
+    card->flags = action_flags;
+    card->start_attach = false;
+    __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
+    snap_default_wait_policy (card);
+    return (struct snap_action*)card;
 }
 
-struct snap_action* snap_attach_action (struct snap_card* card,
-                                        snap_action_type_t action_type,
-                                        snap_action_flag_t action_flags,
-                                        int timeout_ms)
+static int sw_mmio_per_pasid_write32 (struct snap_card* card,
+                                      uint64_t offset, uint32_t data)
 {
-    return df->attach_action (card, action_type, action_flags, timeout_ms);
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    reg_trace ("  %s(%p, %llx, %lx)\n", __func__, card,
+               (long long)offset, (long)data);
+    return snap_sim_per_pasid_write32 (card->priv, offset, data);
 }
 
-int snap_detach_action (struct snap_action* action)
+static int sw_mmio_per_pasid_read32 (struct snap_card* card,
+                                     uint64_t offset, uint32_t* data)
 {
     int rc;
 
-    snap_trace ("%s Enter\n", __func__);
-    rc = df->detach_action (action);
-    snap_trace ("%s Exit rc: %d\n", __func__, rc);
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = snap_sim_per_pasid_read32 (card->priv, offset, data);
+    reg_trace ("  %s(%p, %llx, %lx) %d\n", __func__, card,
+               (long long)offset, (long)*data, rc);
+    return rc;
+}
+
+static int sw_mmio_per_pasid_write_block (struct snap_card* card,
+        uint64_t offset, const uint32_t* data, unsigned int words)
+{
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    reg_trace ("  %s(%p, %llx, %d words)\n", __func__, card,
+               (long long)offset, words);
+    return snap_sim_per_pasid_write_block (card->priv, offset, data, words);
+}
+
+static int sw_mmio_per_pasid_read_block (struct snap_card* card,
+        uint64_t offset, uint32_t* data, unsigned int words)
+{
+    int rc;
+
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = snap_sim_per_pasid_read_block (card->priv, offset, data, words);
+    reg_trace ("  %s(%p, %llx, %d words) %d\n", __func__, card,
+               (long long)offset, words, rc);
+    return rc;
+}
+
+static int sw_mmio_global_write64 (struct snap_card* card,
+                                   uint64_t offset, uint64_t data)
+{
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    reg_trace ("  %s(%p, %llx, %llx)\n", __func__, card,
+               (long long)offset, (long long)data);
+    return snap_sim_global_write64 (card->priv, offset, data);
+}
+
+static int sw_mmio_global_read64 (struct snap_card* card,
+                                  uint64_t offset, uint64_t* data)
+{
+    int rc;
+
+    if ((NULL == card) || (NULL == card->priv)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = snap_sim_global_read64 (card->priv, offset, data);
+    reg_trace ("  %s(%p, %llx, %llx) %d\n", __func__, card,
+               (long long)offset, (long long)*data, rc);
+    return rc;
+}
+
+static void sw_snap_card_free (struct snap_card* card)
+{
+    if (!card) {
+        return;
+    }
+
+    snap_sim_card_close (card->priv);
+    snap_card_sync_fini (card);
+    __free (card);
+}
+
+static int sw_irq_alloc (struct snap_card* card, ocxl_irq_h* irq,
+                         uint64_t* handle)
+{
+    return snap_sim_irq_alloc (card->priv, irq, handle);
+}
+
+static int sw_event_check (struct snap_card* card, int timeout_ms,
+                           ocxl_event* events, uint16_t event_count)
+{
+    return snap_sim_event_check (card->priv, timeout_ms, events, event_count);
+}
+
+static struct snap_funcs software_funcs = {
+    .card_alloc_dev = sw_snap_card_alloc_dev,
+    .attach_action = sw_attach_action,       /* attach Action */
+    .detach_action = hw_detach_action,       /* detach Action */
+    .mmio_per_pasid_write32 = sw_mmio_per_pasid_write32,
+    .mmio_per_pasid_read32 = sw_mmio_per_pasid_read32,
+    .mmio_per_pasid_write_block = sw_mmio_per_pasid_write_block,
+    .mmio_per_pasid_read_block = sw_mmio_per_pasid_read_block,
+    .mmio_global_write64 = sw_mmio_global_write64,
+    .mmio_global_read64 = sw_mmio_global_read64,
+    .card_free = sw_snap_card_free,
+    .card_ioctl = hw_card_ioctl,             /* works on cap_reg only */
+    .irq_alloc = sw_irq_alloc,
+    .event_check = sw_event_check,
+};
+
+static struct snap_funcs* df = &hardware_funcs;
+
+struct snap_card* snap_card_alloc_dev (const char* path,
+                                       uint16_t vendor_id,
+                                       uint16_t device_id)
+{
+    return df->card_alloc_dev (path, vendor_id, device_id);
+}
+
+struct snap_action* snap_attach_action (struct snap_card* card,
+                                        snap_action_type_t action_type,
+                                        snap_action_flag_t action_flags,
+                                        int timeout_ms)
+{
+    struct snap_action* action;
+
+    action = df->attach_action (card, action_type, action_flags, timeout_ms);
+
+    if (action && snap_numa_bind_env) {
+        snap_card_bind_thread (card);
+    }
+
+    if (action && (SNAP_ACTION_CMPL_RECORD & action_flags) &&
+        (NULL == card->cmpl)) {
+        /* One line, page aligned and touched, the action must not fault */
+        card->cmpl = snap_malloc (sizeof (*card->cmpl));
+
+        if (NULL == card->cmpl) {
+            df->detach_action (action);
+            return NULL;
+        }
+
+        memset (card->cmpl, 0, sizeof (*card->cmpl));
+    }
+
+    return action;
+}
+
+int snap_detach_action (struct snap_action* action)
+{
+    int rc;
+
+    snap_trace ("%s Enter\n", __func__);
+    rc = df->detach_action (action);
+    snap_trace ("%s Exit rc: %d\n", __func__, rc);
     return rc;
 }
 
@@ -602,7 +1309,22 @@ int snap_action_write32 (struct snap_card* _card,
                          uint64_t offset, uint32_t data)
 {
     int rc;
+    uint64_t t0;
+
+    if (NULL == _card) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    t0 = snap_tr_start ();
     rc = df->mmio_per_pasid_write32 (_card, offset, data);
+    snap_tr_end (SNAP_TR_MMIO_W32, t0, offset, data);
+
+    /* Not written by the job upload, which may run in another thread */
+    if ((offset >= ACTION_PARAMS_IN) && (offset < ACTION_PARAMS_OUT)) {
+        __atomic_store_n (&_card->params_valid, 0, __ATOMIC_RELAXED);
+    }
+
     return rc;
 }
 
@@ -610,17 +1332,64 @@ int snap_action_read32 (struct snap_card* _card,
                         uint64_t offset, uint32_t* data)
 {
     int rc;
+    uint64_t t0 = snap_tr_start ();
+
     rc = df->mmio_per_pasid_read32 (_card, offset, data);
+    snap_tr_end (SNAP_TR_MMIO_R32, t0, offset, rc ? 0 : *data);
+    return rc;
+}
+
+int snap_action_write_block (struct snap_card* _card, uint64_t offset,
+                             const void* data, uint32_t size)
+{
+    int rc;
+    uint64_t t0;
+
+    if ((NULL == _card) || (size % sizeof (uint32_t)) ||
+        (offset % sizeof (uint32_t))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    t0 = snap_tr_start ();
+    rc = df->mmio_per_pasid_write_block (_card, offset, data,
+                                         size / sizeof (uint32_t));
+    snap_tr_end (SNAP_TR_MMIO_WBLK, t0, offset, size);
+
+    /* Not written by the job upload, which may run in another thread */
+    if ((offset < ACTION_PARAMS_OUT) && (offset + size > ACTION_PARAMS_IN)) {
+        __atomic_store_n (&_card->params_valid, 0, __ATOMIC_RELAXED);
+    }
+
     return rc;
 }
 
+int snap_action_read_block (struct snap_card* _card, uint64_t offset,
+                            void* data, uint32_t size)
+{
+    int rc;
+    uint64_t t0;
+
+    if ((size % sizeof (uint32_t)) || (offset % sizeof (uint32_t))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    t0 = snap_tr_start ();
+    rc = df->mmio_per_pasid_read_block (_card, offset, data,
+                                        size / sizeof (uint32_t));
+    snap_tr_end (SNAP_TR_MMIO_RBLK, t0, offset, size);
+    return rc;
+}
 
 int snap_global_write64 (struct snap_card* _card,
                          uint64_t offset, uint64_t data)
 {
     int rc;
+    uint64_t t0 = snap_tr_start ();
 
     rc = df->mmio_global_write64 (_card, offset, data);
+    snap_tr_end (SNAP_TR_GLOBAL_W64, t0, offset, data);
     return rc;
 }
 
@@ -628,17 +1397,145 @@ int snap_global_read64 (struct snap_card* _card,
                         uint64_t offset, uint64_t* data)
 {
     int rc;
+    uint64_t t0 = snap_tr_start ();
 
     rc = df->mmio_global_read64 (_card, offset, data);
+    snap_tr_end (SNAP_TR_GLOBAL_R64, t0, offset, rc ? 0 : *data);
     return rc;
 }
 
 
+static void snap_card_print_stats (struct snap_card* card)
+{
+    static const char* phase_name[SNAP_PHASE_MAX] = {
+        "upload", "start", "wait", "readback", "total"
+    };
+    struct snap_stats* st = &card->stats;
+    struct snap_histogram* h;
+    int i;
+
+    stat_trace ("%s: jobs: %lld errors: %lld timeouts: %lld cancels: %lld "
+                "faults: %lld irq: %lld polls/job avg: %lld max: %lld\n",
+                __func__, (long long)st->jobs, (long long)st->errors,
+                (long long)st->timeouts, (long long)st->cancels,
+                (long long)st->faults,
+                (long long)st->irq_completions,
+                (long long) (st->polls.count ? st->polls.sum / st->polls.count : 0),
+                (long long)st->polls.max);
+
+    for (i = 0; i < SNAP_PHASE_MAX; i++) {
+        h = &st->phase[i];
+        stat_trace ("%s:   %-8s nsec min: %lld p50: %lld p99: %lld "
+                    "p99.9: %lld max: %lld\n", __func__, phase_name[i],
+                    (long long)h->min,
+                    (long long)snap_histogram_percentile (h, 50.0),
+                    (long long)snap_histogram_percentile (h, 99.0),
+                    (long long)snap_histogram_percentile (h, 99.9),
+                    (long long)h->max);
+    }
+}
+
 void snap_card_free (struct snap_card* _card)
 {
+    if (_card && stat_trace_enabled() && _card->stats.jobs) {
+        snap_card_print_stats (_card);
+    }
+
+    if (_card && _card->cmpl) {
+        __free (_card->cmpl);
+        _card->cmpl = NULL;
+    }
+
+    if (_card) {
+        snap_lcl_fini (_card->lcl);
+        _card->lcl = NULL;
+    }
+
     df->card_free (_card);
 }
 
+int snap_card_get_stats (struct snap_card* card, struct snap_stats* stats)
+{
+    if ((NULL == card) || (NULL == stats)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    pthread_mutex_lock (&card->job_lock);
+    *stats = card->stats;
+    pthread_mutex_unlock (&card->job_lock);
+    return SNAP_OK;
+}
+
+int snap_card_reset_stats (struct snap_card* card)
+{
+    if (NULL == card) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    pthread_mutex_lock (&card->job_lock);
+    memset (&card->stats, 0, sizeof (card->stats));
+    pthread_mutex_unlock (&card->job_lock);
+    return SNAP_OK;
+}
+
+unsigned int snap_card_load (struct snap_card* card, uint64_t* latency_ns)
+{
+    unsigned int i, inflight = 0;
+
+    pthread_mutex_lock (&card->job_lock);
+
+    for (i = 0; i < SNAP_JOB_TABLE_SIZE; i++) {
+        if ((SNAP_JOB_QUEUED == card->jobs[i].state) ||
+            (SNAP_JOB_RUNNING == card->jobs[i].state)) {
+            inflight++;
+        }
+    }
+
+    *latency_ns = card->job_ewma_ns;
+    pthread_mutex_unlock (&card->job_lock);
+    return inflight;
+}
+
+int snap_card_emulated (void)
+{
+    return software_action_enabled();
+}
+
+struct snap_lcl** snap_card_lcl (struct snap_card* card)
+{
+    return &card->lcl;
+}
+
+int snap_card_queue_set (struct snap_card* card, unsigned int length)
+{
+    unsigned int i;
+
+    pthread_mutex_lock (&card->job_lock);
+
+    if (length && (card->queue_length || card->job_driving)) {
+        goto __queue_busy;
+    }
+
+    for (i = 0; length && (i < SNAP_JOB_TABLE_SIZE); i++) {
+        if (SNAP_JOB_FREE != card->jobs[i].state) {
+            goto __queue_busy;
+        }
+    }
+
+    card->queue_length = length;
+    /* The ring owns ACTION_PARAMS_IN */
+    __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&card->job_lock);
+    return SNAP_OK;
+
+__queue_busy:
+    pthread_mutex_unlock (&card->job_lock);
+    errno = EBUSY;
+    return SNAP_EBUSY;
+}
+
 int snap_card_ioctl (struct snap_card* _card, unsigned int cmd, unsigned long arg)
 {
     return df->card_ioctl (_card, cmd, arg);
@@ -651,306 +1548,1416 @@ int snap_card_ioctl (struct snap_card* _card, unsigned int cmd, unsigned long ar
  *        in snap_hls_if.h
  ****************************************************************************/
 
+/* Enable the action done IRQ, drop stale IRQs of earlier jobs */
+static void snap_action_arm_irq (struct snap_card* card)
+{
+    snap_tr (SNAP_TR_IRQ_ARM, 0, card->irq_ea, 0);
+    snap_irq_discard (card, card->irq_ea);
+    snap_action_write32 (card, ACTION_IRQ_APP, ACTION_IRQ_APP_DONE);
+    snap_action_write32 (card, ACTION_IRQ_CONTROL, ACTION_IRQ_CONTROL_ON);
+    card->irq_armed = true;
+}
+
 int snap_action_start (struct snap_action* action)
 {
     struct snap_card* card = (struct snap_card*)action;
 
     snap_trace ("%s: START Action 0x%x Flags %x\n", __func__, card->action_type, card->flags);
 
-    /* Enable Ready IRQ if set by application */
-    if (SNAP_ACTION_DONE_IRQ  & card->flags) {
-        snap_action_write32 (card, ACTION_IRQ_APP, ACTION_IRQ_APP_DONE);
-        snap_action_write32 (card, ACTION_IRQ_CONTROL, ACTION_IRQ_CONTROL_ON);
+    /* Enable Ready IRQ if the wait policy goes straight to the IRQ,
+       hybrid policies enable it only when they stop polling */
+    card->irq_armed = false;
+    __atomic_store_n (&card->aborting, false, __ATOMIC_RELAXED);
+
+    if (card->wait_policy.irq && card->irq_ea &&
+        (0 == card->wait_policy.spin_usec) &&
+        (0 == card->wait_policy.backoff_usec)) {
+        snap_action_arm_irq (card);
+    }
+
+    snap_tr (SNAP_TR_ACTION_START, card->seq, 0, 0);
+    return snap_action_write32 (card, ACTION_CONTROL, ACTION_CONTROL_START);
+}
+
+int snap_action_is_idle (struct snap_action* action, int* rc)
+{
+    int _rc = 0;
+    uint32_t action_data = 0;
+    struct snap_card* card = (struct snap_card*)action;
+
+    _rc = snap_action_read32 (card, ACTION_CONTROL, &action_data);
+
+    if (rc) {
+        *rc = _rc;
+    }
+
+    return (action_data & ACTION_CONTROL_IDLE) == ACTION_CONTROL_IDLE;
+}
+
+int snap_action_wait_interrupt(struct snap_action *action, int *rc, int timeout __unused)
+{
+    //uint32_t action_data = 0;
+    struct snap_card *card = (struct snap_card *)action;
+    //int _rc = hw_wait_irq(card, timeout, SNAP_ACTION_IRQ_NUM);
+    int _rc = hw_wait_irq(card, -1 /*, SNAP_ACTION_IRQ_NUM*/);
+
+    if (NULL != rc)
+        *rc = _rc;
+
+    return _rc;
+}
+
+static inline int snap_action_poll_idle (struct snap_card* card, int* rc)
+{
+    uint32_t action_data = 0;
+
+    /* The completion record is in local memory, no MMIO needed. An
+       aborted job does not write it */
+    if (card->cmpl && (SNAP_ACTION_CMPL_RECORD & card->flags) &&
+        !__atomic_load_n (&card->aborting, __ATOMIC_RELAXED)) {
+        *rc = 0;
+        return (SNAP_CMPL_VALID & __atomic_load_n (&card->cmpl->flags,
+                __ATOMIC_ACQUIRE)) && (card->cmpl->seq == card->cmpl_seq);
+    }
+
+    card->polls++;
+    *rc = snap_action_read32 (card, ACTION_CONTROL, &action_data);
+    return (0 == *rc) &&
+           ((action_data & ACTION_CONTROL_IDLE) == ACTION_CONTROL_IDLE);
+}
+
+/* Disable the action done IRQ, clear the status if it fired */
+static void snap_action_disarm_irq (struct snap_card* card, bool fired)
+{
+    uint32_t status = ACTION_IRQ_STATUS_DONE;
+
+    snap_action_write32 (card, ACTION_IRQ_APP, 0);
+    snap_action_write32 (card, ACTION_IRQ_CONTROL, ACTION_IRQ_CONTROL_OFF);
+
+    /* Status is toggle on write, only touch it if it is set */
+    if (!fired) {
+        snap_action_read32 (card, ACTION_IRQ_STATUS, &status);
+    }
+
+    if (status & ACTION_IRQ_STATUS_DONE) {
+        snap_action_write32 (card, ACTION_IRQ_STATUS, ACTION_IRQ_STATUS_DONE);
+    }
+
+    card->irq_armed = false;
+}
+
+/*
+ * Wait until the action is idle, following card->wait_policy:
+ *  1. busy poll ACTION_CONTROL, or the completion record if the action
+ *     writes one, for spin_usec,
+ *  2. poll with exponential backoff (sched_yield, then nanosleep up to
+ *     sleep_max_usec) for backoff_usec,
+ *  3. enable the action done IRQ and sleep in the IRQ wait, or keep
+ *     polling at sleep_max_usec if the policy or action has no IRQ.
+ * All deadlines are CLOCK_MONOTONIC nanoseconds. timeout_ns < 0 waits
+ * forever, 0 checks once. Returns 1 if the action went idle.
+ */
+static int snap_action_wait_policy (struct snap_card* card,
+                                    int64_t timeout_ns, int* rc)
+{
+    const struct snap_wait_policy* p = &card->wait_policy;
+    uint64_t now, end, phase_end;
+    uint64_t sleep_ns = 0;
+    uint64_t sleep_max_ns = (uint64_t)p->sleep_max_usec * 1000;
+    struct timespec ts;
+    int timeout_ms;
+    bool irq;
+
+    /* An aborted job raises no done IRQ, poll for the reset */
+    irq = p->irq && card->irq_ea &&
+          !__atomic_load_n (&card->aborting, __ATOMIC_RELAXED);
+
+    *rc = 0;
+    now = tget_ns();
+    end = (timeout_ns < 0) ? UINT64_MAX : now + (uint64_t)timeout_ns;
+
+    if (sleep_max_ns == 0) {
+        sleep_max_ns = 1000;
+    }
+
+    if (!card->irq_armed || !irq) {
+        /* 1. Spin */
+        phase_end = (SNAP_WAIT_FOREVER == p->spin_usec) ? end :
+                    MIN (end, now + (uint64_t)p->spin_usec * 1000);
+
+        do {
+            if (snap_action_poll_idle (card, rc) || (0 != *rc)) {
+                goto __wait_done_exit;
+            }
+
+            now = tget_ns();
+        } while (now < phase_end);
+
+        /* 2. Backoff, 3. without IRQ: backoff until the deadline */
+        if (!irq) {
+            phase_end = end;
+        } else if (SNAP_WAIT_FOREVER == p->backoff_usec) {
+            phase_end = end;
+        } else {
+            phase_end = MIN (end, now + (uint64_t)p->backoff_usec * 1000);
+        }
+
+        while (now < phase_end) {
+            if (0 == sleep_ns) {
+                sched_yield();
+                sleep_ns = 1000;
+            } else {
+                sleep_ns = MIN (MIN (sleep_ns, phase_end - now), sleep_max_ns);
+                ts.tv_sec = sleep_ns / 1000000000ull;
+                ts.tv_nsec = sleep_ns % 1000000000ull;
+                nanosleep (&ts, NULL);
+                sleep_ns *= 2;
+            }
+
+            if (snap_action_poll_idle (card, rc) || (0 != *rc)) {
+                goto __wait_done_exit;
+            }
+
+            now = tget_ns();
+        }
+
+        if (!irq || (now >= end)) {
+            return 0;
+        }
+
+        /* 3. Arm the IRQ, recheck to close the race with a done
+           which happened before the IRQ got enabled */
+        snap_action_arm_irq (card);
+
+        if (snap_action_poll_idle (card, rc) || (0 != *rc)) {
+            snap_action_disarm_irq (card, false);
+            goto __wait_done_exit;
+        }
+    }
+
+    snap_trace ("Wait for IRQ\n");
+
+    if (UINT64_MAX == end) {
+        timeout_ms = -1;
+    } else {
+        now = tget_ns();
+        timeout_ms = (now >= end) ? 0 : (int) ((end - now + 999999) / 1000000);
+    }
+
+    *rc = hw_wait_irq (card, timeout_ms);
+
+    if (ETIME == *rc) {
+        *rc = 0;
+        return 0;                       /* IRQ stays armed */
+    }
+
+    snap_action_disarm_irq (card, 0 == *rc);
+
+    if (0 != *rc) {
+        return 0;
+    }
+
+    card->irq_done++;
+    snap_action_poll_idle (card, rc);
+
+__wait_done_exit:
+    return 0 == *rc;
+}
+
+static int snap_action_wait_done (struct snap_card* card, int64_t timeout_ns,
+                                  int* rc)
+{
+    uint64_t t0 = snap_tr_start ();
+    int completed;
+
+    completed = snap_action_wait_policy (card, timeout_ns, rc);
+    snap_tr_end (SNAP_TR_ACTION_DONE, t0, completed, *rc);
+    return completed;
+}
+
+int snap_action_completed (struct snap_action* action, int* rc, int timeout)
+{
+    int _rc = 0;
+    int completed;
+    struct snap_card* card = (struct snap_card*)action;
+
+    completed = snap_action_wait_done (card, (int64_t)timeout * 1000000000ll,
+                                       &_rc);
+
+    if (rc) {
+        *rc = _rc;
+    }
+
+    //return is_completed
+    return completed;
+}
+
+int snap_action_set_wait_policy (struct snap_action* action,
+                                 const struct snap_wait_policy* policy)
+{
+    struct snap_card* card = (struct snap_card*)action;
+
+    if ((NULL == card) || (NULL == policy)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    card->wait_policy = *policy;
+    card->wait_policy_set = true;
+    return SNAP_OK;
+}
+
+int snap_action_assign_irq (struct snap_action* action, uint32_t action_irq_ea_reg_addr)
+{
+    struct snap_card* card = (struct snap_card*)action;
+    int rc = -1;
+
+    snap_trace ("%s: Assign IRQ EA on reg 0x%x\n", __func__, action_irq_ea_reg_addr);
+
+    /* The action done IRQ is the first pool entry, keep it on reassign */
+    if (0 == card->irq_ea) {
+        rc = snap_irq_get (card, &card->irq_ea);
+
+        if (0 != rc) {
+            snap_trace ("%s: Failed to allocate IRQ handler.\n", __func__);
+            card->irq_ea = 0;
+            return -1;
+        }
+    }
+
+    snap_trace ("%s: IRQ EA: %lx.\n", __func__, card->irq_ea);
+
+    snap_action_write32 (card, (action_irq_ea_reg_addr + 4), (uint32_t) ((card->irq_ea & 0xFFFFFFFF00000000) >> 32));
+    snap_action_write32 (card, action_irq_ea_reg_addr,  (uint32_t) (card->irq_ea & 0x00000000FFFFFFFF));
+
+    return 0;
+}
+
+int snap_action_alloc_irq (struct snap_action* action, uint64_t* irq_ea)
+{
+    struct snap_card* card = (struct snap_card*)action;
+
+    if ((NULL == card) || (NULL == irq_ea)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    if (0 != snap_irq_get (card, irq_ea)) {
+        snap_trace ("%s: Failed to allocate IRQ handler.\n", __func__);
+        return (ENOSPC == errno) ? SNAP_EBUSY : SNAP_ENODEV;
+    }
+
+    snap_trace ("%s: IRQ EA: %lx.\n", __func__, (long)*irq_ea);
+    return SNAP_OK;
+}
+
+int snap_action_wait_irq (struct snap_action* action, uint64_t irq_ea,
+                          int timeout_ms)
+{
+    struct snap_card* card = (struct snap_card*)action;
+    int rc;
+
+    if (NULL == card) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    rc = snap_irq_wait (card, irq_ea, timeout_ms);
+
+    switch (rc) {
+    case 0:
+        return SNAP_OK;
+
+    case ETIME:
+        errno = ETIME;
+        return SNAP_ETIMEDOUT;
+
+    case EINVAL:
+        errno = EINVAL;
+        return SNAP_EINVAL;
+
+    case EFAULT:
+        errno = EFAULT;
+        return SNAP_EFAULT;
+
+    default:
+        errno = rc;
+        return SNAP_EIO;
+    }
+}
+
+/*
+ * Encode a job into the workitem layout of ACTION_PARAMS_IN. The
+ * sequence number is filled in at upload time.
+ */
+int snap_job_encode (struct snap_card* card, struct snap_job* cjob,
+                     struct snap_queue_workitem* job, unsigned int* mmio_in)
+{
+    unsigned int mmio_out;
+
+    /* Size must be less than addr[6] */
+    if (cjob->wout_size > SNAP_JOBSIZE) {
+        snap_trace ("  %s: err: wout_size too large %d > %d\n", __func__,
+                    cjob->wout_size, SNAP_JOBSIZE);
+        snap_trace ("      win_addr  = %llx size = %d\n",
+                    (long long)cjob->win_addr, cjob->win_size);
+        snap_trace ("      wout_addr = %llx size = %d\n",
+                    (long long)cjob->wout_addr, cjob->wout_size);
+
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset (job, 0, sizeof (*job));
+    job->short_action = card->sat;      /* Set correct Value after attach */
+    job->flags = SNAP_JOBFLAG_EXEC;
+    job->seq = 0x0000; /* Set later */
+    job->retc = 0x00000000;
+    job->priv_data = 0xdeadbeefc0febabeull;
+
+    if (card->cmpl && (SNAP_ACTION_CMPL_RECORD & card->flags)) {
+        job->flags |= SNAP_JOBFLAG_CMPL;
+        job->priv_data = (unsigned long)card->cmpl;
+    }
+
+    /* Fill workqueue cacheline which we need to transfer to the action */
+    if (cjob->win_size <= (6 * 16)) {
+        memcpy (&job->user, (void*) (unsigned long)cjob->win_addr,
+                MIN (cjob->win_size, sizeof (job->user)));
+        mmio_out = cjob->win_size / sizeof (uint32_t);
+    } else {
+        job->user.ext.addr  = cjob->win_addr;
+        job->user.ext.size  = cjob->win_size;
+        job->user.ext.type  = SNAP_ADDRTYPE_HOST_DRAM;
+        job->user.ext.flags = (SNAP_ADDRFLAG_EXT |
+                               SNAP_ADDRFLAG_END);
+        mmio_out = sizeof (job->user.ext) / sizeof (uint32_t);
+    }
+
+    *mmio_in = 16 / sizeof (uint32_t) + mmio_out;
+
+    snap_trace ("    win_size: %d wout_size: %d mmio_in: %d mmio_out: %d\n",
+                cjob->win_size, cjob->wout_size, *mmio_in, mmio_out);
+    return 0;
+}
+
+/*
+ * Write the workitem to ACTION_PARAMS_IN. Only the words which differ
+ * from the shadow of the last upload are written, consecutive changed
+ * words go out as one block. The action only reads these registers, so
+ * the shadow stays valid until something else writes into the range.
+ * Set bit 0x4 in SNAP_CONFIG to always upload the whole workitem.
+ */
+static int snap_action_upload_params (struct snap_card* card,
+                                      struct snap_queue_workitem* job,
+                                      unsigned int mmio_in)
+{
+    const uint32_t* w = (const uint32_t*)job;
+    unsigned int i = 0, n, valid;
+    int rc = 0;
+
+    job->seq = __atomic_fetch_add (&card->seq, 1, __ATOMIC_RELAXED);
+
+    if (job->flags & SNAP_JOBFLAG_CMPL) {
+        card->cmpl_seq = job->seq;
+        __atomic_store_n (&card->cmpl->flags, 0, __ATOMIC_RELEASE);
+    }
+
+    snap_trace ("%s: PASS PARAMETERS to Short Action %d Seq: %x\n",
+                __func__, job->short_action, job->seq);
+
+    /* __hexdump(stderr, job, sizeof(*job)); */
+
+    valid = delta_upload_enabled() ?
+            __atomic_load_n (&card->params_valid, __ATOMIC_RELAXED) : 0;
+
+    while (i < mmio_in) {
+        if ((i < valid) && (w[i] == card->params_shadow[i])) {
+            i++;
+            continue;
+        }
+
+        /* Run of words to write: up to the next unchanged word */
+        for (n = 1; (i + n < mmio_in) &&
+             ((i + n >= valid) || (w[i + n] != card->params_shadow[i + n]));
+             n++)
+            ;
+
+        rc = snap_action_write_block (card, ACTION_PARAMS_IN + i * sizeof (uint32_t),
+                                      &w[i], n * sizeof (uint32_t));
+
+        if (rc != 0) {
+            __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
+            return rc;
+        }
+
+        i += n;
+    }
+
+    /* The block writes above invalidated the shadow, refresh it */
+    memcpy (card->params_shadow, w, mmio_in * sizeof (uint32_t));
+    __atomic_store_n (&card->params_valid,
+                      MAX (mmio_in, MIN (valid, SNAP_PARAMS_WORDS)),
+                      __ATOMIC_RELAXED);
+    return rc;
+}
+
+/**
+ * Synchronous way to send a job away.  First step : set registers
+ * This function writes through MMIO interface the registers
+ * to the action / in the FPGA internal memory
+ *
+ * @action        handle to streaming framework action/action
+ * @cjob        streaming framework job
+ * @return        0 on success.
+ */
+
+int snap_action_sync_execute_job_set_regs (struct snap_action* action,
+        struct snap_job* cjob)
+{
+    int rc;
+    struct snap_card* card = (struct snap_card*)action;
+    struct snap_queue_workitem job;
+    unsigned int mmio_in;
+
+    rc = snap_job_encode (card, cjob, &job, &mmio_in);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Pass action control and job to the action, should be 128
+       bytes or a little less */
+    return snap_action_upload_params (card, &job, mmio_in);
+}
+
+/*
+ * Read RETC and the job results back from ACTION_PARAMS_OUT once the
+ * action went idle. Shared by the sync and async job paths.
+ */
+static int snap_action_get_results (struct snap_card* card,
+                                    struct snap_job* cjob)
+{
+    int rc;
+    struct snap_queue_workitem job;
+    uint32_t* job_data;
+    unsigned int mmio_out;
+
+    /* Same layout as uploaded by snap_action_sync_execute_job_set_regs() */
+    if (cjob->win_size <= (6 * 16)) {
+        mmio_out = cjob->win_size / sizeof (uint32_t);
+    } else {
+        mmio_out = sizeof (struct snap_addr) / sizeof (uint32_t);
+    }
+
+    /* Get job results max 6*16 bytes back to the caller */
+    if (cjob->wout_addr == 0) {
+        /* No out Address, mmio_out is set */
+        job_data = (uint32_t*) (unsigned long)cjob->win_addr;
+    } else {
+        job_data = (uint32_t*) (unsigned long)cjob->wout_addr;
+        mmio_out = cjob->wout_size / sizeof (uint32_t);
+    }
+
+    snap_trace ("%s: RETURN RESULTS %ld bytes (%d)\n", __func__,
+                mmio_out * sizeof (uint32_t), mmio_out);
+
+    /* Nothing to read back, RETC is in the completion record */
+    if ((0 == mmio_out) && card->cmpl &&
+        (SNAP_ACTION_CMPL_RECORD & card->flags)) {
+        cjob->retc = card->cmpl->retc;
+        return 0;
+    }
+
+    /* One block read from 0x180 covers RETC (0x184) and the results
+       starting at 0x190, the block path can then use 64 bit reads */
+    rc = snap_action_read_block (card, ACTION_PARAMS_OUT, &job,
+                                 16 + mmio_out * sizeof (uint32_t));
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    cjob->retc = job.retc;
+    memcpy (job_data, job.user.data, mmio_out * sizeof (uint32_t));
+    return rc;
+}
+
+/**
+ * Synchronous way to send a job away.  Last step : check completion
+ * This function check the completion of the action, manage the IRQ
+ * if needed, and read all action registers through MMIO interface
+ *
+ * @action        handle to streaming framework action/action
+ * @cjob        streaming framework job
+ * timeout_sec  timeout used if polling mode
+ * @return        0 on success.
+ */
+
+int snap_action_sync_execute_job_check_completion (struct snap_action* action,
+        struct snap_job* cjob,
+        unsigned int timeout_sec)
+{
+    int rc;
+    int completed;
+    struct snap_card* card = (struct snap_card*)action;
+
+    completed = snap_action_completed (action, &rc, timeout_sec);
+
+    /* Issue #360 */
+    if (rc != 0) {
+        snap_trace ("%s: EIO rc=%d completed=%d\n", __func__,
+                    rc, completed);
+        rc = SNAP_EIO;
+        goto __snap_action_sync_execute_job_exit;
+    }
+
+    if (completed == 0) {
+        /* Not done */
+        snap_trace ("%s: rc=%d\n", __func__, rc);
+
+        /* Overran: abort or drain it, so the next job finds the
+           action idle */
+        snap_action_stop (action);
+        errno = ETIME;
+        rc = SNAP_ETIMEDOUT;
+        goto __snap_action_sync_execute_job_exit;
+    }
+
+    rc = snap_action_get_results (card, cjob);
+
+__snap_action_sync_execute_job_exit:
+    return rc;
+}
+
+/* Write the registers of a queued job, prepared jobs skip the encoding */
+static int snap_job_upload (struct snap_card* card, struct snap_job_handle* job)
+{
+    struct snap_prepared_job* pjob = job->pjob;
+    struct snap_queue_workitem wi;
+
+    if (NULL == pjob) {
+        return snap_action_sync_execute_job_set_regs ((struct snap_action*)card,
+                job->cjob);
+    }
+
+    /* Inline parameters are picked up again, the caller may have
+       changed them since the job was prepared */
+    wi = pjob->job;
+
+    if (pjob->cjob->win_size <= (6 * 16)) {
+        memcpy (&wi.user, (void*) (unsigned long)pjob->cjob->win_addr,
+                MIN (pjob->cjob->win_size, sizeof (wi.user)));
+    }
+
+    return snap_action_upload_params (card, &wi, pjob->mmio_in);
+}
+
+/* Abort the running job with the action soft reset, if there is one */
+static bool snap_action_reset (struct snap_card* card)
+{
+    if (0 == card->reset_reg) {
+        return false;
+    }
+
+    snap_trace ("%s: reset reg: 0x%x value: 0x%x\n", __func__,
+                card->reset_reg, card->reset_value);
+    __atomic_store_n (&card->aborting, true, __ATOMIC_RELAXED);
+    snap_action_write32 (card, card->reset_reg, card->reset_value);
+    snap_action_write32 (card, card->reset_reg, 0);
+    /* Registers may be cleared */
+    __atomic_store_n (&card->params_valid, 0, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Poll ACTION_CONTROL until idle or the deadline end (tget_ns) */
+static int snap_action_drain (struct snap_card* card, uint64_t end)
+{
+    struct timespec ts = { 0, 10000 };
+    uint32_t action_data;
+
+    for (;;) {
+        action_data = 0;
+
+        if (0 != snap_action_read32 (card, ACTION_CONTROL, &action_data)) {
+            return 0;
+        }
+
+        if (action_data & ACTION_CONTROL_IDLE) {
+            return 1;
+        }
+
+        if (tget_ns() >= end) {
+            return 0;
+        }
+
+        nanosleep (&ts, NULL);
+    }
+}
+
+/*
+ * Translation fault recovery, with SNAP_ACTION_FAULT_RESTART. The ocxl
+ * driver resolves the faults it can, an address it gave up on is
+ * answered to the AFU with an error and reported as
+ * OCXL_EVENT_TRANSLATION_FAULT. There is no way to resume the AFU, so
+ * the library faults in the host memory of the job and starts it again.
+ * The action sees the same job twice, it must not depend on its outputs.
+ */
+#define SNAP_FAULT_PAGES    256             /* Faulted in from the address */
+#define SNAP_FAULT_RETRIES  1               /* Restarts per job */
+#define SNAP_FAULT_TABLES   4096            /* Chained snap_addr tables */
+#define SNAP_FAULT_MLOCK    (64 * 1024)     /* mlock() chunk, RLIMIT_MEMLOCK */
+#define SNAP_DSISR_STORE    0x02000000ull   /* DSISR_ISSTORE */
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22              /* Linux 5.14 */
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define fault_recovery_enabled(card) \
+    (SNAP_ACTION_FAULT_RESTART & (card)->flags)
+
+/*
+ * Fault in the pages of a host range. Unmapped addresses fail instead
+ * of raising SIGSEGV. Kernels without MADV_POPULATE_* get the pages
+ * through mlock(), which makes them present, and writable in a private
+ * mapping, without touching the data. Returns 0 or -1.
+ */
+static int snap_fault_in (uint64_t addr, uint64_t size, bool store)
+{
+    uint64_t page = (uint64_t)sysconf (_SC_PAGESIZE);
+    uint64_t start = addr & ~(page - 1);
+    uint64_t end = (addr + MAX (size, 1ull) + page - 1) & ~(page - 1);
+    uint64_t chunk = MAX (page, (uint64_t)SNAP_FAULT_MLOCK);
+    uint64_t p, len;
+
+    if (0 == madvise ((void*) (unsigned long)start, end - start,
+                      store ? MADV_POPULATE_WRITE : MADV_POPULATE_READ)) {
+        return 0;
+    }
+
+    if (EINVAL != errno) {
+        return -1;
+    }
+
+    for (p = start; p < end; p += len) {
+        len = MIN (chunk, end - p);
+
+        if (0 != mlock ((void*) (unsigned long)p, len)) {
+            return -1;
+        }
+
+        munlock ((void*) (unsigned long)p, len);
+    }
+
+    return 0;
+}
+
+/* Host snap_addr ranges of the job */
+static void snap_fault_in_addrs (struct snap_job_handle* job,
+                                 const struct snap_addr* a, unsigned int n,
+                                 unsigned int* tables)
+{
+    unsigned int i;
+    bool ok;
+
+    for (i = 0; i < n; i++, a++) {
+        if ((SNAP_ADDRTYPE_HOST_DRAM != a->type) || (0 == a->addr) ||
+            (0 == a->size) || (a->flags & ~0x3f) ||
+            !(a->flags & (SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC |
+                          SNAP_ADDRFLAG_DST | SNAP_ADDRFLAG_EXT))) {
+            continue;
+        }
+
+        /* A source is read, anything else may be written */
+        ok = (!(a->flags & SNAP_ADDRFLAG_SRC) &&
+              (0 == snap_fault_in (a->addr, a->size, true))) ||
+             (0 == snap_fault_in (a->addr, a->size, false));
+        snap_tr (SNAP_TR_JOB_FAULT, ok, job->ticket, a->addr);
+        snap_trace ("%s: job %p addr: %llx size: %x flags: %x faulted in: %d\n",
+                    __func__, job, (long long)a->addr, a->size, a->flags, ok);
+
+        /* A chained table, see struct snap_sgl, readable now if mapped */
+        if (ok && (a->flags & SNAP_ADDRFLAG_EXT) && (*tables < SNAP_FAULT_TABLES) &&
+            !(a->addr & (SNAP_MEMBUS_WIDTH - 1))) {
+            (*tables)++;
+            snap_fault_in_addrs (job, (const struct snap_addr*) (unsigned long)a->addr,
+                                 SNAP_SGL_TABLE_ENTRIES, tables);
+        }
+    }
+}
+
+/* Translation faults were reported since the job was (re)started */
+static inline bool snap_job_faulted (struct snap_card* card,
+                                     struct snap_job_handle* job)
+{
+    return fault_recovery_enabled (card) &&
+           (__atomic_load_n (&card->irq_faults, __ATOMIC_RELAXED) !=
+            job->irq_faults);
+}
+
+/*
+ * Restart the running job if it hit translation faults which can be
+ * resolved. Faults are counted in irq_faults by whoever reads the
+ * events: the IRQ wait, which then ends with EFAULT, or another thread.
+ * Polling does not read the events, they are read when the job failed
+ * or the wait ended without completion. The restart faults in every host range of the job, read from
+ * its parameters in snap_addr steps as the HLS actions lay them out,
+ * and the reported addresses, so a job runs at most twice. Returns true
+ * if the job runs again, else job->rc is set to SNAP_EFAULT for a
+ * fault. Called by the driver with job_lock held, which it drops while
+ * a hung action is reset.
+ */
+static bool snap_job_fault_restart (struct snap_card* card,
+                                    struct snap_job_handle* job,
+                                    int completed, int rc)
+{
+    ocxl_event_translation_fault log[SNAP_FAULT_LOG];
+    uint64_t page = (uint64_t)sysconf (_SC_PAGESIZE);
+    uint64_t faults, n, i;
+    uint64_t addr;
+    unsigned int tables = 0;
+    bool store;
+    bool ok = true;
+    int idle;
+
+    if (job->cancelled || (NULL == job->cjob)) {
+        return false;
+    }
+
+    if (completed && (0 == rc) && (0 == job->rc) &&
+        (SNAP_RETC_SUCCESS != job->cjob->retc)) {
+        snap_irq_drain (card);
+    }
+
+    pthread_mutex_lock (&card->irq_lock);
+    faults = card->irq_faults;
+    memcpy (log, card->fault_log, sizeof (log));
+    pthread_mutex_unlock (&card->irq_lock);
+
+    if (faults == job->irq_faults) {
+        return false;
+    }
+
+    job->rc = SNAP_EFAULT;
+
+    if (!fault_recovery_enabled (card) || (job->faults >= SNAP_FAULT_RETRIES)) {
+        return false;
+    }
+
+    /* The AFU got an error response, it may end with an error or hang */
+    if (!completed) {
+        snap_action_reset (card);
+        pthread_mutex_unlock (&card->job_lock);
+        idle = snap_action_drain (card, tget_ns() +
+                                  SNAP_STOP_TIMEOUT_MS * 1000000ull);
+
+        if (idle) {
+            snap_irq_drain (card);      /* Its done IRQ, if any */
+        }
+
+        pthread_mutex_lock (&card->job_lock);
+
+        if (!idle) {
+            snap_trace ("%s: job %p action not idle\n", __func__, job);
+            return false;
+        }
+
+        if (job->cancelled || (NULL == job->cjob)) {
+            return false;               /* Gone while the lock was free */
+        }
+    }
+
+    snap_fault_in_addrs (job, (const struct snap_addr*) (unsigned long)
+                         job->cjob->win_addr,
+                         job->cjob->win_size / sizeof (struct snap_addr),
+                         &tables);
+
+    /* All faults of this run, as far as the log goes back. An address
+       outside the ranges gets a window, or its page if that fails. */
+    n = MIN (faults - job->irq_faults, (uint64_t)SNAP_FAULT_LOG);
+
+    for (i = faults - n; ok && (i < faults); i++) {
+        addr = (uint64_t)log[i % SNAP_FAULT_LOG].addr;
+        store = log[i % SNAP_FAULT_LOG].dsisr & SNAP_DSISR_STORE;
+        ok = (0 == snap_fault_in (addr, SNAP_FAULT_PAGES * page, store)) ||
+             (0 == snap_fault_in (addr, 1, store));
+        snap_tr (SNAP_TR_JOB_FAULT, ok, job->ticket, addr);
+        snap_trace ("%s: job %p addr: %llx dsisr: %llx faulted in: %d\n",
+                    __func__, job, (long long)addr,
+                    (long long)log[i % SNAP_FAULT_LOG].dsisr, ok);
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    job->faults++;
+    job->irq_faults = faults;
+
+    if ((0 != snap_job_upload (card, job)) ||
+        (0 != snap_action_start ((struct snap_action*)card))) {
+        job->rc = SNAP_EIO;
+        return false;
+    }
+
+    card->stats.faults++;
+    job->rc = 0;
+    return true;
+}
+
+/*
+ * Drive the job table: collect the results of the running job once the
+ * action is idle and start the oldest queued job. The action executes
+ * one job at a time, queued jobs are started in submission order.
+ * Called with job_lock held by the thread owning the action.
+ */
+static void snap_job_progress (struct snap_card* card, int64_t timeout_ns)
+{
+    struct snap_job_handle* job = card->job_running;
+    struct snap_stats* st = &card->stats;
+    uint64_t t0, t1;
+    unsigned int i;
+    int completed;
+    int rc;
+
+    if (job) {
+        pthread_mutex_unlock (&card->job_lock);
+        completed = snap_action_wait_done (card, timeout_ns, &rc);
+
+        /* Polling reads no events, an AFU hung after a fault has
+           nothing else to report */
+        if (!completed && (0 == rc) && fault_recovery_enabled (card)) {
+            snap_irq_drain (card);
+        }
+
+        pthread_mutex_lock (&card->job_lock);
+
+        if (!completed && (0 == rc) && !snap_job_faulted (card, job)) {
+            return;                     /* still running */
+        }
+
+        t0 = tget_ns();
+        t1 = t0;
+
+        if (job->cjob && !job->cancelled) {
+            job->rc = (!completed || (0 != rc)) ? SNAP_EIO :
+                      snap_action_get_results (card, job->cjob);
+            t1 = tget_ns();
+
+            if (snap_job_fault_restart (card, job, completed, rc)) {
+                return;                 /* running again */
+            }
+        }
+
+        card->job_running = NULL;
+        snap_tr (SNAP_TR_JOB_DONE, rc, job->ticket, 0);
+        snap_histogram_add (&st->phase[SNAP_PHASE_WAIT], t0 - job->t_start);
+
+        /* Moving average over the last ~8 jobs, for snap_card_load() */
+        if (card->job_ewma_ns) {
+            card->job_ewma_ns = (card->job_ewma_ns * 7 + (t0 - job->t_start)) / 8;
+        } else {
+            card->job_ewma_ns = t0 - job->t_start;
+        }
+
+        snap_histogram_add (&st->polls, card->polls - job->polls);
+
+        if (card->irq_done != job->irq_done) {
+            st->irq_completions++;
+        }
+
+        if (NULL == job->cjob) {
+            snap_trace ("%s: job %p done, owner gone\n", __func__, job);
+            job->state = SNAP_JOB_FREE;
+        } else if (job->cancelled) {
+            snap_trace ("%s: job %p done, cancelled\n", __func__, job);
+            job->rc = SNAP_ECANCELED;
+            job->state = SNAP_JOB_DONE;
+        } else {
+            job->state = SNAP_JOB_DONE;
+            snap_histogram_add (&st->phase[SNAP_PHASE_READBACK], t1 - t0);
+            snap_histogram_add (&st->phase[SNAP_PHASE_TOTAL], t1 - job->t_queue);
+            snap_trace ("%s: job %p done rc: %d retc: %x\n", __func__, job,
+                        job->rc, job->cjob->retc);
+        }
+
+        st->jobs++;
+
+        if (job->cancelled) {
+            st->cancels++;
+        } else if (0 != job->rc) {
+            st->errors++;
+        }
+    }
+
+    while (NULL == card->job_running) {
+        job = NULL;
+
+        for (i = 0; i < SNAP_JOB_TABLE_SIZE; i++) {
+            if ((SNAP_JOB_QUEUED == card->jobs[i].state) &&
+                ((NULL == job) || (card->jobs[i].ticket < job->ticket))) {
+                job = &card->jobs[i];
+            }
+        }
+
+        if (NULL == job) {
+            return;
+        }
+
+        t0 = tget_ns();
+        rc = snap_job_upload (card, job);
+        t1 = tget_ns();
+
+        if (0 == rc) {
+            job->polls = card->polls;
+            job->irq_done = card->irq_done;
+            job->irq_faults = __atomic_load_n (&card->irq_faults,
+                                               __ATOMIC_RELAXED);
+            job->faults = 0;
+            rc = snap_action_start ((struct snap_action*)card);
+            job->t_start = tget_ns();
+            snap_histogram_add (&st->phase[SNAP_PHASE_UPLOAD], t1 - t0);
+            snap_histogram_add (&st->phase[SNAP_PHASE_START],
+                                job->t_start - t1);
+        }
+
+        if (0 != rc) {
+            job->rc = SNAP_EIO;
+            job->state = SNAP_JOB_DONE;
+            st->jobs++;
+            st->errors++;
+            continue;
+        }
+
+        job->state = SNAP_JOB_RUNNING;
+        card->job_running = job;
+        snap_tr (SNAP_TR_JOB_START, 0, job->ticket, 0);
+        snap_trace ("%s: job %p started\n", __func__, job);
+    }
+}
+
+/*
+ * Wait until the job is done or the deadline end (tget_ns) passed, with
+ * job_lock held. Takes over the action if no other thread drives it,
+ * else sleeps until the driver made progress. A deadline in the past
+ * checks once without blocking.
+ */
+static void snap_job_wait_locked (struct snap_card* card,
+                                  struct snap_job_handle* job, uint64_t end)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    for (;;) {
+        if (SNAP_JOB_DONE == job->state) {
+            return;
+        }
+
+        now = tget_ns();
+
+        if (!card->job_driving) {
+            card->job_driving = true;
+            snap_job_progress (card, (now >= end) ? 0 : (int64_t) (end - now));
+            card->job_driving = false;
+            pthread_cond_broadcast (&card->job_cond);
+
+            if ((SNAP_JOB_DONE == job->state) || (tget_ns() >= end)) {
+                return;
+            }
+
+            continue;
+        }
+
+        if (now >= end) {
+            return;
+        }
+
+        ts.tv_sec = end / 1000000000ull;
+        ts.tv_nsec = end % 1000000000ull;
+        pthread_cond_timedwait (&card->job_cond, &card->job_lock, &ts);
+    }
+}
+
+/* Queue a job, waits up to end for a free slot. Called with job_lock held */
+static struct snap_job_handle* snap_job_queue (struct snap_card* card,
+        struct snap_job* cjob, struct snap_prepared_job* pjob, uint64_t end)
+{
+    struct snap_job_handle* job;
+    struct timespec ts;
+    unsigned int i;
+
+    if (card->queue_length) {
+        snap_trace ("%s: action runs a submission ring\n", __func__);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    for (;;) {
+        for (i = 0; i < SNAP_JOB_TABLE_SIZE; i++) {
+            job = &card->jobs[i];
+
+            if (SNAP_JOB_FREE == job->state) {
+                job->card = card;
+                job->cjob = cjob;
+                job->pjob = pjob;
+                job->reported = false;
+                job->cancelled = false;
+                job->rc = 0;
+                job->ticket = card->job_ticket++;
+                job->t_queue = tget_ns();
+                job->state = SNAP_JOB_QUEUED;
+                snap_tr (SNAP_TR_JOB_QUEUE, 0, job->ticket, 0);
+                return job;
+            }
+        }
+
+        if (tget_ns() >= end) {
+            snap_trace ("%s: job table full\n", __func__);
+            errno = EBUSY;
+            return NULL;
+        }
+
+        ts.tv_sec = end / 1000000000ull;
+        ts.tv_nsec = end % 1000000000ull;
+        pthread_cond_timedwait (&card->job_cond, &card->job_lock, &ts);
+    }
+}
+
+struct snap_job_handle* snap_action_submit_job (struct snap_action* action,
+        struct snap_job* cjob)
+{
+    struct snap_card* card = (struct snap_card*)action;
+    struct snap_job_handle* job = NULL;
+
+    if ((NULL == card) || (NULL == cjob) || (cjob->wout_size > SNAP_JOBSIZE)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock (&card->job_lock);
+    job = snap_job_queue (card, cjob, NULL, 0);
+
+    /* Start it right away if the action is free and nobody drives it */
+    if (job && !card->job_driving) {
+        snap_job_wait_locked (card, job, 0);
     }
 
-    return snap_action_write32 (card, ACTION_CONTROL, ACTION_CONTROL_START);
+    pthread_mutex_unlock (&card->job_lock);
+    return job;
 }
 
-int snap_action_stop (struct snap_action* action __unused)
+int snap_job_poll (struct snap_job_handle* job)
 {
-    /* FIXME Missing */
-    return 0;
-}
+    struct snap_card* card;
+    int rc;
 
-int snap_action_is_idle (struct snap_action* action, int* rc)
-{
-    int _rc = 0;
-    uint32_t action_data = 0;
-    struct snap_card* card = (struct snap_card*)action;
+    if ((NULL == job) || (SNAP_JOB_FREE == job->state)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
 
-    _rc = snap_action_read32 (card, ACTION_CONTROL, &action_data);
+    card = job->card;
+    pthread_mutex_lock (&card->job_lock);
 
-    if (rc) {
-        *rc = _rc;
+    if (!card->job_driving) {
+        snap_job_wait_locked (card, job, 0);
     }
 
-    return (action_data & ACTION_CONTROL_IDLE) == ACTION_CONTROL_IDLE;
+    rc = (SNAP_JOB_DONE == job->state) ? job->rc : SNAP_EBUSY;
+    pthread_mutex_unlock (&card->job_lock);
+    return rc;
 }
 
-int snap_action_wait_interrupt(struct snap_action *action, int *rc, int timeout)
+int snap_job_wait (struct snap_job_handle* job, unsigned int timeout_sec)
 {
-    //uint32_t action_data = 0;
-    struct snap_card *card = (struct snap_card *)action;
-    //int _rc = hw_wait_irq(card, timeout, SNAP_ACTION_IRQ_NUM);
-    int _rc = hw_wait_irq(card, timeout /*, SNAP_ACTION_IRQ_NUM*/);
+    struct snap_card* card;
+    int rc;
 
-    if (NULL != rc)
-        *rc = _rc;
+    if ((NULL == job) || (SNAP_JOB_FREE == job->state)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
 
-    return _rc;
+    card = job->card;
+    pthread_mutex_lock (&card->job_lock);
+    snap_job_wait_locked (card, job, tget_ns() +
+                          (uint64_t)timeout_sec * 1000000000ull);
+
+    if (SNAP_JOB_DONE == job->state) {
+        rc = job->rc;
+        job->state = SNAP_JOB_FREE;
+        pthread_cond_broadcast (&card->job_cond);  /* Slot is free */
+    } else {
+        card->stats.timeouts++;
+        errno = ETIME;
+        rc = SNAP_ETIMEDOUT;
+    }
+
+    pthread_mutex_unlock (&card->job_lock);
+    return rc;
 }
 
-int snap_action_completed (struct snap_action* action, int* rc, int timeout)
+int snap_action_stop (struct snap_action* action)
 {
-    int _rc = 0;
-    uint32_t action_data = 0;
     struct snap_card* card = (struct snap_card*)action;
-    unsigned long t0;
-    int dt, timeout_ms;
-
-    if (SNAP_ACTION_DONE_IRQ & card->flags) {
-        snap_trace ("Wait for IRQ\n");
-        hw_wait_irq (card, timeout);
-        snap_action_write32 (card, ACTION_IRQ_STATUS, ACTION_IRQ_STATUS_DONE);
-        snap_action_write32 (card, ACTION_IRQ_APP, 0);
-        snap_action_write32 (card, ACTION_IRQ_CONTROL, ACTION_IRQ_CONTROL_OFF);
-        _rc = snap_action_read32 (card, ACTION_CONTROL, &action_data);
-    } else {
-        snap_trace ("Poll until timeout\n");
-        /* Busy poll timout sec */
-        t0 = tget_ms();
-        dt = 0;
-        timeout_ms = timeout * 1000;
+    struct snap_job_handle* job;
+    struct timespec ts;
+    uint64_t t0, end;
+    bool reset, own;
+    int idle;
 
-        while (dt < timeout_ms) {
-            _rc = snap_action_read32 (card, ACTION_CONTROL, &action_data);
+    if (NULL == card) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
 
-            if ((action_data & ACTION_CONTROL_IDLE) == ACTION_CONTROL_IDLE) {
-                break;
-            }
+    t0 = snap_tr_start ();
+    end = tget_ns() + SNAP_STOP_TIMEOUT_MS * 1000000ull;
+    pthread_mutex_lock (&card->job_lock);
 
-            dt = (int) (tget_ms() - t0);
-        }
+    if (card->queue_length) {
+        pthread_mutex_unlock (&card->job_lock);
+        snap_trace ("%s: action runs a submission ring\n", __func__);
+        errno = EBUSY;
+        return SNAP_EBUSY;
     }
 
-    if (rc) {
-        *rc = _rc;
+    job = card->job_running;
+
+    if (job && !job->cancelled) {
+        job->cancelled = true;
+        snap_tr (SNAP_TR_JOB_CANCEL, job->state, job->ticket, 0);
     }
 
-    //return is_completed
-    return (action_data & ACTION_CONTROL_IDLE) == ACTION_CONTROL_IDLE;
-}
+    reset = snap_action_reset (card);
 
-int snap_action_assign_irq (struct snap_action* action, uint32_t action_irq_ea_reg_addr)
-{
-    struct snap_card* card = (struct snap_card*)action;
-    int rc = -1;
+    /* The job table owns the action, its driver collects the job */
+    while (job && (card->job_running == job) && (tget_ns() < end)) {
+        if (!card->job_driving) {
+            card->job_driving = true;
+            snap_job_progress (card, (int64_t) (end - tget_ns()));
+            card->job_driving = false;
+            pthread_cond_broadcast (&card->job_cond);
+            continue;
+        }
 
-    snap_trace ("%s: Assign IRQ EA on reg 0x%x\n", __func__, action_irq_ea_reg_addr);
+        ts.tv_sec = end / 1000000000ull;
+        ts.tv_nsec = end % 1000000000ull;
+        pthread_cond_timedwait (&card->job_cond, &card->job_lock, &ts);
+    }
 
-    // TODO: need to discuss if this is the best way to handle IRQ
-    rc = ocxl_irq_alloc(card->afu_h, NULL, &(card->afu_irq));
+    if (job) {
+        idle = (card->job_running != job);
+    } else {
+        /* A job of the split calls: poll without job_lock, owning the
+           action so the table does not start a job meanwhile */
+        own = !card->job_driving;
+        card->job_driving = true;
+        pthread_mutex_unlock (&card->job_lock);
+        idle = snap_action_drain (card, end);
+        pthread_mutex_lock (&card->job_lock);
+
+        if (own) {
+            card->job_driving = false;
+            pthread_cond_broadcast (&card->job_cond);
+        }
+    }
 
-    if (OCXL_OK != rc) {
-        snap_trace ("%s: Failed to allocate IRQ handler.\n", __func__);
-        return -1;
+    /* Drop the done IRQ state of the stopped job, unless a driver
+       waits for the next one already */
+    if (idle && !card->job_driving && (NULL == card->job_running) &&
+        card->irq_ea) {
+        snap_action_disarm_irq (card, false);
+        snap_irq_discard (card, card->irq_ea);
     }
 
-    // TODO: Need to write EA to AFU's register.
-    card->irq_ea = ocxl_irq_get_handle(card->afu_h, card->afu_irq);
-    snap_trace ("%s: IRQ EA: %lx.\n", __func__, card->irq_ea);
+    pthread_mutex_unlock (&card->job_lock);
+    snap_tr_end (SNAP_TR_ACTION_STOP, t0, idle, reset);
+    snap_trace ("%s: idle: %d reset: %d\n", __func__, idle, reset);
 
-    snap_action_write32 (card, (action_irq_ea_reg_addr + 4), (uint32_t) ((card->irq_ea & 0xFFFFFFFF00000000) >> 32));
-    snap_action_write32 (card, action_irq_ea_reg_addr,  (uint32_t) (card->irq_ea & 0x00000000FFFFFFFF));
+    if (!idle) {
+        errno = ETIME;
+        return SNAP_ETIMEDOUT;
+    }
 
-    return 0;
+    return SNAP_OK;
 }
 
-/**
- * Synchronous way to send a job away.  First step : set registers
- * This function writes through MMIO interface the registers
- * to the action / in the FPGA internal memory
- *
- * @action        handle to streaming framework action/action
- * @cjob        streaming framework job
- * @return        0 on success.
- */
-
-int snap_action_sync_execute_job_set_regs (struct snap_action* action,
-        struct snap_job* cjob)
+int snap_action_set_reset_reg (struct snap_action* action, uint32_t offset,
+                               uint32_t value)
 {
-    int rc = 0;
-    unsigned int i;
     struct snap_card* card = (struct snap_card*)action;
-    struct snap_queue_workitem job;
-    uint32_t action_addr;
-    uint32_t* job_data;
-    unsigned int mmio_in, mmio_out;
-
-    /* Size must be less than addr[6] */
-    if (cjob->wout_size > SNAP_JOBSIZE) {
-        snap_trace ("  %s: err: wout_size too large %d > %d\n", __func__,
-                    cjob->wout_size, SNAP_JOBSIZE);
-        snap_trace ("      win_addr  = %llx size = %d\n",
-                    (long long)cjob->win_addr, cjob->win_size);
-        snap_trace ("      wout_addr = %llx size = %d\n",
-                    (long long)cjob->wout_addr, cjob->wout_size);
 
+    if ((NULL == card) || (offset & 0x3) ||
+        ((ACTION_PARAMS_IN <= offset) &&
+         (offset < ACTION_PARAMS_OUT + 0x80)) ||
+        (offset && (0 == value))) {
         errno = EINVAL;
-        return -1;
+        return SNAP_EINVAL;
     }
 
-    /* job.short_action = 0x00; */        /* Set later */
-    job.flags = 0x01; /* FIXME Set Flag to Execute */
-    job.seq = 0x0000; /* Set later */
-    job.retc = 0x00000000;
-    job.priv_data = 0xdeadbeefc0febabeull;
-
-    /* Fill workqueue cacheline which we need to transfer to the action */
-    if (cjob->win_size <= (6 * 16)) {
-        memcpy (&job.user, (void*) (unsigned long)cjob->win_addr,
-                MIN (cjob->win_size, sizeof (job.user)));
-        mmio_out = cjob->win_size / sizeof (uint32_t);
-    } else {
-        job.user.ext.addr  = cjob->win_addr;
-        job.user.ext.size  = cjob->win_size;
-        job.user.ext.type  = SNAP_ADDRTYPE_HOST_DRAM;
-        job.user.ext.flags = (SNAP_ADDRFLAG_EXT |
-                              SNAP_ADDRFLAG_END);
-        mmio_out = sizeof (job.user.ext) / sizeof (uint32_t);
-    }
+    card->reset_reg = offset;
+    card->reset_value = value;
+    return SNAP_OK;
+}
 
-    mmio_in = 16 / sizeof (uint32_t) + mmio_out;
+int snap_job_cancel (struct snap_job_handle* job)
+{
+    struct snap_card* card;
+    int rc = SNAP_OK;
 
-    snap_trace ("    win_size: %d wout_size: %d mmio_in: %d mmio_out: %d\n",
-                cjob->win_size, cjob->wout_size, mmio_in, mmio_out);
+    if ((NULL == job) || (SNAP_JOB_FREE == job->state)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
 
-    job.short_action = card->sat;/* Set correct Value after attach */
-    job.seq = card->seq++; /* Set correct Value after attach */
+    card = job->card;
+    pthread_mutex_lock (&card->job_lock);
+
+    switch (job->state) {
+    case SNAP_JOB_QUEUED:
+        snap_tr (SNAP_TR_JOB_CANCEL, job->state, job->ticket, 0);
+        job->cancelled = true;
+        job->rc = SNAP_ECANCELED;
+        job->state = SNAP_JOB_DONE;
+        card->stats.cancels++;
+        pthread_cond_broadcast (&card->job_cond);
+        break;
 
-    snap_trace ("%s: PASS PARAMETERS to Short Action %d Seq: %x\n",
-                __func__, job.short_action, job.seq);
+    case SNAP_JOB_RUNNING:
+        if (!job->cancelled) {
+            snap_tr (SNAP_TR_JOB_CANCEL, job->state, job->ticket, 0);
+            job->cancelled = true;
+            snap_action_reset (card);
+        }
 
-    /* __hexdump(stderr, &job, sizeof(job)); */
+        /* Collect it if the reset made the action idle already */
+        if (!card->job_driving) {
+            snap_job_wait_locked (card, job, 0);
+        }
 
-    /* Pass action control and job to the action, should be 128
-       bytes or a little less */
-    job_data = (uint32_t*) (unsigned long)&job;
+        if (SNAP_JOB_DONE != job->state) {
+            errno = EINPROGRESS;
+            rc = SNAP_EBUSY;
+        }
 
-    for (i = 0, action_addr = ACTION_PARAMS_IN; i < mmio_in;
-         i++, action_addr += sizeof (uint32_t)) {
-        rc = snap_action_write32 (card, action_addr, job_data[i]);
+        break;
 
-        if (rc != 0) {
-            goto __snap_action_sync_execute_job_exit;
-        }
+    default:
+        errno = EALREADY;
+        rc = SNAP_ENOENT;
+        break;
     }
 
-__snap_action_sync_execute_job_exit:
-    snap_action_stop (action);
+    pthread_mutex_unlock (&card->job_lock);
     return rc;
 }
 
-/**
- * Synchronous way to send a job away.  Last step : check completion
- * This function check the completion of the action, manage the IRQ
- * if needed, and read all action registers through MMIO interface
- *
- * @action        handle to streaming framework action/action
- * @cjob        streaming framework job
- * timeout_sec  timeout used if polling mode
- * @return        0 on success.
- */
-
-int snap_action_sync_execute_job_check_completion (struct snap_action* action,
-        struct snap_job* cjob,
-        unsigned int timeout_sec)
+int snap_card_get_event_fd (struct snap_card* card)
 {
-    int rc;
-    unsigned int i;
-    int completed;
-    struct snap_card* card = (struct snap_card*)action;
-    struct snap_queue_workitem job;
-    uint32_t action_addr;
-    uint32_t* job_data;
-    unsigned int mmio_out;
+    if (NULL == card) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
 
-    completed = snap_action_completed (action, &rc, timeout_sec);
+    return card->afu_fd;
+}
 
-    /* Issue #360 */
-    if (rc != 0) {
-        snap_trace ("%s: EIO rc=%d completed=%d\n", __func__,
-                    rc, completed);
-        rc = SNAP_EIO;
-        goto __snap_action_sync_execute_job_exit;
+int snap_card_process_events (struct snap_card* card,
+                              struct snap_job_handle** done,
+                              unsigned int max)
+{
+    struct snap_job_handle* job;
+    unsigned int i, n = 0;
+
+    if ((NULL == card) || ((NULL == done) && max)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
     }
 
-    if (completed == 0) {
-        /* Not done */
-        snap_trace ("%s: rc=%d\n", __func__, rc);
+    snap_irq_drain (card);
 
-        if (rc == 0) {
-            errno = ETIME;
-            rc = SNAP_ETIMEDOUT;
-        }
+    /* Collect the running job and start the next one, without waiting */
+    pthread_mutex_lock (&card->job_lock);
 
-        goto __snap_action_sync_execute_job_exit;
+    if (!card->job_driving) {
+        card->job_driving = true;
+        snap_job_progress (card, 0);
+        card->job_driving = false;
+        pthread_cond_broadcast (&card->job_cond);
     }
 
-    /* job.short_action = 0x00; */        /* Set later */
-    job.flags = 0x01; /* FIXME Set Flag to Execute */
-    job.seq = 0x0000; /* Set later */
-    job.retc = 0x00000000;
-    job.priv_data = 0xdeadbeefc0febabeull;
+    for (i = 0; (i < SNAP_JOB_TABLE_SIZE) && (n < max); i++) {
+        job = &card->jobs[i];
 
-    /* Fill workqueue cacheline which we need to transfer to the action */
-    if (cjob->win_size <= (6 * 16)) {
-        memcpy (&job.user, (void*) (unsigned long)cjob->win_addr,
-                MIN (cjob->win_size, sizeof (job.user)));
-        mmio_out = cjob->win_size / sizeof (uint32_t);
-    } else {
-        job.user.ext.addr  = cjob->win_addr;
-        job.user.ext.size  = cjob->win_size;
-        job.user.ext.type  = SNAP_ADDRTYPE_HOST_DRAM;
-        job.user.ext.flags = (SNAP_ADDRFLAG_EXT |
-                              SNAP_ADDRFLAG_END);
-        mmio_out = sizeof (job.user.ext) / sizeof (uint32_t);
+        if ((SNAP_JOB_DONE == job->state) && !job->reported) {
+            job->reported = true;
+            done[n++] = job;
+        }
     }
 
-    /* Get RETC (0x184) back to the caller */
-    rc = snap_action_read32 (card, ACTION_RETC_OUT, &cjob->retc);
+    pthread_mutex_unlock (&card->job_lock);
+    return n;
+}
 
-    if (rc != 0) {
-        goto __snap_action_sync_execute_job_exit;
-    }
+/*
+ * Run a job through the job table and wait for it, so calls from several
+ * threads are executed one after the other instead of racing on the action
+ */
+static int snap_job_execute (struct snap_card* card, struct snap_job* cjob,
+                             struct snap_prepared_job* pjob,
+                             unsigned int timeout_sec)
+{
+    struct snap_job_handle* job;
+    uint64_t end = tget_ns() + (uint64_t)timeout_sec * 1000000000ull;
+    int rc;
 
-    snap_trace ("%s: RETURN RESULTS %ld bytes (%d)\n", __func__,
-                mmio_out * sizeof (uint32_t), mmio_out);
+    pthread_mutex_lock (&card->job_lock);
+    job = snap_job_queue (card, cjob, pjob, end);
 
-    /* Get job results max 6*16 bytes back to the caller */
-    if (cjob->wout_addr == 0) {
-        /* No out Address, mmio_out is set */
-        job_data = (uint32_t*) (unsigned long)cjob->win_addr;
-    } else {
-        job_data = (uint32_t*) (unsigned long)cjob->wout_addr;
-        mmio_out = cjob->wout_size / sizeof (uint32_t);
+    if ((NULL == job) && card->queue_length) {
+        pthread_mutex_unlock (&card->job_lock);
+        return SNAP_EBUSY;
+    }
+
+    if (NULL == job) {
+        card->stats.timeouts++;
+        pthread_mutex_unlock (&card->job_lock);
+        errno = ETIME;
+        return SNAP_ETIMEDOUT;
     }
 
-    /* No need to read back 0x190, 0x194, 0x198 and 0x19c .... */
-    for (i = 0, action_addr = ACTION_PARAMS_OUT + 0x10; i < mmio_out;
-         i++, action_addr += sizeof (uint32_t)) {
-        rc = snap_action_read32 (card, action_addr, &job_data[i]);
+    job->reported = true;               /* Not for snap_card_process_events() */
 
-        if (rc != 0) {
-            goto __snap_action_sync_execute_job_exit;
+    snap_job_wait_locked (card, job, end);
+
+    if (SNAP_JOB_DONE == job->state) {
+        rc = job->rc;
+        job->state = SNAP_JOB_FREE;
+    } else {
+        /* Timeout: drop a queued job, abort a running one if the action
+           has a reset register. The driver frees it once the action is
+           done, cjob is not touched again */
+        snap_trace ("%s: timeout job %p state: %d\n", __func__, job,
+                    job->state);
+
+        if (SNAP_JOB_QUEUED == job->state) {
+            job->state = SNAP_JOB_FREE;
+        } else if (!job->cancelled) {
+            snap_tr (SNAP_TR_JOB_CANCEL, job->state, job->ticket, 0);
+            job->cancelled = true;
+            snap_action_reset (card);
         }
 
-        snap_trace ("  %s: %d Addr: %x Data: %x\n", __func__, i,
-                    action_addr, job_data[i]);
+        job->cjob = NULL;
+        card->stats.timeouts++;
+        errno = ETIME;
+        rc = SNAP_ETIMEDOUT;
     }
 
-__snap_action_sync_execute_job_exit:
-    snap_action_stop (action);
+    pthread_cond_broadcast (&card->job_cond);
+    pthread_mutex_unlock (&card->job_lock);
     return rc;
 }
 
@@ -972,43 +2979,98 @@ int snap_action_sync_execute_job (struct snap_action* action,
                                   struct snap_job* cjob,
                                   unsigned int timeout_sec)
 {
-    int rc;
+    struct snap_card* card = (struct snap_card*)action;
 
-    /* Set action registers through MMIO */
-    rc = snap_action_sync_execute_job_set_regs (action, cjob);
+    if ((NULL == card) || (NULL == cjob) || (cjob->wout_size > SNAP_JOBSIZE)) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    if (rc != 0) {
-        return rc;
+    return snap_job_execute (card, cjob, NULL, timeout_sec);
+}
+
+struct snap_prepared_job* snap_action_prepare_job (struct snap_action* action,
+        struct snap_job* cjob)
+{
+    struct snap_card* card = (struct snap_card*)action;
+    struct snap_prepared_job* pjob;
+
+    if ((NULL == card) || (NULL == cjob)) {
+        errno = EINVAL;
+        return NULL;
     }
 
-    /* Start Action */
-    snap_action_start (action);
+    pjob = calloc (1, sizeof (*pjob));
 
-    /* Wait for finish */
-    rc = snap_action_sync_execute_job_check_completion (action, cjob,
-            timeout_sec);
-    return rc;
+    if (NULL == pjob) {
+        return NULL;
+    }
+
+    if (0 != snap_job_encode (card, cjob, &pjob->job, &pjob->mmio_in)) {
+        free (pjob);
+        return NULL;
+    }
+
+    pjob->card = card;
+    pjob->cjob = cjob;
+    return pjob;
+}
+
+int snap_prepared_job_execute (struct snap_prepared_job* pjob,
+                               unsigned int timeout_sec)
+{
+    if (NULL == pjob) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return snap_job_execute (pjob->card, pjob->cjob, pjob, timeout_sec);
 }
 
+void snap_prepared_job_free (struct snap_prepared_job* pjob)
+{
+    free (pjob);
+}
 
 uint32_t snap_action_get_pasid(struct snap_card *card)
 {
+    if (NULL == card->afu_h) {
+        return 0;               /* software emulated card */
+    }
+
     return ocxl_afu_get_pasid(card->afu_h);
 }
 
-/* Software version of the lowlevel functions */
-/* Abandoned */
-//static struct snap_funcs software_funcs = {
-//        .card_alloc_dev = NULL,
-//        .attach_action = NULL, /* attach Action */
-//        .detach_action = NULL, /* detach Action */
-//        .mmio_per_pasid_write32 = NULL,
-//        .mmio_per_pasid_read32 = NULL,
-//        .mmio_global_write64 = NULL,
-//        .mmio_global_read64 = NULL,
-//        .card_free = NULL,
-//        .card_ioctl = NULL,
-//};
+int snap_card_get_numa_node (struct snap_card* card)
+{
+    if (NULL == card) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return card->numa_node;
+}
+
+int snap_card_bind_thread (struct snap_card* card)
+{
+    if (NULL == card) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    if (card->numa_node < 0) {
+        errno = ENODEV;
+        return SNAP_ENODEV;
+    }
+
+    if (0 != snap_numa_bind_thread (card->numa_node)) {
+        snap_trace ("%s: node %d errno: %d\n", __func__, card->numa_node,
+                    errno);
+        return SNAP_EINVAL;
+    }
+
+    return SNAP_OK;
+}
 
 /**********************************************************************
  * LIBRARY INITIALIZATION
@@ -1016,13 +3078,90 @@ uint32_t snap_action_get_pasid(struct snap_card *card)
 
 static void _init (void) __attribute__ ((constructor));
 
+/* Parse "spin=<usec>,backoff=<usec>,sleep=<usec>,irq", "forever" is allowed
+   for spin and backoff */
+static void snap_parse_wait_policy (const char* str,
+                                    struct snap_wait_policy* policy)
+{
+    char buf[128];
+    char* tok;
+    char* save = NULL;
+    char* val;
+    uint32_t usec;
+
+    memset (policy, 0, sizeof (*policy));
+    strncpy (buf, str, sizeof (buf) - 1);
+    buf[sizeof (buf) - 1] = '\0';
+
+    for (tok = strtok_r (buf, ",", &save); tok != NULL;
+         tok = strtok_r (NULL, ",", &save)) {
+        val = strchr (tok, '=');
+
+        if (val) {
+            *val++ = '\0';
+            usec = (strcasecmp (val, "forever") == 0) ? SNAP_WAIT_FOREVER :
+                   (uint32_t)strtoul (val, (char**)NULL, 0);
+        } else {
+            usec = 0;
+        }
+
+        if (strcmp (tok, "spin") == 0) {
+            policy->spin_usec = usec;
+        } else if (strcmp (tok, "backoff") == 0) {
+            policy->backoff_usec = usec;
+        } else if (strcmp (tok, "sleep") == 0) {
+            policy->sleep_max_usec = usec;
+        } else if (strcmp (tok, "irq") == 0) {
+            policy->irq = 1;
+        }
+    }
+}
+
 static void _init (void)
 {
     const char* trace_env;
+    const char* config_env;
+    const char* policy_env;
+    const char* numa_env;
 
     trace_env = getenv ("SNAP_TRACE");
 
     if (trace_env != NULL) {
         snap_trace = strtol (trace_env, (char**)NULL, 0);
     }
+
+    /* SNAP_TRACE_RING: binary trace ring, see osnap_trace.c */
+    snap_tr_init ();
+
+    /* SNAP_WAIT_POLICY: e.g. "spin=20,backoff=1000,sleep=100,irq" */
+    policy_env = getenv ("SNAP_WAIT_POLICY");
+
+    if (policy_env != NULL) {
+        snap_parse_wait_policy (policy_env, &snap_env_wait_policy);
+        snap_env_wait_policy_set = true;
+    }
+
+    numa_env = getenv ("SNAP_NUMA_BIND");
+
+    if (numa_env != NULL) {
+        snap_numa_bind_env = (0 != strtol (numa_env, (char**)NULL, 0));
+    }
+
+    /* SNAP_CONFIG: FPGA (default), CPU or a numeric bitmask */
+    config_env = getenv ("SNAP_CONFIG");
+
+    if (config_env != NULL) {
+        if (strcasecmp (config_env, "CPU") == 0) {
+            snap_config = 0x01;
+        } else if (strcasecmp (config_env, "FPGA") == 0) {
+            snap_config = 0x00;
+        } else {
+            snap_config = strtol (config_env, (char**)NULL, 0);
+        }
+    }
+
+    if (software_action_enabled()) {
+        snap_trace ("%s: software card emulation\n", __func__);
+        df = &software_funcs;
+    }
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * DMA buffer pool
+ *
+ * Buffers handed to an action are translated by the OpenCAPI path on
+ * first touch of each page. A pool reserves its memory in arenas which
+ * are mapped with hugepages if possible, pre-faulted and optionally
+ * locked, and cuts them into fixed size slabs. Slabs are recycled via
+ * a free list, so jobs in steady state neither allocate nor fault.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+#include <osnap_hls_if.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT          26
+#endif
+#define SNAP_MAP_HUGE_2MB       (21 << MAP_HUGE_SHIFT)
+#define SNAP_MAP_HUGE_1GB       (30 << MAP_HUGE_SHIFT)
+
+#define SNAP_HUGEPAGE_2MB       (2ull * 1024 * 1024)
+#define SNAP_HUGEPAGE_1GB       (1024ull * 1024 * 1024)
+
+struct snap_buffer_arena {
+    struct snap_buffer_arena* next;
+    void* base;
+    size_t size;                    /* Mapped size */
+    bool locked;
+};
+
+struct snap_buffer_slab {
+    struct snap_buffer_slab* next;  /* Only valid while on the free list */
+};
+
+struct snap_buffer_pool {
+    pthread_mutex_t lock;
+    size_t slab_size;               /* Multiple of SNAP_MEMBUS_WIDTH */
+    unsigned int slabs_per_arena;
+    unsigned int flags;
+    int node;                       /* NUMA node of the arenas, -1: any */
+    struct snap_buffer_arena* arenas;
+    struct snap_buffer_slab* free_list;
+    unsigned int arena_count;
+    unsigned int slab_count;        /* Slabs in all arenas */
+    unsigned int slab_free;         /* Slabs on the free list */
+};
+
+/* Map one arena, hugepages first, then normal pages */
+static void* snap_arena_map (size_t* size, unsigned int flags)
+{
+    size_t hsize;
+    void* addr;
+
+    if (flags & SNAP_BUFFER_HUGEPAGE_1G) {
+        hsize = SNAP_ROUND_UP (*size, SNAP_HUGEPAGE_1GB);
+        addr = mmap (NULL, hsize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                     SNAP_MAP_HUGE_1GB, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            *size = hsize;
+            mem_trace ("  %s: %zu bytes on 1 GiB pages\n", __func__, hsize);
+            return addr;
+        }
+    }
+
+    if (flags & (SNAP_BUFFER_HUGEPAGE | SNAP_BUFFER_HUGEPAGE_1G)) {
+        hsize = SNAP_ROUND_UP (*size, SNAP_HUGEPAGE_2MB);
+        addr = mmap (NULL, hsize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                     SNAP_MAP_HUGE_2MB, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            *size = hsize;
+            mem_trace ("  %s: %zu bytes on 2 MiB pages\n", __func__, hsize);
+            return addr;
+        }
+
+        /* No hugetlbfs pages reserved, ask for transparent hugepages.
+           Over-map and trim, THP needs a 2 MiB aligned range */
+        addr = mmap (NULL, hsize + SNAP_HUGEPAGE_2MB, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            uint8_t* start = (uint8_t*)SNAP_ROUND_UP ((uintptr_t)addr,
+                             SNAP_HUGEPAGE_2MB);
+            uint8_t* end = start + hsize;
+
+            if (start != (uint8_t*)addr) {
+                munmap (addr, start - (uint8_t*)addr);
+            }
+
+            munmap (end, (uint8_t*)addr + hsize + SNAP_HUGEPAGE_2MB - end);
+            madvise (start, hsize, MADV_HUGEPAGE);
+            *size = hsize;
+            mem_trace ("  %s: %zu bytes, THP advised\n", __func__, hsize);
+            return start;
+        }
+    }
+
+    *size = SNAP_ROUND_UP (*size, (size_t)sysconf (_SC_PAGESIZE));
+    addr = mmap (NULL, *size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    mem_trace ("  %s: %zu bytes on base pages\n", __func__, *size);
+    return addr;
+}
+
+/* Add an arena and put its slabs on the free list, called with lock held */
+static int snap_buffer_pool_grow (struct snap_buffer_pool* pool)
+{
+    struct snap_buffer_arena* arena;
+    struct snap_buffer_slab* slab;
+    size_t size = pool->slab_size * pool->slabs_per_arena;
+    size_t page_size = (size_t)sysconf (_SC_PAGESIZE);
+    unsigned int i, slabs;
+    uint8_t* p;
+
+    arena = calloc (1, sizeof (*arena));
+
+    if (NULL == arena) {
+        return -1;
+    }
+
+    arena->base = snap_arena_map (&size, pool->flags);
+
+    if (NULL == arena->base) {
+        free (arena);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    arena->size = size;
+    snap_numa_bind_mem (arena->base, size, pool->node);
+
+    /* Pre-fault: touch every page so the first job finds it present */
+    for (p = arena->base; p < (uint8_t*)arena->base + size; p += page_size) {
+        *(volatile uint8_t*)p = 0;
+    }
+
+    if (pool->flags & SNAP_BUFFER_MLOCK) {
+        if (0 == mlock (arena->base, size)) {
+            arena->locked = true;
+        } else {
+            mem_trace ("  %s: mlock failed errno: %d\n", __func__, errno);
+        }
+    }
+
+    /* Hugepage rounding may leave room for more slabs */
+    slabs = size / pool->slab_size;
+
+    for (i = slabs; i > 0; i--) {
+        slab = (struct snap_buffer_slab*) ((uint8_t*)arena->base +
+                                           (i - 1) * pool->slab_size);
+        slab->next = pool->free_list;
+        pool->free_list = slab;
+    }
+
+    arena->next = pool->arenas;
+    pool->arenas = arena;
+    pool->arena_count++;
+    pool->slab_count += slabs;
+    pool->slab_free += slabs;
+
+    mem_trace ("%s: pool %p arena %p %zu bytes %u slabs\n", __func__,
+               pool, arena->base, size, slabs);
+    return 0;
+}
+
+struct snap_buffer_pool* snap_buffer_pool_create (size_t slab_size,
+        unsigned int slabs_per_arena, unsigned int flags)
+{
+    return snap_buffer_pool_create_on_node (slab_size, slabs_per_arena,
+                                            flags, -1);
+}
+
+struct snap_buffer_pool* snap_buffer_pool_create_on_node (size_t slab_size,
+        unsigned int slabs_per_arena, unsigned int flags, int node)
+{
+    struct snap_buffer_pool* pool;
+
+    if ((0 == slab_size) || (0 == slabs_per_arena)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pool = calloc (1, sizeof (*pool));
+
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    pthread_mutex_init (&pool->lock, NULL);
+    pool->slab_size = SNAP_ROUND_UP (slab_size, SNAP_MEMBUS_WIDTH);
+    pool->slabs_per_arena = slabs_per_arena;
+    pool->flags = flags;
+    pool->node = node;
+
+    if (0 != snap_buffer_pool_grow (pool)) {
+        pthread_mutex_destroy (&pool->lock);
+        free (pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void* snap_buffer_pool_get (struct snap_buffer_pool* pool)
+{
+    struct snap_buffer_slab* slab = NULL;
+
+    if (NULL == pool) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+
+    if ((NULL == pool->free_list) && !(pool->flags & SNAP_BUFFER_FIXED)) {
+        snap_buffer_pool_grow (pool);
+    }
+
+    if (pool->free_list) {
+        slab = pool->free_list;
+        pool->free_list = slab->next;
+        pool->slab_free--;
+    } else {
+        errno = ENOMEM;
+    }
+
+    pthread_mutex_unlock (&pool->lock);
+    return slab;
+}
+
+void snap_buffer_pool_put (struct snap_buffer_pool* pool, void* buf)
+{
+    struct snap_buffer_slab* slab = buf;
+
+    if ((NULL == pool) || (NULL == buf)) {
+        return;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+    slab->next = pool->free_list;
+    pool->free_list = slab;
+    pool->slab_free++;
+    pthread_mutex_unlock (&pool->lock);
+}
+
+size_t snap_buffer_pool_slab_size (struct snap_buffer_pool* pool)
+{
+    return pool ? pool->slab_size : 0;
+}
+
+void snap_buffer_pool_destroy (struct snap_buffer_pool* pool)
+{
+    struct snap_buffer_arena* arena;
+
+    if (NULL == pool) {
+        return;
+    }
+
+    mem_trace ("%s: pool %p %u arenas %u/%u slabs free\n", __func__, pool,
+               pool->arena_count, pool->slab_free, pool->slab_count);
+
+    while (pool->arenas) {
+        arena = pool->arenas;
+        pool->arenas = arena->next;
+
+        if (arena->locked) {
+            munlock (arena->base, arena->size);
+        }
+
+        munmap (arena->base, arena->size);
+        free (arena);
+    }
+
+    pthread_mutex_destroy (&pool->lock);
+    free (pool);
+}
@@ -0,0 +1,439 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Card memory allocator
+ *
+ * One buddy allocator per LCL_MEM port. The managed range of a port is
+ * cut into blocks of at least SNAP_LCL_MIN_BLOCK bytes and GET_DMA_ALIGN
+ * alignment; the block size doubles for large ports so the tables stay
+ * below SNAP_LCL_MAX_BLOCKS entries. Allocations are a power of two of
+ * blocks, aligned to their size, and free buddies are merged again.
+ * Only the bookkeeping is in host memory, card memory is never touched.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+#include <osnap_hls_if.h>
+
+#define SNAP_LCL_PORTS          2               /* LCL_MEM0, LCL_MEM1 */
+#define SNAP_LCL_MIN_BLOCK      4096
+#define SNAP_LCL_MAX_ORDER      16
+#define SNAP_LCL_MAX_BLOCKS     (1u << SNAP_LCL_MAX_ORDER)
+
+#define LCL_TAG_FREE            0x80            /* Head of a free block */
+#define LCL_TAG_NONE            0xff            /* Inside a block */
+#define LCL_NIL                 UINT32_MAX
+
+struct snap_lcl_port {
+    uint64_t base;                  /* Managed range */
+    uint64_t size;
+    uint64_t start;                 /* First block, base aligned up */
+    bool range_set;                 /* By snap_lcl_set_range() */
+    bool ready;                     /* Tables built */
+    unsigned int shift;             /* log2 of the block size */
+    uint32_t blocks;
+    uint64_t used;                  /* Allocated bytes */
+    uint8_t* tag;                   /* Per block: order, LCL_TAG_* */
+    uint32_t* next;                 /* Free lists, per block */
+    uint32_t* prev;
+    uint32_t free_head[SNAP_LCL_MAX_ORDER + 1];
+};
+
+struct snap_lcl {
+    pthread_mutex_t lock;
+    struct snap_lcl_port port[SNAP_LCL_PORTS];
+};
+
+static void lcl_push (struct snap_lcl_port* p, uint32_t i, unsigned int order)
+{
+    p->tag[i] = order | LCL_TAG_FREE;
+    p->prev[i] = LCL_NIL;
+    p->next[i] = p->free_head[order];
+
+    if (LCL_NIL != p->next[i]) {
+        p->prev[p->next[i]] = i;
+    }
+
+    p->free_head[order] = i;
+}
+
+static void lcl_unlink (struct snap_lcl_port* p, uint32_t i, unsigned int order)
+{
+    if (LCL_NIL != p->prev[i]) {
+        p->next[p->prev[i]] = p->next[i];
+    } else {
+        p->free_head[order] = p->next[i];
+    }
+
+    if (LCL_NIL != p->next[i]) {
+        p->prev[p->next[i]] = p->prev[i];
+    }
+}
+
+static void lcl_port_fini (struct snap_lcl_port* p)
+{
+    free (p->tag);
+    free (p->next);
+    free (p->prev);
+    p->tag = NULL;
+    p->next = NULL;
+    p->prev = NULL;
+    p->ready = false;
+}
+
+/* Build the tables of a port, with its default range if none was set */
+static int lcl_port_init (struct snap_card* card, struct snap_lcl_port* p,
+                          unsigned int port)
+{
+    unsigned long sdram_mb = 0;
+    unsigned long align = 0;
+    uint64_t block, end;
+    unsigned int k;
+    uint32_t i;
+
+    if (!p->range_set) {
+        /* The card memory is shared evenly by the ports */
+        snap_card_ioctl (card, GET_SDRAM_SIZE, (unsigned long)&sdram_mb);
+        p->size = ((uint64_t)sdram_mb << 20) / SNAP_LCL_PORTS;
+        p->base = 0;
+    }
+
+    if (0 != snap_card_ioctl (card, GET_DMA_ALIGN, (unsigned long)&align)) {
+        align = 0;
+    }
+
+    for (p->shift = 0; (1ull << p->shift) < MAX (align, (unsigned long)SNAP_LCL_MIN_BLOCK);
+         p->shift++)
+        ;
+
+    while ((p->size >> p->shift) > SNAP_LCL_MAX_BLOCKS) {
+        p->shift++;
+    }
+
+    block = 1ull << p->shift;
+    p->start = SNAP_ROUND_UP (p->base, block);
+    end = p->base + p->size;
+    p->blocks = (end > p->start) ? (uint32_t) ((end - p->start) >> p->shift) : 0;
+
+    if (0 == p->blocks) {
+        mem_trace ("%s: LCL_MEM%u has no memory\n", __func__, port);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    p->tag = malloc (p->blocks);
+    p->next = malloc (p->blocks * sizeof (p->next[0]));
+    p->prev = malloc (p->blocks * sizeof (p->prev[0]));
+
+    if ((NULL == p->tag) || (NULL == p->next) || (NULL == p->prev)) {
+        lcl_port_fini (p);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset (p->tag, LCL_TAG_NONE, p->blocks);
+
+    for (k = 0; k <= SNAP_LCL_MAX_ORDER; k++) {
+        p->free_head[k] = LCL_NIL;
+    }
+
+    /* Largest naturally aligned blocks first, the tail may be uneven */
+    for (i = 0; i < p->blocks; i += 1u << k) {
+        for (k = SNAP_LCL_MAX_ORDER; k > 0; k--) {
+            if (!(i & ((1u << k) - 1)) && (i + (1u << k) <= p->blocks)) {
+                break;
+            }
+        }
+
+        lcl_push (p, i, k);
+    }
+
+    p->used = 0;
+    p->ready = true;
+    mem_trace ("%s: LCL_MEM%u base: %llx blocks: %u of %llu bytes\n", __func__,
+               port, (long long)p->start, p->blocks, (long long)block);
+    return 0;
+}
+
+/* Allocator of the card, created on first use */
+static struct snap_lcl* lcl_get (struct snap_card* card)
+{
+    struct snap_lcl** lp = snap_card_lcl (card);
+    struct snap_lcl* lcl = __atomic_load_n (lp, __ATOMIC_ACQUIRE);
+    struct snap_lcl* expected = NULL;
+
+    if (lcl) {
+        return lcl;
+    }
+
+    lcl = calloc (1, sizeof (*lcl));
+
+    if (NULL == lcl) {
+        return NULL;
+    }
+
+    pthread_mutex_init (&lcl->lock, NULL);
+
+    if (!__atomic_compare_exchange_n (lp, &expected, lcl, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy (&lcl->lock);
+        free (lcl);
+        lcl = expected;
+    }
+
+    return lcl;
+}
+
+static int lcl_port_index (snap_addrtype_t type, unsigned int* port)
+{
+    if ((type < SNAP_ADDRTYPE_LCL_MEM0) ||
+        (type >= SNAP_ADDRTYPE_LCL_MEM0 + SNAP_LCL_PORTS)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *port = type - SNAP_ADDRTYPE_LCL_MEM0;
+    return 0;
+}
+
+int snap_lcl_alloc (struct snap_card* card, snap_addrtype_t type,
+                    uint64_t size, uint64_t* addr)
+{
+    struct snap_lcl* lcl;
+    struct snap_lcl_port* p;
+    unsigned int port, order, k;
+    uint64_t blocks;
+    uint32_t i;
+    int rc = SNAP_OK;
+
+    if ((NULL == card) || (NULL == addr) || (0 == size) ||
+        (0 != lcl_port_index (type, &port))) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    lcl = lcl_get (card);
+
+    if (NULL == lcl) {
+        return SNAP_ENOMEM;
+    }
+
+    p = &lcl->port[port];
+    pthread_mutex_lock (&lcl->lock);
+
+    if (!p->ready && (0 != lcl_port_init (card, p, port))) {
+        rc = SNAP_ENOMEM;
+        goto __lcl_alloc_exit;
+    }
+
+    blocks = (size + (1ull << p->shift) - 1) >> p->shift;
+
+    for (order = 0; (order <= SNAP_LCL_MAX_ORDER) && ((1ull << order) < blocks);
+         order++)
+        ;
+
+    for (k = order; (k <= SNAP_LCL_MAX_ORDER) && (LCL_NIL == p->free_head[k]); k++)
+        ;
+
+    if (k > SNAP_LCL_MAX_ORDER) {
+        mem_trace ("%s: LCL_MEM%u no block for %llu bytes, used: %llu\n",
+                   __func__, port, (long long)size, (long long)p->used);
+        errno = ENOMEM;
+        rc = SNAP_ENOMEM;
+        goto __lcl_alloc_exit;
+    }
+
+    i = p->free_head[k];
+    lcl_unlink (p, i, k);
+
+    /* Split, the upper halves go back to the free lists */
+    while (k > order) {
+        k--;
+        lcl_push (p, i + (1u << k), k);
+    }
+
+    p->tag[i] = order;
+    p->used += 1ull << (order + p->shift);
+    *addr = p->start + ((uint64_t)i << p->shift);
+    mem_trace ("%s: LCL_MEM%u %llx size: %llu (%llu)\n", __func__, port,
+               (long long)*addr, (long long)size,
+               (long long) (1ull << (order + p->shift)));
+
+__lcl_alloc_exit:
+    pthread_mutex_unlock (&lcl->lock);
+    return rc;
+}
+
+int snap_lcl_free (struct snap_card* card, snap_addrtype_t type, uint64_t addr)
+{
+    struct snap_lcl* lcl;
+    struct snap_lcl_port* p;
+    unsigned int port, order;
+    uint32_t i, b;
+    int rc = SNAP_OK;
+
+    if ((NULL == card) || (0 != lcl_port_index (type, &port))) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    lcl = __atomic_load_n (snap_card_lcl (card), __ATOMIC_ACQUIRE);
+
+    if (NULL == lcl) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    p = &lcl->port[port];
+    pthread_mutex_lock (&lcl->lock);
+
+    if (!p->ready || (addr < p->start) ||
+        (addr & ((1ull << p->shift) - 1)) ||
+        (((addr - p->start) >> p->shift) >= p->blocks) ||
+        (p->tag[(addr - p->start) >> p->shift] & LCL_TAG_FREE)) {
+        mem_trace ("%s: LCL_MEM%u %llx not allocated\n", __func__, port,
+                   (long long)addr);
+        errno = EINVAL;
+        rc = SNAP_EINVAL;
+        goto __lcl_free_exit;
+    }
+
+    i = (uint32_t) ((addr - p->start) >> p->shift);
+    order = p->tag[i];
+    p->used -= 1ull << (order + p->shift);
+
+    /* Merge with the buddy as long as it is free and whole */
+    while (order < SNAP_LCL_MAX_ORDER) {
+        b = i ^ (1u << order);
+
+        if ((b >= p->blocks) || (p->tag[b] != (order | LCL_TAG_FREE))) {
+            break;
+        }
+
+        lcl_unlink (p, b, order);
+        p->tag[MAX (i, b)] = LCL_TAG_NONE;
+        i = MIN (i, b);
+        order++;
+    }
+
+    lcl_push (p, i, order);
+    mem_trace ("%s: LCL_MEM%u %llx used: %llu\n", __func__, port,
+               (long long)addr, (long long)p->used);
+
+__lcl_free_exit:
+    pthread_mutex_unlock (&lcl->lock);
+    return rc;
+}
+
+int snap_lcl_set_range (struct snap_card* card, snap_addrtype_t type,
+                        uint64_t base, uint64_t size)
+{
+    struct snap_lcl* lcl;
+    struct snap_lcl_port* p;
+    unsigned int port;
+    int rc = SNAP_OK;
+
+    if ((NULL == card) || (0 != lcl_port_index (type, &port))) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    lcl = lcl_get (card);
+
+    if (NULL == lcl) {
+        return SNAP_ENOMEM;
+    }
+
+    p = &lcl->port[port];
+    pthread_mutex_lock (&lcl->lock);
+
+    if (p->used) {
+        errno = EBUSY;
+        rc = SNAP_EBUSY;
+    } else {
+        lcl_port_fini (p);
+        p->base = base;
+        p->size = size;
+        p->range_set = true;
+    }
+
+    pthread_mutex_unlock (&lcl->lock);
+    return rc;
+}
+
+int snap_lcl_usage (struct snap_card* card, snap_addrtype_t type,
+                    uint64_t* size, uint64_t* used)
+{
+    struct snap_lcl* lcl;
+    struct snap_lcl_port* p;
+    unsigned int port;
+    int rc = SNAP_OK;
+
+    if ((NULL == card) || (0 != lcl_port_index (type, &port))) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    lcl = lcl_get (card);
+
+    if (NULL == lcl) {
+        return SNAP_ENOMEM;
+    }
+
+    p = &lcl->port[port];
+    pthread_mutex_lock (&lcl->lock);
+
+    if (!p->ready && (0 != lcl_port_init (card, p, port))) {
+        rc = SNAP_ENOMEM;
+    } else {
+        if (size) {
+            *size = (uint64_t)p->blocks << p->shift;
+        }
+
+        if (used) {
+            *used = p->used;
+        }
+    }
+
+    pthread_mutex_unlock (&lcl->lock);
+    return rc;
+}
+
+void snap_lcl_fini (struct snap_lcl* lcl)
+{
+    unsigned int port;
+
+    if (NULL == lcl) {
+        return;
+    }
+
+    for (port = 0; port < SNAP_LCL_PORTS; port++) {
+        lcl_port_fini (&lcl->port[port]);
+    }
+
+    pthread_mutex_destroy (&lcl->lock);
+    free (lcl);
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * NUMA placement
+ *
+ * The node of a card is the numa_node of the PCI function behind the
+ * AFU in sysfs. Memory is placed with mbind(MPOL_PREFERRED) before it
+ * is first touched, threads are restricted to the CPUs of the node
+ * within their current affinity. Plain syscalls and sysfs, no libnuma.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+
+#define SNAP_NUMA_MAX_NODES     1024
+#define SNAP_NUMA_MPOL_PREFERRED 1              /* <linux/mempolicy.h> */
+#define SNAP_NUMA_NODE_DIR      "/sys/devices/system/node"
+
+int snap_numa_sysfs_node (const char* sysfs_path)
+{
+    char path[512];
+    FILE* f;
+    int node = -1;
+
+    if ((NULL == sysfs_path) || ('\0' == sysfs_path[0])) {
+        return -1;
+    }
+
+    snprintf (path, sizeof (path), "%s/device/numa_node", sysfs_path);
+    f = fopen (path, "r");
+
+    if (NULL == f) {
+        mem_trace ("%s: no %s\n", __func__, path);
+        return -1;
+    }
+
+    if (1 != fscanf (f, "%d", &node)) {
+        node = -1;
+    }
+
+    fclose (f);
+    mem_trace ("%s: %s node: %d\n", __func__, sysfs_path, node);
+    return (node < SNAP_NUMA_MAX_NODES) ? node : -1;
+}
+
+int snap_numa_bind_mem (void* addr, size_t size, int node)
+{
+    unsigned long mask[SNAP_NUMA_MAX_NODES / (8 * sizeof (unsigned long))];
+    const unsigned int bits = 8 * sizeof (unsigned long);
+
+    if ((node < 0) || (node >= SNAP_NUMA_MAX_NODES)) {
+        return 0;
+    }
+
+    memset (mask, 0, sizeof (mask));
+    mask[node / bits] = 1ul << (node % bits);
+
+    if (0 != syscall (SYS_mbind, addr, size, SNAP_NUMA_MPOL_PREFERRED,
+                      mask, SNAP_NUMA_MAX_NODES + 1, 0)) {
+        mem_trace ("%s: %p %zu bytes node: %d errno: %d\n", __func__,
+                   addr, size, node, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Add the CPUs of a sysfs cpulist, e.g. "0-3,8,10-11", to set */
+static int snap_numa_parse_cpulist (const char* list, cpu_set_t* set,
+                                    size_t size, int ncpus)
+{
+    const char* p = list;
+    char* end;
+    long lo, hi, cpu;
+
+    while (*p && ('\n' != *p)) {
+        lo = strtol (p, &end, 10);
+
+        if (end == p) {
+            return -1;
+        }
+
+        hi = lo;
+        p = end;
+
+        if ('-' == *p) {
+            hi = strtol (p + 1, &end, 10);
+            p = end;
+        }
+
+        for (cpu = lo; (cpu <= hi) && (cpu < ncpus); cpu++) {
+            CPU_SET_S (cpu, size, set);
+        }
+
+        if (',' == *p) {
+            p++;
+        }
+    }
+
+    return 0;
+}
+
+int snap_numa_bind_thread (int node)
+{
+    char path[128], list[4096];
+    cpu_set_t* allowed;
+    cpu_set_t* local;
+    int ncpus = CPU_SETSIZE;
+    size_t size;
+    FILE* f;
+    int rc = -1;
+
+    if (node < 0) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    snprintf (path, sizeof (path), SNAP_NUMA_NODE_DIR "/node%d/cpulist", node);
+    f = fopen (path, "r");
+
+    if (NULL == f) {
+        return -1;
+    }
+
+    if (NULL == fgets (list, sizeof (list), f)) {
+        fclose (f);
+        errno = EIO;
+        return -1;
+    }
+
+    fclose (f);
+
+    allowed = CPU_ALLOC (ncpus);
+    local = CPU_ALLOC (ncpus);
+    size = CPU_ALLOC_SIZE (ncpus);
+
+    if ((NULL == allowed) || (NULL == local)) {
+        errno = ENOMEM;
+        goto __bind_exit;
+    }
+
+    CPU_ZERO_S (size, local);
+
+    if ((0 != snap_numa_parse_cpulist (list, local, size, ncpus)) ||
+        (0 != sched_getaffinity (0, size, allowed))) {
+        errno = EIO;
+        goto __bind_exit;
+    }
+
+    /* Stay within the affinity set by taskset, cgroups or the caller */
+    CPU_AND_S (size, local, local, allowed);
+
+    if (0 == CPU_COUNT_S (size, local)) {
+        mem_trace ("%s: no allowed CPU on node %d\n", __func__, node);
+        errno = EINVAL;
+        goto __bind_exit;
+    }
+
+    rc = sched_setaffinity (0, size, local);
+    mem_trace ("%s: node %d, %d CPUs: %s", __func__, node,
+               CPU_COUNT_S (size, local), list);
+
+__bind_exit:
+    CPU_FREE (allowed);
+    CPU_FREE (local);
+    return rc;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Card pool
+ *
+ * Opens every AFU of a name found in /dev/ocxl and spreads jobs over the
+ * cards which have the requested action attached. A job goes to the
+ * card with the lowest expected wait: (jobs in flight + 1) times the
+ * recent job execution time of the card. Cards which did not complete
+ * a job yet are preferred, so every card gets measured. Ties are broken
+ * round robin.
+ *
+ * Environment:
+ *   SNAP_SIM_CARDS   Number of cards to emulate with SNAP_CONFIG=CPU,
+ *                    default 1.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+
+#define SNAP_POOL_DEV_DIR   "/dev/ocxl"
+#define SNAP_POOL_AFU_NAME  "IBM,oc-snap"
+
+struct snap_pool_card {
+    struct snap_card* card;
+    struct snap_action* action;     /* NULL if not attached */
+    snap_action_type_t action_type;
+    char path[sizeof (SNAP_POOL_DEV_DIR) + 256];
+};
+
+struct snap_card_pool {
+    unsigned int count;
+    unsigned int next;              /* Round robin start */
+    struct snap_pool_card cards[];
+};
+
+static int snap_pool_path_cmp (const void* a, const void* b)
+{
+    return strcmp (((const struct snap_pool_card*)a)->path,
+                   ((const struct snap_pool_card*)b)->path);
+}
+
+/* Collect the device paths of all AFUs named afu_name */
+static struct snap_card_pool* snap_pool_scan (const char* afu_name)
+{
+    struct snap_card_pool* pool;
+    struct snap_card_pool* p;
+    struct dirent* de;
+    DIR* dir;
+    size_t len = strlen (afu_name);
+    unsigned int n = 0, max = 8;
+
+    pool = calloc (1, sizeof (*pool) + max * sizeof (pool->cards[0]));
+
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    dir = opendir (SNAP_POOL_DEV_DIR);
+
+    if (NULL == dir) {
+        free (pool);
+        errno = ENODEV;
+        return NULL;
+    }
+
+    /* Device names are <afu_name>.<domain>:<bus>:<dev>.<fn>.<afu_index> */
+    while (NULL != (de = readdir (dir))) {
+        if ((0 != strncmp (de->d_name, afu_name, len)) ||
+            ('.' != de->d_name[len])) {
+            continue;
+        }
+
+        if (n == max) {
+            max *= 2;
+            p = realloc (pool, sizeof (*pool) + max * sizeof (pool->cards[0]));
+
+            if (NULL == p) {
+                closedir (dir);
+                free (pool);
+                return NULL;
+            }
+
+            pool = p;
+        }
+
+        memset (&pool->cards[n], 0, sizeof (pool->cards[n]));
+        snprintf (pool->cards[n].path, sizeof (pool->cards[n].path), "%s/%s",
+                  SNAP_POOL_DEV_DIR, de->d_name);
+        n++;
+    }
+
+    closedir (dir);
+    pool->count = n;
+    qsort (pool->cards, n, sizeof (pool->cards[0]), snap_pool_path_cmp);
+    return pool;
+}
+
+/* Emulated cards for SNAP_CONFIG=CPU */
+static struct snap_card_pool* snap_pool_sim (void)
+{
+    struct snap_card_pool* pool;
+    const char* env = getenv ("SNAP_SIM_CARDS");
+    unsigned int i, n = 1;
+
+    if (env) {
+        n = strtoul (env, (char**)NULL, 0);
+    }
+
+    if (0 == n) {
+        n = 1;
+    }
+
+    pool = calloc (1, sizeof (*pool) + n * sizeof (pool->cards[0]));
+
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        snprintf (pool->cards[i].path, sizeof (pool->cards[i].path),
+                  "sim%u", i);
+    }
+
+    pool->count = n;
+    return pool;
+}
+
+struct snap_card_pool* snap_card_pool_open (const char* afu_name)
+{
+    struct snap_card_pool* pool;
+    unsigned int i, n = 0;
+
+    if (NULL == afu_name) {
+        afu_name = SNAP_POOL_AFU_NAME;
+    }
+
+    pool = snap_card_emulated() ? snap_pool_sim () : snap_pool_scan (afu_name);
+
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    /* Keep the cards which open, e.g. skip those we lack permission for */
+    for (i = 0; i < pool->count; i++) {
+        pool->cards[n] = pool->cards[i];
+        pool->cards[n].card = snap_card_alloc_dev (pool->cards[i].path,
+                              SNAP_VENDOR_ID_IBM, SNAP_DEVICE_ID_SNAP);
+
+        if (NULL == pool->cards[n].card) {
+            pool_trace ("%s: cannot open %s\n", __func__, pool->cards[i].path);
+            continue;
+        }
+
+        pool_trace ("%s: card %u is %s\n", __func__, n, pool->cards[n].path);
+        n++;
+    }
+
+    pool->count = n;
+
+    if (0 == n) {
+        free (pool);
+        errno = ENODEV;
+        return NULL;
+    }
+
+    return pool;
+}
+
+unsigned int snap_card_pool_count (struct snap_card_pool* pool)
+{
+    return pool->count;
+}
+
+struct snap_card* snap_card_pool_card (struct snap_card_pool* pool,
+                                       unsigned int i)
+{
+    return (i < pool->count) ? pool->cards[i].card : NULL;
+}
+
+int snap_card_pool_attach (struct snap_card_pool* pool,
+                           snap_action_type_t action_type,
+                           snap_action_flag_t action_flags,
+                           int attach_timeout_sec)
+{
+    struct snap_pool_card* c;
+    unsigned int i;
+    int n = 0;
+
+    for (i = 0; i < pool->count; i++) {
+        c = &pool->cards[i];
+
+        if (c->action) {
+            n += (c->action_type == action_type);
+            continue;
+        }
+
+        c->action = snap_attach_action (c->card, action_type, action_flags,
+                                        attach_timeout_sec);
+
+        if (NULL == c->action) {
+            pool_trace ("%s: no action %08x on %s\n", __func__, action_type,
+                        c->path);
+            continue;
+        }
+
+        c->action_type = action_type;
+        n++;
+    }
+
+    if (0 == n) {
+        errno = ENODEV;
+        return SNAP_ENODEV;
+    }
+
+    return n;
+}
+
+/* Card with the lowest expected wait for a job of action_type */
+static struct snap_pool_card* snap_card_pool_pick (struct snap_card_pool* pool,
+        snap_action_type_t action_type)
+{
+    struct snap_pool_card* best = NULL;
+    struct snap_pool_card* c;
+    uint64_t cost, best_cost = 0, latency;
+    unsigned int i, k, start, inflight;
+
+    start = __atomic_fetch_add (&pool->next, 1, __ATOMIC_RELAXED);
+
+    for (k = 0; k < pool->count; k++) {
+        i = (start + k) % pool->count;
+        c = &pool->cards[i];
+
+        if ((NULL == c->action) || (c->action_type != action_type)) {
+            continue;
+        }
+
+        inflight = snap_card_load (c->card, &latency);
+        cost = (inflight + 1) * MAX (latency, (uint64_t)1);
+
+        if ((NULL == best) || (cost < best_cost)) {
+            best = c;
+            best_cost = cost;
+        }
+    }
+
+    if (NULL == best) {
+        errno = ENODEV;
+    }
+
+    return best;
+}
+
+int snap_card_pool_execute_job (struct snap_card_pool* pool,
+                                snap_action_type_t action_type,
+                                struct snap_job* cjob,
+                                unsigned int timeout_sec)
+{
+    struct snap_pool_card* c = snap_card_pool_pick (pool, action_type);
+
+    if (NULL == c) {
+        return SNAP_ENODEV;
+    }
+
+    return snap_action_sync_execute_job (c->action, cjob, timeout_sec);
+}
+
+struct snap_job_handle* snap_card_pool_submit_job (struct snap_card_pool* pool,
+        snap_action_type_t action_type,
+        struct snap_job* cjob)
+{
+    struct snap_pool_card* c = snap_card_pool_pick (pool, action_type);
+
+    if (NULL == c) {
+        return NULL;
+    }
+
+    return snap_action_submit_job (c->action, cjob);
+}
+
+void snap_card_pool_free (struct snap_card_pool* pool)
+{
+    unsigned int i;
+
+    if (NULL == pool) {
+        return;
+    }
+
+    for (i = 0; i < pool->count; i++) {
+        if (pool->cards[i].action) {
+            snap_detach_action (pool->cards[i].action);
+        }
+
+        snap_card_free (pool->cards[i].card);
+    }
+
+    free (pool);
+}
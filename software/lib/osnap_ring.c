@@ -0,0 +1,382 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Submission ring
+ *
+ * Jobs are encoded into workitems in host memory instead of being
+ * written to ACTION_PARAMS_IN word by word. A batch is published with
+ * one store of sq_tail and started with one MMIO write, the doorbell,
+ * which is skipped if the action is still working on the ring: it reads
+ * sq_tail again before it stops. Completions are the per-slot records
+ * of the completion queue, see struct snap_ring_ctl in osnap_types.h.
+ *
+ * The control line, the submission and the completion queue share one
+ * mapping which is pre-faulted and locked if possible, like the
+ * scatter-gather tables.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+#include <osnap_hls_if.h>
+
+#define SNAP_RING_MAX_ENTRIES   65536
+#define SNAP_RING_FREE_WAIT_MS  1000    /* For the last run to end */
+
+struct snap_ring {
+    struct snap_card* card;
+    struct snap_ring_ctl* ctl;
+    struct snap_queue_workitem* sq;
+    struct snap_completion_record* cq;
+    struct snap_job** jobs;         /* Job of each slot */
+    void* mem;
+    size_t size;                    /* Mapped size */
+    bool locked;
+    uint32_t mask;                  /* entries - 1 */
+    uint32_t tail;                  /* Next slot to fill */
+    uint32_t published;             /* sq_tail as last stored */
+    uint32_t head;                  /* Next slot to reap */
+    uint32_t doorbells;             /* ACTION_CONTROL_START writes */
+    uint16_t seq;
+};
+
+/* Deadlines use the monotonic clock, like the job waits */
+static uint64_t ring_now_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/* Ring the doorbell if the action is idle and published entries wait */
+static int snap_ring_kick (struct snap_ring* ring)
+{
+    uint32_t head;
+
+    if (__atomic_load_n (&ring->ctl->runs, __ATOMIC_ACQUIRE) != ring->doorbells) {
+        return SNAP_OK;                 /* Running, it reads sq_tail again */
+    }
+
+    head = __atomic_load_n (&ring->ctl->sq_head, __ATOMIC_ACQUIRE);
+
+    if (head == ring->published) {
+        return SNAP_OK;
+    }
+
+    ring->doorbells++;
+    snap_tr (SNAP_TR_RING_DOORBELL, 0, ring->published, ring->published - head);
+
+    if (0 != snap_action_write32 (ring->card, ACTION_CONTROL,
+                                  ACTION_CONTROL_START)) {
+        ring->doorbells--;
+        return SNAP_EIO;
+    }
+
+    return SNAP_OK;
+}
+
+struct snap_ring* snap_action_ring_create (struct snap_action* action,
+        unsigned int entries)
+{
+    struct snap_card* card = (struct snap_card*)action;
+    struct snap_ring* ring;
+    struct snap_queue_workitem wi;
+    struct snap_job cjob;
+    size_t page_size = (size_t)sysconf (_SC_PAGESIZE);
+    unsigned int mmio_in;
+    uint8_t* p;
+    int err;
+
+    if ((NULL == card) || (0 == entries) || (entries & (entries - 1)) ||
+        (entries > SNAP_RING_MAX_ENTRIES)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (SNAP_OK != snap_card_queue_set (card, entries)) {
+        return NULL;
+    }
+
+    ring = calloc (1, sizeof (*ring));
+
+    if (NULL == ring) {
+        goto __ring_err;
+    }
+
+    ring->jobs = calloc (entries, sizeof (ring->jobs[0]));
+
+    if (NULL == ring->jobs) {
+        goto __ring_err;
+    }
+
+    ring->size = SNAP_ROUND_UP (sizeof (*ring->ctl) +
+                                (size_t)entries * (sizeof (*ring->sq) + sizeof (*ring->cq)),
+                                page_size);
+    ring->mem = mmap (NULL, ring->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == ring->mem) {
+        ring->mem = NULL;
+        errno = ENOMEM;
+        goto __ring_err;
+    }
+
+    snap_numa_bind_mem (ring->mem, ring->size, snap_card_get_numa_node (card));
+
+    for (p = ring->mem; p < (uint8_t*)ring->mem + ring->size; p += page_size) {
+        *(volatile uint8_t*)p = 0;
+    }
+
+    if (0 == mlock (ring->mem, ring->size)) {
+        ring->locked = true;
+    } else {
+        mem_trace ("  %s: mlock failed errno: %d\n", __func__, errno);
+    }
+
+    ring->card = card;
+    ring->mask = entries - 1;
+    ring->ctl = ring->mem;
+    ring->sq = (struct snap_queue_workitem*) (ring->ctl + 1);
+    ring->cq = (struct snap_completion_record*) (ring->sq + entries);
+    ring->ctl->sq_addr = (unsigned long)ring->sq;
+    ring->ctl->cq_addr = (unsigned long)ring->cq;
+    ring->ctl->entries = entries;
+
+    /* The ring job, only the 16 byte header is uploaded */
+    snap_job_set (&cjob, NULL, 0, NULL, 0);
+
+    if (0 != snap_job_encode (card, &cjob, &wi, &mmio_in)) {
+        goto __ring_err;
+    }
+
+    wi.flags = SNAP_JOBFLAG_EXEC | SNAP_JOBFLAG_RING;
+    wi.priv_data = (unsigned long)ring->ctl;
+
+    if (0 != snap_action_write_block (card, ACTION_PARAMS_IN, &wi,
+                                      mmio_in * sizeof (uint32_t))) {
+        errno = EIO;
+        goto __ring_err;
+    }
+
+    mem_trace ("%s: ring %p ctl %p %u entries\n", __func__, ring, ring->ctl,
+               entries);
+    return ring;
+
+__ring_err:
+    err = errno;
+
+    if (ring && ring->mem) {
+        if (ring->locked) {
+            munlock (ring->mem, ring->size);
+        }
+
+        munmap (ring->mem, ring->size);
+    }
+
+    if (ring) {
+        free (ring->jobs);
+        free (ring);
+    }
+
+    snap_card_queue_set (card, 0);
+    errno = err;
+    return NULL;
+}
+
+int snap_ring_submit (struct snap_ring* ring, struct snap_job* cjob)
+{
+    struct snap_queue_workitem wi;
+    unsigned int mmio_in;
+    uint32_t slot;
+
+    if ((NULL == ring) || (NULL == cjob) || (cjob->wout_size > SNAP_JOBSIZE)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    if (ring->tail - ring->head > ring->mask) {
+        errno = ENOSPC;
+        return SNAP_EBUSY;
+    }
+
+    if (0 != snap_job_encode (ring->card, cjob, &wi, &mmio_in)) {
+        return SNAP_EINVAL;
+    }
+
+    slot = ring->tail & ring->mask;
+    wi.flags = SNAP_JOBFLAG_EXEC | SNAP_JOBFLAG_CMPL;
+    wi.seq = ring->seq++;
+    wi.priv_data = (unsigned long)&ring->cq[slot];
+
+    ring->cq[slot].flags = 0;
+    ring->sq[slot] = wi;
+    ring->jobs[slot] = cjob;
+    ring->tail++;
+    return SNAP_OK;
+}
+
+int snap_ring_doorbell (struct snap_ring* ring)
+{
+    if (NULL == ring) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    if (ring->published != ring->tail) {
+        __atomic_store_n (&ring->ctl->sq_tail, ring->tail, __ATOMIC_RELEASE);
+        ring->published = ring->tail;
+    }
+
+    return snap_ring_kick (ring);
+}
+
+/* Copy the results of a completed entry back like ACTION_PARAMS_OUT */
+static void snap_ring_results (struct snap_job* cjob,
+                               const struct snap_queue_workitem* wi)
+{
+    if (cjob->wout_addr) {
+        memcpy ((void*) (unsigned long)cjob->wout_addr, wi->user.data,
+                cjob->wout_size);
+    } else if (cjob->win_size <= SNAP_JOBSIZE) {
+        memcpy ((void*) (unsigned long)cjob->win_addr, wi->user.data,
+                cjob->win_size);
+    }
+}
+
+int snap_ring_reap (struct snap_ring* ring, struct snap_job** done,
+                    unsigned int max)
+{
+    struct snap_completion_record* rec;
+    struct snap_job* cjob;
+    unsigned int n = 0;
+    uint32_t slot;
+    int rc;
+
+    if ((NULL == ring) || ((NULL == done) && max)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    while ((n < max) && (ring->head != ring->published)) {
+        slot = ring->head & ring->mask;
+        rec = &ring->cq[slot];
+
+        if (!(SNAP_CMPL_VALID & __atomic_load_n (&rec->flags, __ATOMIC_ACQUIRE)) ||
+            (rec->seq != ring->sq[slot].seq)) {
+            break;
+        }
+
+        cjob = ring->jobs[slot];
+        cjob->retc = rec->retc;
+        snap_ring_results (cjob, &ring->sq[slot]);
+        ring->jobs[slot] = NULL;
+        ring->head++;
+        done[n++] = cjob;
+    }
+
+    /* Entries published while the last run was ending */
+    rc = snap_ring_kick (ring);
+    return (SNAP_OK == rc) ? (int)n : rc;
+}
+
+int snap_ring_wait (struct snap_ring* ring, struct snap_job** done,
+                    unsigned int max, int timeout_ms)
+{
+    uint64_t end;
+    uint64_t sleep_ns = 0;
+    struct timespec ts;
+    int n;
+
+    end = ring_now_ns() + (uint64_t)timeout_ms * 1000000;
+
+    for (;;) {
+        n = snap_ring_reap (ring, done, max);
+
+        if ((0 != n) || (0 == max) || (ring->head == ring->published)) {
+            return n;
+        }
+
+        if ((timeout_ms >= 0) && (ring_now_ns() >= end)) {
+            errno = ETIME;
+            return SNAP_ETIMEDOUT;
+        }
+
+        /* Same backoff as the job wait policy, up to 64 usec */
+        if (0 == sleep_ns) {
+            sched_yield();
+            sleep_ns = 1000;
+        } else {
+            ts.tv_sec = 0;
+            ts.tv_nsec = (long)sleep_ns;
+            nanosleep (&ts, NULL);
+            sleep_ns = MIN (sleep_ns * 2, (uint64_t)64000);
+        }
+    }
+}
+
+unsigned int snap_ring_pending (const struct snap_ring* ring)
+{
+    return ring->tail - ring->head;
+}
+
+void snap_ring_free (struct snap_ring* ring)
+{
+    struct timespec ts = { 0, 1000000 };
+    unsigned int ms;
+
+    if (NULL == ring) {
+        return;
+    }
+
+    /* The action may still read the queue or write records */
+    for (ms = 0; ms < SNAP_RING_FREE_WAIT_MS; ms++) {
+        if (__atomic_load_n (&ring->ctl->runs, __ATOMIC_ACQUIRE) ==
+            ring->doorbells) {
+            break;
+        }
+
+        nanosleep (&ts, NULL);
+    }
+
+    snap_card_queue_set (ring->card, 0);
+
+    if (SNAP_RING_FREE_WAIT_MS == ms) {
+        /* Keep the memory, the action could still write into it */
+        mem_trace ("%s: ring %p action still running, %zu bytes leaked\n",
+                   __func__, ring, ring->size);
+    } else {
+        if (ring->locked) {
+            munlock (ring->mem, ring->size);
+        }
+
+        munmap (ring->mem, ring->size);
+    }
+
+    free (ring->jobs);
+    free (ring);
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Scatter-gather descriptor lists
+ *
+ * A list is a chain of snap_addr tables, see osnap_types.h for the
+ * layout. The tables of a list are allocated in one mapping at create
+ * time, pre-faulted and locked if possible, so the action walks them
+ * without translation faults. Entries are packed: when a table is full
+ * its last entry moves to the next table and becomes the link.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+#include <osnap_hls_if.h>
+
+struct snap_sgl {
+    struct snap_addr* tables;       /* SNAP_SGL_TABLE_ENTRIES each */
+    size_t size;                    /* Mapped size */
+    unsigned int max_tables;
+    unsigned int max_entries;
+    unsigned int entries;           /* Data entries */
+    unsigned int used;              /* Slots used, data and links */
+    struct snap_addr* last;         /* Last data entry, carries END */
+    bool locked;
+};
+
+struct snap_sgl* snap_sgl_create (unsigned int max_entries)
+{
+    struct snap_sgl* sgl;
+    size_t page_size = (size_t)sysconf (_SC_PAGESIZE);
+    unsigned int tables;
+    uint8_t* p;
+
+    if (0 == max_entries) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* The first table holds one entry more than the others, which
+       give up a slot for the link */
+    tables = (max_entries <= SNAP_SGL_TABLE_ENTRIES) ? 1 :
+             (max_entries - 2) / (SNAP_SGL_TABLE_ENTRIES - 1) + 1;
+
+    sgl = calloc (1, sizeof (*sgl));
+
+    if (NULL == sgl) {
+        return NULL;
+    }
+
+    sgl->size = SNAP_ROUND_UP ((size_t)tables * SNAP_MEMBUS_WIDTH, page_size);
+    sgl->tables = mmap (NULL, sgl->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == sgl->tables) {
+        free (sgl);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (p = (uint8_t*)sgl->tables; p < (uint8_t*)sgl->tables + sgl->size;
+         p += page_size) {
+        *(volatile uint8_t*)p = 0;
+    }
+
+    if (0 == mlock (sgl->tables, sgl->size)) {
+        sgl->locked = true;
+    } else {
+        mem_trace ("  %s: mlock failed errno: %d\n", __func__, errno);
+    }
+
+    sgl->max_tables = tables;
+    sgl->max_entries = max_entries;
+
+    mem_trace ("%s: sgl %p tables %p %u entries in %u tables\n", __func__,
+               sgl, sgl->tables, max_entries, tables);
+    return sgl;
+}
+
+int snap_sgl_add (struct snap_sgl* sgl, const void* addr, uint32_t size,
+                  snap_addrtype_t type, snap_addrflag_t flags)
+{
+    struct snap_addr* e;
+    struct snap_addr* link;
+
+    if ((NULL == sgl) || (flags & (SNAP_ADDRFLAG_EXT | SNAP_ADDRFLAG_END))) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    if ((sgl->entries == sgl->max_entries) ||
+        (sgl->used == sgl->max_tables * SNAP_SGL_TABLE_ENTRIES)) {
+        errno = ENOMEM;
+        return SNAP_ENOMEM;
+    }
+
+    if (sgl->used && (0 == sgl->used % SNAP_SGL_TABLE_ENTRIES)) {
+        /* Table full: move its last entry over, link in its place */
+        link = &sgl->tables[sgl->used - 1];
+        sgl->tables[sgl->used] = *link;
+        sgl->last = &sgl->tables[sgl->used];
+        snap_addr_set (link, &sgl->tables[sgl->used], SNAP_MEMBUS_WIDTH,
+                       SNAP_ADDRTYPE_HOST_DRAM, SNAP_ADDRFLAG_EXT);
+        sgl->used++;
+    }
+
+    if (sgl->last) {
+        sgl->last->flags &= ~SNAP_ADDRFLAG_END;
+    }
+
+    e = &sgl->tables[sgl->used++];
+    snap_addr_set (e, addr, size, type, flags | SNAP_ADDRFLAG_END);
+    sgl->last = e;
+    sgl->entries++;
+    return SNAP_OK;
+}
+
+void snap_sgl_reset (struct snap_sgl* sgl)
+{
+    if (NULL == sgl) {
+        return;
+    }
+
+    sgl->entries = 0;
+    sgl->used = 0;
+    sgl->last = NULL;
+}
+
+unsigned int snap_sgl_entries (const struct snap_sgl* sgl)
+{
+    if (NULL == sgl) {
+        return 0;
+    }
+
+    return sgl->entries;
+}
+
+int snap_sgl_addr_set (struct snap_addr* da, const struct snap_sgl* sgl,
+                       snap_addrflag_t flags)
+{
+    if ((NULL == da) || (NULL == sgl) || (0 == sgl->entries)) {
+        errno = EINVAL;
+        return SNAP_EINVAL;
+    }
+
+    snap_addr_set (da, sgl->tables, SNAP_MEMBUS_WIDTH, SNAP_ADDRTYPE_HOST_DRAM,
+                   flags | SNAP_ADDRFLAG_EXT);
+    return SNAP_OK;
+}
+
+void snap_sgl_free (struct snap_sgl* sgl)
+{
+    if (NULL == sgl) {
+        return;
+    }
+
+    if (sgl->locked) {
+        munlock (sgl->tables, sgl->size);
+    }
+
+    munmap (sgl->tables, sgl->size);
+    free (sgl);
+}
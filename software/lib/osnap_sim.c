@@ -0,0 +1,1222 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software card emulator
+ *
+ * Selected with SNAP_CONFIG=CPU (or SNAP_CONFIG=0x1). It models the two
+ * MMIO register files of an OC-Accel card in host memory:
+ *  - the global (snap_core) space with SNAP_IVR, SNAP_CAP, SNAP_FRT and
+ *    the DEBUG counters,
+ *  - the per-PASID action space with ACTION_CONTROL start/done/idle,
+ *    the HLS IRQ registers and ACTION_PARAMS_IN/OUT.
+ *
+ * Writing ACTION_CONTROL_START hands the workitem found in
+ * ACTION_PARAMS_IN to a worker thread, which runs the host-side model
+ * of the attached action and then sets DONE/IDLE and raises the
+ * action IRQ like the HLS wrapper does. Card memory (LCL_MEM0/1) is
+ * backed by lazily mapped host memory.
+ *
+ * An action model has a soft reset register if the action has one,
+ * hdl_single_engine at 0x8C: writing 1 aborts the running job, it goes
+ * idle without results, completion record or IRQ. The HLS actions have
+ * none.
+ *
+ * hdl_single_engine is register driven instead: its job lasts from
+ * ACTION_CONTROL start to the release through USER_CONTROL. Writing
+ * USER_CONTROL bit 0 runs the AXI read and write bursts of its patterns,
+ * checks the read data and fills the time trace RAMs with cycles of a
+ * fixed latency model, see sim_run_hdl().
+ *
+ * With SNAP_SIM_FAULTS set, host pages which are not resident (see
+ * mincore()) are not faulted in by the emulator. Like the ocxl driver
+ * for an address it cannot resolve, it reports a translation fault and
+ * the action ends the job with an error. With SNAP_SIM_FAULTS=2 the
+ * action hangs after a fault instead, until a soft reset or the close.
+ *
+ * Environment:
+ *   SNAP_SIM_DELAY_US  Extra execution time added to every job (default 0)
+ *   SNAP_SIM_FAULTS    Translation faults on pages not resident, 2: and
+ *                      hang after one (default 0)
+ *   SNAP_SIM_NUMA_NODE NUMA node the card reports (default -1, unknown)
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <libosnap.h>
+#include <libocxl.h>
+#include <osnap_internal.h>
+#include <osnap_queue.h>
+#include <osnap_global_regs.h>
+#include <osnap_hls_if.h>
+
+#define SIM_ACTION_REG_SIZE     0x1000          /* per-PASID bytes */
+#define SIM_GLOBAL_REG_SIZE     0x20000         /* global bytes */
+#define SIM_LCL_MEM_PORTS       2
+#define SIM_LCL_MEM_SIZE        (256ull * 1024 * 1024) /* per port */
+#define SIM_EVENT_DEPTH         64
+#define SIM_FRT_NS_PER_CYCLE    4               /* 250MHz */
+#define SIM_IRQ_HANDLE_BASE     0x0000511000000000ull
+#define SIM_DSISR_STORE         0x02000000ull   /* DSISR_ISSTORE */
+#define SIM_DSISR_NOPAGE        0x40000000ull   /* DSISR_NOHPTE */
+
+/* hdl_single_engine registers, see its hdl_single_engine.h */
+#define SIM_HDL_USER_STATUS     0x30
+#define SIM_HDL_USER_CONTROL    0x34
+#define SIM_HDL_USER_MODE       0x38
+#define SIM_HDL_INIT_RDATA      0x3C
+#define SIM_HDL_INIT_WDATA      0x40
+#define SIM_HDL_TT_RD_CMD       0x44            /* Cycle RAMs */
+#define SIM_HDL_TT_RD_RSP       0x48
+#define SIM_HDL_TT_WR_CMD       0x4C
+#define SIM_HDL_TT_WR_RSP       0x50
+#define SIM_HDL_TT_ARID         0x54            /* ID RAMs */
+#define SIM_HDL_TT_AWID         0x58
+#define SIM_HDL_TT_RID          0x5C
+#define SIM_HDL_TT_BID          0x60
+#define SIM_HDL_RD_PATTERN      0x64
+#define SIM_HDL_RD_NUMBER       0x68
+#define SIM_HDL_WR_PATTERN      0x6C
+#define SIM_HDL_WR_NUMBER       0x70
+#define SIM_HDL_SOURCE_ADDR_L   0x74
+#define SIM_HDL_TARGET_ADDR_L   0x7C
+#define SIM_HDL_ERROR_INFO_L    0x84
+#define SIM_HDL_ERROR_INFO_H    0x88
+#define SIM_HDL_SOFT_RESET      0x8C
+#define SIM_HDL_WR_DONE         0x01            /* USER_STATUS bits */
+#define SIM_HDL_RD_DONE         0x02
+#define SIM_HDL_WR_ERROR        0x04
+#define SIM_HDL_RD_ERROR        0x10
+#define SIM_HDL_READY           0x20
+#define SIM_HDL_GO              0x1             /* USER_CONTROL bits */
+#define SIM_HDL_RELEASE         0x2
+#define SIM_TT_ENTRIES          4096            /* Time trace RAM depth */
+#define SIM_TT_LATENCY          200             /* Cycles to the first beat */
+#define SIM_TT_ID_SKEW          16              /* Extra cycles per AXI ID */
+
+/* SNAP_CAP: 2^6 alignment, 2^6 minimum size, card memory, AD9H3 */
+#define SIM_CAP_REG             ((6ull << 36) | (6ull << 32) | \
+                                 (((SIM_LCL_MEM_PORTS * SIM_LCL_MEM_SIZE) >> 20) << 16) | \
+                                 AD9H3_OC_CARD)
+
+struct snap_sim_card;
+
+struct snap_sim_action {
+    snap_action_type_t action_type;
+    uint32_t release;
+    const char* name;
+    uint32_t (* run) (struct snap_sim_card* sim, struct snap_queue_workitem* job);
+    /* Register driven actions: called after a register write, and with
+       sim->lock held on a register read to return the value */
+    void (* write) (struct snap_sim_card* sim, uint64_t offset, uint32_t data);
+    uint32_t (* read) (struct snap_sim_card* sim, uint64_t offset, uint32_t data);
+    uint32_t reset_reg;                 /* Soft reset register, 0: none */
+};
+
+/* One direction of the hdl_single_engine time trace RAMs */
+struct sim_tt_ram {
+    uint32_t cmd_id[SIM_TT_ENTRIES];
+    uint32_t cmd_cyc[SIM_TT_ENTRIES];
+    uint32_t rsp_id[SIM_TT_ENTRIES];
+    uint32_t rsp_cyc[SIM_TT_ENTRIES];
+    uint32_t cmd_addr;                  /* Advanced by cycle reads */
+    uint32_t rsp_addr;
+};
+
+struct snap_sim_card {
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;          /* worker waits for ACTION_CONTROL_START */
+    pthread_cond_t event_cond;          /* event_check waits for IRQs */
+    pthread_t worker;
+    bool worker_exit;
+    bool start_pending;
+    bool abort;                         /* Soft reset of the running job */
+
+    const struct snap_sim_action* action;
+    uint32_t action_regs[SIM_ACTION_REG_SIZE / sizeof (uint32_t)];
+    uint64_t global_regs[SIM_GLOBAL_REG_SIZE / sizeof (uint64_t)];
+    uint8_t* lcl_mem[SIM_LCL_MEM_PORTS];
+    struct sim_tt_ram tt[2];            /* hdl_single_engine read, write */
+    uint32_t hdl_control;               /* USER_CONTROL bits not taken yet */
+
+    ocxl_event events[SIM_EVENT_DEPTH];
+    unsigned int event_head;
+    unsigned int event_count;
+    int event_fd;                   /* Readable while events are queued */
+    uint16_t next_irq;
+
+    unsigned long delay_us;
+    unsigned long faults;           /* SNAP_SIM_FAULTS */
+    uint64_t fault_events;          /* Translation faults reported */
+    int numa_node;                  /* SNAP_SIM_NUMA_NODE */
+    struct timespec t_open;
+};
+
+static uint64_t sim_ns_since (const struct timespec* t0)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - t0->tv_sec) * 1000000000ull +
+           (uint64_t) now.tv_nsec - (uint64_t) t0->tv_nsec;
+}
+
+static inline uint32_t* sim_areg (struct snap_sim_card* sim, uint64_t offset)
+{
+    return &sim->action_regs[offset / sizeof (uint32_t)];
+}
+
+static inline uint64_t* sim_greg (struct snap_sim_card* sim, uint64_t offset)
+{
+    return &sim->global_regs[offset / sizeof (uint64_t)];
+}
+
+/* Job execution time, returns true if a soft reset aborted the job */
+static bool sim_delay (struct snap_sim_card* sim, unsigned long delay_us)
+{
+    struct timespec ts;
+    uint64_t ns;
+    bool abort;
+
+    pthread_mutex_lock (&sim->lock);
+
+    if (delay_us) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ns = (uint64_t)ts.tv_nsec + (uint64_t)delay_us * 1000;
+        ts.tv_sec += ns / 1000000000ull;
+        ts.tv_nsec = ns % 1000000000ull;
+
+        while (!sim->abort && !sim->worker_exit &&
+               (ETIMEDOUT != pthread_cond_timedwait (&sim->start_cond,
+                       &sim->lock, &ts)))
+            ;
+    }
+
+    abort = sim->abort;
+    pthread_mutex_unlock (&sim->lock);
+    return abort;
+}
+
+/*
+ * SNAP_SIM_FAULTS=2: the action hangs if the job got a fault, faults is
+ * fault_events at its start. Returns true if it did.
+ */
+static bool sim_hang (struct snap_sim_card* sim, uint64_t faults)
+{
+    bool hung;
+
+    pthread_mutex_lock (&sim->lock);
+    hung = (sim->faults > 1) && (faults != sim->fault_events);
+
+    while (hung && !sim->abort && !sim->worker_exit) {
+        pthread_cond_wait (&sim->start_cond, &sim->lock);
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return hung;
+}
+
+/*
+ * Account for DMA traffic in the DEBUG counters. TLX commands are
+ * counted per 128 byte cacheline, AXI commands per 4 KiB burst.
+ * Called with sim->lock held.
+ */
+static void sim_count_dma (struct snap_sim_card* sim, snap_addrtype_t type,
+                           uint64_t bytes, bool write)
+{
+    uint64_t lines = (bytes + CACHELINE_BYTES - 1) / CACHELINE_BYTES;
+    uint64_t bursts = (bytes + 4095) / 4096;
+
+    if (type == SNAP_ADDRTYPE_HOST_DRAM) {
+        *sim_greg (sim, DEBUG_CNT_TLX_CMD) += lines;
+        *sim_greg (sim, DEBUG_CNT_TLX_RSP) += lines;
+    }
+
+    if (write) {
+        *sim_greg (sim, DEBUG_CNT_AXI_W_CMD) += bursts;
+        *sim_greg (sim, DEBUG_CNT_AXI_W_RSP) += bursts;
+    } else {
+        *sim_greg (sim, DEBUG_CNT_AXI_R_CMD) += bursts;
+        *sim_greg (sim, DEBUG_CNT_AXI_R_RSP) += lines;
+    }
+}
+
+/* Queue an event, called with sim->lock held */
+static void sim_queue_event (struct snap_sim_card* sim, const ocxl_event* ev)
+{
+    uint64_t one = 1;
+
+    if (sim->event_count == SIM_EVENT_DEPTH) {
+        sim_trace ("  %s: event queue full, event type %d lost\n", __func__,
+                   ev->type);
+        return;
+    }
+
+    sim->events[(sim->event_head + sim->event_count) % SIM_EVENT_DEPTH] = *ev;
+    sim->event_count++;
+    pthread_cond_broadcast (&sim->event_cond);
+
+    if ((1 == sim->event_count) &&
+        (write (sim->event_fd, &one, sizeof (one)) < 0)) {
+        sim_trace ("  %s: event fd write failed errno: %d\n", __func__, errno);
+    }
+}
+
+/*
+ * SNAP_SIM_FAULTS: report the first page of the host range which is not
+ * resident as translation fault. Returns true if there was one.
+ */
+static bool sim_fault (struct snap_sim_card* sim, uint64_t addr,
+                       uint64_t size, bool write)
+{
+    uint64_t page = (uint64_t)sysconf (_SC_PAGESIZE);
+    uint64_t p = addr & ~(page - 1);
+    uint64_t end = addr + size;
+    unsigned char vec[256];
+    ocxl_event ev;
+    size_t n, i;
+
+    while (p < end) {
+        n = MIN ((end - p + page - 1) / page, sizeof (vec));
+
+        if (0 != mincore ((void*) (unsigned long)p, n * page, vec)) {
+            memset (vec, 0, n);         /* Not mapped */
+        }
+
+        for (i = 0; i < n; i++, p += page) {
+            if (vec[i] & 1) {
+                continue;
+            }
+
+            sim_trace ("  %s: translation fault addr: %llx write: %d\n",
+                       __func__, (long long)MAX (p, addr), write);
+            memset (&ev, 0, sizeof (ev));
+            ev.type = OCXL_EVENT_TRANSLATION_FAULT;
+            ev.translation_fault.addr = (void*) (unsigned long)MAX (p, addr);
+            ev.translation_fault.dsisr = write ? SIM_DSISR_STORE | SIM_DSISR_NOPAGE :
+                                         SIM_DSISR_NOPAGE;
+            ev.translation_fault.count = 1;
+            pthread_mutex_lock (&sim->lock);
+            sim->fault_events++;
+            sim_queue_event (sim, &ev);
+            pthread_mutex_unlock (&sim->lock);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Resolve a snap_addr the way the action would see it. Host addresses
+ * are used as they are, card memory is looked up in the emulated
+ * LCL_MEM ports. Returns NULL if the range is not accessible.
+ */
+static void* sim_mem (struct snap_sim_card* sim, const struct snap_addr* a,
+                      uint64_t size, bool write)
+{
+    unsigned int port;
+    void* p;
+
+    switch (a->type) {
+    case SNAP_ADDRTYPE_HOST_DRAM:
+        p = (void*) (unsigned long)a->addr;
+
+        if (sim->faults && sim_fault (sim, a->addr, size, write)) {
+            return NULL;
+        }
+
+        break;
+
+    case SNAP_ADDRTYPE_LCL_MEM0:
+    case SNAP_ADDRTYPE_LCL_MEM1:
+        port = a->type - SNAP_ADDRTYPE_LCL_MEM0;
+
+        if (a->addr + size > SIM_LCL_MEM_SIZE) {
+            return NULL;
+        }
+
+        pthread_mutex_lock (&sim->lock);
+
+        if (NULL == sim->lcl_mem[port]) {
+            p = mmap (NULL, SIM_LCL_MEM_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+            if (MAP_FAILED == p) {
+                pthread_mutex_unlock (&sim->lock);
+                return NULL;
+            }
+
+            sim->lcl_mem[port] = p;
+        }
+
+        pthread_mutex_unlock (&sim->lock);
+        p = sim->lcl_mem[port] + a->addr;
+        break;
+
+    default:
+        return NULL;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    sim_count_dma (sim, a->type, size, write);
+    pthread_mutex_unlock (&sim->lock);
+    return p;
+}
+
+/* hls_helloworld: convert in to upper case, whole 64 byte words */
+static uint32_t sim_run_helloworld (struct snap_sim_card* sim,
+                                    struct snap_queue_workitem* job)
+{
+    const struct snap_addr* in = &job->user.addr[0];
+    const struct snap_addr* out = &job->user.addr[1];
+    uint64_t size = SNAP_ROUND_UP ((uint64_t)in->size, 64);
+    const uint8_t* src;
+    uint8_t* dst;
+    uint64_t i;
+
+    src = sim_mem (sim, in, size, false);
+    dst = sim_mem (sim, out, size, true);
+
+    if ((NULL == src) || (NULL == dst)) {
+        return SNAP_RETC_FAILURE;
+    }
+
+    for (i = 0; i < size; i++) {
+        uint8_t c = src[i];
+        dst[i] = ((c >= 'a') && (c <= 'z')) ? c - ('a' - 'A') : c;
+    }
+
+    return SNAP_RETC_SUCCESS;
+}
+
+/* hls_memcopy_1024: copy MIN(in.size, out.size) between HOST/LCL_MEM0 */
+static uint32_t sim_run_memcopy (struct snap_sim_card* sim,
+                                 struct snap_queue_workitem* job)
+{
+    const struct snap_addr* in = &job->user.addr[0];
+    const struct snap_addr* out = &job->user.addr[1];
+    uint64_t size = MIN (in->size, out->size);
+    const void* src;
+    void* dst;
+
+    if (((in->type == SNAP_ADDRTYPE_LCL_MEM0) && (in->size > SIM_LCL_MEM_SIZE)) ||
+        ((out->type == SNAP_ADDRTYPE_LCL_MEM0) && (out->size > SIM_LCL_MEM_SIZE))) {
+        return SNAP_RETC_FAILURE;
+    }
+
+    if ((in->type == SNAP_ADDRTYPE_UNUSED) ||
+        (out->type == SNAP_ADDRTYPE_UNUSED)) {
+        return SNAP_RETC_SUCCESS;
+    }
+
+    if ((in->type == SNAP_ADDRTYPE_LCL_MEM1) ||
+        (out->type == SNAP_ADDRTYPE_LCL_MEM1)) {
+        return SNAP_RETC_FAILURE;       /* Action only wires up port 0 */
+    }
+
+    src = sim_mem (sim, in, size, false);
+    dst = sim_mem (sim, out, size, true);
+
+    if ((NULL == src) || (NULL == dst)) {
+        return SNAP_RETC_FAILURE;
+    }
+
+    memmove (dst, src, size);
+    return SNAP_RETC_SUCCESS;
+}
+
+/* Byte o of the incrementing 32 bit data pattern starting at init */
+static inline uint8_t sim_hdl_byte (uint32_t init, uint64_t o)
+{
+    return (uint8_t) ((init + (uint32_t) (o / 4)) >> (8 * (o % 4)));
+}
+
+/*
+ * One direction of hdl_single_engine: num bursts of the pattern
+ * ([20:16] ID range, [15:8] length - 1, [2:0] size) over the buffer,
+ * wrapped at (wrap len + 1) * 4KB in wrap mode. Data is the 32 bit
+ * incrementing pattern from INIT_R/WDATA by offset, read data is
+ * checked against it. Commands go out one per burst of beats,
+ * responses come SIM_TT_LATENCY cycles later plus the beats and a skew
+ * per ID, in order per ID. The RAMs record them in that order.
+ * Returns false on a read mismatch or an inaccessible buffer.
+ */
+static bool sim_hdl_transfer (struct snap_sim_card* sim, bool write)
+{
+    struct sim_tt_ram* tt = &sim->tt[write];
+    uint32_t pattern, num, init, mode, blen, ids, id, cyc0, best = 0;
+    uint32_t next[32];
+    uint64_t bytes, range, o, i, k, t, t_best;
+    struct snap_addr a;
+    uint8_t* p;
+
+    pthread_mutex_lock (&sim->lock);
+    pattern = *sim_areg (sim, write ? SIM_HDL_WR_PATTERN : SIM_HDL_RD_PATTERN);
+    num = *sim_areg (sim, write ? SIM_HDL_WR_NUMBER : SIM_HDL_RD_NUMBER);
+    init = *sim_areg (sim, write ? SIM_HDL_INIT_WDATA : SIM_HDL_INIT_RDATA);
+    mode = *sim_areg (sim, SIM_HDL_USER_MODE);
+    o = write ? SIM_HDL_TARGET_ADDR_L : SIM_HDL_SOURCE_ADDR_L;
+    a.addr = ((uint64_t) *sim_areg (sim, o + 4) << 32) | *sim_areg (sim, o);
+    cyc0 = (uint32_t) (sim_ns_since (&sim->t_open) / SIM_FRT_NS_PER_CYCLE);
+    pthread_mutex_unlock (&sim->lock);
+
+    if (0 == num) {
+        return true;
+    }
+
+    blen = ((pattern >> 8) & 0xff) + 1;
+    ids = ((pattern >> 16) & 0x1f) + 1;
+    bytes = (uint64_t)blen << (pattern & 0x7);
+    range = (mode & 0x1) ? (((mode >> 8) & 0xf) + 1) * 4096ull : num * bytes;
+
+    a.size = (uint32_t)MIN (range, UINT32_MAX);
+    a.type = SNAP_ADDRTYPE_HOST_DRAM;
+    a.flags = write ? SNAP_ADDRFLAG_DST : SNAP_ADDRFLAG_SRC;
+    p = sim_mem (sim, &a, range, write);
+
+    for (i = 0, o = 0; p && (i < num); i++) {
+        for (k = 0; k < bytes; k++, o = (o + 1 == range) ? 0 : o + 1) {
+            if (write) {
+                p[o] = sim_hdl_byte (init, o);
+            } else if (p[o] != sim_hdl_byte (init, o)) {
+                /* Expected and actual 32 bit word */
+                for (t = 0, o &= ~3ull, k = 0; (k < 4) && (o + k < range); k++) {
+                    t |= (uint64_t)p[o + k] << (8 * k);
+                }
+
+                pthread_mutex_lock (&sim->lock);
+                *sim_areg (sim, SIM_HDL_ERROR_INFO_L) = init + (uint32_t) (o / 4);
+                *sim_areg (sim, SIM_HDL_ERROR_INFO_H) = (uint32_t)t;
+                pthread_mutex_unlock (&sim->lock);
+                return false;
+            }
+        }
+    }
+
+    if (NULL == p) {
+        return false;
+    }
+
+    /* Merge the per ID response streams by cycle, the older on a tie */
+    pthread_mutex_lock (&sim->lock);
+
+    for (i = 0; i < num; i++) {
+        tt->cmd_id[i % SIM_TT_ENTRIES] = i % ids;
+        tt->cmd_cyc[i % SIM_TT_ENTRIES] = cyc0 + (uint32_t) (i * blen);
+    }
+
+    for (id = 0; id < ids; id++) {
+        next[id] = id;
+    }
+
+    for (i = 0; i < num; i++) {
+        t_best = UINT64_MAX;
+
+        for (id = 0; id < ids; id++) {
+            t = (uint64_t)next[id] * blen + SIM_TT_LATENCY + blen +
+                id * SIM_TT_ID_SKEW;
+
+            if ((next[id] < num) && (t < t_best)) {
+                t_best = t;
+                best = id;
+            }
+        }
+
+        tt->rsp_id[i % SIM_TT_ENTRIES] = best;
+        tt->rsp_cyc[i % SIM_TT_ENTRIES] = cyc0 + (uint32_t)t_best;
+        next[best] += ids;
+    }
+
+    tt->cmd_addr = 0;
+    tt->rsp_addr = 0;
+    pthread_mutex_unlock (&sim->lock);
+    return true;
+}
+
+static void sim_hdl_engine (struct snap_sim_card* sim)
+{
+    uint32_t status = 0;
+
+    if (!sim_hdl_transfer (sim, false)) {
+        status |= SIM_HDL_RD_ERROR;
+    } else if (sim_hdl_transfer (sim, true)) {
+        status |= SIM_HDL_RD_DONE | SIM_HDL_WR_DONE;
+    } else {
+        status |= SIM_HDL_RD_DONE | SIM_HDL_WR_ERROR;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    *sim_areg (sim, SIM_HDL_USER_STATUS) |= status;
+    pthread_mutex_unlock (&sim->lock);
+}
+
+/*
+ * hdl_single_engine job, from ACTION_CONTROL start to the release. With
+ * SNAP_SIM_DELAY_US the engine runs here after that time, else right at
+ * the USER_CONTROL write. A soft reset ends the job at any point.
+ */
+static uint32_t sim_run_hdl (struct snap_sim_card* sim,
+                             struct snap_queue_workitem* job __unused)
+{
+    uint32_t control;
+
+    pthread_mutex_lock (&sim->lock);
+
+    while (!sim->abort && !sim->worker_exit) {
+        control = sim->hdl_control;
+        sim->hdl_control = 0;
+
+        if (control & SIM_HDL_GO) {
+            pthread_mutex_unlock (&sim->lock);
+
+            if (!sim_delay (sim, sim->delay_us)) {
+                sim_hdl_engine (sim);
+            }
+
+            pthread_mutex_lock (&sim->lock);
+        }
+
+        if (control & SIM_HDL_RELEASE) {
+            break;
+        }
+
+        if (0 == control) {
+            pthread_cond_wait (&sim->start_cond, &sim->lock);
+        }
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return SNAP_RETC_SUCCESS;
+}
+
+static void sim_hdl_write (struct snap_sim_card* sim, uint64_t offset,
+                           uint32_t data)
+{
+    switch (offset) {
+    case ACTION_CONTROL:
+        if (data & ACTION_CONTROL_START) {
+            pthread_mutex_lock (&sim->lock);
+            *sim_areg (sim, SIM_HDL_USER_STATUS) |= SIM_HDL_READY;
+            pthread_mutex_unlock (&sim->lock);
+        }
+
+        break;
+
+    case SIM_HDL_USER_CONTROL:
+        /* Without execution time the engine is done when the write is */
+        if ((data & SIM_HDL_GO) && (0 == sim->delay_us)) {
+            sim_hdl_engine (sim);
+            data &= ~SIM_HDL_GO;
+        }
+
+        pthread_mutex_lock (&sim->lock);
+        sim->hdl_control |= data & (SIM_HDL_GO | SIM_HDL_RELEASE);
+        pthread_cond_signal (&sim->start_cond);
+        pthread_mutex_unlock (&sim->lock);
+        break;
+
+    case SIM_HDL_SOFT_RESET:
+        if (data & 0x1) {
+            pthread_mutex_lock (&sim->lock);
+            *sim_areg (sim, SIM_HDL_USER_STATUS) = 0;
+            memset (sim->tt, 0, sizeof (sim->tt));
+            sim->hdl_control = 0;
+            pthread_mutex_unlock (&sim->lock);
+        }
+
+        break;
+    }
+}
+
+/* Time trace RAMs: a cycle read advances the address, an ID read not */
+static uint32_t sim_hdl_read (struct snap_sim_card* sim, uint64_t offset,
+                              uint32_t data)
+{
+    struct sim_tt_ram* rd = &sim->tt[0];
+    struct sim_tt_ram* wr = &sim->tt[1];
+
+    switch (offset) {
+    case SIM_HDL_TT_RD_CMD:
+        return rd->cmd_cyc[rd->cmd_addr++ % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_RD_RSP:
+        return rd->rsp_cyc[rd->rsp_addr++ % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_WR_CMD:
+        return wr->cmd_cyc[wr->cmd_addr++ % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_WR_RSP:
+        return wr->rsp_cyc[wr->rsp_addr++ % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_ARID:
+        return rd->cmd_id[rd->cmd_addr % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_AWID:
+        return wr->cmd_id[wr->cmd_addr % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_RID:
+        return rd->rsp_id[rd->rsp_addr % SIM_TT_ENTRIES];
+
+    case SIM_HDL_TT_BID:
+        return wr->rsp_id[wr->rsp_addr % SIM_TT_ENTRIES];
+    }
+
+    return data;
+}
+
+/* Host-side models of the shipped actions */
+static const struct snap_sim_action snap_sim_actions[] = {
+    { 0x10143008, 0x00000022, "hls_helloworld",    sim_run_helloworld,
+      NULL, NULL, 0 },
+    { 0x1014300B, 0x00000003, "hls_memcopy_1024",  sim_run_memcopy,
+      NULL, NULL, 0 },
+    { 0x10142002, 0x00000002, "hdl_single_engine", sim_run_hdl,
+      sim_hdl_write, sim_hdl_read, SIM_HDL_SOFT_RESET },
+};
+
+/* Queue an IRQ event, called with sim->lock held */
+static void sim_raise_irq (struct snap_sim_card* sim, uint64_t handle)
+{
+    ocxl_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.type = OCXL_EVENT_IRQ;
+    ev.irq.handle = handle;
+    ev.irq.count = 1;
+    sim_queue_event (sim, &ev);
+}
+
+/* Completion record, it goes out before the job counts as done */
+static void sim_complete (struct snap_sim_card* sim,
+                          const struct snap_queue_workitem* job, uint32_t retc)
+{
+    struct snap_completion_record* rec;
+
+    if (!(job->flags & SNAP_JOBFLAG_CMPL)) {
+        return;
+    }
+
+    rec = (struct snap_completion_record*) (unsigned long)job->priv_data;
+    rec->seq = job->seq;
+    rec->retc = retc;
+    rec->timestamp = sim_ns_since (&sim->t_open) / SIM_FRT_NS_PER_CYCLE;
+    __atomic_store_n (&rec->flags, SNAP_CMPL_VALID, __ATOMIC_RELEASE);
+}
+
+/*
+ * Fetch front-end for SNAP_JOBFLAG_RING: execute the submission queue
+ * entries up to sq_tail, read it again until it brings nothing new.
+ * The caller increments runs.
+ */
+static uint32_t sim_run_ring (struct snap_sim_card* sim,
+                              const struct snap_queue_workitem* ring_job)
+{
+    struct snap_ring_ctl* ctl;
+    struct snap_queue_workitem* sq;
+    struct snap_queue_workitem job;
+    uint32_t mask, head, tail, retc;
+
+    ctl = (struct snap_ring_ctl*) (unsigned long)ring_job->priv_data;
+
+    if ((NULL == ctl) || (NULL == sim->action)) {
+        return SNAP_RETC_FAILURE;
+    }
+
+    sq = (struct snap_queue_workitem*) (unsigned long)ctl->sq_addr;
+    mask = ctl->entries - 1;
+    head = ctl->sq_head;
+
+    while (head != (tail = __atomic_load_n (&ctl->sq_tail, __ATOMIC_ACQUIRE))) {
+        pthread_mutex_lock (&sim->lock);
+        sim_count_dma (sim, SNAP_ADDRTYPE_HOST_DRAM,
+                       (uint64_t) (tail - head) * sizeof (job), false);
+        pthread_mutex_unlock (&sim->lock);
+
+        for (; head != tail; head++) {
+            job = sq[head & mask];
+            sim_trace ("  %s: run %s seq: %x slot: %u\n", __func__,
+                       sim->action->name, job.seq, head & mask);
+
+            retc = sim->action->run (sim, &job);
+            sim_delay (sim, sim->delay_us); /* No reset while a ring runs */
+            job.retc = retc;
+            sq[head & mask] = job;
+            sim_complete (sim, &job, retc);
+            __atomic_store_n (&ctl->sq_head, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return SNAP_RETC_SUCCESS;
+}
+
+static void* sim_worker (void* arg)
+{
+    struct snap_sim_card* sim = arg;
+    struct snap_queue_workitem job;
+    struct snap_ring_ctl* ctl;
+    uint32_t retc;
+    uint64_t handle;
+    uint64_t faults;
+    bool aborted;
+
+    pthread_mutex_lock (&sim->lock);
+
+    while (1) {
+        while (!sim->start_pending && !sim->worker_exit) {
+            pthread_cond_wait (&sim->start_cond, &sim->lock);
+        }
+
+        if (sim->worker_exit) {
+            break;
+        }
+
+        /* ap_start handshake */
+        sim->start_pending = false;
+        sim->abort = false;
+        aborted = false;
+        faults = sim->fault_events;
+        *sim_areg (sim, ACTION_CONTROL) &= ~ACTION_CONTROL_START;
+        memcpy (&job, sim_areg (sim, ACTION_PARAMS_IN), sizeof (job));
+        pthread_mutex_unlock (&sim->lock);
+
+        sim_trace ("  %s: run %s sat: %d seq: %x flags: %x\n", __func__,
+                   sim->action ? sim->action->name : "none",
+                   job.short_action, job.seq, job.flags);
+
+        if (job.flags & SNAP_JOBFLAG_RING) {
+            retc = sim_run_ring (sim, &job);
+        } else {
+            retc = sim->action ? sim->action->run (sim, &job) : SNAP_RETC_FAILURE;
+
+            /* Register driven actions spend the delay in their engine */
+            if (!sim_hang (sim, faults) &&
+                !sim_delay (sim, (sim->action && sim->action->write) ?
+                            0 : sim->delay_us)) {
+                sim_complete (sim, &job, retc);
+            }
+        }
+
+        pthread_mutex_lock (&sim->lock);
+
+        /* A reset up to here still ends the job without results */
+        if (!(job.flags & SNAP_JOBFLAG_RING)) {
+            aborted = sim->abort;
+        }
+
+        if (aborted) {
+            sim_trace ("  %s: seq: %x aborted\n", __func__, job.seq);
+            sim->abort = false;
+            *sim_areg (sim, ACTION_CONTROL) |= ACTION_CONTROL_IDLE;
+            continue;
+        }
+
+        /* Last write of a ring run, under the lock so a doorbell which
+           saw it finds the action idle */
+        if (job.flags & SNAP_JOBFLAG_RING) {
+            ctl = (struct snap_ring_ctl*) (unsigned long)job.priv_data;
+
+            if (ctl) {
+                __atomic_store_n (&ctl->runs, ctl->runs + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        job.retc = retc;
+        memcpy (sim_areg (sim, ACTION_PARAMS_OUT), &job, sizeof (job));
+        *sim_areg (sim, ACTION_CONTROL) |= ACTION_CONTROL_DONE |
+                                           ACTION_CONTROL_IDLE;
+
+        if ((*sim_areg (sim, ACTION_IRQ_CONTROL) & ACTION_IRQ_CONTROL_ON) &&
+            (*sim_areg (sim, ACTION_IRQ_APP) & ACTION_IRQ_APP_DONE)) {
+            *sim_areg (sim, ACTION_IRQ_STATUS) |= ACTION_IRQ_STATUS_DONE;
+            handle = ((uint64_t) *sim_areg (sim, ACTION_IRQ_SRC_HI) << 32) |
+                     *sim_areg (sim, ACTION_IRQ_SRC_LO);
+            sim_raise_irq (sim, handle);
+        }
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return NULL;
+}
+
+struct snap_sim_card* snap_sim_card_open (void)
+{
+    struct snap_sim_card* sim;
+    const char* env;
+
+    sim = calloc (1, sizeof (*sim));
+
+    if (NULL == sim) {
+        return NULL;
+    }
+
+    sim->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (sim->event_fd < 0) {
+        free (sim);
+        return NULL;
+    }
+
+    pthread_mutex_init (&sim->lock, NULL);
+    pthread_cond_init (&sim->start_cond, NULL);
+    pthread_cond_init (&sim->event_cond, NULL);
+    clock_gettime (CLOCK_MONOTONIC, &sim->t_open);
+
+    env = getenv ("SNAP_SIM_DELAY_US");
+
+    if (env != NULL) {
+        sim->delay_us = strtoul (env, (char**)NULL, 0);
+    }
+
+    sim->numa_node = -1;
+    env = getenv ("SNAP_SIM_NUMA_NODE");
+
+    if (env != NULL) {
+        sim->numa_node = strtol (env, (char**)NULL, 0);
+    }
+
+    env = getenv ("SNAP_SIM_FAULTS");
+
+    if (env != NULL) {
+        sim->faults = strtoul (env, (char**)NULL, 0);
+    }
+
+    *sim_greg (sim, SNAP_SSR) = 0x100;  /* Exploration done */
+    *sim_greg (sim, SNAP_CAP) = SIM_CAP_REG;
+    *sim_areg (sim, ACTION_CONTROL) = ACTION_CONTROL_IDLE;
+
+    if (0 != pthread_create (&sim->worker, NULL, sim_worker, sim)) {
+        close (sim->event_fd);
+        free (sim);
+        return NULL;
+    }
+
+    sim_trace ("%s: sim card %p cap: %llx delay: %lu usec\n", __func__, sim,
+               (long long)SIM_CAP_REG, sim->delay_us);
+    return sim;
+}
+
+void snap_sim_card_close (struct snap_sim_card* sim)
+{
+    unsigned int i;
+
+    if (NULL == sim) {
+        return;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    sim->worker_exit = true;
+    pthread_cond_signal (&sim->start_cond);
+    pthread_mutex_unlock (&sim->lock);
+    pthread_join (sim->worker, NULL);
+
+    for (i = 0; i < SIM_LCL_MEM_PORTS; i++) {
+        if (sim->lcl_mem[i]) {
+            munmap (sim->lcl_mem[i], SIM_LCL_MEM_SIZE);
+        }
+    }
+
+    pthread_cond_destroy (&sim->event_cond);
+    pthread_cond_destroy (&sim->start_cond);
+    pthread_mutex_destroy (&sim->lock);
+    close (sim->event_fd);
+    free (sim);
+}
+
+int snap_sim_attach_action (struct snap_sim_card* sim,
+                            snap_action_type_t action_type)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE (snap_sim_actions); i++) {
+        if (snap_sim_actions[i].action_type == action_type) {
+            break;
+        }
+    }
+
+    if (i == ARRAY_SIZE (snap_sim_actions)) {
+        sim_trace ("%s: no model for action 0x%x\n", __func__, action_type);
+        errno = ENOENT;
+        return -1;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    sim->action = &snap_sim_actions[i];
+    *sim_areg (sim, ACTION_TYPE_REG) = sim->action->action_type;
+    *sim_areg (sim, ACTION_RELEASE_REG) = sim->action->release;
+    pthread_mutex_unlock (&sim->lock);
+
+    sim_trace ("%s: action 0x%x %s\n", __func__, action_type, sim->action->name);
+    return 0;
+}
+
+/* Write to the soft reset register of the action, sim->lock held */
+static void sim_soft_reset (struct snap_sim_card* sim, uint32_t data)
+{
+    if (!(data & 0x1)) {
+        return;
+    }
+
+    if (sim->start_pending) {
+        /* Not picked up by the worker yet */
+        sim->start_pending = false;
+        *sim_areg (sim, ACTION_CONTROL) &= ~ACTION_CONTROL_START;
+        *sim_areg (sim, ACTION_CONTROL) |= ACTION_CONTROL_IDLE;
+    } else if (!(*sim_areg (sim, ACTION_CONTROL) & ACTION_CONTROL_IDLE)) {
+        sim->abort = true;
+        pthread_cond_signal (&sim->start_cond);
+    }
+
+    *sim_areg (sim, ACTION_CONTROL) &= ~ACTION_CONTROL_DONE;
+    *sim_areg (sim, ACTION_IRQ_STATUS) = 0;
+}
+
+int snap_sim_per_pasid_write32 (struct snap_sim_card* sim,
+                                uint64_t offset, uint32_t data)
+{
+    if ((offset & 0x3) || (offset >= SIM_ACTION_REG_SIZE)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+
+    switch (offset) {
+    case ACTION_CONTROL:
+        if ((data & ACTION_CONTROL_START) &&
+            (*sim_areg (sim, ACTION_CONTROL) & ACTION_CONTROL_IDLE) &&
+            !sim->start_pending) {
+            /* Leave idle right away, a poll must never see the old state */
+            *sim_areg (sim, ACTION_CONTROL) |= ACTION_CONTROL_START;
+            *sim_areg (sim, ACTION_CONTROL) &= ~ACTION_CONTROL_IDLE;
+            sim->start_pending = true;
+            pthread_cond_signal (&sim->start_cond);
+        }
+
+        break;
+
+    case ACTION_IRQ_STATUS:
+        *sim_areg (sim, offset) ^= data;        /* Toggle on write */
+        break;
+
+    case ACTION_TYPE_REG:
+    case ACTION_RELEASE_REG:
+        break;                                  /* Read only */
+
+    default:
+        if (sim->action && sim->action->reset_reg &&
+            (offset == sim->action->reset_reg)) {
+            sim_soft_reset (sim, data);
+        }
+
+        *sim_areg (sim, offset) = data;
+        break;
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+
+    if (sim->action && sim->action->write) {
+        sim->action->write (sim, offset, data);
+    }
+
+    return 0;
+}
+
+int snap_sim_per_pasid_read32 (struct snap_sim_card* sim,
+                               uint64_t offset, uint32_t* data)
+{
+    if ((offset & 0x3) || (offset >= SIM_ACTION_REG_SIZE)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    *data = *sim_areg (sim, offset);
+
+    if (sim->action && sim->action->read) {
+        *data = sim->action->read (sim, offset, *data);
+    }
+
+    if (ACTION_CONTROL == offset) {
+        *sim_areg (sim, offset) &= ~ACTION_CONTROL_DONE;  /* Clear on read */
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return 0;
+}
+
+/* Block accesses are emulated word by word */
+int snap_sim_per_pasid_write_block (struct snap_sim_card* sim, uint64_t offset,
+                                    const uint32_t* data, unsigned int words)
+{
+    unsigned int i;
+    int rc = 0;
+
+    for (i = 0; (0 == rc) && (i < words); i++) {
+        rc = snap_sim_per_pasid_write32 (sim, offset + i * sizeof (uint32_t),
+                                         data[i]);
+    }
+
+    return rc;
+}
+
+int snap_sim_per_pasid_read_block (struct snap_sim_card* sim, uint64_t offset,
+                                   uint32_t* data, unsigned int words)
+{
+    unsigned int i;
+    int rc = 0;
+
+    for (i = 0; (0 == rc) && (i < words); i++) {
+        rc = snap_sim_per_pasid_read32 (sim, offset + i * sizeof (uint32_t),
+                                        &data[i]);
+    }
+
+    return rc;
+}
+
+int snap_sim_global_write64 (struct snap_sim_card* sim,
+                             uint64_t offset, uint64_t data)
+{
+    uint64_t reg;
+
+    if ((offset & 0x7) || (offset >= SIM_GLOBAL_REG_SIZE)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+
+    switch (offset) {
+    case DEBUG_DBG_CLR:
+        if (data & 0x1) {
+            for (reg = DEBUG_CNT_TLX_CMD; reg <= DEBUG_CNT_AXI_R_RSP; reg += 8) {
+                *sim_greg (sim, reg) = 0;
+            }
+        }
+
+        break;
+
+    case SNAP_IVR:
+    case SNAP_BDR:
+    case SNAP_SSR:
+    case SNAP_CAP:
+    case SNAP_FRT:
+        break;                                  /* Read only */
+
+    default:
+        *sim_greg (sim, offset) = data;
+        break;
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return 0;
+}
+
+int snap_sim_global_read64 (struct snap_sim_card* sim,
+                            uint64_t offset, uint64_t* data)
+{
+    if ((offset & 0x7) || (offset >= SIM_GLOBAL_REG_SIZE)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    if (SNAP_FRT == offset) {
+        *data = sim_ns_since (&sim->t_open) / SIM_FRT_NS_PER_CYCLE;
+        return 0;
+    }
+
+    pthread_mutex_lock (&sim->lock);
+    *data = *sim_greg (sim, offset);
+    pthread_mutex_unlock (&sim->lock);
+    return 0;
+}
+
+int snap_sim_irq_alloc (struct snap_sim_card* sim, uint16_t* irq,
+                        uint64_t* handle)
+{
+    pthread_mutex_lock (&sim->lock);
+    *irq = sim->next_irq++;
+    pthread_mutex_unlock (&sim->lock);
+
+    /* Any unique value works, the action only echoes it back */
+    *handle = SIM_IRQ_HANDLE_BASE | *irq;
+    return 0;
+}
+
+int snap_sim_event_check (struct snap_sim_card* sim, int timeout_ms,
+                          ocxl_event* events, uint16_t event_count)
+{
+    struct timespec deadline;
+    uint64_t val;
+    int n = 0;
+    int rc = 0;
+
+    if (timeout_ms > 0) {
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock (&sim->lock);
+
+    while ((0 == sim->event_count) && (0 != timeout_ms) && (0 == rc)) {
+        if (timeout_ms < 0) {
+            rc = pthread_cond_wait (&sim->event_cond, &sim->lock);
+        } else {
+            rc = pthread_cond_timedwait (&sim->event_cond, &sim->lock, &deadline);
+        }
+    }
+
+    while ((sim->event_count > 0) && (n < event_count)) {
+        events[n++] = sim->events[sim->event_head];
+        sim->event_head = (sim->event_head + 1) % SIM_EVENT_DEPTH;
+        sim->event_count--;
+    }
+
+    /* Queue drained, the fd is not readable anymore */
+    if ((n > 0) && (0 == sim->event_count) &&
+        (read (sim->event_fd, &val, sizeof (val)) < 0)) {
+        sim_trace ("  %s: event fd read failed errno: %d\n", __func__, errno);
+    }
+
+    pthread_mutex_unlock (&sim->lock);
+    return n;
+}
+
+int snap_sim_event_fd (struct snap_sim_card* sim)
+{
+    return sim->event_fd;
+}
+
+int snap_sim_numa_node (struct snap_sim_card* sim)
+{
+    return sim->numa_node;
+}
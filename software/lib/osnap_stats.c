@@ -0,0 +1,102 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Log-linear latency histograms
+ *
+ * Values below 2^SNAP_HIST_SUB_BITS have their own bucket. Above, every
+ * power of 2 range is split into 2^SNAP_HIST_SUB_BITS linear buckets,
+ * so a bucket is at most 12.5% wide, whatever the magnitude. Adding a
+ * value is a count-leading-zeros and a few shifts.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+
+#define SNAP_HIST_SUB       (1u << SNAP_HIST_SUB_BITS)
+
+static unsigned int snap_histogram_index (uint64_t v)
+{
+    unsigned int k;
+
+    if (v < SNAP_HIST_SUB) {
+        return (unsigned int)v;
+    }
+
+    k = 63 - __builtin_clzll (v);       /* k >= SNAP_HIST_SUB_BITS */
+    return (k - SNAP_HIST_SUB_BITS + 1) * SNAP_HIST_SUB +
+           (unsigned int) ((v >> (k - SNAP_HIST_SUB_BITS)) & (SNAP_HIST_SUB - 1));
+}
+
+uint64_t snap_histogram_bucket_value (unsigned int i)
+{
+    unsigned int k;
+
+    if (i < SNAP_HIST_SUB) {
+        return i;
+    }
+
+    k = i / SNAP_HIST_SUB + SNAP_HIST_SUB_BITS - 1;
+    return (uint64_t) (SNAP_HIST_SUB + i % SNAP_HIST_SUB) <<
+           (k - SNAP_HIST_SUB_BITS);
+}
+
+void snap_histogram_add (struct snap_histogram* h, uint64_t v)
+{
+    if ((0 == h->count) || (v < h->min)) {
+        h->min = v;
+    }
+
+    if (v > h->max) {
+        h->max = v;
+    }
+
+    h->count++;
+    h->sum += v;
+    h->bucket[snap_histogram_index (v)]++;
+}
+
+uint64_t snap_histogram_percentile (const struct snap_histogram* h,
+                                    double percentile)
+{
+    uint64_t rank, seen = 0;
+    unsigned int i;
+
+    if (0 == h->count) {
+        return 0;
+    }
+
+    rank = (uint64_t) (percentile / 100.0 * (double)h->count + 0.5);
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (i = 0; i < SNAP_HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+
+        if (seen >= rank) {
+            /* Lower bound of the bucket, clamped to the seen range */
+            uint64_t v = snap_histogram_bucket_value (i);
+            return (v < h->min) ? h->min : ((v > h->max) ? h->max : v);
+        }
+    }
+
+    return h->max;
+}
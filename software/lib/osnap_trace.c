@@ -0,0 +1,218 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Binary trace ring
+ *
+ * Cheap enough to stay enabled: a record is a timestamp and four words
+ * stored into the ring of the calling thread, no lock, no syscall and
+ * no formatting. The rings live in a shared memory file, which stays
+ * readable after the process ended or crashed. See osnap_trace.h for
+ * the layout and tools/snap_trace_decode for the reader.
+ *
+ * Environment:
+ *   SNAP_TRACE_RING  Records per thread ring, rounded to a power of 2.
+ *                    Tracing is off if not set.
+ *   SNAP_TRACE_FILE  Trace file, default /dev/shm/osnap_trace.<pid>
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <libosnap.h>
+#include <osnap_internal.h>
+#include <osnap_trace.h>
+
+int snap_tr_enabled = 0;
+
+static struct snap_trace_file* tr_file = NULL;
+static size_t tr_file_size = 0;
+static uint64_t tr_mask = 0;
+
+static __thread struct snap_trace_ring* tr_ring = NULL;
+static __thread bool tr_no_ring = false;
+
+/* Rings of threads which exited, reused before a new one is claimed */
+static pthread_key_t tr_key;
+static pthread_mutex_t tr_free_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t tr_free[SNAP_TRACE_RINGS];
+static uint32_t tr_free_count = 0;
+
+uint64_t snap_tr_clock (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Thread exit: the ring goes to the free list, its records stay */
+static void snap_tr_detach (void* arg)
+{
+    uint32_t i = (uint32_t) (unsigned long)arg - 1;
+    struct snap_trace_ring* ring = snap_trace_get_ring (tr_file, i);
+
+    tr_ring = NULL;
+    tr_no_ring = true;                  /* Later destructors of this thread */
+    __atomic_store_n (&ring->last_tid, ring->tid, __ATOMIC_RELAXED);
+    __atomic_store_n (&ring->tid, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock (&tr_free_lock);
+    tr_free[tr_free_count++] = i;
+    pthread_mutex_unlock (&tr_free_lock);
+}
+
+/* First record of a thread: reuse a released ring or claim a new one */
+static struct snap_trace_ring* snap_tr_attach (void)
+{
+    struct snap_trace_ring* ring;
+    uint32_t i;
+
+    pthread_mutex_lock (&tr_free_lock);
+
+    if (tr_free_count) {
+        i = tr_free[--tr_free_count];
+    } else {
+        i = tr_file->rings_used;
+
+        if (i < tr_file->rings) {
+            __atomic_store_n (&tr_file->rings_used, i + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock (&tr_free_lock);
+
+    if (i >= tr_file->rings) {
+        tr_no_ring = true;              /* Out of rings, drop this thread */
+        return NULL;
+    }
+
+    ring = snap_trace_get_ring (tr_file, i);
+    __atomic_store_n (&ring->tid, (uint32_t)__gettid(), __ATOMIC_RELEASE);
+    tr_ring = ring;
+    pthread_setspecific (tr_key, (void*) (unsigned long) (i + 1));
+    snap_tr_put (SNAP_TR_THREAD, ring->tid, ring->last_tid, 0);
+    return ring;
+}
+
+void snap_tr_put (uint16_t id, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    struct snap_trace_ring* ring = tr_ring;
+    struct snap_trace_rec* rec;
+    uint64_t head;
+
+    if (NULL == ring) {
+        if (tr_no_ring) {
+            return;
+        }
+
+        ring = snap_tr_attach ();
+
+        if (NULL == ring) {
+            return;
+        }
+    }
+
+    head = ring->head;
+    rec = &ring->rec[head & tr_mask];
+    rec->ts = snap_tr_clock ();
+    rec->id = id;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void snap_tr_init (void)
+{
+    const char* env;
+    char path[128];
+    unsigned long entries;
+    int fd;
+
+    env = getenv ("SNAP_TRACE_RING");
+
+    if (NULL == env) {
+        return;
+    }
+
+    entries = strtoul (env, (char**)NULL, 0);
+
+    if (entries < 64) {
+        entries = 64;
+    }
+
+    /* Power of 2, so the ring index is a mask */
+    while (entries & (entries - 1)) {
+        entries &= entries - 1;
+    }
+
+    env = getenv ("SNAP_TRACE_FILE");
+
+    if (env) {
+        snprintf (path, sizeof (path), "%s", env);
+    } else {
+        snprintf (path, sizeof (path), "/dev/shm/osnap_trace.%d", getpid ());
+    }
+
+    tr_file_size = sizeof (struct snap_trace_file) +
+                   SNAP_TRACE_RINGS * snap_trace_ring_size (entries);
+
+    fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        fprintf (stderr, "osnap: cannot create trace file %s: %s\n", path,
+                 strerror (errno));
+        return;
+    }
+
+    if (0 != ftruncate (fd, tr_file_size)) {
+        fprintf (stderr, "osnap: cannot size trace file %s: %s\n", path,
+                 strerror (errno));
+        close (fd);
+        return;
+    }
+
+    tr_file = mmap (NULL, tr_file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    close (fd);
+
+    if (MAP_FAILED == tr_file) {
+        tr_file = NULL;
+        return;
+    }
+
+    tr_file->version = SNAP_TRACE_VERSION;
+    tr_file->rings = SNAP_TRACE_RINGS;
+    tr_file->ring_entries = entries;
+    tr_file->rings_used = 0;
+    tr_file->pid = getpid ();
+    tr_file->t0 = snap_tr_clock ();
+    tr_mask = entries - 1;
+    pthread_key_create (&tr_key, snap_tr_detach);
+    __atomic_store_n (&tr_file->magic, SNAP_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    snap_tr_enabled = 1;
+}
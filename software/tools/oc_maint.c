@@ -105,7 +105,7 @@ static void* snap_open (struct mdev_ctx* mctx)
     if (mctx->card == 0) {
         snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
     } else {
-        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", mctx->card);
+        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", mctx->card);
     }
 
     VERBOSE3 ("[%s] Enter: %s\n", __func__, device);
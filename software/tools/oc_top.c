@@ -0,0 +1,441 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Link and AXI throughput monitor. Samples the DEBUG counters of the
+ * snap_core on a fixed interval and prints them as rates per second:
+ * TLX commands, responses, retries, failures and translations, AXI
+ * commands and the host read and write bandwidth. Retries and failures
+ * going up with the bandwidth going down point at the link, commands
+ * going down with them at the action.
+ *
+ * Read bytes are AXI read responses (beats) times the bus width. The
+ * DEBUG counters have no write beats, write bytes are estimated from
+ * the write commands and the burst size (-b).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+
+#include <libosnap.h>
+#include <osnap_tools.h>
+#include <osnap_global_regs.h>
+#include <osnap_hls_if.h>
+
+static const char* version = GIT_VERSION;
+static int verbose = 0;
+static volatile sig_atomic_t stop = 0;
+
+#define VERBOSE0(fmt, ...) do {                                        \
+        fprintf(stdout, fmt, ## __VA_ARGS__);                          \
+    } while (0)
+
+#define VERBOSE1(fmt, ...) do {                                        \
+        if (verbose > 0)                                               \
+            fprintf(stderr, fmt, ## __VA_ARGS__);                      \
+    } while (0)
+
+#define OC_TOP_MAX_CARDS    16
+#define OC_TOP_HEADER_ROWS  20          /* Repeat the text header */
+
+enum oc_top_format {
+    OC_TOP_TEXT = 0,
+    OC_TOP_CSV,
+    OC_TOP_JSON
+};
+
+/* The counters in register order, DEBUG_CNT_TLX_CMD .. DEBUG_CNT_AXI_R_RSP */
+enum {
+    CNT_TLX_CMD = 0,
+    CNT_TLX_RSP,
+    CNT_TLX_RTY,
+    CNT_TLX_FAIL,
+    CNT_TLX_XLP,
+    CNT_TLX_XLD,
+    CNT_AXI_W_CMD,
+    CNT_AXI_R_CMD,
+    CNT_AXI_W_RSP,
+    CNT_AXI_R_RSP,
+    CNT_MAX
+};
+
+static const char* cnt_name[CNT_MAX] = {
+    "tlx_cmd", "tlx_rsp", "tlx_rty", "tlx_fail", "tlx_xlp", "tlx_xld",
+    "axi_w_cmd", "axi_r_cmd", "axi_w_rsp", "axi_r_rsp"
+};
+
+struct oc_top_card {
+    int num;                        /* -C number */
+    struct snap_card* handle;
+    uint64_t cnt[CNT_MAX];          /* Last sample */
+    uint64_t t;                     /* and its time */
+};
+
+struct oc_top_ctx {
+    struct oc_top_card card[OC_TOP_MAX_CARDS];
+    unsigned int cards;
+    unsigned int interval_ms;
+    long count;                     /* Samples, < 0 forever */
+    enum oc_top_format format;
+    unsigned int beat_bytes;        /* AXI data width */
+    unsigned int burst_bytes;       /* Assumed bytes per AXI write command */
+    bool clear;
+};
+
+static void sig_handler (int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Same device naming as oc_maint */
+static struct snap_card* oc_top_open (int num)
+{
+    char device[64];
+    struct snap_card* handle;
+
+    if (0 == num) {
+        snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
+    } else {
+        snprintf (device, sizeof (device) - 1,
+                  "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", num);
+    }
+
+    handle = snap_card_alloc_dev (device, 0xffff, 0xffff);
+
+    if (NULL == handle) {
+        fprintf (stderr, "Error: Can not open CAPI-SNAP Device: %s\n", device);
+    }
+
+    VERBOSE1 ("[%s] %s: %p\n", __func__, device, handle);
+    return handle;
+}
+
+static int oc_top_sample (struct oc_top_card* c, uint64_t* cnt)
+{
+    unsigned int i;
+
+    for (i = 0; i < CNT_MAX; i++) {
+        if (0 != snap_global_read64 (c->handle, DEBUG_CNT_TLX_CMD + 8 * i,
+                                     &cnt[i])) {
+            fprintf (stderr, "Error: card %d reading DEBUG counter %s\n",
+                     c->num, cnt_name[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void oc_top_header (struct oc_top_ctx* ctx)
+{
+    unsigned int i;
+
+    switch (ctx->format) {
+    case OC_TOP_TEXT:
+        VERBOSE0 ("%-8s %4s %10s %10s %8s %8s %8s %8s %9s %9s %9s %9s %6s\n",
+                  "time", "card", "tlx_cmd/s", "tlx_rsp/s", "rty/s",
+                  "fail/s", "xlp/s", "xld/s", "axi_rd/s", "axi_wr/s",
+                  "rd_MB/s", "wr_MB/s", "rty%");
+        break;
+
+    case OC_TOP_CSV:
+        VERBOSE0 ("time_s,card");
+
+        for (i = 0; i < CNT_MAX; i++) {
+            VERBOSE0 (",%s_per_s", cnt_name[i]);
+        }
+
+        VERBOSE0 (",rd_MB_per_s,wr_MB_per_s\n");
+        break;
+
+    case OC_TOP_JSON:
+        break;
+    }
+}
+
+/* Print one card, t seconds since start, rate[] per second */
+static void oc_top_print (struct oc_top_ctx* ctx, struct oc_top_card* c,
+                          double t, const double* rate)
+{
+    double rd_mb = rate[CNT_AXI_R_RSP] * ctx->beat_bytes / 1e6;
+    double wr_mb = rate[CNT_AXI_W_CMD] * ctx->burst_bytes / 1e6;
+    double rty_pct = rate[CNT_TLX_CMD] ?
+                     100.0 * rate[CNT_TLX_RTY] / rate[CNT_TLX_CMD] : 0.0;
+    unsigned int i;
+
+    switch (ctx->format) {
+    case OC_TOP_TEXT:
+        VERBOSE0 ("%8.1f %4d %10.0f %10.0f %8.0f %8.0f %8.0f %8.0f "
+                  "%9.0f %9.0f %9.1f %9.1f %6.2f\n", t, c->num,
+                  rate[CNT_TLX_CMD], rate[CNT_TLX_RSP], rate[CNT_TLX_RTY],
+                  rate[CNT_TLX_FAIL], rate[CNT_TLX_XLP], rate[CNT_TLX_XLD],
+                  rate[CNT_AXI_R_CMD], rate[CNT_AXI_W_CMD], rd_mb, wr_mb,
+                  rty_pct);
+        break;
+
+    case OC_TOP_CSV:
+        VERBOSE0 ("%.3f,%d", t, c->num);
+
+        for (i = 0; i < CNT_MAX; i++) {
+            VERBOSE0 (",%.1f", rate[i]);
+        }
+
+        VERBOSE0 (",%.3f,%.3f\n", rd_mb, wr_mb);
+        break;
+
+    case OC_TOP_JSON:
+        VERBOSE0 ("{\"time_s\":%.3f,\"card\":%d", t, c->num);
+
+        for (i = 0; i < CNT_MAX; i++) {
+            VERBOSE0 (",\"%s_per_s\":%.1f", cnt_name[i], rate[i]);
+        }
+
+        VERBOSE0 (",\"rd_MB_per_s\":%.3f,\"wr_MB_per_s\":%.3f}\n",
+                  rd_mb, wr_mb);
+        break;
+    }
+}
+
+static void help (char* prog)
+{
+    printf ("Live link and AXI throughput. Usage: %s [-CcibBfzvVh]\n"
+            "\t-C, --card <num>        Card to use (default 0), repeat for more cards\n"
+            "\t-i, --interval <msec>   Sample interval (default 1000)\n"
+            "\t-c, --count <num>       Number of samples (default forever)\n"
+            "\t-f, --format <fmt>      text (default), csv or json (one object per line)\n"
+            "\t-z, --clear             Clear the DEBUG counters first\n"
+            "\t-b, --beat <bytes>      AXI data width (default %d)\n"
+            "\t-B, --burst <bytes>     Assumed bytes per AXI write command (default 4096)\n"
+            "\t-v, --verbose           Verbose mode\n"
+            "\t-V, --version           Print Version number\n"
+            "\t-h, --help              This help message\n"
+            "\n"
+            "Write bandwidth is an estimate, the counters have no write beats.\n"
+            "\n", prog, SNAP_MEMBUS_WIDTH);
+}
+
+int main (int argc, char* argv[])
+{
+    static struct oc_top_ctx ctx;
+    uint64_t cnt[CNT_MAX];
+    double rate[CNT_MAX];
+    uint64_t t_start, t_now, next;
+    struct timespec ts;
+    unsigned int i, k, rows = 0;
+    long samples = 0;
+    int rc = EXIT_SUCCESS;
+    int ch;
+
+    ctx.interval_ms = 1000;
+    ctx.count = -1;
+    ctx.format = OC_TOP_TEXT;
+    ctx.beat_bytes = SNAP_MEMBUS_WIDTH;
+    ctx.burst_bytes = 4096;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            { "card",     required_argument, NULL, 'C' },
+            { "interval", required_argument, NULL, 'i' },
+            { "count",    required_argument, NULL, 'c' },
+            { "format",   required_argument, NULL, 'f' },
+            { "clear",    no_argument,       NULL, 'z' },
+            { "beat",     required_argument, NULL, 'b' },
+            { "burst",    required_argument, NULL, 'B' },
+            { "verbose",  no_argument,       NULL, 'v' },
+            { "version",  no_argument,       NULL, 'V' },
+            { "help",     no_argument,       NULL, 'h' },
+            { 0,          0,                 NULL,  0  }
+        };
+        ch = getopt_long (argc, argv, "C:i:c:f:zb:B:vVh",
+                          long_options, &option_index);
+
+        if (-1 == ch) {
+            break;
+        }
+
+        switch (ch) {
+        case 'C':        /* --card */
+            if (ctx.cards == OC_TOP_MAX_CARDS) {
+                fprintf (stderr, "Error: at most %d cards\n", OC_TOP_MAX_CARDS);
+                exit (EXIT_FAILURE);
+            }
+
+            ctx.card[ctx.cards++].num = strtol (optarg, (char**)NULL, 0);
+            break;
+
+        case 'i':        /* --interval */
+            ctx.interval_ms = strtoul (optarg, NULL, 0);
+
+            if (0 == ctx.interval_ms) {
+                ctx.interval_ms = 1;
+            }
+
+            break;
+
+        case 'c':        /* --count */
+            ctx.count = strtol (optarg, NULL, 0);
+            break;
+
+        case 'f':        /* --format */
+            if (0 == strcmp (optarg, "text")) {
+                ctx.format = OC_TOP_TEXT;
+            } else if (0 == strcmp (optarg, "csv")) {
+                ctx.format = OC_TOP_CSV;
+            } else if (0 == strcmp (optarg, "json")) {
+                ctx.format = OC_TOP_JSON;
+            } else {
+                fprintf (stderr, "Error: format %s, use text, csv or json\n",
+                         optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'z':        /* --clear */
+            ctx.clear = true;
+            break;
+
+        case 'b':        /* --beat */
+            ctx.beat_bytes = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'B':        /* --burst */
+            ctx.burst_bytes = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'v':        /* --verbose */
+            verbose++;
+            break;
+
+        case 'V':        /* --version */
+            printf ("%s\n", version);
+            exit (EXIT_SUCCESS);
+
+        case 'h':        /* --help */
+            help (argv[0]);
+            exit (EXIT_SUCCESS);
+
+        default:
+            help (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (0 == ctx.cards) {
+        ctx.cards = 1;                  /* Card 0 */
+    }
+
+    for (k = 0; k < ctx.cards; k++) {
+        ctx.card[k].handle = oc_top_open (ctx.card[k].num);
+
+        if (NULL == ctx.card[k].handle) {
+            rc = ENODEV;
+            goto __main_exit;
+        }
+
+        if (ctx.clear) {
+            snap_global_write64 (ctx.card[k].handle, DEBUG_DBG_CLR, 1);
+        }
+
+        if (0 != oc_top_sample (&ctx.card[k], ctx.card[k].cnt)) {
+            rc = EIO;
+            goto __main_exit;
+        }
+
+        ctx.card[k].t = now_ns();
+    }
+
+    signal (SIGINT, sig_handler);
+    signal (SIGTERM, sig_handler);
+    setvbuf (stdout, NULL, _IOLBF, 0);
+
+    t_start = now_ns();
+    next = t_start;
+
+    while (!stop && ((ctx.count < 0) || (samples < ctx.count))) {
+        /* Absolute deadlines, the interval does not drift */
+        next += (uint64_t)ctx.interval_ms * 1000000ull;
+        ts.tv_sec = next / 1000000000ull;
+        ts.tv_nsec = next % 1000000000ull;
+
+        while (!stop && (0 != clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                               &ts, NULL)))
+            ;
+
+        if (stop) {
+            break;
+        }
+
+        if ((OC_TOP_TEXT == ctx.format) ? (0 == rows % OC_TOP_HEADER_ROWS) :
+            (0 == samples)) {
+            oc_top_header (&ctx);
+        }
+
+        for (k = 0; k < ctx.cards; k++) {
+            struct oc_top_card* c = &ctx.card[k];
+
+            if (0 != oc_top_sample (c, cnt)) {
+                rc = EIO;
+                goto __main_exit;
+            }
+
+            t_now = now_ns();
+
+            for (i = 0; i < CNT_MAX; i++) {
+                /* Cleared by somebody else: count from 0 */
+                uint64_t d = (cnt[i] >= c->cnt[i]) ? cnt[i] - c->cnt[i] : cnt[i];
+
+                rate[i] = (double)d * 1e9 / (double) (t_now - c->t);
+                c->cnt[i] = cnt[i];
+            }
+
+            c->t = t_now;
+
+            oc_top_print (&ctx, c, (t_now - t_start) / 1e9, rate);
+            rows++;
+        }
+
+        samples++;
+    }
+
+__main_exit:
+
+    for (k = 0; k < ctx.cards; k++) {
+        if (ctx.card[k].handle) {
+            snap_card_free (ctx.card[k].handle);
+        }
+    }
+
+    exit (rc);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Batch register access for snap_peek and snap_poke: runs a script of
+ * reads, writes, masked writes, compares and polls against one open
+ * card, instead of one process and card open per register.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <osnap_tools.h>
+#include <libosnap.h>
+#include "snap_batch.h"
+
+#define BATCH_MAX_ARGS          5
+#define BATCH_POLL_TIMEOUT_MS   1000
+
+#define BATCH_ERR(fmt, ...) do {                                       \
+        fprintf(stderr, "err: %s:%u: " fmt "\n", fname, lineno,        \
+                ## __VA_ARGS__);                                       \
+    } while (0)
+
+FILE* snap_batch_open (const char* fname)
+{
+    FILE* f;
+
+    if (0 == strcmp (fname, "-")) {
+        return stdin;
+    }
+
+    f = fopen (fname, "r");
+
+    if (NULL == f) {
+        fprintf (stderr, "err: can not open batch file %s: %s\n", fname,
+                 strerror (errno));
+    }
+
+    return f;
+}
+
+void snap_batch_close (FILE* f)
+{
+    if ((NULL != f) && (stdin != f)) {
+        fclose (f);
+    }
+}
+
+static uint64_t batch_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 32 bit: action space, 64 bit: global space, like snap_peek -w */
+static int batch_read (struct snap_card* card, int width, uint32_t offs,
+                       uint64_t* val)
+{
+    uint32_t v32;
+    int rc;
+
+    if (32 == width) {
+        rc = snap_action_read32 (card, offs, &v32);
+        *val = v32;
+        return rc;
+    }
+
+    return snap_global_read64 (card, offs, val);
+}
+
+static int batch_write (struct snap_card* card, int width, uint32_t offs,
+                        uint64_t val)
+{
+    if (32 == width) {
+        return snap_action_write32 (card, offs, (uint32_t)val);
+    }
+
+    return snap_global_write64 (card, offs, val);
+}
+
+static void batch_print (int width, uint32_t offs, uint64_t val)
+{
+    if (32 == width) {
+        printf ("[%08x] %08llx\n", offs, (unsigned long long)val);
+    } else {
+        printf ("[%08x] %016llx\n", offs, (unsigned long long)val);
+    }
+}
+
+/* "r32" -> "r", 32 */
+static int batch_width (const char* cmd, char* op, size_t size)
+{
+    size_t len = strlen (cmd);
+
+    if ((len < 3) || (len >= size)) {
+        return 0;
+    }
+
+    if (0 == strcmp (cmd + len - 2, "32")) {
+        snprintf (op, size, "%.*s", (int) (len - 2), cmd);
+        return 32;
+    }
+
+    if (0 == strcmp (cmd + len - 2, "64")) {
+        snprintf (op, size, "%.*s", (int) (len - 2), cmd);
+        return 64;
+    }
+
+    return 0;
+}
+
+/* One script line, argv[0] is the command */
+static int batch_exec (struct snap_card* card, int argc, char** argv,
+                       int quiet, const char* fname, unsigned int lineno)
+{
+    char op[16];
+    int width = batch_width (argv[0], op, sizeof (op));
+    uint64_t arg[BATCH_MAX_ARGS - 1] = { 0 };
+    uint64_t val, t_end;
+    uint32_t offs;
+    unsigned long i;
+    char* end;
+    int n;
+
+    if (0 == strcmp (argv[0], "sleep") && (2 == argc)) {
+        usleep (strtoul (argv[1], NULL, 0));
+        return EXIT_SUCCESS;
+    }
+
+    if (0 == width) {
+        BATCH_ERR ("unknown command %s", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (n = 1; n < argc; n++) {
+        arg[n - 1] = strtoull (argv[n], &end, 0);
+
+        if (*end) {
+            BATCH_ERR ("bad number %s", argv[n]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    offs = (uint32_t)arg[0];
+    n = argc - 1;
+
+    if (0 == strcmp (op, "r") && (1 == n)) {
+        if (0 != batch_read (card, width, offs, &val)) {
+            goto __batch_io;
+        }
+
+        if (!quiet) {
+            batch_print (width, offs, val);
+        }
+    } else if (0 == strcmp (op, "w") && (2 == n)) {
+        if (0 != batch_write (card, width, offs, arg[1])) {
+            goto __batch_io;
+        }
+    } else if (0 == strcmp (op, "rmw") && (3 == n)) {
+        if (0 != batch_read (card, width, offs, &val)) {
+            goto __batch_io;
+        }
+
+        val = (val & ~arg[1]) | (arg[2] & arg[1]);
+
+        if (0 != batch_write (card, width, offs, val)) {
+            goto __batch_io;
+        }
+    } else if (0 == strcmp (op, "expect") && (3 == n)) {
+        if (0 != batch_read (card, width, offs, &val)) {
+            goto __batch_io;
+        }
+
+        if ((val & arg[1]) != arg[2]) {
+            BATCH_ERR ("[%08x] %016llx & %016llx != %016llx", offs,
+                       (unsigned long long)val, (unsigned long long)arg[1],
+                       (unsigned long long)arg[2]);
+            return EX_ERR_DATA;
+        }
+    } else if (0 == strcmp (op, "poll") && ((3 == n) || (4 == n))) {
+        t_end = batch_now_ms() + ((4 == n) ? arg[3] : BATCH_POLL_TIMEOUT_MS);
+
+        while (1) {
+            if (0 != batch_read (card, width, offs, &val)) {
+                goto __batch_io;
+            }
+
+            if ((val & arg[1]) == arg[2]) {
+                break;
+            }
+
+            if (batch_now_ms() > t_end) {
+                BATCH_ERR ("timeout, [%08x] %016llx & %016llx != %016llx",
+                           offs, (unsigned long long)val,
+                           (unsigned long long)arg[1], (unsigned long long)arg[2]);
+                return EX_ERR_DATA;
+            }
+
+            usleep (10);
+        }
+    } else if (0 == strcmp (op, "dump") && (2 == n)) {
+        for (i = 0; i < arg[1]; i++, offs += width / 8) {
+            if (0 != batch_read (card, width, offs, &val)) {
+                goto __batch_io;
+            }
+
+            if (!quiet) {
+                batch_print (width, offs, val);
+            }
+        }
+    } else {
+        BATCH_ERR ("bad arguments for %s", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+
+__batch_io:
+    BATCH_ERR ("access to [%08x] failed: %s", offs, strerror (errno));
+    return EXIT_FAILURE;
+}
+
+int snap_batch_run (struct snap_card* card, FILE* f, const char* fname,
+                    int quiet, int verbose)
+{
+    char line[512];
+    char* argv[BATCH_MAX_ARGS];
+    char* save;
+    char* p;
+    unsigned int lineno = 0;
+    int argc, rc;
+
+    while (fgets (line, sizeof (line), f)) {
+        lineno++;
+
+        if (NULL != (p = strchr (line, '#'))) {
+            *p = '\0';
+        }
+
+        line[strcspn (line, "\r\n")] = '\0';
+
+        /* echo prints the rest of the line as it is */
+        p = line + strspn (line, " \t");
+
+        if ((0 == strncmp (p, "echo", 4)) && (NULL != strchr (" \t", p[4]))) {
+            p += 4;
+            printf ("%s\n", p + strspn (p, " \t"));
+            continue;
+        }
+
+        argc = 0;
+
+        for (p = strtok_r (line, " \t", &save); p;
+             p = strtok_r (NULL, " \t", &save)) {
+            if (BATCH_MAX_ARGS == argc) {
+                BATCH_ERR ("too many arguments");
+                return EXIT_FAILURE;
+            }
+
+            argv[argc++] = p;
+        }
+
+        if (0 == argc) {
+            continue;
+        }
+
+        if (verbose) {
+            fprintf (stderr, "%s:%u: %s\n", fname, lineno, argv[0]);
+        }
+
+        rc = batch_exec (card, argc, argv, quiet, fname, lineno);
+
+        if (EXIT_SUCCESS != rc) {
+            return rc;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
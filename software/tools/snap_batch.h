@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SNAP_BATCH_H__
+#define __SNAP_BATCH_H__
+
+#include <stdio.h>
+#include <libosnap.h>
+
+/* Script syntax, printed by the --help of snap_peek and snap_poke */
+#define SNAP_BATCH_HELP                                                 \
+    "Batch script, one command per line, # starts a comment.\n"         \
+    "32 bit commands access the action, 64 bit ones the global space:\n" \
+    "  r32|r64 <addr>                     read and print\n"             \
+    "  w32|w64 <addr> <val>               write\n"                      \
+    "  rmw32|rmw64 <addr> <mask> <val>    write val to the mask bits\n" \
+    "  expect32|expect64 <addr> <mask> <val>  fail if (reg & mask) != val\n" \
+    "  poll32|poll64 <addr> <mask> <val> [msec]  wait for (reg & mask)\n" \
+    "                                     == val, 1000 msec default\n"  \
+    "  dump32|dump64 <addr> <count>       read and print count registers\n" \
+    "  sleep <usec>                       wait\n"                       \
+    "  echo <text>                        print text\n"
+
+/* Open "-" as stdin or a file, NULL on error */
+FILE* snap_batch_open (const char* fname);
+
+/* Close a script from snap_batch_open(), stdin is left open */
+void snap_batch_close (FILE* f);
+
+/*
+ * Run a batch script on an open card. Stops at the first failing
+ * command, returns EXIT_SUCCESS, EX_ERR_DATA for a failed expect or
+ * poll, else EXIT_FAILURE.
+ */
+int snap_batch_run (struct snap_card* card, FILE* f, const char* fname,
+                    int quiet, int verbose);
+
+#endif        /* __SNAP_BATCH_H__ */
@@ -0,0 +1,982 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark suite. Runs memcopy jobs (hls_memcopy_1024 or any action
+ * with the same job layout) over a sweep of transfer sizes, queue
+ * depths, threads, completion modes and source/destination memories
+ * and reports bandwidth and p50/p99/p99.9 job latency for each point.
+ *
+ * Each thread keeps its queue depth of asynchronous jobs in flight and
+ * waits for them in submission order. Latency is submit to completion
+ * seen by the thread, bandwidth is the bytes copied over the wall time
+ * of the point. All jobs of a point copy between the same two buffers,
+ * the data is not checked.
+ *
+ * With -b the results are compared against the CSV output of an
+ * earlier run. A point whose bandwidth dropped or whose p99 latency
+ * rose by more than the threshold is a regression, the exit code is
+ * then 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <libosnap.h>
+#include <osnap_tools.h>
+#include <osnap_types.h>
+#include <osnap_hls_if.h>
+#include <osnap_global_regs.h>
+
+static const char* version = GIT_VERSION;
+static int verbose = 0;
+
+#define VERBOSE0(fmt, ...) do {                                        \
+        fprintf(stdout, fmt, ## __VA_ARGS__);                          \
+    } while (0)
+
+#define VERBOSE1(fmt, ...) do {                                        \
+        if (verbose > 0)                                               \
+            fprintf(stderr, fmt, ## __VA_ARGS__);                      \
+    } while (0)
+
+#define BENCH_ACTION_TYPE   0x1014300B  /* hls_memcopy_1024 */
+#define BENCH_MAX_LIST      32
+#define BENCH_MAX_INFLIGHT  16          /* Job table of a card */
+#define BENCH_MAX_BASE      4096
+#define BENCH_TIMEOUT       60          /* sec per job */
+
+/* Job layout of the memcopy action */
+struct bench_job {
+    struct snap_addr in;
+    struct snap_addr out;
+};
+
+enum bench_format {
+    BENCH_TEXT = 0,
+    BENCH_CSV,
+    BENCH_JSON
+};
+
+enum bench_mode {
+    BENCH_IRQ = 0,
+    BENCH_POLL
+};
+
+static const char* mode_name[] = { "irq", "poll" };
+
+struct bench_path {
+    snap_addrtype_t src;
+    snap_addrtype_t dst;
+    const char* name;
+};
+
+static const struct bench_path paths[] = {
+    { SNAP_ADDRTYPE_HOST_DRAM, SNAP_ADDRTYPE_HOST_DRAM, "host-host" },
+    { SNAP_ADDRTYPE_HOST_DRAM, SNAP_ADDRTYPE_LCL_MEM0,  "host-lcl" },
+    { SNAP_ADDRTYPE_LCL_MEM0,  SNAP_ADDRTYPE_HOST_DRAM, "lcl-host" },
+    { SNAP_ADDRTYPE_LCL_MEM0,  SNAP_ADDRTYPE_LCL_MEM0,  "lcl-lcl" },
+};
+
+#define BENCH_PATHS (sizeof (paths) / sizeof (paths[0]))
+
+/* One point of the sweep and its result */
+struct bench_point {
+    uint64_t size;
+    unsigned int qd;
+    unsigned int threads;
+    enum bench_mode mode;
+    unsigned int path;
+
+    unsigned long jobs;
+    double mb_s;
+    double iops;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+};
+
+/* Results of an earlier run, -b */
+struct bench_base {
+    struct bench_point pt[BENCH_MAX_BASE];
+    unsigned int n;
+};
+
+struct bench_ctx {
+    struct snap_card* card;
+    struct snap_action* action;
+    int card_no;
+    uint32_t action_type;
+
+    uint64_t sizes[BENCH_MAX_LIST];
+    unsigned int nsizes;
+    unsigned int qds[BENCH_MAX_LIST];
+    unsigned int nqds;
+    unsigned int threads[BENCH_MAX_LIST];
+    unsigned int nthreads;
+    bool modes[2];
+    bool path_on[BENCH_PATHS];
+
+    unsigned long jobs;             /* Jobs per point */
+    uint64_t budget;                /* Bytes per point */
+    unsigned int warmup;            /* Jobs per thread, not counted */
+    enum bench_format format;
+    double threshold;               /* Regression threshold in % */
+    struct bench_base* base;
+    unsigned int regressions;
+
+    /* Buffers of the current point, shared by all jobs */
+    void* host_src;
+    void* host_dst;
+    uint64_t lcl_src;
+    uint64_t lcl_dst;
+    bool lcl;
+};
+
+/* State of one benchmark thread */
+struct bench_thread {
+    pthread_t tid;
+    struct bench_ctx* ctx;
+    struct bench_point* pt;
+    pthread_barrier_t* start;
+    unsigned long jobs;
+    uint64_t* lat;                  /* ns per job */
+    int rc;
+};
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64 (const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of a sorted array, in usec */
+static double percentile_us (const uint64_t* lat, unsigned long n, double pct)
+{
+    unsigned long i = (unsigned long) (pct / 100.0 * n + 0.999999);
+
+    if (0 == n) {
+        return 0.0;
+    }
+
+    i = (i < 1) ? 0 : ((i > n) ? n - 1 : i - 1);
+    return lat[i] / 1e3;
+}
+
+/* "64", "4K", "1M", "1G" */
+static uint64_t parse_size (const char* s)
+{
+    char* end;
+    uint64_t v = strtoull (s, &end, 0);
+
+    switch (*end) {
+    case 'k':
+    case 'K':
+        v <<= 10;
+        break;
+
+    case 'm':
+    case 'M':
+        v <<= 20;
+        break;
+
+    case 'g':
+    case 'G':
+        v <<= 30;
+        break;
+    }
+
+    return v;
+}
+
+/* "64-1M" sweeps powers of two, "4K,64K,1M" lists sizes */
+static int parse_sizes (struct bench_ctx* ctx, const char* arg)
+{
+    const char* dash = strchr (arg, '-');
+    char buf[256];
+    char* tok;
+    char* save;
+    uint64_t s, lo, hi;
+
+    ctx->nsizes = 0;
+
+    if (dash) {
+        lo = parse_size (arg);
+        hi = parse_size (dash + 1);
+
+        for (s = lo; s && (s <= hi) && (ctx->nsizes < BENCH_MAX_LIST); s <<= 1) {
+            ctx->sizes[ctx->nsizes++] = s;
+        }
+    } else {
+        snprintf (buf, sizeof (buf), "%s", arg);
+
+        for (tok = strtok_r (buf, ",", &save);
+             tok && (ctx->nsizes < BENCH_MAX_LIST);
+             tok = strtok_r (NULL, ",", &save)) {
+            ctx->sizes[ctx->nsizes++] = parse_size (tok);
+        }
+    }
+
+    for (s = 0; s < ctx->nsizes; s++) {
+        if ((0 == ctx->sizes[s]) || (ctx->sizes[s] > 0xffffffffull)) {
+            return -1;
+        }
+    }
+
+    return ctx->nsizes ? 0 : -1;
+}
+
+/* "1,4,16" */
+static int parse_list (unsigned int* list, unsigned int* n, const char* arg)
+{
+    char buf[256];
+    char* tok;
+    char* save;
+
+    *n = 0;
+    snprintf (buf, sizeof (buf), "%s", arg);
+
+    for (tok = strtok_r (buf, ",", &save); tok && (*n < BENCH_MAX_LIST);
+         tok = strtok_r (NULL, ",", &save)) {
+        list[*n] = strtoul (tok, NULL, 0);
+
+        if (0 == list[*n]) {
+            return -1;
+        }
+
+        (*n)++;
+    }
+
+    return *n ? 0 : -1;
+}
+
+static int parse_paths (struct bench_ctx* ctx, const char* arg)
+{
+    char buf[256];
+    char* tok;
+    char* save;
+    unsigned int i;
+
+    memset (ctx->path_on, 0, sizeof (ctx->path_on));
+    snprintf (buf, sizeof (buf), "%s", arg);
+
+    for (tok = strtok_r (buf, ",", &save); tok;
+         tok = strtok_r (NULL, ",", &save)) {
+        for (i = 0; i < BENCH_PATHS; i++) {
+            if (0 == strcmp (tok, paths[i].name)) {
+                ctx->path_on[i] = true;
+                break;
+            }
+        }
+
+        if (BENCH_PATHS == i) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_modes (struct bench_ctx* ctx, const char* arg)
+{
+    ctx->modes[BENCH_IRQ] = (NULL != strstr (arg, "irq"));
+    ctx->modes[BENCH_POLL] = (NULL != strstr (arg, "poll"));
+    return (ctx->modes[BENCH_IRQ] || ctx->modes[BENCH_POLL]) ? 0 : -1;
+}
+
+/* Read the CSV output of an earlier run */
+static struct bench_base* load_base (const char* fname)
+{
+    struct bench_base* base;
+    struct bench_point* pt;
+    char line[512], mode[16], path[16];
+    unsigned long long size;
+    FILE* f;
+    unsigned int i;
+
+    f = fopen (fname, "r");
+
+    if (NULL == f) {
+        fprintf (stderr, "Error: can not open baseline %s: %s\n",
+                 fname, strerror (errno));
+        return NULL;
+    }
+
+    base = calloc (1, sizeof (*base));
+
+    if (NULL == base) {
+        fclose (f);
+        return NULL;
+    }
+
+    while (fgets (line, sizeof (line), f) && (base->n < BENCH_MAX_BASE)) {
+        pt = &base->pt[base->n];
+
+        if (11 != sscanf (line, "%llu,%u,%u,%15[^,],%15[^,],%lu,%lf,%lf,%lf,%lf,%lf",
+                          &size, &pt->qd, &pt->threads, mode, path, &pt->jobs,
+                          &pt->mb_s, &pt->iops, &pt->p50_us, &pt->p99_us,
+                          &pt->p999_us)) {
+            continue;               /* Comment or header line */
+        }
+
+        pt->size = size;
+        pt->mode = (0 == strcmp (mode, "poll")) ? BENCH_POLL : BENCH_IRQ;
+
+        for (i = 0; i < BENCH_PATHS; i++) {
+            if (0 == strcmp (path, paths[i].name)) {
+                pt->path = i;
+                base->n++;
+                break;
+            }
+        }
+    }
+
+    fclose (f);
+    VERBOSE1 ("Baseline %s: %u points\n", fname, base->n);
+    return base;
+}
+
+static const struct bench_point* find_base (const struct bench_base* base,
+        const struct bench_point* pt)
+{
+    unsigned int i;
+
+    for (i = 0; base && (i < base->n); i++) {
+        const struct bench_point* b = &base->pt[i];
+
+        if ((b->size == pt->size) && (b->qd == pt->qd) &&
+            (b->threads == pt->threads) && (b->mode == pt->mode) &&
+            (b->path == pt->path)) {
+            return b;
+        }
+    }
+
+    return NULL;
+}
+
+static void bench_job_init (struct bench_ctx* ctx, const struct bench_point* pt,
+                            struct bench_job* mj, struct snap_job* cjob)
+{
+    const struct bench_path* p = &paths[pt->path];
+    void* src = (SNAP_ADDRTYPE_HOST_DRAM == p->src) ? ctx->host_src :
+                (void*) (uintptr_t)ctx->lcl_src;
+    void* dst = (SNAP_ADDRTYPE_HOST_DRAM == p->dst) ? ctx->host_dst :
+                (void*) (uintptr_t)ctx->lcl_dst;
+
+    memset (mj, 0, sizeof (*mj));
+    snap_addr_set (&mj->in, src, pt->size, p->src,
+                   SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+    snap_addr_set (&mj->out, dst, pt->size, p->dst,
+                   SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST | SNAP_ADDRFLAG_END);
+    snap_job_set (cjob, mj, sizeof (*mj), NULL, 0);
+}
+
+/* Run jobs with qd in flight, latencies to lat unless NULL */
+static int bench_run_jobs (struct bench_thread* t, unsigned long jobs,
+                           uint64_t* lat)
+{
+    struct bench_ctx* ctx = t->ctx;
+    unsigned int qd = t->pt->qd;
+    struct bench_job mj[BENCH_MAX_INFLIGHT];
+    struct snap_job cjob[BENCH_MAX_INFLIGHT];
+    struct snap_job_handle* h[BENCH_MAX_INFLIGHT];
+    uint64_t t_submit[BENCH_MAX_INFLIGHT];
+    unsigned long submitted = 0, done = 0;
+    unsigned int slot;
+    int rc;
+
+    for (slot = 0; slot < qd; slot++) {
+        bench_job_init (ctx, t->pt, &mj[slot], &cjob[slot]);
+    }
+
+    while (done < jobs) {
+        /* Fill up the queue */
+        while ((submitted < jobs) && (submitted - done < qd)) {
+            slot = submitted % qd;
+            t_submit[slot] = now_ns();
+            h[slot] = snap_action_submit_job (ctx->action, &cjob[slot]);
+
+            if (NULL == h[slot]) {
+                fprintf (stderr, "Error: submit: %s\n", strerror (errno));
+                return -1;
+            }
+
+            submitted++;
+        }
+
+        /* Oldest job first */
+        slot = done % qd;
+        rc = snap_job_wait (h[slot], BENCH_TIMEOUT);
+
+        if (lat) {
+            lat[done] = now_ns() - t_submit[slot];
+        }
+
+        if ((SNAP_OK != rc) || (SNAP_RETC_SUCCESS != cjob[slot].retc)) {
+            fprintf (stderr, "Error: job rc %d retc 0x%x\n", rc, cjob[slot].retc);
+            return -1;
+        }
+
+        done++;
+    }
+
+    return 0;
+}
+
+static void* bench_thread (void* arg)
+{
+    struct bench_thread* t = arg;
+
+    t->rc = bench_run_jobs (t, t->ctx->warmup, NULL);
+    pthread_barrier_wait (t->start);
+
+    if (0 == t->rc) {
+        t->rc = bench_run_jobs (t, t->jobs, t->lat);
+    }
+
+    return NULL;
+}
+
+static int bench_set_mode (struct bench_ctx* ctx, enum bench_mode mode)
+{
+    struct snap_wait_policy irq = { 0, 0, 0, 1 };
+    struct snap_wait_policy poll = { SNAP_WAIT_FOREVER, 0, 0, 0 };
+
+    return snap_action_set_wait_policy (ctx->action,
+                                        (BENCH_IRQ == mode) ? &irq : &poll);
+}
+
+/* Run one point of the sweep */
+static int bench_point (struct bench_ctx* ctx, struct bench_point* pt)
+{
+    struct bench_thread t[BENCH_MAX_INFLIGHT];
+    pthread_barrier_t start;
+    uint64_t* lat;
+    uint64_t t0, t1;
+    unsigned long jobs, n = 0;
+    unsigned int i, started;
+    int rc = 0;
+
+    /* Fewer jobs for large sizes, at least a few per thread */
+    jobs = ctx->jobs;
+
+    if (jobs * pt->size > ctx->budget) {
+        jobs = ctx->budget / pt->size;
+    }
+
+    if (jobs < 4 * pt->threads) {
+        jobs = 4 * pt->threads;
+    }
+
+    lat = malloc (jobs * sizeof (*lat));
+
+    if (NULL == lat) {
+        return -1;
+    }
+
+    pthread_barrier_init (&start, NULL, pt->threads + 1);
+
+    for (i = 0; i < pt->threads; i++) {
+        t[i].ctx = ctx;
+        t[i].pt = pt;
+        t[i].start = &start;
+        t[i].jobs = jobs / pt->threads + ((i < jobs % pt->threads) ? 1 : 0);
+        t[i].lat = lat + n;
+        t[i].rc = 0;
+        n += t[i].jobs;
+    }
+
+    for (started = 0; started < pt->threads; started++) {
+        if (0 != pthread_create (&t[started].tid, NULL, bench_thread,
+                                 &t[started])) {
+            fprintf (stderr, "Error: pthread_create: %s\n", strerror (errno));
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait (&start);
+    t0 = now_ns();
+
+    for (i = 0; i < pt->threads; i++) {
+        pthread_join (t[i].tid, NULL);
+        rc |= t[i].rc;
+    }
+
+    t1 = now_ns();
+    pthread_barrier_destroy (&start);
+
+    if (0 == rc) {
+        qsort (lat, jobs, sizeof (*lat), cmp_u64);
+        pt->jobs = jobs;
+        pt->mb_s = (double)jobs * pt->size * 1e3 / (double) (t1 - t0);
+        pt->iops = (double)jobs * 1e9 / (double) (t1 - t0);
+        pt->p50_us = percentile_us (lat, jobs, 50.0);
+        pt->p99_us = percentile_us (lat, jobs, 99.0);
+        pt->p999_us = percentile_us (lat, jobs, 99.9);
+    }
+
+    free (lat);
+    return rc;
+}
+
+static void print_header (struct bench_ctx* ctx)
+{
+    uint64_t ivr = 0, bdr = 0;
+
+    snap_global_read64 (ctx->card, SNAP_IVR, &ivr);
+    snap_global_read64 (ctx->card, SNAP_BDR, &bdr);
+
+    switch (ctx->format) {
+    case BENCH_TEXT:
+        VERBOSE0 ("# snap_bench %s card %d action 0x%08x IVR 0x%016llx BDR 0x%016llx\n",
+                  version, ctx->card_no, ctx->action_type,
+                  (unsigned long long)ivr, (unsigned long long)bdr);
+        VERBOSE0 ("%10s %3s %3s %-4s %-9s %7s %9s %9s %9s %9s %9s",
+                  "size", "qd", "thr", "mode", "path", "jobs", "MB/s",
+                  "iops", "p50_us", "p99_us", "p99.9_us");
+
+        if (ctx->base) {
+            VERBOSE0 (" %8s %8s", "d_MB/s%", "d_p99%");
+        }
+
+        VERBOSE0 ("\n");
+        break;
+
+    case BENCH_CSV:
+        VERBOSE0 ("# snap_bench %s card %d action 0x%08x IVR 0x%016llx BDR 0x%016llx\n",
+                  version, ctx->card_no, ctx->action_type,
+                  (unsigned long long)ivr, (unsigned long long)bdr);
+        VERBOSE0 ("size,qd,threads,mode,path,jobs,MB_s,iops,p50_us,p99_us,p999_us");
+
+        if (ctx->base) {
+            VERBOSE0 (",d_MB_s_pct,d_p99_pct,regression");
+        }
+
+        VERBOSE0 ("\n");
+        break;
+
+    case BENCH_JSON:
+        VERBOSE0 ("{\"tool\":\"snap_bench\",\"version\":\"%s\",\"card\":%d,"
+                  "\"action\":\"0x%08x\",\"ivr\":\"0x%016llx\",\"bdr\":\"0x%016llx\"}\n",
+                  version, ctx->card_no, ctx->action_type,
+                  (unsigned long long)ivr, (unsigned long long)bdr);
+        break;
+    }
+}
+
+static void print_point (struct bench_ctx* ctx, const struct bench_point* pt)
+{
+    const struct bench_point* b = find_base (ctx->base, pt);
+    double d_bw = 0.0, d_p99 = 0.0;
+    bool regression = false;
+
+    if (b) {
+        d_bw = b->mb_s ? 100.0 * (pt->mb_s - b->mb_s) / b->mb_s : 0.0;
+        d_p99 = b->p99_us ? 100.0 * (pt->p99_us - b->p99_us) / b->p99_us : 0.0;
+        regression = (d_bw < -ctx->threshold) || (d_p99 > ctx->threshold);
+        ctx->regressions += regression ? 1 : 0;
+    }
+
+    switch (ctx->format) {
+    case BENCH_TEXT:
+        VERBOSE0 ("%10llu %3u %3u %-4s %-9s %7lu %9.1f %9.0f %9.1f %9.1f %9.1f",
+                  (unsigned long long)pt->size, pt->qd, pt->threads,
+                  mode_name[pt->mode], paths[pt->path].name, pt->jobs,
+                  pt->mb_s, pt->iops, pt->p50_us, pt->p99_us, pt->p999_us);
+
+        if (b) {
+            VERBOSE0 (" %+8.1f %+8.1f%s", d_bw, d_p99,
+                      regression ? " REGRESSION" : "");
+        } else if (ctx->base) {
+            VERBOSE0 (" %8s %8s", "-", "-");
+        }
+
+        VERBOSE0 ("\n");
+        break;
+
+    case BENCH_CSV:
+        VERBOSE0 ("%llu,%u,%u,%s,%s,%lu,%.3f,%.1f,%.3f,%.3f,%.3f",
+                  (unsigned long long)pt->size, pt->qd, pt->threads,
+                  mode_name[pt->mode], paths[pt->path].name, pt->jobs,
+                  pt->mb_s, pt->iops, pt->p50_us, pt->p99_us, pt->p999_us);
+
+        if (b) {
+            VERBOSE0 (",%.1f,%.1f,%d", d_bw, d_p99, regression);
+        } else if (ctx->base) {
+            VERBOSE0 (",,,");
+        }
+
+        VERBOSE0 ("\n");
+        break;
+
+    case BENCH_JSON:
+        VERBOSE0 ("{\"size\":%llu,\"qd\":%u,\"threads\":%u,\"mode\":\"%s\","
+                  "\"path\":\"%s\",\"jobs\":%lu,\"MB_s\":%.3f,\"iops\":%.1f,"
+                  "\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f",
+                  (unsigned long long)pt->size, pt->qd, pt->threads,
+                  mode_name[pt->mode], paths[pt->path].name, pt->jobs,
+                  pt->mb_s, pt->iops, pt->p50_us, pt->p99_us, pt->p999_us);
+
+        if (b) {
+            VERBOSE0 (",\"d_MB_s_pct\":%.1f,\"d_p99_pct\":%.1f,\"regression\":%s",
+                      d_bw, d_p99, regression ? "true" : "false");
+        }
+
+        VERBOSE0 ("}\n");
+        break;
+    }
+}
+
+/* Buffers for the largest size of the sweep */
+static int bench_alloc (struct bench_ctx* ctx)
+{
+    uint64_t max = 0;
+    unsigned int i;
+
+    for (i = 0; i < ctx->nsizes; i++) {
+        max = (ctx->sizes[i] > max) ? ctx->sizes[i] : max;
+    }
+
+    ctx->host_src = snap_malloc (max);
+    ctx->host_dst = snap_malloc (max);
+
+    if ((NULL == ctx->host_src) || (NULL == ctx->host_dst)) {
+        fprintf (stderr, "Error: can not allocate 2x %llu bytes\n",
+                 (unsigned long long)max);
+        return -1;
+    }
+
+    memset (ctx->host_src, 0x5a, max);
+    memset (ctx->host_dst, 0, max);
+
+    for (i = 1; i < BENCH_PATHS; i++) {
+        ctx->lcl |= ctx->path_on[i];
+    }
+
+    if (!ctx->lcl) {
+        return 0;
+    }
+
+    if (SNAP_OK != snap_lcl_alloc (ctx->card, SNAP_ADDRTYPE_LCL_MEM0, max,
+                                   &ctx->lcl_src)) {
+        ctx->lcl = false;
+    } else if (SNAP_OK != snap_lcl_alloc (ctx->card, SNAP_ADDRTYPE_LCL_MEM0,
+                                          max, &ctx->lcl_dst)) {
+        snap_lcl_free (ctx->card, SNAP_ADDRTYPE_LCL_MEM0, ctx->lcl_src);
+        ctx->lcl = false;
+    }
+
+    if (!ctx->lcl) {
+        fprintf (stderr, "Warning: no 2x %llu bytes of card memory, "
+                 "skipping the lcl paths\n", (unsigned long long)max);
+
+        for (i = 1; i < BENCH_PATHS; i++) {
+            ctx->path_on[i] = false;
+        }
+    }
+
+    return 0;
+}
+
+static void help (char* prog)
+{
+    printf ("Benchmark suite. Usage: %s [-CAsqtmpnBwfbTvVh]\n"
+            "\t-C, --card <num>        Card to use (default 0)\n"
+            "\t-A, --action <type>     Memcopy compatible action (default 0x%08x)\n"
+            "\t-s, --size <sizes>      Sizes, 64-1M sweeps powers of two,\n"
+            "\t                        4K,64K,1G lists them (default 64-1M)\n"
+            "\t-q, --qd <list>         Jobs in flight per thread (default 1,4)\n"
+            "\t-t, --threads <list>    Threads (default 1)\n"
+            "\t-m, --mode <modes>      Completion: irq, poll or irq,poll (default)\n"
+            "\t-p, --path <paths>      host-host (default), host-lcl, lcl-host, lcl-lcl\n"
+            "\t-n, --jobs <num>        Jobs per point (default 1000)\n"
+            "\t-B, --budget <bytes>    Limit jobs to this many bytes per point (default 1G)\n"
+            "\t-w, --warmup <num>      Uncounted jobs per thread (default 4)\n"
+            "\t-f, --format <fmt>      text (default), csv or json (one object per line)\n"
+            "\t-b, --baseline <file>   Compare with the csv output of an earlier run\n"
+            "\t-T, --threshold <pct>   Regression threshold (default 10)\n"
+            "\t-v, --verbose           Verbose mode\n"
+            "\t-V, --version           Print Version number\n"
+            "\t-h, --help              This help message\n"
+            "\n"
+            "Queue depth times threads is limited to %d. Exits with 1 if a point\n"
+            "regressed against the baseline.\n"
+            "\n", prog, BENCH_ACTION_TYPE, BENCH_MAX_INFLIGHT);
+}
+
+int main (int argc, char* argv[])
+{
+    static struct bench_ctx ctx;
+    struct bench_point pt;
+    char device[64];
+    unsigned int s, q, t, m, p;
+    int rc = EXIT_SUCCESS;
+    int ch;
+
+    ctx.action_type = BENCH_ACTION_TYPE;
+    parse_sizes (&ctx, "64-1M");
+    parse_list (ctx.qds, &ctx.nqds, "1,4");
+    parse_list (ctx.threads, &ctx.nthreads, "1");
+    parse_modes (&ctx, "irq,poll");
+    parse_paths (&ctx, "host-host");
+    ctx.jobs = 1000;
+    ctx.budget = 1ull << 30;
+    ctx.warmup = 4;
+    ctx.threshold = 10.0;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            { "card",      required_argument, NULL, 'C' },
+            { "action",    required_argument, NULL, 'A' },
+            { "size",      required_argument, NULL, 's' },
+            { "qd",        required_argument, NULL, 'q' },
+            { "threads",   required_argument, NULL, 't' },
+            { "mode",      required_argument, NULL, 'm' },
+            { "path",      required_argument, NULL, 'p' },
+            { "jobs",      required_argument, NULL, 'n' },
+            { "budget",    required_argument, NULL, 'B' },
+            { "warmup",    required_argument, NULL, 'w' },
+            { "format",    required_argument, NULL, 'f' },
+            { "baseline",  required_argument, NULL, 'b' },
+            { "threshold", required_argument, NULL, 'T' },
+            { "verbose",   no_argument,       NULL, 'v' },
+            { "version",   no_argument,       NULL, 'V' },
+            { "help",      no_argument,       NULL, 'h' },
+            { 0,           0,                 NULL,  0  }
+        };
+        ch = getopt_long (argc, argv, "C:A:s:q:t:m:p:n:B:w:f:b:T:vVh",
+                          long_options, &option_index);
+
+        if (-1 == ch) {
+            break;
+        }
+
+        switch (ch) {
+        case 'C':        /* --card */
+            ctx.card_no = strtol (optarg, (char**)NULL, 0);
+            break;
+
+        case 'A':        /* --action */
+            ctx.action_type = strtoul (optarg, NULL, 0);
+            break;
+
+        case 's':        /* --size */
+            if (0 != parse_sizes (&ctx, optarg)) {
+                fprintf (stderr, "Error: sizes %s, 1 byte to 4 GiB\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'q':        /* --qd */
+            if (0 != parse_list (ctx.qds, &ctx.nqds, optarg)) {
+                fprintf (stderr, "Error: queue depths %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 't':        /* --threads */
+            if (0 != parse_list (ctx.threads, &ctx.nthreads, optarg)) {
+                fprintf (stderr, "Error: threads %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'm':        /* --mode */
+            if (0 != parse_modes (&ctx, optarg)) {
+                fprintf (stderr, "Error: mode %s, use irq, poll or both\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'p':        /* --path */
+            if (0 != parse_paths (&ctx, optarg)) {
+                fprintf (stderr, "Error: paths %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'n':        /* --jobs */
+            ctx.jobs = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'B':        /* --budget */
+            ctx.budget = parse_size (optarg);
+            break;
+
+        case 'w':        /* --warmup */
+            ctx.warmup = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'f':        /* --format */
+            if (0 == strcmp (optarg, "text")) {
+                ctx.format = BENCH_TEXT;
+            } else if (0 == strcmp (optarg, "csv")) {
+                ctx.format = BENCH_CSV;
+            } else if (0 == strcmp (optarg, "json")) {
+                ctx.format = BENCH_JSON;
+            } else {
+                fprintf (stderr, "Error: format %s, use text, csv or json\n",
+                         optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'b':        /* --baseline */
+            ctx.base = load_base (optarg);
+
+            if (NULL == ctx.base) {
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'T':        /* --threshold */
+            ctx.threshold = strtod (optarg, NULL);
+            break;
+
+        case 'v':        /* --verbose */
+            verbose++;
+            break;
+
+        case 'V':        /* --version */
+            printf ("%s\n", version);
+            exit (EXIT_SUCCESS);
+
+        case 'h':        /* --help */
+            help (argv[0]);
+            exit (EXIT_SUCCESS);
+
+        default:
+            help (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (0 == ctx.card_no) {
+        snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
+    } else {
+        snprintf (device, sizeof (device) - 1,
+                  "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", ctx.card_no);
+    }
+
+    ctx.card = snap_card_alloc_dev (device, 0xffff, 0xffff);
+
+    if (NULL == ctx.card) {
+        fprintf (stderr, "Error: Can not open CAPI-SNAP Device: %s\n", device);
+        exit (ENODEV);
+    }
+
+    ctx.action = snap_attach_action (ctx.card, ctx.action_type,
+                                     SNAP_ACTION_DONE_IRQ, 60);
+
+    if (NULL == ctx.action) {
+        fprintf (stderr, "Error: Can not attach action 0x%08x\n", ctx.action_type);
+        rc = ENODEV;
+        goto __exit_card;
+    }
+
+    snap_action_assign_irq (ctx.action, ACTION_IRQ_SRC_LO);
+
+    if (0 != bench_alloc (&ctx)) {
+        rc = ENOMEM;
+        goto __exit_action;
+    }
+
+    setvbuf (stdout, NULL, _IOLBF, 0);
+    print_header (&ctx);
+
+    for (p = 0; p < BENCH_PATHS; p++) {
+        for (m = 0; m < 2; m++) {
+            if (!ctx.path_on[p] || !ctx.modes[m]) {
+                continue;
+            }
+
+            bench_set_mode (&ctx, m);
+
+            for (t = 0; t < ctx.nthreads; t++) {
+                for (q = 0; q < ctx.nqds; q++) {
+                    if (ctx.qds[q] * ctx.threads[t] > BENCH_MAX_INFLIGHT) {
+                        VERBOSE1 ("Skip qd %u x %u threads\n", ctx.qds[q],
+                                  ctx.threads[t]);
+                        continue;
+                    }
+
+                    for (s = 0; s < ctx.nsizes; s++) {
+                        memset (&pt, 0, sizeof (pt));
+                        pt.size = ctx.sizes[s];
+                        pt.qd = ctx.qds[q];
+                        pt.threads = ctx.threads[t];
+                        pt.mode = m;
+                        pt.path = p;
+
+                        if (0 != bench_point (&ctx, &pt)) {
+                            rc = EIO;
+                            goto __exit_buf;
+                        }
+
+                        print_point (&ctx, &pt);
+                    }
+                }
+            }
+        }
+    }
+
+    if (ctx.regressions) {
+        fprintf (stderr, "%u point(s) regressed by more than %.1f%%\n",
+                 ctx.regressions, ctx.threshold);
+        rc = 1;
+    }
+
+__exit_buf:
+
+    if (ctx.lcl) {
+        snap_lcl_free (ctx.card, SNAP_ADDRTYPE_LCL_MEM0, ctx.lcl_src);
+        snap_lcl_free (ctx.card, SNAP_ADDRTYPE_LCL_MEM0, ctx.lcl_dst);
+    }
+
+    free (ctx.host_src);
+    free (ctx.host_dst);
+__exit_action:
+    snap_detach_action (ctx.action);
+__exit_card:
+    snap_card_free (ctx.card);
+    free (ctx.base);
+    exit (rc);
+}
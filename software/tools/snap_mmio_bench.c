@@ -0,0 +1,544 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * MMIO latency microbenchmark, sibling of snap_peek and snap_poke.
+ * Loops over snap_action_read32/write32 (per-PASID space) and
+ * snap_global_read64/write64 (global space), single, interleaved and
+ * as write followed by a read of the same register.
+ *
+ * Every test runs twice: once timing each access for the latency
+ * distribution, once timing the whole loop for the throughput. Writes
+ * are posted, their latency is the CPU side cost only. A read after a
+ * write waits for the write to reach the card, the extra time over a
+ * plain write plus a plain read is the ordering cost. The clock row is
+ * the cost of the time stamps themselves, included in every latency.
+ *
+ * The default write targets are a job parameter register of the action
+ * and the DEBUG counter clear register written with 0. Do not run it
+ * while the action runs a job.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <libosnap.h>
+#include <osnap_tools.h>
+#include <osnap_hls_if.h>
+#include <osnap_global_regs.h>
+
+#include "force_cpu.h"
+
+static const char* version = GIT_VERSION;
+static int verbose = 0;
+
+#define VERBOSE0(fmt, ...) do {                                        \
+        fprintf(stdout, fmt, ## __VA_ARGS__);                          \
+    } while (0)
+
+#define VERBOSE1(fmt, ...) do {                                        \
+        if (verbose > 0)                                               \
+            fprintf(stderr, fmt, ## __VA_ARGS__);                      \
+    } while (0)
+
+enum mmio_format {
+    MMIO_TEXT = 0,
+    MMIO_CSV,
+    MMIO_JSON
+};
+
+enum mmio_test {
+    T_CLOCK = 0,
+    T_AR32,                         /* snap_action_read32 */
+    T_AW32,                         /* snap_action_write32 */
+    T_GR64,                         /* snap_global_read64 */
+    T_GW64,                         /* snap_global_write64 */
+    T_MIX,                          /* action read32, global read64, ... */
+    T_RAW32,                        /* action write32 + read32 */
+    T_RAW64,                        /* global write64 + read64 */
+    T_MAX
+};
+
+static const char* test_name[T_MAX] = {
+    "clock", "ar32", "aw32", "gr64", "gw64", "mix", "raw32", "raw64"
+};
+
+struct mmio_result {
+    double min, p50, p90, p99, p999, max, mean;    /* ns */
+    double mops;                                    /* Throughput */
+};
+
+struct mmio_ctx {
+    struct snap_card* card;
+    int card_no;
+    int cpu;
+    unsigned long count;
+    unsigned long warmup;
+    enum mmio_format format;
+    bool test_on[T_MAX];
+    uint32_t action_rd;             /* Offsets */
+    uint32_t action_wr;
+    uint32_t global_rd;
+    uint32_t global_wr;
+    uint64_t global_wr_val;
+    uint64_t* lat;
+    struct mmio_result res[T_MAX];
+};
+
+static inline uint64_t now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64 (const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of a sorted array */
+static double percentile (const uint64_t* lat, unsigned long n, double pct)
+{
+    unsigned long i = (unsigned long) (pct / 100.0 * n + 0.999999);
+
+    i = (i < 1) ? 0 : ((i > n) ? n - 1 : i - 1);
+    return (double)lat[i];
+}
+
+/* One access of test t, i selects the register of T_MIX */
+static inline int mmio_op (struct mmio_ctx* ctx, enum mmio_test t,
+                           unsigned long i)
+{
+    uint32_t v32;
+    uint64_t v64;
+
+    switch (t) {
+    case T_CLOCK:
+        return 0;
+
+    case T_AR32:
+        return snap_action_read32 (ctx->card, ctx->action_rd, &v32);
+
+    case T_AW32:
+        return snap_action_write32 (ctx->card, ctx->action_wr, (uint32_t)i);
+
+    case T_GR64:
+        return snap_global_read64 (ctx->card, ctx->global_rd, &v64);
+
+    case T_GW64:
+        return snap_global_write64 (ctx->card, ctx->global_wr,
+                                    ctx->global_wr_val);
+
+    case T_MIX:
+        return (i & 1) ? snap_global_read64 (ctx->card, ctx->global_rd, &v64) :
+               snap_action_read32 (ctx->card, ctx->action_rd, &v32);
+
+    case T_RAW32:
+        return snap_action_write32 (ctx->card, ctx->action_wr, (uint32_t)i) |
+               snap_action_read32 (ctx->card, ctx->action_wr, &v32);
+
+    case T_RAW64:
+        return snap_global_write64 (ctx->card, ctx->global_wr,
+                                    ctx->global_wr_val) |
+               snap_global_read64 (ctx->card, ctx->global_wr, &v64);
+
+    default:
+        return -1;
+    }
+}
+
+static int mmio_test (struct mmio_ctx* ctx, enum mmio_test t)
+{
+    struct mmio_result* r = &ctx->res[t];
+    unsigned long i, n = ctx->count;
+    uint64_t t0, t1;
+    double sum = 0.0;
+
+    for (i = 0; i < ctx->warmup; i++) {
+        if (0 != mmio_op (ctx, t, i)) {
+            goto __test_err;
+        }
+    }
+
+    /* Latency, each access on its own */
+    for (i = 0; i < n; i++) {
+        t0 = now_ns();
+
+        if (0 != mmio_op (ctx, t, i)) {
+            goto __test_err;
+        }
+
+        ctx->lat[i] = now_ns() - t0;
+    }
+
+    /* Throughput, back to back */
+    t0 = now_ns();
+
+    for (i = 0; i < n; i++) {
+        if (0 != mmio_op (ctx, t, i)) {
+            goto __test_err;
+        }
+    }
+
+    t1 = now_ns();
+
+    for (i = 0; i < n; i++) {
+        sum += ctx->lat[i];
+    }
+
+    qsort (ctx->lat, n, sizeof (*ctx->lat), cmp_u64);
+    r->min = ctx->lat[0];
+    r->p50 = percentile (ctx->lat, n, 50.0);
+    r->p90 = percentile (ctx->lat, n, 90.0);
+    r->p99 = percentile (ctx->lat, n, 99.0);
+    r->p999 = percentile (ctx->lat, n, 99.9);
+    r->max = ctx->lat[n - 1];
+    r->mean = sum / n;
+    r->mops = (t1 > t0) ? (double)n * 1e3 / (double) (t1 - t0) : 0.0;
+    return 0;
+
+__test_err:
+    fprintf (stderr, "Error: %s access %lu failed: %s\n", test_name[t], i,
+             strerror (errno));
+    return -1;
+}
+
+/* Read after write cost over a plain write and a plain read, p50 */
+static double mmio_order_cost (struct mmio_ctx* ctx, enum mmio_test t)
+{
+    enum mmio_test w = (T_RAW32 == t) ? T_AW32 : T_GW64;
+    enum mmio_test rd = (T_RAW32 == t) ? T_AR32 : T_GR64;
+
+    if (!ctx->test_on[w] || !ctx->test_on[rd]) {
+        return 0.0;
+    }
+
+    /* Each of the three latencies includes one clock pair */
+    return ctx->res[t].p50 - ctx->res[w].p50 - ctx->res[rd].p50 +
+           (ctx->test_on[T_CLOCK] ? ctx->res[T_CLOCK].p50 : 0.0);
+}
+
+static void mmio_print (struct mmio_ctx* ctx)
+{
+    unsigned int t;
+
+    switch (ctx->format) {
+    case MMIO_TEXT:
+        VERBOSE0 ("# snap_mmio_bench %s card %d cpu %d count %lu\n",
+                  version, ctx->card_no, ctx->cpu, ctx->count);
+        VERBOSE0 ("%-6s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "test",
+                  "min_ns", "p50_ns", "p90_ns", "p99_ns", "p99.9_ns",
+                  "max_ns", "mean_ns", "Mops/s", "order_ns");
+        break;
+
+    case MMIO_CSV:
+        VERBOSE0 ("# snap_mmio_bench %s card %d cpu %d count %lu\n",
+                  version, ctx->card_no, ctx->cpu, ctx->count);
+        VERBOSE0 ("test,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns,"
+                  "mops,order_ns\n");
+        break;
+
+    case MMIO_JSON:
+        VERBOSE0 ("{\"tool\":\"snap_mmio_bench\",\"version\":\"%s\",\"card\":%d,"
+                  "\"cpu\":%d,\"count\":%lu}\n", version, ctx->card_no,
+                  ctx->cpu, ctx->count);
+        break;
+    }
+
+    for (t = 0; t < T_MAX; t++) {
+        struct mmio_result* r = &ctx->res[t];
+        bool raw = (T_RAW32 == t) || (T_RAW64 == t);
+        double order = raw ? mmio_order_cost (ctx, t) : 0.0;
+
+        if (!ctx->test_on[t]) {
+            continue;
+        }
+
+        switch (ctx->format) {
+        case MMIO_TEXT:
+            VERBOSE0 ("%-6s %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.1f %8.3f",
+                      test_name[t], r->min, r->p50, r->p90, r->p99, r->p999,
+                      r->max, r->mean, r->mops);
+
+            if (raw) {
+                VERBOSE0 (" %8.0f", order);
+            }
+
+            VERBOSE0 ("\n");
+            break;
+
+        case MMIO_CSV:
+            VERBOSE0 ("%s,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.1f,%.3f,",
+                      test_name[t], r->min, r->p50, r->p90, r->p99, r->p999,
+                      r->max, r->mean, r->mops);
+
+            if (raw) {
+                VERBOSE0 ("%.0f", order);
+            }
+
+            VERBOSE0 ("\n");
+            break;
+
+        case MMIO_JSON:
+            VERBOSE0 ("{\"test\":\"%s\",\"min_ns\":%.0f,\"p50_ns\":%.0f,"
+                      "\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,"
+                      "\"max_ns\":%.0f,\"mean_ns\":%.1f,\"mops\":%.3f",
+                      test_name[t], r->min, r->p50, r->p90, r->p99, r->p999,
+                      r->max, r->mean, r->mops);
+
+            if (raw) {
+                VERBOSE0 (",\"order_ns\":%.0f", order);
+            }
+
+            VERBOSE0 ("}\n");
+            break;
+        }
+    }
+}
+
+static int parse_tests (struct mmio_ctx* ctx, const char* arg)
+{
+    char buf[256];
+    char* tok;
+    char* save;
+    unsigned int t;
+
+    memset (ctx->test_on, 0, sizeof (ctx->test_on));
+    snprintf (buf, sizeof (buf), "%s", arg);
+
+    for (tok = strtok_r (buf, ",", &save); tok;
+         tok = strtok_r (NULL, ",", &save)) {
+        for (t = 0; t < T_MAX; t++) {
+            if (0 == strcmp (tok, test_name[t])) {
+                ctx->test_on[t] = true;
+                break;
+            }
+        }
+
+        if (T_MAX == t) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void help (char* prog)
+{
+    printf ("MMIO latency microbenchmark. Usage: %s [-CXntwfaAgGvVh]\n"
+            "\t-C, --card <num>        Card to use (default 0)\n"
+            "\t-X, --cpu <id>          Only run on this CPU\n"
+            "\t-n, --count <num>       Accesses per test (default 100000)\n"
+            "\t-w, --warmup <num>      Uncounted accesses per test (default 1000)\n"
+            "\t-t, --tests <list>      clock,ar32,aw32,gr64,gw64,mix,raw32,raw64 (default all)\n"
+            "\t-f, --format <fmt>      text (default), csv or json (one object per line)\n"
+            "\t-a, --action-rd <offs>  Action register to read (default 0x%x)\n"
+            "\t-A, --action-wr <offs>  Action register to write (default 0x%x)\n"
+            "\t-g, --global-rd <offs>  Global register to read (default 0x%x)\n"
+            "\t-G, --global-wr <offs>  Global register to write with 0 (default 0x%x)\n"
+            "\t-v, --verbose           Verbose mode\n"
+            "\t-V, --version           Print Version number\n"
+            "\t-h, --help              This help message\n"
+            "\n"
+            "Tests: ar32/aw32 action read32/write32, gr64/gw64 global read64/write64,\n"
+            "mix alternates ar32 and gr64, raw32/raw64 write and read back the write\n"
+            "register. order_ns is raw minus write minus read (p50).\n"
+            "\n", prog, ACTION_TYPE_REG, ACTION_PARAMS_IN + 0x10, SNAP_IVR,
+            DEBUG_DBG_CLR);
+}
+
+int main (int argc, char* argv[])
+{
+    static struct mmio_ctx ctx;
+    char device[64];
+    unsigned int t;
+    int rc = EXIT_SUCCESS;
+    int ch;
+
+    ctx.cpu = -1;
+    ctx.count = 100000;
+    ctx.warmup = 1000;
+    ctx.action_rd = ACTION_TYPE_REG;
+    ctx.action_wr = ACTION_PARAMS_IN + 0x10;
+    ctx.global_rd = SNAP_IVR;
+    ctx.global_wr = DEBUG_DBG_CLR;
+    ctx.global_wr_val = 0;
+
+    for (t = 0; t < T_MAX; t++) {
+        ctx.test_on[t] = true;
+    }
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            { "card",      required_argument, NULL, 'C' },
+            { "cpu",       required_argument, NULL, 'X' },
+            { "count",     required_argument, NULL, 'n' },
+            { "warmup",    required_argument, NULL, 'w' },
+            { "tests",     required_argument, NULL, 't' },
+            { "format",    required_argument, NULL, 'f' },
+            { "action-rd", required_argument, NULL, 'a' },
+            { "action-wr", required_argument, NULL, 'A' },
+            { "global-rd", required_argument, NULL, 'g' },
+            { "global-wr", required_argument, NULL, 'G' },
+            { "verbose",   no_argument,       NULL, 'v' },
+            { "version",   no_argument,       NULL, 'V' },
+            { "help",      no_argument,       NULL, 'h' },
+            { 0,           0,                 NULL,  0  }
+        };
+        ch = getopt_long (argc, argv, "C:X:n:w:t:f:a:A:g:G:vVh",
+                          long_options, &option_index);
+
+        if (-1 == ch) {
+            break;
+        }
+
+        switch (ch) {
+        case 'C':        /* --card */
+            ctx.card_no = strtol (optarg, (char**)NULL, 0);
+            break;
+
+        case 'X':        /* --cpu */
+            ctx.cpu = strtol (optarg, (char**)NULL, 0);
+            break;
+
+        case 'n':        /* --count */
+            ctx.count = strtoul (optarg, NULL, 0);
+
+            if (0 == ctx.count) {
+                ctx.count = 1;
+            }
+
+            break;
+
+        case 'w':        /* --warmup */
+            ctx.warmup = strtoul (optarg, NULL, 0);
+            break;
+
+        case 't':        /* --tests */
+            if (0 != parse_tests (&ctx, optarg)) {
+                fprintf (stderr, "Error: tests %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'f':        /* --format */
+            if (0 == strcmp (optarg, "text")) {
+                ctx.format = MMIO_TEXT;
+            } else if (0 == strcmp (optarg, "csv")) {
+                ctx.format = MMIO_CSV;
+            } else if (0 == strcmp (optarg, "json")) {
+                ctx.format = MMIO_JSON;
+            } else {
+                fprintf (stderr, "Error: format %s, use text, csv or json\n",
+                         optarg);
+                exit (EXIT_FAILURE);
+            }
+
+            break;
+
+        case 'a':        /* --action-rd */
+            ctx.action_rd = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'A':        /* --action-wr */
+            ctx.action_wr = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'g':        /* --global-rd */
+            ctx.global_rd = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'G':        /* --global-wr */
+            ctx.global_wr = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'v':        /* --verbose */
+            verbose++;
+            break;
+
+        case 'V':        /* --version */
+            printf ("%s\n", version);
+            exit (EXIT_SUCCESS);
+
+        case 'h':        /* --help */
+            help (argv[0]);
+            exit (EXIT_SUCCESS);
+
+        default:
+            help (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    /* A benchmark on some other CPU than asked for is worthless */
+    if (0 != switch_cpu (ctx.cpu, verbose)) {
+        exit (EXIT_FAILURE);
+    }
+
+    ctx.lat = malloc (ctx.count * sizeof (*ctx.lat));
+
+    if (NULL == ctx.lat) {
+        fprintf (stderr, "Error: no memory for %lu samples\n", ctx.count);
+        exit (ENOMEM);
+    }
+
+    if (0 == ctx.card_no) {
+        snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
+    } else {
+        snprintf (device, sizeof (device) - 1,
+                  "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", ctx.card_no);
+    }
+
+    ctx.card = snap_card_alloc_dev (device, SNAP_VENDOR_ID_ANY,
+                                    SNAP_DEVICE_ID_ANY);
+
+    if (NULL == ctx.card) {
+        fprintf (stderr, "Error: Can not open CAPI-SNAP Device: %s\n", device);
+        free (ctx.lat);
+        exit (ENODEV);
+    }
+
+    for (t = 0; t < T_MAX; t++) {
+        if (ctx.test_on[t]) {
+            VERBOSE1 ("Test %s\n", test_name[t]);
+
+            if (0 != mmio_test (&ctx, t)) {
+                rc = EIO;
+                goto __main_exit;
+            }
+        }
+    }
+
+    mmio_print (&ctx);
+
+__main_exit:
+    snap_card_free (ctx.card);
+    free (ctx.lat);
+    exit (rc);
+}
@@ -26,6 +26,7 @@
 #include <osnap_tools.h>
 #include <libosnap.h>
 #include "force_cpu.h"
+#include "snap_batch.h"
 
 int verbose_flag = 0;
 
@@ -49,13 +50,15 @@ static void usage (const char* prog)
             "  -e, --must-be <value>     compare and exit if not equal.\n"
             "  -n, --must-not-be <value> compare and exit if equal.\n"
             "  -d, --dump                Number of 32 or 64 bytes to read. default 1\n"
+            "  -b, --batch <file>        run a batch script, - for stdin.\n"
             "  <addr>\n"
             "Note: Use -w32 to access snap action starting at offset 0x10000\n"
             "Example:\n"
             "  $ snap_peek 0x0000\n"
             "  [00000000] 0008002f0bc0ed99\nor\n"
             "  $ snap_peek 0x0008\n"
-            "  [00000000] 0000201703222151\n\n",
+            "  [00000000] 0000201703222151\n\n"
+            SNAP_BATCH_HELP "\n",
             prog);
 }
 
@@ -69,7 +72,7 @@ int main (int argc, char* argv[])
     struct snap_card* card;
     int cpu = -1;
     int width = 64;
-    uint32_t offs;
+    uint32_t offs = 0;
     uint64_t val = 0xffffffffffffffffull;
     uint64_t and_mask = 0xffffffffffffffffull;
     uint64_t equal_val = val;
@@ -80,6 +83,8 @@ int main (int argc, char* argv[])
     unsigned long interval = 0;
     char device[128];
     int dump = 1;
+    const char* batch = NULL;
+    FILE* batch_f = NULL;
 
     while (1) {
         int option_index = 0;
@@ -101,11 +106,12 @@ int main (int argc, char* argv[])
             { "verbose",         no_argument,            NULL, 'v' },
             { "help",         no_argument,            NULL, 'h' },
             { "dump",         required_argument, NULL, 'd' },
+            { "batch",         required_argument, NULL, 'b' },
             { 0,                 no_argument,            NULL, 0   },
         };
 
         ch = getopt_long (argc, argv,
-                          "C:X:w:i:c:e:n:a:d:Vqvh",
+                          "C:X:w:i:c:e:n:a:d:b:Vqvh",
                           long_options, &option_index);
 
         if (ch == -1) {      /* all params processed ? */
@@ -169,19 +175,34 @@ int main (int argc, char* argv[])
             dump = strtol (optarg, (char**)NULL, 0);
             break;
 
+        case 'b':                /* batch */
+            batch = optarg;
+            break;
+
         default:
             usage (argv[0]);
             exit (EXIT_FAILURE);
         }
     }
 
-    if (optind + 1 != argc) {
+    if (batch) {
+        if (optind != argc) {
+            usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+
+        batch_f = snap_batch_open (batch);
+
+        if (NULL == batch_f) {
+            exit (EXIT_FAILURE);
+        }
+    } else if (optind + 1 != argc) {
         usage (argv[0]);
         exit (EXIT_FAILURE);
+    } else {
+        offs = strtoull (argv[optind], NULL, 0);
     }
 
-    offs = strtoull (argv[optind], NULL, 0);
-
     if (equal && not_equal) {
         usage (argv[0]);
         exit (EXIT_FAILURE);
@@ -192,7 +213,7 @@ int main (int argc, char* argv[])
     if (card_no == 0) {
         snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
     } else {
-        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", card_no);
+        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
     }
 
     if (verbose_flag) {
@@ -212,6 +233,13 @@ int main (int argc, char* argv[])
         printf ("[%s] Open CAPI Card Got handle: %p\n", argv[0], card);
     }
 
+    if (batch) {
+        rc = snap_batch_run (card, batch_f, batch, quiet, verbose_flag);
+        snap_batch_close (batch_f);
+        snap_card_free (card);
+        exit (rc);
+    }
+
     for (i = 0; i < count; i++) {
 dump_more:
 
@@ -25,6 +25,7 @@
 #include <osnap_tools.h>
 #include <libosnap.h>
 #include "force_cpu.h"
+#include "snap_batch.h"
 
 int verbose_flag = 0;
 static int quiet = 0;
@@ -46,11 +47,13 @@ static void usage (const char* prog)
             "  -i, --interval <intv>     interval in usec, 0: default.\n"
             "  -c, --count <mum>         number of pokes, 1: default\n"
             "  -r, --read-back           read back and verify.\n"
+            "  -b, --batch <file>        run a batch script, - for stdin.\n"
             "  <addr> <val>\n"
             "\n"
             "Example:\n"
             "  snap_poke 0x0000000 0xdeadbeef\n"
-            "\n",
+            "\n"
+            SNAP_BATCH_HELP "\n",
             prog);
 }
 
@@ -65,12 +68,14 @@ int main (int argc, char* argv[])
     int cpu = -1;
     int width = 64;
     int rd_back = 0;
-    uint32_t offs;
-    uint64_t val, rbval;
+    uint32_t offs = 0;
+    uint64_t val = 0, rbval = 0;
     unsigned long i, count = 1;
     unsigned long interval = 0;
     int xerrno;
     char device[128];
+    const char* batch = NULL;
+    FILE* batch_f = NULL;
 
     while (1) {
         int option_index = 0;
@@ -83,6 +88,7 @@ int main (int argc, char* argv[])
             { "interval",        required_argument, NULL, 'i' },
             { "count",        required_argument, NULL, 'c' },
             { "rd-back",        no_argument,       NULL, 'r' },
+            { "batch",        required_argument, NULL, 'b' },
 
             /* misc/support */
             { "version",        no_argument,           NULL, 'V' },
@@ -93,7 +99,7 @@ int main (int argc, char* argv[])
             { 0,                no_argument,           NULL, 0   },
         };
 
-        ch = getopt_long (argc, argv, "p:C:X:w:i:c:Vqrvh",
+        ch = getopt_long (argc, argv, "p:C:X:w:i:c:b:Vqrvh",
                           long_options, &option_index);
 
         if (ch == -1) {      /* all params processed ? */
@@ -134,6 +140,10 @@ int main (int argc, char* argv[])
             rd_back++;
             break;
 
+        case 'b':                /* batch */
+            batch = optarg;
+            break;
+
         case 'v':
             verbose_flag++;
             break;
@@ -149,17 +159,28 @@ int main (int argc, char* argv[])
         }
     }
 
-    if (optind + 2 != argc) {
+    if (batch) {
+        if (optind != argc) {
+            usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+
+        batch_f = snap_batch_open (batch);
+
+        if (NULL == batch_f) {
+            exit (EXIT_FAILURE);
+        }
+    } else if (optind + 2 != argc) {
         usage (argv[0]);
         exit (EXIT_FAILURE);
+    } else {
+        offs = strtoull (argv[optind++], NULL, 0);
+        val  = strtoull (argv[optind++], NULL, 0);
+        rbval = ~val;
     }
-
-    offs = strtoull (argv[optind++], NULL, 0);
-    val  = strtoull (argv[optind++], NULL, 0);
-    rbval = ~val;
     switch_cpu (cpu, verbose_flag);
 
-    if ((card_no < 0) || (card_no > 4)) {
+    if ((card_no < 0) || (card_no > 0xffff)) {  /* PCI domain */
         fprintf (stderr, "err: (%d) is a invalid card number!\n",
                  card_no);
         usage (argv[0]);
@@ -169,7 +190,7 @@ int main (int argc, char* argv[])
     if (card_no == 0) {
         snprintf (device, sizeof (device) - 1, "IBM,oc-snap");
     } else {
-        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.000%d:00:00.1.0", card_no);
+        snprintf (device, sizeof (device) - 1, "/dev/ocxl/IBM,oc-snap.%04x:00:00.1.0", card_no);
     }
 
     card = snap_card_alloc_dev (device, SNAP_VENDOR_ID_ANY,
@@ -181,6 +202,13 @@ int main (int argc, char* argv[])
         exit (EXIT_FAILURE);
     }
 
+    if (batch) {
+        rc = snap_batch_run (card, batch_f, batch, quiet, verbose_flag);
+        snap_batch_close (batch_f);
+        snap_card_free (card);
+        exit (rc);
+    }
+
     for (i = 0; i < count; i++) {
         switch (width) {
         case 32:
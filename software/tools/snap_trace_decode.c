@@ -0,0 +1,323 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decode a libosnap binary trace file (SNAP_TRACE_RING). The records of
+ * all thread rings are merged in time order.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <osnap_trace.h>
+
+static const char* version = GIT_VERSION;
+
+struct decode_rec {
+    struct snap_trace_rec rec;
+    uint32_t tid;
+};
+
+static const char* snap_tr_names[SNAP_TR_MAX] = {
+    [SNAP_TR_NONE]         = "NONE",
+    [SNAP_TR_MMIO_W32]     = "MMIO_W32",
+    [SNAP_TR_MMIO_R32]     = "MMIO_R32",
+    [SNAP_TR_MMIO_WBLK]    = "MMIO_WBLK",
+    [SNAP_TR_MMIO_RBLK]    = "MMIO_RBLK",
+    [SNAP_TR_GLOBAL_W64]   = "GLOBAL_W64",
+    [SNAP_TR_GLOBAL_R64]   = "GLOBAL_R64",
+    [SNAP_TR_ACTION_START] = "ACTION_START",
+    [SNAP_TR_ACTION_DONE]  = "ACTION_DONE",
+    [SNAP_TR_JOB_QUEUE]    = "JOB_QUEUE",
+    [SNAP_TR_JOB_START]    = "JOB_START",
+    [SNAP_TR_JOB_DONE]     = "JOB_DONE",
+    [SNAP_TR_IRQ_ARM]      = "IRQ_ARM",
+    [SNAP_TR_IRQ_WAIT]     = "IRQ_WAIT",
+    [SNAP_TR_IRQ_EVENT]    = "IRQ_EVENT",
+    [SNAP_TR_IRQ_FAULT]    = "IRQ_FAULT",
+    [SNAP_TR_RING_DOORBELL] = "RING_DOORBELL",
+    [SNAP_TR_ACTION_STOP]  = "ACTION_STOP",
+    [SNAP_TR_JOB_CANCEL]   = "JOB_CANCEL",
+    [SNAP_TR_JOB_FAULT]    = "JOB_FAULT",
+    [SNAP_TR_THREAD]       = "THREAD",
+};
+
+/* Events which carry a duration in arg2 */
+static int snap_tr_has_duration (uint16_t id)
+{
+    switch (id) {
+    case SNAP_TR_MMIO_W32:
+    case SNAP_TR_MMIO_R32:
+    case SNAP_TR_MMIO_WBLK:
+    case SNAP_TR_MMIO_RBLK:
+    case SNAP_TR_GLOBAL_W64:
+    case SNAP_TR_GLOBAL_R64:
+    case SNAP_TR_ACTION_DONE:
+    case SNAP_TR_ACTION_STOP:
+    case SNAP_TR_IRQ_WAIT:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static void usage (const char* prog)
+{
+    printf ("Usage: %s [-h] [-V] [-s] [-t <tid>] <trace file>\n"
+            "  -s, --summary     print per event counts and durations only.\n"
+            "  -t, --tid <tid>   only decode records of this thread.\n"
+            "  -V, --version     print version.\n"
+            "  -h, --help        this help.\n"
+            "Example:\n"
+            "  $ SNAP_TRACE_RING=65536 snap_memcopy ...\n"
+            "  $ %s /dev/shm/osnap_trace.<pid>\n",
+            prog, prog);
+}
+
+static int rec_cmp (const void* a, const void* b)
+{
+    const struct decode_rec* ra = a;
+    const struct decode_rec* rb = b;
+
+    if (ra->rec.ts < rb->rec.ts) {
+        return -1;
+    }
+
+    return (ra->rec.ts > rb->rec.ts) ? 1 : 0;
+}
+
+static void print_summary (struct decode_rec* recs, size_t n)
+{
+    uint64_t count[SNAP_TR_MAX] = { 0 };
+    uint64_t sum[SNAP_TR_MAX] = { 0 };
+    uint64_t max[SNAP_TR_MAX] = { 0 };
+    uint64_t min[SNAP_TR_MAX];
+    size_t i;
+    uint16_t id;
+
+    memset (min, 0xff, sizeof (min));
+
+    for (i = 0; i < n; i++) {
+        id = recs[i].rec.id;
+
+        if (id >= SNAP_TR_MAX) {
+            continue;
+        }
+
+        count[id]++;
+        sum[id] += recs[i].rec.arg2;
+
+        if (recs[i].rec.arg2 > max[id]) {
+            max[id] = recs[i].rec.arg2;
+        }
+
+        if (recs[i].rec.arg2 < min[id]) {
+            min[id] = recs[i].rec.arg2;
+        }
+    }
+
+    printf ("%-14s %10s %12s %12s %12s\n", "event", "count",
+            "min ns", "avg ns", "max ns");
+
+    for (id = 1; id < SNAP_TR_MAX; id++) {
+        if (0 == count[id]) {
+            continue;
+        }
+
+        if (snap_tr_has_duration (id)) {
+            printf ("%-14s %10llu %12llu %12llu %12llu\n", snap_tr_names[id],
+                    (unsigned long long)count[id],
+                    (unsigned long long)min[id],
+                    (unsigned long long) (sum[id] / count[id]),
+                    (unsigned long long)max[id]);
+        } else {
+            printf ("%-14s %10llu\n", snap_tr_names[id],
+                    (unsigned long long)count[id]);
+        }
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    int ch, fd;
+    int summary = 0;
+    unsigned long tid = 0;
+    const char* fname;
+    struct stat st;
+    struct snap_trace_file* f;
+    struct snap_trace_ring* ring;
+    struct decode_rec* recs;
+    size_t n = 0;
+    uint64_t i, head, first;
+    uint32_t r, rings, owner;
+    uint16_t id;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            { "summary",  no_argument,       NULL, 's' },
+            { "tid",      required_argument, NULL, 't' },
+            { "version",  no_argument,       NULL, 'V' },
+            { "help",     no_argument,       NULL, 'h' },
+            { 0,          no_argument,       NULL, 0   },
+        };
+
+        ch = getopt_long (argc, argv, "st:Vh", long_options, &option_index);
+
+        if (ch == -1) {
+            break;
+        }
+
+        switch (ch) {
+        case 's':
+            summary = 1;
+            break;
+
+        case 't':
+            tid = strtoul (optarg, NULL, 0);
+            break;
+
+        case 'V':
+            printf ("%s\n", version);
+            exit (EXIT_SUCCESS);
+
+        case 'h':
+            usage (argv[0]);
+            exit (EXIT_SUCCESS);
+
+        default:
+            usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage (argv[0]);
+        exit (EXIT_FAILURE);
+    }
+
+    fname = argv[optind];
+    fd = open (fname, O_RDONLY);
+
+    if ((fd < 0) || (fstat (fd, &st) != 0)) {
+        perror (fname);
+        exit (EXIT_FAILURE);
+    }
+
+    if ((size_t)st.st_size < sizeof (*f)) {
+        fprintf (stderr, "%s: too small for a trace file\n", fname);
+        exit (EXIT_FAILURE);
+    }
+
+    f = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (MAP_FAILED == f) {
+        perror ("mmap");
+        exit (EXIT_FAILURE);
+    }
+
+    if ((SNAP_TRACE_MAGIC != f->magic) || (SNAP_TRACE_VERSION != f->version) ||
+        (sizeof (*f) + f->rings * snap_trace_ring_size (f->ring_entries) >
+         (uint64_t)st.st_size)) {
+        fprintf (stderr, "%s: not a version %d trace file\n", fname,
+                 SNAP_TRACE_VERSION);
+        exit (EXIT_FAILURE);
+    }
+
+    rings = (f->rings_used < f->rings) ? f->rings_used : f->rings;
+    recs = malloc ((size_t)rings * f->ring_entries * sizeof (*recs) + 1);
+
+    if (NULL == recs) {
+        perror ("malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Collect the records which are still in the rings */
+    for (r = 0; r < rings; r++) {
+        ring = snap_trace_get_ring (f, r);
+
+        head = ring->head;
+        first = (head > f->ring_entries) ? head - f->ring_entries : 0;
+
+        if (first == head) {
+            continue;
+        }
+
+        /* A reused ring: the records before the oldest THREAD record
+           belong to the owner it names as previous */
+        owner = ring->tid ? ring->tid : ring->last_tid;
+
+        for (i = first; i < head; i++) {
+            if (SNAP_TR_THREAD == ring->rec[i & (f->ring_entries - 1)].id) {
+                owner = (uint32_t)ring->rec[i & (f->ring_entries - 1)].arg1;
+                break;
+            }
+        }
+
+        if (!summary) {
+            printf ("# ring %u tid %u: %llu records, %llu lost to wrap\n", r,
+                    ring->tid ? ring->tid : ring->last_tid,
+                    (unsigned long long)head, (unsigned long long)first);
+        }
+
+        for (i = first; i < head; i++) {
+            recs[n].rec = ring->rec[i & (f->ring_entries - 1)];
+
+            if (SNAP_TR_THREAD == recs[n].rec.id) {
+                owner = recs[n].rec.arg0;
+            }
+
+            recs[n].tid = owner;
+
+            if (!tid || (tid == owner)) {
+                n++;
+            }
+        }
+    }
+
+    qsort (recs, n, sizeof (*recs), rec_cmp);
+
+    if (summary) {
+        print_summary (recs, n);
+    } else {
+        printf ("# pid %d, %zu records, time in usec since library init\n",
+                f->pid, n);
+
+        for (i = 0; i < n; i++) {
+            id = recs[i].rec.id;
+            printf ("%14.3f %6u %-14s %08x %016llx %llu\n",
+                    (double) ((int64_t) (recs[i].rec.ts - f->t0)) / 1000.0,
+                    recs[i].tid,
+                    (id < SNAP_TR_MAX) ? snap_tr_names[id] : "UNKNOWN",
+                    recs[i].rec.arg0,
+                    (unsigned long long)recs[i].rec.arg1,
+                    (unsigned long long)recs[i].rec.arg2);
+        }
+    }
+
+    free (recs);
+    munmap (f, st.st_size);
+    exit (EXIT_SUCCESS);
+}